@@ -7,8 +7,11 @@
 #include "cyprebench.h"
 
 #include <bvar/bvar.h>
+#include <gperftools/malloc_hook.h>
 #include <signal.h>
 
+#include <thread>
+
 #include "butil/logging.h"
 #include "common/error_code.h"
 #include "utils/chrono.h"
@@ -20,6 +23,22 @@ bvar::LatencyRecorder g_latency_cypre_bench_write("cypre_bench_write");
 bvar::LatencyRecorder g_latency_cypre_bench_read("cypre_bench_read");
 bvar::LatencyRecorder g_latency_cypre_bench_submit("cypre_bench_submit");
 
+// heap allocations of the whole process and ios done, for nullio
+static std::atomic<uint64_t> g_num_allocs(0);
+static std::atomic<uint64_t> g_num_ios(0);
+
+static void count_alloc(const void *ptr, size_t size) {
+    g_num_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void report_allocs(
+        const char *what, uint64_t num_allocs, uint64_t num_ios) {
+    double allocs_per_io =
+            num_ios == 0 ? 0 : num_allocs / static_cast<double>(num_ios);
+    LOG(INFO) << what << ": " << num_ios << " ios, " << num_allocs
+              << " allocs, " << allocs_per_io << " allocs/io";
+}
+
 Cyprebench &Cyprebench::GlobalCyprebench() {
     static Cyprebench globalCyprebench;
     return globalCyprebench;
@@ -86,6 +105,7 @@ int Cyprebench::Init(const CyprebenchOptions &options) {
 static void read_cb(int rc, void *arg) {
     IOContext *io_ctx = static_cast<IOContext *>(arg);
     Cyprebench *cypre_bench = io_ctx->cypre_bench;
+    g_num_ios.fetch_add(1, std::memory_order_relaxed);
     if (rc != 0) {
         LOG(ERROR) << "Couldn't read at offset " << io_ctx->io_u->offset;
         io_ctx->io_depth->fetch_sub(1);
@@ -176,6 +196,7 @@ void Cyprebench::doRead(RBDStreamHandlePtr handle) {
 static void write_cb(int rc, void *arg) {
     IOContext *io_ctx = static_cast<IOContext *>(arg);
     Cyprebench *cypre_bench = io_ctx->cypre_bench;
+    g_num_ios.fetch_add(1, std::memory_order_relaxed);
     if (rc != 0) {
         LOG(ERROR) << "Couldn't write at offset " << io_ctx->io_u->offset;
         io_ctx->io_depth->fetch_sub(1);
@@ -370,7 +391,26 @@ void Cyprebench::Stop() {
     LOG(INFO) << "Stop job threads";
 }
 
+void Cyprebench::reportAllocs() {
+    uint64_t allocs = g_num_allocs.load(std::memory_order_relaxed);
+    uint64_t ios = g_num_ios.load(std::memory_order_relaxed);
+    while (!jobs_done_.load(std::memory_order_relaxed)) {
+        sleep(1);
+        uint64_t now_allocs = g_num_allocs.load(std::memory_order_relaxed);
+        uint64_t now_ios = g_num_ios.load(std::memory_order_relaxed);
+        report_allocs("last second", now_allocs - allocs, now_ios - ios);
+        allocs = now_allocs;
+        ios = now_ios;
+    }
+}
+
 void Cyprebench::Run() {
+    // with nullio no server is in the way, allocations per io show what
+    // the client library costs, it should be zero once pools are warm
+    if (options_.nullio) {
+        MallocHook::AddNewHook(count_alloc);
+    }
+
     if (options_.read_jobs > 0) {
         if (launchThreads("read") != 0) {
             LOG(ERROR) << "Couldn't launch read jobs";
@@ -385,6 +425,11 @@ void Cyprebench::Run() {
         }
     }
 
+    std::thread reporter;
+    if (options_.nullio) {
+        reporter = std::thread(&Cyprebench::reportAllocs, this);
+    }
+
     signal(SIGINT, Cyprebench::sigHandler);
     signal(SIGTERM, Cyprebench::sigHandler);
 
@@ -396,6 +441,13 @@ void Cyprebench::Run() {
         pthread_join(write_jobs_[i], nullptr);
     }
 
+    if (options_.nullio) {
+        jobs_done_.store(true, std::memory_order_relaxed);
+        reporter.join();
+        MallocHook::RemoveNewHook(count_alloc);
+        report_allocs("total", g_num_allocs.load(), g_num_ios.load());
+    }
+
     LOG(INFO) << "Cyprebench run to completion";
     return;
 }
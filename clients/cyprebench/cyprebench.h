@@ -24,7 +24,7 @@ namespace clients {
 class Cyprebench {
 public:
     Cyprebench()
-            : stop_(false), engine_factory_(nullptr),
+            : stop_(false), jobs_done_(false), engine_factory_(nullptr),
               cypre_rbd_(nullptr), file_(nullptr) {}
 
     ~Cyprebench() {
@@ -51,9 +51,12 @@ private:
     int launchThreads(const std::string &rw);
     void doRead(RBDStreamHandlePtr handle);
     void doWrite(RBDStreamHandlePtr handle);
+    // allocations per io every second till jobs are done
+    void reportAllocs();
 
     CyprebenchOptions options_;
     std::atomic<bool> stop_;
+    std::atomic<bool> jobs_done_;
     EngineFactory *engine_factory_;
     CypreRBD *cypre_rbd_;
     File *file_;
@@ -33,7 +33,9 @@ DEFINE_uint64(size, 0, "read/write size");
 DEFINE_uint64(io_nums, 0, "i/o nums to dispatch");
 DEFINE_int32(dummy_server_port, 0, "dummy server port [80]");
 DEFINE_bool(run_forever, false, "running forever");
-DEFINE_bool(use_nullio, false, "use null io for test");
+DEFINE_bool(
+        use_nullio, false,
+        "use null io for test, reports heap allocations per io");
 DEFINE_int32(brpc_sender_ring_power, 16, "brpc sender ring power [16]");
 DEFINE_int32(brpc_sender_thread_num, 4, "brpc sender thread number [4]");
 DEFINE_int32(brpc_worker_thread_num, 9, "brpc worker thread number [9]");
@@ -19,6 +19,7 @@
 #include "extentserver/pb/extent_io.pb.h"
 #include "stream/brpc_es_wrapper.h"
 #include "stream/rbd_stream_handle_impl.h"
+#include "stream/replica_selector.h"
 
 namespace cyprestore {
 namespace clients {
@@ -52,7 +53,9 @@ int CypreClusterRBD::Init(const CypreRBDOptions &opts) {
     }
 
     // for brpc backgroud sender
-    extent_router_mgr_.reset(new common::ExtentRouterMgr(em_channel_));
+    // shared by handles, not per thread, so routers are fetched once
+    extent_router_mgr_.reset(new common::ExtentRouterMgr(em_channel_, false));
+    replica_selector_ = new ReplicaSelector(opts.hedged_read_percentile);
     int rv = BrpcEsWrapper::StartSenderWorker(
             opts.brpc_sender_thread, opts.brpc_sender_ring_power,
             opts.brpc_sender_thread_cpu_affinity, &brpc_sender_);
@@ -94,10 +97,34 @@ int CypreClusterRBD::Open(
 
     sopts.pool_id = response.blob().pool_id();
     sopts.user_id = response.blob().user_id();
+    if (options_.optimal_iosize != 0) {
+        sopts.optimal_iosize = options_.optimal_iosize;
+    }
+    for (auto &pool_id : options_.star_replication_pools) {
+        if (pool_id == sopts.pool_id) {
+            sopts.star_replication = true;
+            break;
+        }
+    }
+    sopts.write_quorum = options_.star_write_quorum;
+    // a star write acked by part of the replicas may miss on a secondary
+    sopts.secondary_reads = options_.secondary_reads
+                            && !(sopts.star_replication
+                                 && options_.star_write_quorum > 0);
 
     sopts.conn_pool.reset(new common::ConnectionPool2());
     sopts.extent_router_mgr = extent_router_mgr_;
+    if (sopts.extent_size > 0) {
+        uint64_t num_extents = (sopts.blob_size + sopts.extent_size - 1)
+                               / sopts.extent_size;
+        sopts.blob_routers =
+                extent_router_mgr_->OpenBlob(sopts.blob_id, num_extents);
+        if (options_.prefetch_routers) {
+            sopts.blob_routers->Prefetch();
+        }
+    }
     sopts.brpc_sender = brpc_sender_;
+    sopts.replica_selector = replica_selector_;
     RBDStreamHandlePtr streamHandle(new RBDStreamHandleImpl(sopts));
     int rv = streamHandle->Init();
     if (rv != common::CYPRE_OK) {
@@ -114,7 +141,8 @@ int CypreClusterRBD::Open(
     handle = streamHandle;
     LOG(WARNING) << "Open blob Ok, blob_id:" << sopts.blob_id
                  << ", name:" << sopts.blob_name << ", size:" << sopts.blob_size
-                 << ", extent_size:" << sopts.extent_size;
+                 << ", extent_size:" << sopts.extent_size
+                 << ", star_replication:" << sopts.star_replication;
 
     std::lock_guard<std::mutex> lock(lock_);
     stream_table_.push_back(streamHandle);
@@ -160,6 +188,8 @@ int CypreClusterRBD::Finalize() {
         handle.reset();
     }
     stream_table_.clear();
+    delete replica_selector_;
+    replica_selector_ = NULL;
     LOG(WARNING) << " CypreRBD Destroyed, handles:" << count
                  << ", return:" << rv;
     return rv;
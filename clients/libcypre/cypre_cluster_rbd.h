@@ -24,9 +24,12 @@ namespace cyprestore {
 namespace clients {
 
 class BrpcSenderWorker;
+class ReplicaSelector;
 class CypreClusterRBD : public CypreRBD {
 public:
-    CypreClusterRBD() : em_channel_(nullptr), brpc_sender_(NULL) {}
+    CypreClusterRBD()
+            : em_channel_(nullptr), brpc_sender_(NULL),
+              replica_selector_(NULL) {}
     virtual ~CypreClusterRBD() {
         Finalize();
     }
@@ -45,6 +48,7 @@ private:
     std::list<RBDStreamHandlePtr> stream_table_;
     std::mutex lock_;
     BrpcSenderWorker *brpc_sender_;
+    ReplicaSelector *replica_selector_;
 };
 
 }  // namespace clients
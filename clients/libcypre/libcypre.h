@@ -20,10 +20,15 @@ struct CypreRBDOptions {
     CypreRBDOptions(const std::string &eip, int eport)
             : em_ip(eip), em_port(eport), proto(kBrpc),
               brpc_worker_thread_num(9), brpc_sender_thread(4),
-              brpc_sender_ring_power(10) {}
+              brpc_sender_ring_power(10), star_write_quorum(0),
+              secondary_reads(false), hedged_read_percentile(0),
+              optimal_iosize(0), prefetch_routers(true) {}
     CypreRBDOptions()
             : em_port(0), proto(kBrpc), brpc_worker_thread_num(9),
-			  brpc_sender_thread(4), brpc_sender_ring_power(10) {}
+			  brpc_sender_thread(4), brpc_sender_ring_power(10),
+              star_write_quorum(0), secondary_reads(false),
+              hedged_read_percentile(0), optimal_iosize(0),
+              prefetch_routers(true) {}
 
     std::string em_ip;
     int em_port;
@@ -34,6 +39,20 @@ struct CypreRBDOptions {
     int brpc_sender_ring_power;  // should in [10, 30]
     // brpc sender thread's cpu affinity
     std::vector<int> brpc_sender_thread_cpu_affinity;
+    // blobs of these pools are written to every replica by the client
+    std::vector<std::string> star_replication_pools;
+    // copies of a star write, primary included, 0 for every replica
+    int star_write_quorum;
+    // read the least loaded replica instead of the primary only, es serve
+    // it if every replica acks writes (write_quorum of es is 0)
+    bool secondary_reads;
+    // e.g. 0.99, reads slower than that send a copy to the next replica
+    double hedged_read_percentile;
+    // user io is split at multiples of it and at extent boundaries, and
+    // sent in parallel. 0 splits at max io size (16M) only
+    uint64_t optimal_iosize;
+    // fetch routers of every extent on open, not on first io to each
+    bool prefetch_routers;
 };
 
 class CypreRBD {
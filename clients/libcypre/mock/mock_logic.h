@@ -75,6 +75,10 @@ public:
     virtual void QueryRouter(
             const extentmanager::pb::QueryRouterRequest *request,
             extentmanager::pb::QueryRouterResponse *response) = 0;
+
+    virtual void QueryRouters(
+            const extentmanager::pb::QueryRoutersRequest *request,
+            extentmanager::pb::QueryRoutersResponse *response) = 0;
 };
 
 class MockExtentIoLogic {
@@ -91,6 +95,17 @@ public:
     Write(google::protobuf::RpcController *cntl,
           const extentserver::pb::WriteRequest *request,
           extentserver::pb::WriteResponse *response) = 0;
+
+    // mocked es as secondary of a primary es
+    virtual void Replicate(
+            google::protobuf::RpcController *cntl,
+            const extentserver::pb::ReplicateRequest *request,
+            extentserver::pb::ReplicateResponse *response) = 0;
+
+    virtual void
+    Discard(google::protobuf::RpcController *cntl,
+            const extentserver::pb::DiscardRequest *request,
+            extentserver::pb::DiscardResponse *response) = 0;
 };
 
 const int DEF_EXTENT_SIZE = 32 * 1024 * 1024;  // 32M extent size for test
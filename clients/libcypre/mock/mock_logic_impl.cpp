@@ -585,6 +585,45 @@ void MockBlobLogicImpl::QueryRouter(
     }
 }
 
+void MockBlobLogicImpl::QueryRouters(
+        const extentmanager::pb::QueryRoutersRequest *request,
+        extentmanager::pb::QueryRoutersResponse *response) {
+    std::vector<uint64_t> indexes(
+            request->extent_indexes().begin(), request->extent_indexes().end());
+    if (indexes.empty() && request->has_begin_index()
+        && request->has_end_index()) {
+        for (uint64_t i = request->begin_index(); i <= request->end_index();
+             ++i) {
+            indexes.push_back(i);
+        }
+    }
+    if (request->blob_id().empty() || indexes.empty()) {
+        LOG(ERROR) << "Query routers failed, blob id or extents empty";
+        response->mutable_status()->set_code(common::CYPRE_ER_INVALID_ARGUMENT);
+        response->mutable_status()->set_message("blobid or extents empty");
+        return;
+    }
+    for (auto index : indexes) {
+        std::string extent_id = common::ExtentIDGenerator::GenerateExtentID(
+                request->blob_id(), index);
+        std::string rg_id;
+        ESData es;
+        if (mgr_->QueryRouter(extent_id, rg_id, es) != common::CYPRE_OK) {
+            continue;
+        }
+        common::pb::ExtentRouter *router = response->add_routers();
+        router->set_extent_id(extent_id);
+        router->set_rg_id(rg_id);
+        router->mutable_primary()->set_es_id(es.id);
+        router->mutable_primary()->set_public_ip(es.ip);
+        router->mutable_primary()->set_public_port(es.port);
+        router->mutable_primary()->set_private_ip(es.ip);
+        router->mutable_primary()->set_private_port(es.port);
+    }
+    response->set_router_version(1);
+    response->mutable_status()->set_code(common::CYPRE_OK);
+}
+
 ////// Class MockeExtentIoLogicImpl
 void MockExtentIoLogicImpl::Read(
         google::protobuf::RpcController *cntl,
@@ -629,6 +668,50 @@ void MockExtentIoLogicImpl::Write(
     }
 }
 
+void MockExtentIoLogicImpl::Replicate(
+        google::protobuf::RpcController *cntl,
+        const extentserver::pb::ReplicateRequest *request,
+        extentserver::pb::ReplicateResponse *response) {
+    if (request->extent_id().empty()) {
+        LOG(ERROR) << "Replicate failed, extent id empty";
+        response->mutable_status()->set_code(common::CYPRE_ER_INVALID_ARGUMENT);
+        response->mutable_status()->set_message("extentid empty");
+        return;
+    }
+    brpc::Controller *bcntl = static_cast<brpc::Controller *>(cntl);
+    const butil::IOBuf &iobuf = bcntl->request_attachment();
+    int rv = exmgr_->Write(
+            request->extent_id(), request->offset(), request->size(), iobuf);
+    response->mutable_status()->set_code(rv);
+    if (rv != common::CYPRE_OK) {
+        response->mutable_status()->set_message("replicate failed");
+    }
+}
+
+void MockExtentIoLogicImpl::Discard(
+        google::protobuf::RpcController *cntl,
+        const extentserver::pb::DiscardRequest *request,
+        extentserver::pb::DiscardResponse *response) {
+    for (int i = 0; i < request->ranges_size(); i++) {
+        const extentserver::pb::DiscardRange &range = request->ranges(i);
+        if (range.extent_id().empty()) {
+            LOG(ERROR) << "Discard failed, extent id empty";
+            response->mutable_status()->set_code(
+                    common::CYPRE_ER_INVALID_ARGUMENT);
+            response->mutable_status()->set_message("extentid empty");
+            return;
+        }
+        int rv = exmgr_->Discard(
+                range.extent_id(), range.offset(), range.size());
+        if (rv != common::CYPRE_OK) {
+            response->mutable_status()->set_code(rv);
+            response->mutable_status()->set_message("discard failed");
+            return;
+        }
+    }
+    response->mutable_status()->set_code(common::CYPRE_OK);
+}
+
 ///////////////////Mocked Entent Io logic
 // do nothing extent io
 int MockEmptyExtentManager::Read(
@@ -644,6 +727,11 @@ int MockEmptyExtentManager::Write(
     return common::CYPRE_OK;
 }
 
+int MockEmptyExtentManager::Discard(
+        const std::string &extent_id, uint64_t offset, uint64_t len) {
+    return common::CYPRE_OK;
+}
+
 // memory extent io
 int MockMemExtentManager::Read(
         const std::string &extent_id, uint64_t offset, uint64_t len,
@@ -696,3 +784,26 @@ int MockMemExtentManager::Write(
     iobuf.copy_to(extent + offset, len, 0);
     return common::CYPRE_OK;
 }
+
+int MockMemExtentManager::Discard(
+        const std::string &extent_id, uint64_t offset, uint64_t len) {
+    const uint64_t ext_size = GlobalConfig::Instance()->GetExtentSize();
+    if (offset >= ext_size || offset + len > ext_size) {
+        LOG(ERROR) << "Discard failed, offset or len invalid";
+        return common::CYPRE_ER_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    auto itr = extents_.find(extent_id);
+    if (itr == extents_.end()) {
+        return common::CYPRE_OK;
+    }
+    if (offset == 0 && len == ext_size) {
+        // whole extent gives its memory back, as es frees its space
+        delete[] itr->second;
+        extents_.erase(itr);
+    } else {
+        memset(itr->second + offset, 0, len);
+    }
+    return common::CYPRE_OK;
+}
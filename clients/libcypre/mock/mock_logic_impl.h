@@ -119,6 +119,9 @@ public:
     virtual int
     Write(const std::string &extent_id, uint64_t offset, uint64_t len,
           const butil::IOBuf &iobuf) = 0;
+    // discarded range reads as zeros
+    virtual int
+    Discard(const std::string &extent_id, uint64_t offset, uint64_t len) = 0;
 };
 
 // do nothing extent io
@@ -132,6 +135,8 @@ public:
     virtual int
     Write(const std::string &extent_id, uint64_t offset, uint64_t len,
           const butil::IOBuf &iobuf);
+    virtual int
+    Discard(const std::string &extent_id, uint64_t offset, uint64_t len);
 };
 
 // memory extent io
@@ -145,6 +150,8 @@ public:
     virtual int
     Write(const std::string &extent_id, uint64_t offset, uint64_t len,
           const butil::IOBuf &iobuf);
+    virtual int
+    Discard(const std::string &extent_id, uint64_t offset, uint64_t len);
 
 private:
     std::map<std::string, char *> extents_;
@@ -216,6 +223,10 @@ public:
             const extentmanager::pb::QueryRouterRequest *request,
             extentmanager::pb::QueryRouterResponse *response);
 
+    virtual void QueryRouters(
+            const extentmanager::pb::QueryRoutersRequest *request,
+            extentmanager::pb::QueryRoutersResponse *response);
+
 private:
     MockLogicManager *mgr_;
 };
@@ -235,6 +246,16 @@ public:
           const extentserver::pb::WriteRequest *request,
           extentserver::pb::WriteResponse *response);
 
+    virtual void Replicate(
+            google::protobuf::RpcController *cntl,
+            const extentserver::pb::ReplicateRequest *request,
+            extentserver::pb::ReplicateResponse *response);
+
+    virtual void
+    Discard(google::protobuf::RpcController *cntl,
+            const extentserver::pb::DiscardRequest *request,
+            extentserver::pb::DiscardResponse *response);
+
 private:
     MockExtentManager *exmgr_;
 };
@@ -13,6 +13,7 @@
 #include <string>
 #include <vector>
 
+#include "extentserver/replicate_receiver.h"
 #include "mock/mock_logic.h"
 #include "mock/mock_logic_impl.h"
 
@@ -146,6 +147,15 @@ public:
         mblob_->QueryRouter(request, response);
     }
 
+    virtual void QueryRouters(
+            google::protobuf::RpcController *cntl_base,
+            const extentmanager::pb::QueryRoutersRequest *request,
+            extentmanager::pb::QueryRoutersResponse *response,
+            google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        mblob_->QueryRouters(request, response);
+    }
+
 private:
     MockBlobLogic *mblob_;
 };
@@ -173,6 +183,37 @@ public:
         mio_->Write(cntl_base, request, response);
     }
 
+    virtual void
+    Replicate(google::protobuf::RpcController *cntl_base,
+              const extentserver::pb::ReplicateRequest *request,
+              extentserver::pb::ReplicateResponse *response,
+              google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        mio_->Replicate(cntl_base, request, response);
+    }
+
+    virtual void
+    Discard(google::protobuf::RpcController *cntl_base,
+            const extentserver::pb::DiscardRequest *request,
+            extentserver::pb::DiscardResponse *response,
+            google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        mio_->Discard(cntl_base, request, response);
+    }
+
+    virtual void OpenReplicateStream(
+            google::protobuf::RpcController *cntl_base,
+            const extentserver::pb::OpenReplicateStreamRequest *request,
+            extentserver::pb::OpenReplicateStreamResponse *response,
+            google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+        auto s = extentserver::ReplicateStreamReceiver::Accept(
+                cntl, *request, this);
+        response->mutable_status()->set_code(s.code());
+        response->mutable_status()->set_message(s.ToString());
+    }
+
 private:
     MockExtentIoLogic *mio_;
 };
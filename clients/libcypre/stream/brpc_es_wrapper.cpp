@@ -7,6 +7,7 @@
 #include "stream/brpc_es_wrapper.h"
 
 #include <bthread/bthread.h>
+#include <butil/object_pool.h>
 
 #include "common/builtin.h"
 #include "common/connection_pool.h"
@@ -61,58 +62,81 @@ private:
     const bool isReader_;
     bool isNullAsyncIo_;
 protected:
+    void clearNullAsyncIo() {
+        isNullAsyncIo_ = false;
+    }
+
     struct timespec tenque_;
     struct timespec tdeque_;
 };
 
-class BrpcEsReader : public BrpcEsCaller {
+// Readers and writers are recycled through butil object pool together
+// with their controller and messages, and are the done closure of their
+// own rpc, so a pooled one allocates nothing per io.
+class BrpcEsReader : public BrpcEsCaller, public google::protobuf::Closure {
 public:
-    BrpcEsReader(
-            const ExtentStreamOptions &eopts, common::ConnectionPtr &conn,
-            ReadRequest *req, google::protobuf::Closure *callback);
+    BrpcEsReader();
     virtual ~BrpcEsReader();
 
+    static BrpcEsReader *Get(
+            const ExtentStreamOptions &eopts, common::BlobRouterCache *routers,
+            common::ConnectionPtr &conn, ReadRequest *req,
+            google::protobuf::Closure *callback);
+    void Put();
+
     virtual uint64_t HashKey() const {
-        return (uint64_t)eopts_.extent_idx;
+        return (uint64_t)eopts_->extent_idx;
     }
     virtual int AsyncCall();
     virtual int SyncCall();
     virtual void SetExpired();
+    // rpc done
+    virtual void Run();
 
 private:
-    void onReadDone(
-            brpc::Controller *cntl, extentserver::pb::ReadResponse *resp,
-            ReadRequest *req, google::protobuf::Closure *callback);
+    void buildRequest();
 
-    const ExtentStreamOptions &eopts_;
+    const ExtentStreamOptions *eopts_;
     common::ConnectionPtr conn_;
+    common::BlobRouterCache *routers_;  // told of newer router versions
     ReadRequest *req_;
     google::protobuf::Closure *cb_;
+    brpc::Controller cntl_;
+    extentserver::pb::ReadRequest request_;
+    extentserver::pb::ReadResponse response_;
 };
 
-class BrpcEsWriter : public BrpcEsCaller {
+class BrpcEsWriter : public BrpcEsCaller, public google::protobuf::Closure {
 public:
-    BrpcEsWriter(
-            const ExtentStreamOptions &eopts, common::ConnectionPtr &conn,
-            WriteRequest *req, google::protobuf::Closure *callback);
+    BrpcEsWriter();
     ~BrpcEsWriter();
 
+    static BrpcEsWriter *Get(
+            const ExtentStreamOptions &eopts, common::BlobRouterCache *routers,
+            common::ConnectionPtr &conn, WriteRequest *req,
+            google::protobuf::Closure *callback);
+    void Put();
+
     virtual uint64_t HashKey() const {
-        return (uint64_t)eopts_.extent_idx;
+        return (uint64_t)eopts_->extent_idx;
     }
     virtual int AsyncCall();
     virtual int SyncCall();
     virtual void SetExpired();
+    // rpc done
+    virtual void Run();
 
 private:
-    void onWriteDone(
-            brpc::Controller *cntl, extentserver::pb::WriteResponse *resp,
-            WriteRequest *req, google::protobuf::Closure *callback);
+    void buildRequest();
 
-    const ExtentStreamOptions &eopts_;
+    const ExtentStreamOptions *eopts_;
     common::ConnectionPtr conn_;
+    common::BlobRouterCache *routers_;  // told of newer router versions
     WriteRequest *req_;
     google::protobuf::Closure *cb_;
+    brpc::Controller cntl_;
+    extentserver::pb::WriteRequest request_;
+    extentserver::pb::WriteResponse response_;
 };
 
 class BrpcSenderWorker {
@@ -292,11 +316,12 @@ int BrpcEsWrapper::AsyncRead(
         req->status = common::CYPRE_C_INTERNAL_ERROR;
         return req->status;
     }
-    BrpcEsReader *reader = new BrpcEsReader(eopts_, conn, req, callback);
+    BrpcEsReader *reader = BrpcEsReader::Get(
+            eopts_, sopts_.blob_routers.get(), conn, req, callback);
     if (likely(callback != NULL)) {
         int rv = sopts_.brpc_sender->Push(reader);  // reader->AsyncCall();
         if (rv != common::CYPRE_OK) {
-            delete reader;
+            reader->Put();
             req->is_done = true;
             req->status = common::CYPRE_C_INTERNAL_ERROR;
             return req->status;
@@ -321,11 +346,12 @@ int BrpcEsWrapper::AsyncWrite(
         req->status = common::CYPRE_C_INTERNAL_ERROR;
         return req->status;
     }
-    BrpcEsWriter *writer = new BrpcEsWriter(eopts_, conn, req, callback);
+    BrpcEsWriter *writer = BrpcEsWriter::Get(
+            eopts_, sopts_.blob_routers.get(), conn, req, callback);
     if (likely(callback != NULL)) {
         int rv = sopts_.brpc_sender->Push(writer);  // writer->AsyncCall();
         if (rv != common::CYPRE_OK) {
-            delete writer;
+            writer->Put();
             req->is_done = true;
             req->status = common::CYPRE_C_INTERNAL_ERROR;
             return req->status;
@@ -336,93 +362,119 @@ int BrpcEsWrapper::AsyncWrite(
 }
 
 //////////////////class BrpcEsReader/////////////////
-BrpcEsReader::BrpcEsReader(
-        const ExtentStreamOptions &eopts, common::ConnectionPtr &conn,
-        ReadRequest *req, google::protobuf::Closure *callback)
-        : BrpcEsCaller(true), eopts_(eopts), conn_(conn), req_(req),
-          cb_(callback) {}
+BrpcEsReader::BrpcEsReader()
+        : BrpcEsCaller(true), eopts_(NULL), routers_(NULL), req_(NULL),
+          cb_(NULL) {}
 
 BrpcEsReader::~BrpcEsReader() {}
 
+BrpcEsReader *BrpcEsReader::Get(
+        const ExtentStreamOptions &eopts, common::BlobRouterCache *routers,
+        common::ConnectionPtr &conn, ReadRequest *req,
+        google::protobuf::Closure *callback) {
+    BrpcEsReader *reader = butil::get_object<BrpcEsReader>();
+    reader->eopts_ = &eopts;
+    reader->routers_ = routers;
+    reader->conn_ = conn;
+    reader->req_ = req;
+    reader->cb_ = callback;
+    return reader;
+}
+
+void BrpcEsReader::Put() {
+    // Reset drops the attachment, pooled readers hold no io buffer
+    cntl_.Reset();
+    request_.Clear();
+    response_.Clear();
+    conn_.reset();
+    eopts_ = NULL;
+    routers_ = NULL;
+    req_ = NULL;
+    cb_ = NULL;
+    clearNullAsyncIo();
+    butil::return_object(this);
+}
+
 void BrpcEsReader::SetExpired() {
     if (cb_) {
         req_->is_done = true;
         req_->status = common::CYPRE_C_DEVICE_CLOSED;
         cb_->Run();
     }
-    delete this;
+    Put();
+}
+
+void BrpcEsReader::buildRequest() {
+    request_.set_extent_id(eopts_->extent_id);
+    request_.set_offset(req_->real_offset);
+    request_.set_size(req_->real_len);
+    request_.set_header_crc32(req_->header_crc32_);
+    if (req_->allow_secondary) {
+        request_.set_allow_secondary(true);
+    }
 }
 
 int BrpcEsReader::AsyncCall() {
     // send request
-    extentserver::pb::ReadRequest request;
-    request.set_extent_id(eopts_.extent_id);
-    request.set_offset(req_->real_offset);
-    request.set_size(req_->real_len);
-    request.set_header_crc32(req_->header_crc32_);
-    extentserver::pb::ReadResponse *response =
-            new extentserver::pb::ReadResponse();
-    brpc::Controller *cntl = new brpc::Controller();
-    google::protobuf::Closure *done = brpc::NewCallback(
-            this, &BrpcEsReader::onReadDone, cntl, response, req_, cb_);
+    buildRequest();
     if (unlikely(IsNullAsyncIo())) {
-        done->Run();
+        Run();
     } else {
         extentserver::pb::ExtentIOService_Stub stub(conn_->channel.get());
-        stub.Read(cntl, &request, response, done);
+        stub.Read(&cntl_, &request_, &response_, this);
     }
     return common::CYPRE_OK;
 }
 
 int BrpcEsReader::SyncCall() {
     // send request
-    brpc::Controller *cntl = new brpc::Controller();
+    ReadRequest *req = req_;
+    buildRequest();
     extentserver::pb::ExtentIOService_Stub stub(conn_->channel.get());
-    extentserver::pb::ReadRequest request;
-    extentserver::pb::ReadResponse *response =
-            new extentserver::pb::ReadResponse();
-
-    request.set_extent_id(eopts_.extent_id);
-    request.set_offset(req_->real_offset);
-    request.set_size(req_->real_len);
-    request.set_header_crc32(req_->header_crc32_);
     // sync mode
-    stub.Read(cntl, &request, response, NULL);
-    onReadDone(cntl, response, req_, NULL);
-    return req_->status;
+    stub.Read(&cntl_, &request_, &response_, NULL);
+    Run();
+    return req->status;
 }
 
-void BrpcEsReader::onReadDone(
-        brpc::Controller *cntl, extentserver::pb::ReadResponse *resp,
-        ReadRequest *req, google::protobuf::Closure *callback) {
+void BrpcEsReader::Run() {
 	struct timespec curtime;
     utils::Chrono::GetTime(&curtime);
 	g_latency_read_e2etime << utils::Chrono::TimeSinceUs(&tdeque_, &curtime);
     int rc = common::CYPRE_OK;
+    ReadRequest *req = req_;
+    google::protobuf::Closure *callback = cb_;
     if (req->is_done.exchange(true, std::memory_order_relaxed)) {
+        Put();
         return;  // avoid double call
     }
-    std::unique_ptr<brpc::Controller> cntl_guard(cntl);
-    std::unique_ptr<extentserver::pb::ReadResponse> response_guard(resp);
-    if (cntl->Failed()) {
-        rc = common::CYPRE_ER_NET_ERROR;
-        LOG(ERROR) << "Couldn't send read request, " << cntl->ErrorText()
-                   << ", Extent:" << eopts_.extent_id;
-    } else if (resp->status().code() != 0) {
-        rc = resp->status().code();
-        LOG(ERROR) << "Couldn't read extent, " << resp->status().message()
-                   << ", Extent:" << eopts_.extent_id << ", rc:" << rc;
+    if (routers_ != NULL && !cntl_.Failed()
+        && response_.has_router_version()) {
+        routers_->UpdateVersion(response_.router_version());
     }
-
-    if (common::CYPRE_OK == resp->status().code()) {
-        const butil::IOBuf &io_buf = cntl->response_attachment();
+    if (cntl_.Failed()) {
+        rc = common::CYPRE_ER_NET_ERROR;
+        LOG(ERROR) << "Couldn't send read request, " << cntl_.ErrorText()
+                   << ", Extent:" << eopts_->extent_id;
+    } else if (response_.status().code() != 0) {
+        rc = response_.status().code();
+        LOG(ERROR) << "Couldn't read extent, " << response_.status().message()
+                   << ", Extent:" << eopts_->extent_id << ", rc:" << rc;
+    }
+
+    if (rc == common::CYPRE_OK && req->buf_claim != NULL
+        && req->buf_claim->exchange(true)) {
+        rc = common::CYPRE_C_READ_OVERTAKEN;
+    } else if (common::CYPRE_OK == response_.status().code()) {
+        const butil::IOBuf &io_buf = cntl_.response_attachment();
         io_buf.copy_to(req->buf);
-        if (resp->has_crc32()) {
-            req->data_crc32_ = resp->crc32();
+        if (response_.has_crc32()) {
+            req->data_crc32_ = response_.crc32();
             req->has_data_crc32_ = true;
         }
     }
     req->status = rc;
+    Put();
     if (likely(callback != NULL)) {
         struct timespec te, ts;
         utils::Chrono::GetTime(&ts);
@@ -430,118 +482,129 @@ void BrpcEsReader::onReadDone(
         utils::Chrono::GetTime(&te);
         g_latency_sdk_usercb << utils::Chrono::TimeSinceUs(&ts, &te);
     }
-    delete this;
 }
 
 /////////////////class BrpcEsWriter//////////////
-BrpcEsWriter::BrpcEsWriter(
-        const ExtentStreamOptions &eopts, common::ConnectionPtr &conn,
-        WriteRequest *req, google::protobuf::Closure *callback)
-        : BrpcEsCaller(false), eopts_(eopts), conn_(conn), req_(req),
-          cb_(callback) {}
+BrpcEsWriter::BrpcEsWriter()
+        : BrpcEsCaller(false), eopts_(NULL), routers_(NULL), req_(NULL),
+          cb_(NULL) {}
 
 BrpcEsWriter::~BrpcEsWriter() {}
 
+BrpcEsWriter *BrpcEsWriter::Get(
+        const ExtentStreamOptions &eopts, common::BlobRouterCache *routers,
+        common::ConnectionPtr &conn, WriteRequest *req,
+        google::protobuf::Closure *callback) {
+    BrpcEsWriter *writer = butil::get_object<BrpcEsWriter>();
+    writer->eopts_ = &eopts;
+    writer->routers_ = routers;
+    writer->conn_ = conn;
+    writer->req_ = req;
+    writer->cb_ = callback;
+    return writer;
+}
+
+void BrpcEsWriter::Put() {
+    cntl_.Reset();
+    request_.Clear();
+    response_.Clear();
+    conn_.reset();
+    eopts_ = NULL;
+    routers_ = NULL;
+    req_ = NULL;
+    cb_ = NULL;
+    clearNullAsyncIo();
+    butil::return_object(this);
+}
+
 void BrpcEsWriter::SetExpired() {
     if (cb_) {
         req_->is_done = true;
         req_->status = common::CYPRE_C_DEVICE_CLOSED;
         cb_->Run();
     }
-    delete this;
+    Put();
 }
 
-int BrpcEsWriter::AsyncCall() {
-    // send request
-    brpc::Controller *cntl = new brpc::Controller();
-    extentserver::pb::WriteRequest request;
-    extentserver::pb::WriteResponse *response =
-            new extentserver::pb::WriteResponse();
-
-    request.set_extent_id(eopts_.extent_id);
-    request.set_offset(req_->real_offset);
-    request.set_size(req_->real_len);
-    request.set_crc32(req_->data_crc32_);
-    request.set_header_crc32(req_->header_crc32_);
+void BrpcEsWriter::buildRequest() {
+    request_.set_extent_id(eopts_->extent_id);
+    request_.set_offset(req_->real_offset);
+    request_.set_size(req_->real_len);
+    request_.set_crc32(req_->data_crc32_);
+    request_.set_header_crc32(req_->header_crc32_);
+    if (req_->client_replicated) {
+        request_.set_client_replicated(true);
+    }
 
     // TODO: Don't using zero-copy function utill brpc timeout problem is figured out.
-    //cntl->request_attachment().append_user_data(
+    //cntl_.request_attachment().append_user_data(
     //        const_cast<void *>(req_->buf), req_->real_len,
     //        brpc_iobuf_userdata_dummy_deleter);
-    cntl->request_attachment().append(
+    cntl_.request_attachment().append(
             const_cast<void *>(req_->buf), req_->real_len);
-    google::protobuf::Closure *done = brpc::NewCallback(
-            this, &BrpcEsWriter::onWriteDone, cntl, response, req_, cb_);
+}
+
+int BrpcEsWriter::AsyncCall() {
+    // send request
+    buildRequest();
     if (unlikely(IsNullAsyncIo())) {
-        done->Run();
+        Run();
     } else {
         extentserver::pb::ExtentIOService_Stub stub(conn_->channel.get());
-        stub.Write(cntl, &request, response, done);
+        stub.Write(&cntl_, &request_, &response_, this);
     }
     return common::CYPRE_OK;
 }
 
 int BrpcEsWriter::SyncCall() {
     // send request
-    brpc::Controller *cntl = new brpc::Controller();
+    WriteRequest *req = req_;
+    buildRequest();
     extentserver::pb::ExtentIOService_Stub stub(conn_->channel.get());
-    extentserver::pb::WriteRequest request;
-    extentserver::pb::WriteResponse *response =
-            new extentserver::pb::WriteResponse();
-
-    request.set_extent_id(eopts_.extent_id);
-    request.set_offset(req_->real_offset);
-    request.set_size(req_->real_len);
-    request.set_crc32(req_->data_crc32_);
-    request.set_header_crc32(req_->header_crc32_);
-
-    // TODO: Don't using zero-copy function utill brpc timeout problem is figured out.
-    //cntl->request_attachment().append_user_data(
-    //        const_cast<void *>(req_->buf), req_->real_len,
-    //        brpc_iobuf_userdata_dummy_deleter);
-    cntl->request_attachment().append(
-            const_cast<void *>(req_->buf), req_->real_len);
-
     // sync mode
-    stub.Write(cntl, &request, response, NULL);
-    onWriteDone(cntl, response, req_, NULL);
-    return req_->status;
+    stub.Write(&cntl_, &request_, &response_, NULL);
+    Run();
+    return req->status;
 }
 
-void BrpcEsWriter::onWriteDone(
-        brpc::Controller *cntl, extentserver::pb::WriteResponse *resp,
-        WriteRequest *req, google::protobuf::Closure *callback) {
+void BrpcEsWriter::Run() {
 	struct timespec curtime;
     utils::Chrono::GetTime(&curtime);
 	g_latency_write_e2etime << utils::Chrono::TimeSinceUs(&tdeque_, &curtime);
+    WriteRequest *req = req_;
+    google::protobuf::Closure *callback = cb_;
     if (req->is_done.exchange(true, std::memory_order_relaxed)) {
+        Put();
         return;  // avoid double call
     }
-    std::unique_ptr<brpc::Controller> cntl_guard(cntl);
-    std::unique_ptr<extentserver::pb::WriteResponse> response_guard(resp);
+    if (routers_ != NULL && !cntl_.Failed()
+        && response_.has_router_version()) {
+        routers_->UpdateVersion(response_.router_version());
+    }
     int rc = common::CYPRE_OK;
-    if (cntl->Failed()) {
+    if (cntl_.Failed()) {
         rc = common::CYPRE_ER_NET_ERROR;
-        LOG(ERROR) << "Couldn't send write request, " << cntl->ErrorText()
+        LOG(ERROR) << "Couldn't send write request, " << cntl_.ErrorText()
 				   << ", offset:" << req->real_offset
 				   << ", len:" << req->real_len
 				   << ", crc32:" << req->data_crc32_
 				   << ", logic_offset:" << req->ureq->logic_offset
 				   << ", logic_len:" << req->ureq->logic_len
 				   << ", logic_crc32:" << req->ureq->data_crc32_
-                   << ", extent_id:" << eopts_.extent_id;
-    } else if (resp->status().code() != 0) {
-        rc = resp->status().code();
-        LOG(ERROR) << "Couldn't write extent, " << resp->status().message()
+                   << ", extent_id:" << eopts_->extent_id;
+    } else if (response_.status().code() != 0) {
+        rc = response_.status().code();
+        LOG(ERROR) << "Couldn't write extent, " << response_.status().message()
 				   << ", offset:" << req->real_offset
 				   << ", len:" << req->real_len
 				   << ", crc32:" << req->data_crc32_
 				   << ", logic_offset:" << req->ureq->logic_offset
 				   << ", logic_len:" << req->ureq->logic_len
 				   << ", logic_crc32:" << req->ureq->data_crc32_
-                   << ", extent_id:" << eopts_.extent_id << ", rc:" << rc;
+                   << ", extent_id:" << eopts_->extent_id << ", rc:" << rc;
     }
     req->status = rc;
+    Put();
     if (likely(callback != NULL)) {
         struct timespec te, ts;
         utils::Chrono::GetTime(&ts);
@@ -549,7 +612,6 @@ void BrpcEsWriter::onWriteDone(
         utils::Chrono::GetTime(&te);
         g_latency_sdk_usercb << utils::Chrono::TimeSinceUs(&ts, &te);
     }
-    delete this;
 }
 
 ///////////// Null Wrapper for test///////////////
@@ -562,19 +624,20 @@ int NullEsWrapper::AsyncRead(
         conn = sopts_.conn_pool->NewConnection(
                 es.es_id, es.public_ip, es.public_port);
     }
-    BrpcEsReader *reader = new BrpcEsReader(eopts_, conn, req, callback);
+    BrpcEsReader *reader = BrpcEsReader::Get(
+            eopts_, sopts_.blob_routers.get(), conn, req, callback);
     reader->Test_SetNullAsyncIo();
     if (callback != NULL) {
         int rv = sopts_.brpc_sender->Push(reader);  // reader->AsyncCall(); //
         if (rv != common::CYPRE_OK) {
-            delete reader;
+            reader->Put();
             req->is_done = true;
             req->status = common::CYPRE_C_INTERNAL_ERROR;
             return req->status;
         }
         return common::CYPRE_OK;
     }
-    delete reader;
+    reader->Put();
     return common::CYPRE_OK;
 }
 
@@ -586,19 +649,20 @@ int NullEsWrapper::AsyncWrite(
         conn = sopts_.conn_pool->NewConnection(
                 es.es_id, es.public_ip, es.public_port);
     }
-    BrpcEsWriter *writer = new BrpcEsWriter(eopts_, conn, req, callback);
+    BrpcEsWriter *writer = BrpcEsWriter::Get(
+            eopts_, sopts_.blob_routers.get(), conn, req, callback);
     writer->Test_SetNullAsyncIo();
     if (callback != NULL) {
         int rv = sopts_.brpc_sender->Push(writer);  // writer->AsyncCall(); //
         if (rv != common::CYPRE_OK) {
-            delete writer;
+            writer->Put();
             req->is_done = true;
             req->status = common::CYPRE_C_INTERNAL_ERROR;
             return req->status;
         }
         return common::CYPRE_OK;
     }
-    delete writer;
+    writer->Put();
     return common::CYPRE_OK;
 }
 
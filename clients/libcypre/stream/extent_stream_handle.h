@@ -7,6 +7,8 @@
 #ifndef CYPRESTORE_CLIENTS_STREAM_STREAM_HANDLE_H_
 #define CYPRESTORE_CLIENTS_STREAM_STREAM_HANDLE_H_
 
+#include <butil/object_pool.h>
+#include <google/protobuf/stubs/callback.h>
 #include <time.h>
 
 #include <memory>
@@ -30,13 +32,61 @@ struct ExtentStreamOptions {
     int extent_idx;
 };
 
+// Done closure kept in a pooled request. Unlike brpc::NewCallback it isn't
+// deleted by Run(), it goes back to the pool with its request.
+template <typename Req>
+class RequestDone : public google::protobuf::Closure {
+public:
+    typedef void (*Callback)(void *ctx, Req *req);
+    RequestDone() : cb_(NULL), ctx_(NULL), req_(NULL) {}
+
+    void Set(Callback cb, void *ctx, Req *req) {
+        cb_ = cb;
+        ctx_ = ctx;
+        req_ = req;
+    }
+    virtual void Run() {
+        cb_(ctx_, req_);
+    }
+
+private:
+    Callback cb_;
+    void *ctx_;
+    Req *req_;
+};
+
 struct ReadRequest {
     ReadRequest() : buf(NULL), data_crc32_(0), has_data_crc32_(false),
-            header_crc32_(0), ureq(NULL), is_done(false), status(-1) {}
+            header_crc32_(0), allow_secondary(false), buf_claim(NULL),
+            real_offset(0), real_len(0), ureq(NULL), is_done(false),
+            status(-1) {}
+    // recycled through butil object pool, Put drops the extent handle
+    static ReadRequest *Get() {
+        return butil::get_object<ReadRequest>();
+    }
+    static void Put(ReadRequest *req) {
+        req->buf = NULL;
+        req->data_crc32_ = 0;
+        req->has_data_crc32_ = false;
+        req->header_crc32_ = 0;
+        req->allow_secondary = false;
+        req->buf_claim = NULL;
+        req->real_offset = 0;
+        req->real_len = 0;
+        req->handle.reset();
+        req->ureq = NULL;
+        req->is_done = false;
+        req->status = -1;
+        butil::return_object(req);
+    }
+
     void *buf;
     uint32_t data_crc32_;
     bool has_data_crc32_;
     uint32_t header_crc32_;
+    bool allow_secondary;
+    // copies of a hedged read share buf, the first to succeed fills it
+    std::atomic<bool> *buf_claim;
     // range in extent
     uint32_t real_offset;
     uint32_t real_len;
@@ -44,14 +94,35 @@ struct ReadRequest {
     UserReadRequest *ureq;
     std::atomic<bool> is_done;
     int status;
+    RequestDone<ReadRequest> done;
 };
 
 struct WriteRequest {
     WriteRequest() : buf(NULL), data_crc32_(0), header_crc32_(0),
-            ureq(NULL), is_done(false), status(-1) {}
+            client_replicated(false), real_offset(0), real_len(0), ureq(NULL),
+            is_done(false), status(-1) {}
+    static WriteRequest *Get() {
+        return butil::get_object<WriteRequest>();
+    }
+    static void Put(WriteRequest *req) {
+        req->buf = NULL;
+        req->data_crc32_ = 0;
+        req->header_crc32_ = 0;
+        req->client_replicated = false;
+        req->real_offset = 0;
+        req->real_len = 0;
+        req->handle.reset();
+        req->ureq = NULL;
+        req->is_done = false;
+        req->status = -1;
+        butil::return_object(req);
+    }
+
     const void *buf;
     uint32_t data_crc32_;
     uint32_t header_crc32_;
+    // one copy of a star write, es doesn't replicate it
+    bool client_replicated;
     // range in extent
     uint32_t real_offset;
     uint32_t real_len;
@@ -59,6 +130,7 @@ struct WriteRequest {
     UserWriteRequest *ureq;
     std::atomic<bool> is_done;
     int status;
+    RequestDone<WriteRequest> done;
 };
 
 class ExtentStreamHandle {
@@ -17,6 +17,8 @@ namespace clients {
 
 typedef void (*io_completion_cb)(int rc, void *ctx);
 
+// io may be issued on a handle by many threads at once, io callbacks
+// included
 class RBDStreamHandle {
 public:
     RBDStreamHandle() {}
@@ -24,17 +26,26 @@ public:
 
     virtual int Init() = 0;
     virtual int Close() = 0;
-    // return CYPREC_OK is success
+    // return CYPREC_OK is success, in async mode an error return means
+    // the callback will not run, later errors go to the callback only
     // @callback, for sync mode, set to NULL
     virtual int AsyncRead(
             void *buf, uint32_t len, uint64_t offset, io_completion_cb callback,
             void *ctx) = 0;
-    // return CYPREC_OK is success
+    // return CYPREC_OK is success, in async mode an error return means
+    // the callback will not run, later errors go to the callback only
     // @callback, for sync mode, set to NULL
     virtual int AsyncWrite(
             const void *buf, uint32_t len, uint64_t offset,
             io_completion_cb callback, void *ctx) = 0;
 
+    // return CYPREC_OK is success, discarded range reads as zeros,
+    // unaligned head and tail of the range are left as they are
+    // @callback, for sync mode, set to NULL
+    virtual int AsyncDiscard(
+            uint64_t offset, uint64_t len, io_completion_cb callback,
+            void *ctx) = 0;
+
     virtual int Read(void *buf, uint32_t len, uint64_t offset) = 0;
     virtual int Write(const void *buf, uint32_t len, uint64_t offset) = 0;
 
@@ -6,19 +6,64 @@
 
 #include "stream/rbd_stream_handle_impl.h"
 
-#include <brpc/callback.h>
+#include <bthread/countdown_event.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include "common/builtin.h"
 #include "common/error_code.h"
 #include "common/extent_id_generator.h"
+#include "extentserver/pb/extent_io.pb.h"
 #include "stream/ystream_handle.h"
 #include "utils/crc32.h"
 
 using namespace cyprestore;
 using namespace cyprestore::clients;
 
+namespace {
+
+// a sync io split in many is sent like an async one and waited for
+struct SyncIo {
+    SyncIo() : done(1), status(common::CYPRE_OK) {}
+
+    static void OnDone(int rc, void *ctx) {
+        SyncIo *io = static_cast<SyncIo *>(ctx);
+        io->status = rc;
+        io->done.signal();
+    }
+
+    bthread::CountdownEvent done;
+    int status;
+};
+
+const uint64_t kDiscardAlign = 4096;
+const int kMaxDiscardRanges = 1024;  // per rpc, as es takes
+
+}  // namespace
+
+struct RBDStreamHandleImpl::UserDiscardRequest {
+    UserDiscardRequest(RBDStreamHandleImpl *h, io_completion_cb cb, void *ctx)
+            : handle(h), user_cb(cb), user_ctx(ctx), ref(1),
+              status(common::CYPRE_OK) {}
+
+    RBDStreamHandleImpl *handle;
+    io_completion_cb user_cb;
+    void *user_ctx;
+    std::atomic<int> ref;  // rpcs in flight plus the sender
+    std::atomic<int> status;
+};
+
+struct RBDStreamHandleImpl::DiscardCall {
+    UserDiscardRequest *ureq;
+    common::ConnectionPtr conn;
+    brpc::Controller cntl;
+    extentserver::pb::DiscardRequest request;
+    extentserver::pb::DiscardResponse response;
+};
+
 RBDStreamHandleImpl::RBDStreamHandleImpl(const RBDStreamOptions &opt)
         : RBDStreamHandle(), sopts_(opt), esio_proto_(kBrpc), ioInflight_(0),
           isClosed_(false) {}
@@ -43,6 +88,7 @@ int RBDStreamHandleImpl::Close() {
     while (ioInflight_.load(std::memory_order_acquire) != 0) {
         usleep(1);
     }
+    common::WriteLock lock(handleLock_);
     for (auto itr = handleMap_.begin(); itr != handleMap_.end(); ++itr) {
         ExtentStreamHandlePtr handle = itr->second;
         int rc = handle->Close();
@@ -58,6 +104,14 @@ int RBDStreamHandleImpl::Close() {
 
 ExtentStreamHandlePtr
 RBDStreamHandleImpl::GetExtentStreamHandle(uint64_t extent_index) {
+    {
+        common::ReadLock lock(handleLock_);
+        auto itr = handleMap_.find(extent_index);
+        if (itr != handleMap_.end()) {
+            return itr->second;
+        }
+    }
+    common::WriteLock lock(handleLock_);
     auto itr = handleMap_.find(extent_index);
     if (itr != handleMap_.end()) {
         return itr->second;
@@ -74,8 +128,8 @@ RBDStreamHandleImpl::GetExtentStreamHandle(uint64_t extent_index) {
         handle.reset();
     } else {
         handleMap_[extent_index] = handle;
+        handle->SetExtentIoProto(esio_proto_);
     }
-    handle->SetExtentIoProto(esio_proto_);
     return handle;
 }
 
@@ -93,8 +147,7 @@ int RBDStreamHandleImpl::AsyncRead(
     if (isClosed_.load(std::memory_order_relaxed)) {
         return common::CYPRE_C_DEVICE_CLOSED;
     }
-    // TODO(zhangliang): use pool
-    UserReadRequest *ureq = new UserReadRequest();
+    UserReadRequest *ureq = UserReadRequest::Get();
     ureq->buf = buf;
     ureq->logic_len = len;
     ureq->logic_offset = offset;
@@ -110,88 +163,252 @@ int RBDStreamHandleImpl::AsyncWrite(
     if (isClosed_.load(std::memory_order_relaxed)) {
         return common::CYPRE_C_DEVICE_CLOSED;
     }
-    // TODO(zhangliang): use pool
-    UserWriteRequest *ureq = new UserWriteRequest();
+    UserWriteRequest *ureq = UserWriteRequest::Get();
     ureq->buf = buf;
     ureq->logic_len = len;
     ureq->logic_offset = offset;
     ureq->user_cb = callback;
     ureq->user_ctx = ctx;
-    ureq->data_crc32_ = utils::Crc32::Checksum(buf, len);
     ureq->generateHeaderCrc32();
     return doUserWriteRequest(ureq);
 }
 
-int RBDStreamHandleImpl::splitUserRequest(
-        const UserIoRequest *ureq, uint64_t roff[2], uint32_t len[2],
-        ExtentStreamHandlePtr handle[2], int &size) {
-    const uint64_t extSize = sopts_.extent_size;
-    uint64_t extent_index1 = ureq->logic_offset / extSize + 1;
-    uint64_t extent_index2 =
-            (ureq->logic_offset + ureq->logic_len - 1) / extSize + 1;
-    if (extent_index2 > extent_index1 + 1) {
-        return common::CYPRE_C_DATA_TOO_LARGE;
-    }
-    size = (extent_index2 > extent_index1 ? 2 : 1);
-    handle[0] = GetExtentStreamHandle(extent_index1);
-    if (handle[0].get() == nullptr) {
-        return common::CYPRE_C_INTERNAL_ERROR;
-    }
-    roff[0] = ureq->logic_offset - (extent_index1 - 1) * extSize;
-    if (size == 2) {
-        len[0] = extSize - roff[0];
-        handle[1] = GetExtentStreamHandle(extent_index2);
-        if (handle[1].get() == nullptr) {
-            return common::CYPRE_C_INTERNAL_ERROR;
+int RBDStreamHandleImpl::AsyncDiscard(
+        uint64_t offset, uint64_t len, io_completion_cb callback, void *ctx) {
+    if (isClosed_.load(std::memory_order_relaxed)) {
+        return common::CYPRE_C_DEVICE_CLOSED;
+    }
+    uint64_t end = std::min(offset + len, sopts_.blob_size);
+    // only whole blocks can be discarded
+    offset = (offset + kDiscardAlign - 1) / kDiscardAlign * kDiscardAlign;
+    end = end / kDiscardAlign * kDiscardAlign;
+    if (offset >= end || esio_proto_ == kNull) {
+        if (callback != NULL) {
+            callback(common::CYPRE_OK, ctx);
         }
-        roff[1] = 0;
-        len[1] = ureq->logic_len - len[0];
-    } else {
-        len[0] = ureq->logic_len;
+        return common::CYPRE_OK;
+    }
+
+    SyncIo sync;
+    if (callback == NULL) {
+        callback = SyncIo::OnDone;
+        ctx = &sync;
+    }
+    UserDiscardRequest *ureq = new UserDiscardRequest(this, callback, ctx);
+    ioInflight_.fetch_add(1, std::memory_order_release);
+    // errors of an async discard only go to the callback
+    onDiscardDone(ureq, sendDiscardRequests(ureq, offset, end));
+    if (ctx == &sync) {
+        sync.done.wait();
+        return sync.status;
     }
     return common::CYPRE_OK;
 }
 
+int RBDStreamHandleImpl::sendDiscardRequests(
+        UserDiscardRequest *ureq, uint64_t offset, uint64_t end) {
+    const uint64_t extSize = sopts_.extent_size;
+    std::map<int, DiscardCall *> calls;  // by es_id
+    std::vector<DiscardCall *> full;
+    int rv = common::CYPRE_OK;
+    while (offset < end) {
+        uint64_t extent_index = offset / extSize + 1;
+        uint64_t roff = offset % extSize;
+        uint64_t rlen = std::min(end - offset, extSize - roff);
+        offset += rlen;
+
+        common::ExtentRouterPtr router;
+        std::string extent_id = common::ExtentIDGenerator::GenerateExtentID(
+                sopts_.blob_id, extent_index);
+        if (sopts_.blob_routers) {
+            router = sopts_.blob_routers->QueryRouter(extent_index);
+        } else {
+            router = sopts_.extent_router_mgr->QueryRouter(extent_id);
+        }
+        if (unlikely(!router)) {
+            LOG(ERROR) << "Couldn't get extent router"
+                       << ", extent_id:" << extent_id;
+            rv = common::CYPRE_C_INTERNAL_ERROR;
+            break;
+        }
+
+        // primary replicates a discard in order with writes, a client
+        // replicating its writes does so with discards too
+        size_t num_secondaries =
+                sopts_.star_replication ? router->secondaries.size() : 0;
+        for (size_t i = 0; i <= num_secondaries; i++) {
+            const common::ESInstance &es =
+                    i == 0 ? router->primary : router->secondaries[i - 1];
+            DiscardCall *&call = calls[es.es_id];
+            if (call == NULL) {
+                auto conn = sopts_.conn_pool->GetConnection(es.es_id);
+                if (unlikely(conn == nullptr)) {
+                    conn = sopts_.conn_pool->NewConnection(
+                            es.es_id, es.public_ip, es.public_port);
+                }
+                if (unlikely(conn == nullptr)) {
+                    LOG(ERROR) << "Couldn't connnect to " << es.address()
+                               << ", extent_id:" << extent_id;
+                    rv = common::CYPRE_C_INTERNAL_ERROR;
+                    calls.erase(es.es_id);
+                    continue;
+                }
+                call = new DiscardCall();
+                call->ureq = ureq;
+                call->conn = conn;
+                if (sopts_.star_replication) {
+                    call->request.set_client_replicated(true);
+                }
+            }
+            auto range = call->request.add_ranges();
+            range->set_extent_id(extent_id);
+            range->set_offset(roff);
+            range->set_size(rlen);
+            if (call->request.ranges_size() == kMaxDiscardRanges) {
+                full.push_back(call);
+                call = NULL;
+            }
+        }
+    }
+
+    for (auto &it : calls) {
+        if (it.second != NULL) {
+            full.push_back(it.second);
+        }
+    }
+    for (auto call : full) {
+        extentserver::pb::ExtentIOService_Stub stub(call->conn->channel.get());
+        ureq->ref.fetch_add(1);
+        stub.Discard(
+                &call->cntl, &call->request, &call->response,
+                brpc::NewCallback(&RBDStreamHandleImpl::discardDone, call));
+    }
+    return rv;
+}
+
+void RBDStreamHandleImpl::discardDone(DiscardCall *call) {
+    int status = common::CYPRE_OK;
+    if (call->cntl.Failed()) {
+        LOG(ERROR) << "Couldn't send discard request: "
+                   << call->cntl.ErrorText();
+        status = common::CYPRE_C_INTERNAL_ERROR;
+    } else if (call->response.status().code() != common::CYPRE_OK) {
+        LOG(ERROR) << "Couldn't discard: "
+                   << call->response.status().message();
+        status = call->response.status().code();
+    }
+    UserDiscardRequest *ureq = call->ureq;
+    delete call;
+    ureq->handle->onDiscardDone(ureq, status);
+}
+
+void RBDStreamHandleImpl::onDiscardDone(UserDiscardRequest *ureq, int status) {
+    if (status != common::CYPRE_OK) {
+        int ok = common::CYPRE_OK;
+        ureq->status.compare_exchange_strong(ok, status);
+    }
+    if (ureq->ref.fetch_sub(1) != 1) {
+        return;
+    }
+    ureq->user_cb(ureq->status.load(), ureq->user_ctx);
+    ioInflight_.fetch_sub(1, std::memory_order_release);
+    delete ureq;
+}
+
+uint32_t RBDStreamHandleImpl::splitLength(uint64_t offset, uint64_t end) const {
+    const uint64_t extSize = sopts_.extent_size;
+    uint64_t len = std::min(end - offset, extSize - offset % extSize);
+    uint64_t chunk = sopts_.optimal_iosize != 0 ? sopts_.optimal_iosize
+                                                : sopts_.max_iosize;
+    if (chunk != 0) {
+        len = std::min(len, chunk - offset % chunk);
+    }
+    return static_cast<uint32_t>(len);
+}
+
+int RBDStreamHandleImpl::countSplits(const UserIoRequest *ureq) const {
+    uint64_t offset = ureq->logic_offset;
+    const uint64_t end = offset + ureq->logic_len;
+    int num = 0;
+    do {  // an empty io is still sent once
+        offset += splitLength(offset, end);
+        ++num;
+    } while (offset < end);
+    return num;
+}
+
+ExtentStreamHandlePtr
+RBDStreamHandleImpl::splitHandle(uint64_t offset, uint32_t *roff) {
+    const uint64_t extSize = sopts_.extent_size;
+    uint64_t extent_index = offset / extSize + 1;
+    *roff = static_cast<uint32_t>(offset - (extent_index - 1) * extSize);
+    return GetExtentStreamHandle(extent_index);
+}
+
 int RBDStreamHandleImpl::doUserReadRequest(UserReadRequest *ureq) {
-    int ionum = 1;
-    uint64_t roff[2] = { 0, 0 };
-    uint32_t len[2] = { 0, 0 };
-    ExtentStreamHandlePtr handle[2];
-    int rv = splitUserRequest(ureq, roff, len, handle, ionum);
-    if (rv != common::CYPRE_OK) {
-        LOG(ERROR) << "splitUserRequest Failed, rv=" << rv
-                   << ", Blob:" << sopts_.blob_id
-                   << ", offset:" << ureq->logic_offset
-                   << ", len:" << ureq->logic_len;
-        delete ureq;
-        return rv;
+    int ionum = countSplits(ureq);
+    if (ureq->user_cb != NULL || ionum == 1) {
+        return sendReadRequests(ureq, ionum);
+    }
+    SyncIo sync;
+    ureq->user_cb = SyncIo::OnDone;
+    ureq->user_ctx = &sync;
+    int rv = sendReadRequests(ureq, ionum);
+    sync.done.wait();
+    return rv != common::CYPRE_OK ? rv : sync.status;
+}
+
+int RBDStreamHandleImpl::doUserWriteRequest(UserWriteRequest *ureq) {
+    int ionum = countSplits(ureq);
+    if (ionum == 1) {
+        ureq->data_crc32_ = utils::Crc32::Checksum(ureq->buf, ureq->logic_len);
+    }
+    if (ureq->user_cb != NULL || ionum == 1) {
+        return sendWriteRequests(ureq, ionum);
     }
+    SyncIo sync;
+    ureq->user_cb = SyncIo::OnDone;
+    ureq->user_ctx = &sync;
+    int rv = sendWriteRequests(ureq, ionum);
+    sync.done.wait();
+    return rv != common::CYPRE_OK ? rv : sync.status;
+}
+
+int RBDStreamHandleImpl::sendReadRequests(UserReadRequest *ureq, int ionum) {
+    int rv = common::CYPRE_OK;
+    const bool async = ureq->user_cb != NULL;
     ioInflight_.fetch_add(1, std::memory_order_release);
     ureq->ref = ionum;
-    if (ionum == 2) {
-        ureq->is_splited_ = true;
-    }
-    void *buf = ureq->buf;
+    ureq->is_splited_ = ionum > 1;
+    uint64_t offset = ureq->logic_offset;
+    const uint64_t end = offset + ureq->logic_len;
+    char *buf = static_cast<char *>(ureq->buf);
     for (int i = 0; i < ionum; i++) {
-        // TODO(zhangliang): use pool
-        ReadRequest *req = new ReadRequest();
-        req->handle = handle[i];
+        ReadRequest *req = ReadRequest::Get();
+        req->real_len = splitLength(offset, end);
+        req->handle = splitHandle(offset, &req->real_offset);
         req->buf = buf;
-        req->real_len = len[i];
-        req->real_offset = roff[i];
         req->ureq = ureq;
         req->header_crc32_ = ureq->header_crc32_;
-        buf = (char *)buf + len[i];
-        google::protobuf::Closure *cb =
-                brpc::NewCallback(this, &RBDStreamHandleImpl::onReadDone, req);
-        if (likely(ureq->user_cb != NULL)) {
-            int rc = handle[i]->AsyncRead(req, cb);
+        buf += req->real_len;
+        offset += req->real_len;
+        req->done.Set(&RBDStreamHandleImpl::readDone, this, req);
+        google::protobuf::Closure *cb = &req->done;
+        if (unlikely(req->handle.get() == nullptr)) {
+            req->status = common::CYPRE_C_INTERNAL_ERROR;
+            if (!async) {
+                rv = req->status;
+            }
+            cb->Run();
+        } else if (likely(async)) {
+            // errors after this point are reported by the callback only
+            int rc = req->handle->AsyncRead(req, cb);
             if (rc != common::CYPRE_OK) {
-                rv = rc;
+                req->status = rc;
                 cb->Run();
             }
         } else {  // sync mode
-            int rc = handle[i]->AsyncRead(req, NULL);
+            int rc = req->handle->AsyncRead(req, NULL);
             if (rc != common::CYPRE_OK) {
                 rv = rc;
             }
@@ -201,33 +418,20 @@ int RBDStreamHandleImpl::doUserReadRequest(UserReadRequest *ureq) {
     return rv;
 }
 
-int RBDStreamHandleImpl::doUserWriteRequest(UserWriteRequest *ureq) {
-    int ionum = 1;
-    uint64_t roff[2] = { 0, 0 };
-    uint32_t len[2] = { 0, 0 };
-    ExtentStreamHandlePtr handle[2];
-    int rv = splitUserRequest(ureq, roff, len, handle, ionum);
-    if (rv != common::CYPRE_OK) {
-        LOG(ERROR) << "splitUserRequest Failed, rv=" << rv
-                   << ", Blob:" << sopts_.blob_id
-                   << ", offset:" << ureq->logic_offset
-                   << ", len:" << ureq->logic_len;
-        delete ureq;
-        return rv;
-    }
+int RBDStreamHandleImpl::sendWriteRequests(UserWriteRequest *ureq, int ionum) {
+    int rv = common::CYPRE_OK;
+    const bool async = ureq->user_cb != NULL;
     ioInflight_.fetch_add(1, std::memory_order_release);
     ureq->ref = ionum;
-    if (ionum == 2) {
-        ureq->is_splited_ = true;
-    }
-    const void *buf = ureq->buf;
+    ureq->is_splited_ = ionum > 1;
+    uint64_t offset = ureq->logic_offset;
+    const uint64_t end = offset + ureq->logic_len;
+    const char *buf = static_cast<const char *>(ureq->buf);
     for (int i = 0; i < ionum; i++) {
-        // TODO(zhangliang): use pool
-        WriteRequest *req = new WriteRequest();
-        req->handle = handle[i];
+        WriteRequest *req = WriteRequest::Get();
+        req->real_len = splitLength(offset, end);
+        req->handle = splitHandle(offset, &req->real_offset);
         req->buf = buf;
-        req->real_len = len[i];
-        req->real_offset = roff[i];
         req->ureq = ureq;
         req->header_crc32_ = ureq->header_crc32_;
         if (ureq->is_splited_) {
@@ -235,17 +439,25 @@ int RBDStreamHandleImpl::doUserWriteRequest(UserWriteRequest *ureq) {
         } else {
             req->data_crc32_ = ureq->data_crc32_;
         }
-        buf = (const char *)buf + len[i];
-        google::protobuf::Closure *cb =
-                brpc::NewCallback(this, &RBDStreamHandleImpl::onWriteDone, req);
-        if (likely(ureq->user_cb != NULL)) {
-            int rc = handle[i]->AsyncWrite(req, cb);
+        buf += req->real_len;
+        offset += req->real_len;
+        req->done.Set(&RBDStreamHandleImpl::writeDone, this, req);
+        google::protobuf::Closure *cb = &req->done;
+        if (unlikely(req->handle.get() == nullptr)) {
+            req->status = common::CYPRE_C_INTERNAL_ERROR;
+            if (!async) {
+                rv = req->status;
+            }
+            cb->Run();
+        } else if (likely(async)) {
+            // errors after this point are reported by the callback only
+            int rc = req->handle->AsyncWrite(req, cb);
             if (rc != common::CYPRE_OK) {
-                rv = rc;
+                req->status = rc;
                 cb->Run();
             }
         } else {  // sync mode
-            int rc = handle[i]->AsyncWrite(req, NULL);
+            int rc = req->handle->AsyncWrite(req, NULL);
             if (rc != common::CYPRE_OK) {
                 rv = rc;
             }
@@ -255,6 +467,14 @@ int RBDStreamHandleImpl::doUserWriteRequest(UserWriteRequest *ureq) {
     return rv;
 }
 
+void RBDStreamHandleImpl::readDone(void *ctx, ReadRequest *req) {
+    static_cast<RBDStreamHandleImpl *>(ctx)->onReadDone(req);
+}
+
+void RBDStreamHandleImpl::writeDone(void *ctx, WriteRequest *req) {
+    static_cast<RBDStreamHandleImpl *>(ctx)->onWriteDone(req);
+}
+
 void RBDStreamHandleImpl::onReadDone(ReadRequest *req) {
     UserReadRequest *ureq = req->ureq;
     if (req->status == common::CYPRE_OK  && req->has_data_crc32_) {
@@ -272,7 +492,7 @@ void RBDStreamHandleImpl::onReadDone(ReadRequest *req) {
     if (req->status != common::CYPRE_OK && ureq->status == common::CYPRE_OK) {
         ureq->status = req->status;
     }
-    delete req;
+    ReadRequest::Put(req);
     if (--ureq->ref > 0) {
         return;
     }
@@ -280,7 +500,7 @@ void RBDStreamHandleImpl::onReadDone(ReadRequest *req) {
         ureq->user_cb(ureq->status, ureq->user_ctx);
     }
     ioInflight_.fetch_sub(1, std::memory_order_release);
-    delete ureq;
+    UserReadRequest::Put(ureq);
 }
 
 void RBDStreamHandleImpl::onWriteDone(WriteRequest *req) {
@@ -288,7 +508,7 @@ void RBDStreamHandleImpl::onWriteDone(WriteRequest *req) {
     if (req->status != common::CYPRE_OK && ureq->status == common::CYPRE_OK) {
         ureq->status = req->status;
     }
-    delete req;
+    WriteRequest::Put(req);
     if (--ureq->ref > 0) {
         return;
     }
@@ -296,10 +516,11 @@ void RBDStreamHandleImpl::onWriteDone(WriteRequest *req) {
         ureq->user_cb(ureq->status, ureq->user_ctx);
     }
     ioInflight_.fetch_sub(1, std::memory_order_release);
-    delete ureq;
+    UserWriteRequest::Put(ureq);
 }
 
 int RBDStreamHandleImpl::SetExtentIoProto(ExtentIoProtocol esio) {
+    common::WriteLock lock(handleLock_);
     if (esio_proto_ == esio) {
         return common::CYPRE_OK;
     }
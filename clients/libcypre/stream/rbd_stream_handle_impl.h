@@ -12,6 +12,7 @@
 #include <unordered_map>
 
 #include "common/connection_pool.h"
+#include "common/rwlock.h"
 //#include "concurrency/io_concurrency.h"
 #include "stream/extent_stream_handle.h"
 #include "stream/rbd_stream_handle.h"
@@ -20,6 +21,7 @@ namespace cyprestore {
 namespace clients {
 
 class BrpcSenderWorker;
+class ReplicaSelector;
 struct RBDStreamOptions {
     RBDStreamOptions(
             const std::string &id, const std::string &name,
@@ -27,10 +29,14 @@ struct RBDStreamOptions {
             uint64_t bs)
             : blob_id(id), blob_name(name), pool_id(pool), user_id(user),
               extent_size(es), blob_size(bs), max_iosize(1024 * 1024 * 16),
-              optimal_iosize(0), conn_pool(NULL), brpc_sender(NULL) {}
+              optimal_iosize(0), star_replication(false), write_quorum(0),
+              secondary_reads(false), conn_pool(NULL), brpc_sender(NULL),
+              replica_selector(NULL) {}
     RBDStreamOptions()
             : extent_size(0), blob_size(0), max_iosize(1024 * 1024 * 16),
-              optimal_iosize(0), conn_pool(NULL), brpc_sender(NULL) {}
+              optimal_iosize(0), star_replication(false), write_quorum(0),
+              secondary_reads(false), conn_pool(NULL), brpc_sender(NULL),
+              replica_selector(NULL) {}
 
     std::string blob_id;    // blob id
     std::string blob_name;  // blob name
@@ -40,10 +46,18 @@ struct RBDStreamOptions {
     mutable uint64_t blob_size;  // blob size
     mutable uint64_t max_iosize;
     mutable uint64_t optimal_iosize;
+    // writes go to every replica from here, done on write_quorum copies
+    bool star_replication;
+    int write_quorum;
+    // reads go to the least loaded replica, see ReplicaSelector
+    bool secondary_reads;
     //
     mutable std::shared_ptr<common::ConnectionPool2> conn_pool;
     mutable common::ExtentRouterMgrPtr extent_router_mgr;
+    // routers of this blob, shared with other handles of it
+    common::BlobRouterCachePtr blob_routers;
     BrpcSenderWorker *brpc_sender;
+    ReplicaSelector *replica_selector;
 };
 
 class RBDStreamHandleImpl : public RBDStreamHandle {
@@ -59,6 +73,9 @@ public:
     virtual int AsyncWrite(
             const void *buf, uint32_t len, uint64_t offset,
             io_completion_cb callback, void *ctx);
+    virtual int AsyncDiscard(
+            uint64_t offset, uint64_t len, io_completion_cb callback,
+            void *ctx);
 
     virtual int Read(void *buf, uint32_t len, uint64_t offset);
     virtual int Write(const void *buf, uint32_t len, uint64_t offset);
@@ -99,20 +116,40 @@ private:
 
     inline ExtentStreamHandlePtr GetExtentStreamHandle(uint64_t index);
 
-    int splitUserRequest(
-            const UserIoRequest *ureq, uint64_t roff[2], uint32_t len[2],
-            ExtentStreamHandlePtr handle[2], int &size);
+    // a discard goes to each es holding a primary of its extents in one
+    // rpc (every replica with star replication), see sendDiscardRequests
+    struct UserDiscardRequest;
+    struct DiscardCall;
+    int sendDiscardRequests(
+            UserDiscardRequest *ureq, uint64_t offset, uint64_t end);
+    static void discardDone(DiscardCall *call);
+    void onDiscardDone(UserDiscardRequest *ureq, int status);
+
+    // A user io is split at extent boundaries and at multiples of optimal
+    // io size (max io size if not set), sub requests go out in parallel.
+    // length of the sub request at offset of an io ending at end
+    uint32_t splitLength(uint64_t offset, uint64_t end) const;
+    int countSplits(const UserIoRequest *ureq) const;
+    // handle of extent holding offset, roff is the offset in extent
+    ExtentStreamHandlePtr splitHandle(uint64_t offset, uint32_t *roff);
 
     int doUserReadRequest(UserReadRequest *ureq);
     int doUserWriteRequest(UserWriteRequest *ureq);
+    int sendReadRequests(UserReadRequest *ureq, int ionum);
+    int sendWriteRequests(UserWriteRequest *ureq, int ionum);
 
+    // done closures of pooled requests
+    static void readDone(void *ctx, ReadRequest *req);
+    static void writeDone(void *ctx, WriteRequest *req);
     void onReadDone(ReadRequest *req);
     void onWriteDone(WriteRequest *req);
 
     const RBDStreamOptions sopts_;
+    // io of a handle comes from many threads, io callbacks included
+    common::RWLock handleLock_;
     std::unordered_map<uint64_t, ExtentStreamHandlePtr> handleMap_;
     // IoConcurrency concurrency_;
-    ExtentIoProtocol esio_proto_;
+    std::atomic<ExtentIoProtocol> esio_proto_;
     std::atomic<int64_t> ioInflight_;
     std::atomic<bool> isClosed_;
 };
@@ -0,0 +1,89 @@
+
+/*
+ * Copyright 2021 JDD authors.
+ * @zhangliang
+ */
+
+#include "stream/replica_selector.h"
+
+#include <algorithm>
+
+namespace cyprestore {
+namespace clients {
+
+// a failed read weighs like a read this slow
+const int64_t kFailurePenaltyUs = 1000 * 1000;
+const int64_t kMinHedgeDelayUs = 200;
+
+ReplicaSelector::EsLoad *ReplicaSelector::getLoad(int es_id) {
+    {
+        common::ReadLock lock(lock_);
+        auto it = loads_.find(es_id);
+        if (it != loads_.end()) return it->second.get();
+    }
+
+    common::WriteLock lock(lock_);
+    std::unique_ptr<EsLoad> &load = loads_[es_id];
+    if (!load) {
+        load.reset(new EsLoad());
+    }
+    return load.get();
+}
+
+int ReplicaSelector::Rank(
+        const common::ExtentRouterPtr &router,
+        const common::ESInstance *ranked[kMaxReadReplicas]) {
+    int64_t scores[kMaxReadReplicas];
+    int num = 0;
+    int num_replicas = 1 + static_cast<int>(router->secondaries.size());
+    for (int i = 0; i < num_replicas && num < kMaxReadReplicas; ++i) {
+        const common::ESInstance *es =
+                i == 0 ? &router->primary : &router->secondaries[i - 1];
+        EsLoad *load = getLoad(es->es_id);
+        int64_t score = load->ewma_us.load(std::memory_order_relaxed)
+                        * (load->inflight.load(std::memory_order_relaxed) + 1);
+        // insertion sort, a handful of replicas; ties keep primary first
+        int pos = num++;
+        while (pos > 0 && scores[pos - 1] > score) {
+            scores[pos] = scores[pos - 1];
+            ranked[pos] = ranked[pos - 1];
+            --pos;
+        }
+        scores[pos] = score;
+        ranked[pos] = es;
+    }
+    return num;
+}
+
+void ReplicaSelector::OnStart(int es_id) {
+    getLoad(es_id)->inflight.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ReplicaSelector::OnDone(int es_id, int64_t latency_us, bool success) {
+    EsLoad *load = getLoad(es_id);
+    load->inflight.fetch_sub(1, std::memory_order_relaxed);
+    if (success) {
+        read_latency_ << latency_us;
+    } else {
+        latency_us = std::max(latency_us, kFailurePenaltyUs);
+    }
+
+    // ewma with weight 1/8, racing updates may drop a sample
+    int64_t ewma = load->ewma_us.load(std::memory_order_relaxed);
+    ewma = ewma == 0 ? latency_us : ewma + (latency_us - ewma) / 8;
+    load->ewma_us.store(std::max(ewma, (int64_t)1), std::memory_order_relaxed);
+}
+
+int64_t ReplicaSelector::HedgeDelayUs() {
+    if (hedge_percentile_ <= 0 || hedge_percentile_ >= 1) {
+        return 0;
+    }
+    int64_t delay = read_latency_.latency_percentile(hedge_percentile_);
+    if (delay <= 0) {
+        return 0;
+    }
+    return std::max(delay, kMinHedgeDelayUs);
+}
+
+}  // namespace clients
+}  // namespace cyprestore
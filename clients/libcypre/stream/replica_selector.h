@@ -0,0 +1,62 @@
+
+/*
+ * Copyright 2021 JDD authors.
+ * @zhangliang
+ */
+
+#ifndef CYPRESTORE_CLIENTS_STREAM_REPLICA_SELECTOR_H_
+#define CYPRESTORE_CLIENTS_STREAM_REPLICA_SELECTOR_H_
+
+#include <bvar/bvar.h>
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+#include "common/extent_router.h"
+#include "common/rwlock.h"
+
+namespace cyprestore {
+namespace clients {
+
+const int kMaxReadReplicas = 8;
+
+// Load of every es seen by reads of a cluster, shared by all handles.
+// Replicas are ranked by latency EWMA times (outstanding reads + 1), an
+// es without samples ranks first so new replicas get tried.
+class ReplicaSelector {
+public:
+    // hedge_percentile in (0, 1) hedges reads slower than that percentile
+    // of recent reads, 0 disables hedging
+    explicit ReplicaSelector(double hedge_percentile)
+            : hedge_percentile_(hedge_percentile),
+              read_latency_("cypre_replica_read") {}
+    ~ReplicaSelector() = default;
+
+    // replicas of router, best first. returns the number ranked
+    int Rank(
+            const common::ExtentRouterPtr &router,
+            const common::ESInstance *ranked[kMaxReadReplicas]);
+    void OnStart(int es_id);
+    void OnDone(int es_id, int64_t latency_us, bool success);
+    // 0 if reads aren't hedged or there are no samples yet
+    int64_t HedgeDelayUs();
+
+private:
+    struct EsLoad {
+        EsLoad() : inflight(0), ewma_us(0) {}
+        std::atomic<int> inflight;
+        std::atomic<int64_t> ewma_us;
+    };
+
+    EsLoad *getLoad(int es_id);
+
+    const double hedge_percentile_;
+    bvar::LatencyRecorder read_latency_;
+    std::unordered_map<int, std::unique_ptr<EsLoad>> loads_;
+    common::RWLock lock_;
+};
+
+}  // namespace clients
+}  // namespace cyprestore
+#endif  // CYPRESTORE_CLIENTS_STREAM_REPLICA_SELECTOR_H_
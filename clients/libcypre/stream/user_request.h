@@ -7,6 +7,8 @@
 #ifndef CYPRESTORE_CLIENTS_STREAM_USER_REQUEST_H_
 #define CYPRESTORE_CLIENTS_STREAM_USER_REQUEST_H_
 
+#include <butil/object_pool.h>
+
 #include <atomic>
 #include <memory>
 #include <string>
@@ -30,6 +32,13 @@ public:
     StreamIoType GetIoType() const {
         return type;
     }
+    void Reset() {
+        is_splited_ = false;
+        user_cb = NULL;
+        user_ctx = NULL;
+        status = common::CYPRE_OK;
+        ref = 0;
+    }
 
     bool is_splited_;
     io_completion_cb user_cb;
@@ -50,6 +59,12 @@ public:
         header.append(std::to_string(logic_offset));
         header_crc32_ = utils::Crc32::Checksum(header);
     }
+    void Reset() {
+        UserRequest::Reset();
+        header_crc32_ = 0;
+        logic_len = 0;
+        logic_offset = 0;
+    }
 
     uint32_t header_crc32_;
     uint32_t logic_len;
@@ -59,6 +74,16 @@ public:
 class UserWriteRequest : public UserIoRequest {
 public:
     UserWriteRequest() : UserIoRequest(kWrite), buf(NULL), data_crc32_(0) {}
+    // recycled through butil object pool, one per user io
+    static UserWriteRequest *Get() {
+        return butil::get_object<UserWriteRequest>();
+    }
+    static void Put(UserWriteRequest *req) {
+        req->Reset();
+        req->buf = NULL;
+        req->data_crc32_ = 0;
+        butil::return_object(req);
+    }
     const void *buf;
     uint32_t data_crc32_;
 };
@@ -66,6 +91,14 @@ public:
 class UserReadRequest : public UserIoRequest {
 public:
     UserReadRequest() : UserIoRequest(kRead), buf(NULL) {}
+    static UserReadRequest *Get() {
+        return butil::get_object<UserReadRequest>();
+    }
+    static void Put(UserReadRequest *req) {
+        req->Reset();
+        req->buf = NULL;
+        butil::return_object(req);
+    }
     void *buf;
 };
 
@@ -6,8 +6,15 @@
 
 #include "stream/ystream_handle.h"
 
+#include <brpc/callback.h>
 #include <brpc/channel.h>
+#include <bthread/countdown_event.h>
+#include <bthread/unstable.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
 
+#include <atomic>
+#include <cstring>
 #include <memory>
 
 #include "common/builtin.h"
@@ -15,10 +22,232 @@
 #include "extentmanager/pb/resource.pb.h"
 #include "stream/brpc_es_wrapper.h"
 #include "stream/rbd_stream_handle_impl.h"
+#include "stream/replica_selector.h"
 
 namespace cyprestore {
 namespace clients {
 
+bvar::Adder<int64_t> g_star_write_missed("cypre_star_write_missed");
+bvar::Adder<int64_t> g_hedged_reads("cypre_hedged_reads");
+
+namespace {
+
+// One read of a secondary_reads blob. It goes to the best ranked replica,
+// a failure moves on to the next one right away. If hedging is on, a copy
+// goes to the next replica once the read is slower than the hedge delay.
+// Copies share the user buffer, the first to succeed claims and fills it.
+// req may be recycled once replied while copies are still out, so what
+// copies need of it is kept here.
+struct ReplicaRead {
+    ReplicaRead(
+            ReadRequest *r, google::protobuf::Closure *cb,
+            const common::ExtentRouterPtr &rt, ReplicaSelector *sel,
+            EsWrapper *wrapper)
+            : req(r), callback(cb), sync_done(NULL), buf(r->buf),
+              header_crc32(r->header_crc32_), real_offset(r->real_offset),
+              real_len(r->real_len), ureq(r->ureq), router(rt),
+              selector(sel), es_wrapper(wrapper), num_ranked(0), next(0),
+              buf_claim(false), status(common::CYPRE_C_INTERNAL_ERROR),
+              refs(1), decided(false), timer_armed(false) {}
+
+    static void OnAttemptDone(
+            ReplicaRead *read, ReadRequest *copy, int es_id,
+            int64_t start_us);
+    static void OnHedge(void *arg);
+    // read next ranked replica if any is left
+    void launch();
+    void cancelHedge();
+    void reply(int rc);
+    void unref();
+
+    ReadRequest *req;
+    google::protobuf::Closure *callback;
+    bthread::CountdownEvent *sync_done;
+    void *buf;
+    const uint32_t header_crc32;
+    const uint32_t real_offset;
+    const uint32_t real_len;
+    UserReadRequest *ureq;
+    common::ExtentRouterPtr router;  // holds ranked replicas
+    ReplicaSelector *selector;
+    EsWrapper *es_wrapper;
+    const common::ESInstance *ranked[kMaxReadReplicas];
+    int num_ranked;
+    std::atomic<int> next;
+    std::atomic<bool> buf_claim;
+    std::atomic<int> status;  // last failure
+    std::atomic<int> refs;    // attempts, armed timer and launcher
+    std::atomic<bool> decided;
+    std::atomic<bool> timer_armed;
+    bthread_timer_t hedge_timer;
+};
+
+void ReplicaRead::launch() {
+    int i = next.fetch_add(1);
+    if (i >= num_ranked) return;
+
+    const common::ESInstance *es = ranked[i];
+    ReadRequest *copy = ReadRequest::Get();
+    copy->buf = buf;
+    copy->header_crc32_ = header_crc32;
+    copy->allow_secondary = es != &router->primary;
+    copy->buf_claim = &buf_claim;
+    copy->real_offset = real_offset;
+    copy->real_len = real_len;
+    copy->ureq = ureq;
+    refs.fetch_add(1);
+    selector->OnStart(es->es_id);
+    google::protobuf::Closure *cb = brpc::NewCallback(
+            &ReplicaRead::OnAttemptDone, this, copy, es->es_id,
+            butil::cpuwide_time_us());
+    int rc = es_wrapper->AsyncRead(*es, copy, cb);
+    if (rc != common::CYPRE_OK) {
+        cb->Run();
+    }
+}
+
+void ReplicaRead::OnAttemptDone(
+        ReplicaRead *read, ReadRequest *copy, int es_id, int64_t start_us) {
+    int rc = copy->status;
+    read->selector->OnDone(
+            es_id, butil::cpuwide_time_us() - start_us,
+            rc == common::CYPRE_OK || rc == common::CYPRE_C_READ_OVERTAKEN);
+    if (rc == common::CYPRE_OK) {
+        // buffer is claimed, no other copy decides, req is not replied yet
+        read->decided = true;
+        read->cancelHedge();
+        read->req->data_crc32_ = copy->data_crc32_;
+        read->req->has_data_crc32_ = copy->has_data_crc32_;
+        read->reply(rc);
+    } else if (rc != common::CYPRE_C_READ_OVERTAKEN) {
+        read->status = rc;
+        if (!read->decided.load()) {
+            read->cancelHedge();
+            read->launch();
+        }
+    }
+    ReadRequest::Put(copy);
+    read->unref();
+}
+
+void ReplicaRead::OnHedge(void *arg) {
+    ReplicaRead *read = static_cast<ReplicaRead *>(arg);
+    if (read->timer_armed.exchange(false) && !read->decided.load()) {
+        g_hedged_reads << 1;
+        read->launch();
+    }
+    read->unref();
+}
+
+void ReplicaRead::cancelHedge() {
+    // a running timer unrefs on its own
+    if (timer_armed.exchange(false) && bthread_timer_del(hedge_timer) == 0) {
+        unref();
+    }
+}
+
+void ReplicaRead::reply(int rc) {
+    req->status = rc;
+    req->is_done = true;
+    if (callback != NULL) {
+        callback->Run();
+    } else {
+        sync_done->signal();
+    }
+}
+
+void ReplicaRead::unref() {
+    if (refs.fetch_sub(1) != 1) return;
+    if (!decided.exchange(true)) {
+        reply(status.load());
+    }
+    delete this;
+}
+
+// One write of a star replication blob, sent to every replica of the
+// extent at once. It's done when the primary and write_quorum - 1 copies
+// in all have it, reads go to the primary and never miss an acked write.
+// Failure is only reported once every copy is back.
+struct StarWrite {
+    StarWrite(WriteRequest *r, google::protobuf::Closure *cb, int n, int q)
+            : req(r), callback(cb), sync_done(NULL), num_replicas(n),
+              quorum(q), data(NULL), status(common::CYPRE_OK),
+              primary_ok(false), acked(0), failed(0), unfinished(n),
+              decided(false) {
+        // stragglers outlive the user request, keep what they log
+        ureq.logic_offset = r->ureq->logic_offset;
+        ureq.logic_len = r->ureq->logic_len;
+        ureq.data_crc32_ = r->ureq->data_crc32_;
+    }
+    ~StarWrite() {
+        delete[] data;
+    }
+
+    static void OnReplicaDone(
+            StarWrite *write, WriteRequest *copy, bool is_primary);
+    void reply(int rc);
+
+    WriteRequest *req;
+    google::protobuf::Closure *callback;
+    bthread::CountdownEvent *sync_done;
+    const int num_replicas;
+    const int quorum;
+    char *data;  // copy of user data if done before every copy is back
+    UserWriteRequest ureq;
+    std::atomic<int> status;  // first failure
+    std::atomic<bool> primary_ok;
+    std::atomic<int> acked;  // by secondaries
+    std::atomic<int> failed;
+    std::atomic<int> unfinished;
+    std::atomic<bool> decided;
+};
+
+void StarWrite::reply(int rc) {
+    req->status = rc;
+    req->is_done = true;
+    if (callback != NULL) {
+        callback->Run();
+    } else {
+        sync_done->signal();
+    }
+}
+
+void StarWrite::OnReplicaDone(
+        StarWrite *write, WriteRequest *copy, bool is_primary) {
+    bool done = false;
+    if (copy->status != common::CYPRE_OK) {
+        int ok = common::CYPRE_OK;
+        write->status.compare_exchange_strong(ok, copy->status);
+        write->failed.fetch_add(1);
+    } else if (is_primary) {
+        write->primary_ok = true;
+        done = write->acked.load() >= write->quorum - 1;
+    } else {
+        done = write->acked.fetch_add(1) + 1 >= write->quorum - 1
+               && write->primary_ok.load();
+    }
+    if (done && !write->decided.exchange(true)) {
+        write->reply(common::CYPRE_OK);
+    }
+    WriteRequest::Put(copy);
+
+    if (write->unfinished.fetch_sub(1) != 1) return;
+    if (!write->decided.exchange(true)) {
+        write->reply(write->status.load());
+    } else if (write->failed.load() > 0) {
+        // acked without them, those replicas need repair
+        g_star_write_missed << write->failed.load();
+        LOG(ERROR) << "Replicas missed acked star write"
+                   << ", offset:" << write->ureq.logic_offset
+                   << ", len:" << write->ureq.logic_len
+                   << ", missed:" << write->failed.load()
+                   << ", rc:" << write->status.load();
+    }
+    delete write;
+}
+
+}  // namespace
+
 YStreamHandle::YStreamHandle(
         const RBDStreamOptions &sopt, const ExtentStreamOptions &eopt)
         : ExtentStreamHandle(sopt, eopt) {
@@ -35,11 +264,17 @@ int YStreamHandle::Close() {
     return common::CYPRE_OK;
 }
 
+common::ExtentRouterPtr YStreamHandle::queryRouter() {
+    if (sopts_.blob_routers) {
+        return sopts_.blob_routers->QueryRouter(eopts_.extent_idx);
+    }
+    return sopts_.extent_router_mgr->QueryRouter(eopts_.extent_id);
+}
+
 int YStreamHandle::AsyncRead(
         ReadRequest *req, google::protobuf::Closure *callback) {
     // get rpc channel
-    common::ExtentRouterPtr router =
-            sopts_.extent_router_mgr->QueryRouter(eopts_.extent_id);
+    common::ExtentRouterPtr router = queryRouter();
     if (unlikely(!router)) {
         LOG(ERROR) << "Couldn't get extent router"
                    << ", extent_id:" << eopts_.extent_id;
@@ -47,14 +282,51 @@ int YStreamHandle::AsyncRead(
         req->status = common::CYPRE_C_INTERNAL_ERROR;
         return req->status;
     }
-    return es_wrapper_->AsyncRead(router->primary, req, callback);
+    if (sopts_.secondary_reads && !router->secondaries.empty()) {
+        return replicaRead(router, req, callback);
+    }
+    return es_wrapper_.load()->AsyncRead(router->primary, req, callback);
+}
+
+int YStreamHandle::replicaRead(
+        const common::ExtentRouterPtr &router, ReadRequest *req,
+        google::protobuf::Closure *callback) {
+    ReplicaSelector *selector = sopts_.replica_selector;
+    ReplicaRead *read = new ReplicaRead(
+            req, callback, router, selector, es_wrapper_.load());
+    bthread::CountdownEvent sync_done(1);
+    if (callback == NULL) {
+        read->sync_done = &sync_done;
+    }
+    read->num_ranked = selector->Rank(router, read->ranked);
+
+    int64_t hedge_delay_us = selector->HedgeDelayUs();
+    if (hedge_delay_us > 0) {
+        read->refs.fetch_add(1);
+        read->timer_armed = true;
+        if (bthread_timer_add(
+                    &read->hedge_timer,
+                    butil::microseconds_from_now(hedge_delay_us),
+                    ReplicaRead::OnHedge, read)
+            != 0) {
+            read->timer_armed = false;
+            read->refs.fetch_sub(1);
+        }
+    }
+    read->launch();
+    read->unref();
+
+    if (callback == NULL) {
+        sync_done.wait();
+        return req->status;
+    }
+    return common::CYPRE_OK;
 }
 
 int YStreamHandle::AsyncWrite(
         WriteRequest *req, google::protobuf::Closure *callback) {
     // get rpc channel
-    common::ExtentRouterPtr router =
-            sopts_.extent_router_mgr->QueryRouter(eopts_.extent_id);
+    common::ExtentRouterPtr router = queryRouter();
     if (unlikely(!router)) {
         LOG(ERROR) << "Couldn't get extent router"
                    << ", extent_id:" << eopts_.extent_id;
@@ -62,7 +334,57 @@ int YStreamHandle::AsyncWrite(
         req->status = common::CYPRE_C_INTERNAL_ERROR;
         return req->status;
     }
-    return es_wrapper_->AsyncWrite(router->primary, req, callback);
+    if (sopts_.star_replication && !router->secondaries.empty()) {
+        return starWrite(router, req, callback);
+    }
+    return es_wrapper_.load()->AsyncWrite(router->primary, req, callback);
+}
+
+int YStreamHandle::starWrite(
+        const common::ExtentRouterPtr &router, WriteRequest *req,
+        google::protobuf::Closure *callback) {
+    int num_replicas = 1 + router->secondaries.size();
+    int quorum = sopts_.write_quorum;
+    if (quorum <= 0 || quorum > num_replicas) {
+        quorum = num_replicas;
+    }
+    StarWrite *write = new StarWrite(req, callback, num_replicas, quorum);
+    bthread::CountdownEvent sync_done(1);
+    if (callback == NULL) {
+        write->sync_done = &sync_done;
+    }
+    EsWrapper *es_wrapper = es_wrapper_.load();
+    const void *buf = req->buf;
+    if (quorum < num_replicas) {
+        write->data = new char[req->real_len];
+        memcpy(write->data, req->buf, req->real_len);
+        buf = write->data;
+    }
+
+    for (int i = 0; i < num_replicas; ++i) {
+        const common::ESInstance &es =
+                i == 0 ? router->primary : router->secondaries[i - 1];
+        WriteRequest *copy = WriteRequest::Get();
+        copy->buf = buf;
+        copy->data_crc32_ = req->data_crc32_;
+        copy->header_crc32_ = req->header_crc32_;
+        copy->client_replicated = true;
+        copy->real_offset = req->real_offset;
+        copy->real_len = req->real_len;
+        copy->ureq = &write->ureq;
+        google::protobuf::Closure *cb = brpc::NewCallback(
+                &StarWrite::OnReplicaDone, write, copy, i == 0);
+        int rc = es_wrapper->AsyncWrite(es, copy, cb);
+        if (rc != common::CYPRE_OK) {
+            cb->Run();
+        }
+    }
+
+    if (callback == NULL) {
+        sync_done.wait();
+        return req->status;
+    }
+    return common::CYPRE_OK;
 }
 
 int YStreamHandle::SetExtentIoProto(ExtentIoProtocol esio) {
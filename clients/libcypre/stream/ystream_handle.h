@@ -9,6 +9,7 @@
 
 #include <brpc/channel.h>
 
+#include <atomic>
 #include <memory>
 
 #include "stream/es_wrapper.h"
@@ -40,7 +41,18 @@ public:
     virtual int SetExtentIoProto(ExtentIoProtocol esio);
 
 private:
-    EsWrapper *es_wrapper_;
+    common::ExtentRouterPtr queryRouter();
+    // read the best ranked replica, see secondary_reads
+    int replicaRead(
+            const common::ExtentRouterPtr &router, ReadRequest *req,
+            google::protobuf::Closure *callback);
+    // write every replica in parallel, see star_replication
+    int starWrite(
+            const common::ExtentRouterPtr &router, WriteRequest *req,
+            google::protobuf::Closure *callback);
+
+    // switched while io of other threads goes on
+    std::atomic<EsWrapper *> es_wrapper_;
     EsWrapper *brpc_es_wrapper_;
     EsWrapper *null_es_wrapper_;
 };
@@ -500,6 +500,74 @@ TEST_F(MockTest, TestBrpcIoLatencySync) {
     rbd_->Close(handle);
 }
 
+TEST_F(MockTest, TestIoAcrossManyExtents) {
+    const int ESIZE = 1024 * 1024 * 2;
+    GlobalConfig::Instance()->SetExtentSize(ESIZE);
+    const uint64_t DEVICE_SIZE = 16 * ESIZE;
+    RBDStreamHandlePtr handle;
+    int rv = prepareForLatencyTest(DEVICE_SIZE, 9435, "mblob1", false, handle);
+    ASSERT_TRUE(rv == 0);
+    // from the tail of extent 1 to the head of extent 6
+    const uint64_t offset = ESIZE - 4096;
+    const uint32_t len = 4 * ESIZE + 8192;
+    char *wbuf = new char[len];
+    for (uint32_t i = 0; i < len; i++) {
+        wbuf[i] = rand() % 26 + 'a';
+    }
+    rv = handle->Write(wbuf, len, offset);
+    ASSERT_EQ(rv, 0);
+    char *rbuf = new char[len];
+    rv = handle->Read(rbuf, len, offset);
+    ASSERT_EQ(rv, 0);
+    ASSERT_EQ(memcmp(wbuf, rbuf, len), 0);
+    // async too, completes once every extent is read
+    memset(rbuf, 0, len);
+    brpc_ctx_t bctx(1);
+    bctx.inflight++;
+    rv = handle->AsyncRead(rbuf, len, offset, brpc_io_cb, &bctx);
+    ASSERT_EQ(rv, 0);
+    while (bctx.fini < 1) usleep(1000);
+    ASSERT_EQ(memcmp(wbuf, rbuf, len), 0);
+    delete[] wbuf;
+    delete[] rbuf;
+    rbd_->Close(handle);
+}
+
+TEST_F(MockTest, TestDiscard) {
+    const int ESIZE = 1024 * 1024 * 2;
+    GlobalConfig::Instance()->SetExtentSize(ESIZE);
+    const uint64_t DEVICE_SIZE = 8 * ESIZE;
+    RBDStreamHandlePtr handle;
+    int rv = prepareForLatencyTest(DEVICE_SIZE, 9535, "mblob2", false, handle);
+    ASSERT_TRUE(rv == 0);
+    const uint32_t len = 3 * ESIZE;
+    char *wbuf = new char[len];
+    for (uint32_t i = 0; i < len; i++) {
+        wbuf[i] = rand() % 26 + 'a';
+    }
+    rv = handle->Write(wbuf, len, 0);
+    ASSERT_EQ(rv, 0);
+    // unaligned head and tail are kept, extent 2 is discarded whole
+    const uint64_t offset = ESIZE - 8192 - 100;
+    const uint64_t dlen = ESIZE + 16384 + 200;
+    rv = handle->AsyncDiscard(offset, dlen, NULL, NULL);
+    ASSERT_EQ(rv, 0);
+    memset(wbuf + ESIZE - 8192, 0, ESIZE + 16384);
+    char *rbuf = new char[len];
+    rv = handle->Read(rbuf, len, 0);
+    ASSERT_EQ(rv, 0);
+    ASSERT_EQ(memcmp(wbuf, rbuf, len), 0);
+    // async, a range of nothing written completes too
+    brpc_ctx_t bctx(1);
+    bctx.inflight++;
+    rv = handle->AsyncDiscard(len, ESIZE, brpc_io_cb, &bctx);
+    ASSERT_EQ(rv, 0);
+    while (bctx.fini < 1) usleep(1000);
+    delete[] wbuf;
+    delete[] rbuf;
+    rbd_->Close(handle);
+}
+
 TEST_F(MockTest, TestNullIoLatency) {
     const int BS = 4096;
     const uint64_t DEVICE_SIZE = 128 * 1024 * 1024;
@@ -8,6 +8,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <atomic>
+
 #include "bvar/bvar.h"
 #include "common/error_code.h"
 #include "config.h"
@@ -23,6 +25,18 @@ bvar::LatencyRecorder g_latency_cypre_nbd_write("cypre_nbd_write");
 bvar::LatencyRecorder g_latency_cypre_nbd_submit("cypre_nbd_submit");
 extern std::shared_ptr<NBDConfig> g_nbd_config;
 
+// 非对齐写的读-改-写上下文
+struct RMWContext {
+    BlobInstance *blob = nullptr;
+    IOContext *ctx = nullptr;
+    // 对齐后的缓冲区，读入首尾块后合并写数据
+    IOBuf buf;
+    // 未完成的读，外加提交者持有的一个
+    std::atomic<int> pending;
+    // 第一个失败的读的返回值
+    std::atomic<int> ret;
+};
+
 BlobInstance::BlobInstance(
         const std::string &em_ip, int em_port, clients::CypreRBD *cyprerbd) {
     fd_ = -1;
@@ -31,6 +45,7 @@ BlobInstance::BlobInstance(
     extent_manager_ip_ = em_ip;
     extent_manager_port_ = em_port;
     cyprerbd_ = cyprerbd;
+    range_lock_ = std::make_shared<RangeLock>();
 }
 
 BlobInstance::~BlobInstance() {
@@ -103,8 +118,10 @@ bool BlobInstance::Read(IOContext *ctx) {
         auto align_offset = ctx->align_offset;
         auto align_length = ctx->align_length;
 
-        ctx->data.reset(new char[sizeof(nbd_reply) + align_length]);
-        char *buf = ctx->data.get() + sizeof(nbd_reply);
+        if (!ctx->data.alloc(align_length)) {
+            return false;
+        }
+        char *buf = ctx->data.get();
 
         if (g_nbd_config->nullio) {
             // 开始计时
@@ -146,39 +163,11 @@ bool BlobInstance::Write(IOContext *ctx, bool flush) {
         auto align_offset = ctx->align_offset;
         auto align_length = ctx->align_length;
 
-        char *buf = NULL;
         if (offyu > 0 || length != align_length) {
-            buf = new char[align_length];
-
-            // read head
-            int readlen = CYPRE_BLOCK_SIZE;
-            if (align_length < 65536) readlen = align_length;
-            int ret = handle_->Read(buf, readlen, align_offset);
-            if (ret <= 0) {
-                LOG(ERROR) << "BlobInstance::pread failed offset="
-                           << align_offset << ", len=" << readlen
-                           << ", ret=" << ret;
-                return false;
-            }
-
-            if ((unsigned int)ret < align_length && lenyu > 0) {  // read tail
-                char *endbuf = buf + align_length - CYPRE_BLOCK_SIZE;
-                uint64_t endoffset = align_offset + align_length - CYPRE_BLOCK_SIZE;
-                ret = handle_->Read(endbuf, CYPRE_BLOCK_SIZE, endoffset);
-                if (ret <= 0) {
-                    LOG(ERROR)
-                            << "BlobInstance::pread failed offset=" << endoffset
-                            << ", len=" << CYPRE_BLOCK_SIZE << ", ret=" << ret;
-                    return false;
-                }
-            }
-
-            char *oldbuf = ctx->data.get();
-            memcpy(buf + offyu, oldbuf, length);
-            ctx->data.reset(buf);
+            return StartRMW(ctx);
         }
 
-        buf = ctx->data.get();
+        char *buf = ctx->data.get();
 
         if (g_nbd_config->nullio) {
             // 开始计时
@@ -203,9 +192,116 @@ bool BlobInstance::Write(IOContext *ctx, bool flush) {
     }
 }
 
-void BlobInstance::Trim(IOContext *ctx) {
-    ctx->ret = 0;
-    ctx->cb(0, ctx);
+bool BlobInstance::StartRMW(IOContext *ctx) {
+    RMWContext *rmw = new RMWContext();
+    rmw->blob = this;
+    rmw->ctx = ctx;
+    rmw->pending = 0;
+    rmw->ret = 0;
+    if (!rmw->buf.alloc(ctx->align_length)) {
+        delete rmw;
+        return false;
+    }
+
+    // 重叠的非对齐写依次执行，不阻塞当前线程
+    range_lock_->Lock(ctx->align_offset, ctx->align_length, RMWLocked, rmw);
+    return true;
+}
+
+void BlobInstance::RMWLocked(void *arg) {
+    RMWContext *rmw = static_cast<RMWContext *>(arg);
+    BlobInstance *blob = rmw->blob;
+    IOContext *ctx = rmw->ctx;
+    uint64_t head = ctx->align_offset;
+    uint64_t tail = ctx->align_offset + ctx->align_length - CYPRE_BLOCK_SIZE;
+    uint64_t end = ctx->request.from + ctx->request.len;
+    bool read_head = ctx->request.from % CYPRE_BLOCK_SIZE != 0;
+    bool read_tail = end % CYPRE_BLOCK_SIZE != 0
+                     && !(read_head && tail == head);
+
+    // 首尾块并行读取，提交失败的读不会回调
+    rmw->pending = 1;
+    int ret = 0;
+    if (read_head) {
+        rmw->pending++;
+        ret = blob->handle_->AsyncRead(
+                rmw->buf.get(), CYPRE_BLOCK_SIZE, head, RMWReadDone, rmw);
+        if (ret != 0) {
+            rmw->pending--;
+        }
+    }
+    if (ret == 0 && read_tail) {
+        rmw->pending++;
+        ret = blob->handle_->AsyncRead(
+                rmw->buf.get() + ctx->align_length - CYPRE_BLOCK_SIZE,
+                CYPRE_BLOCK_SIZE, tail, RMWReadDone, rmw);
+        if (ret != 0) {
+            rmw->pending--;
+        }
+    }
+    RMWReadDone(ret, rmw);
+}
+
+void BlobInstance::RMWReadDone(int rc, void *arg) {
+    RMWContext *rmw = static_cast<RMWContext *>(arg);
+    if (rc != 0) {
+        int expected = 0;
+        rmw->ret.compare_exchange_strong(expected, rc);
+    }
+    if (--rmw->pending > 0) {
+        return;
+    }
+
+    BlobInstance *blob = rmw->blob;
+    IOContext *ctx = rmw->ctx;
+    if (rmw->ret != 0) {
+        LOG(ERROR) << "BlobInstance::RMW read failed offset="
+                   << ctx->align_offset << ", len=" << ctx->align_length
+                   << ", ret=" << rmw->ret;
+        blob->FinishRMW(rmw, rmw->ret);
+        return;
+    }
+
+    int offyu = ctx->request.from % CYPRE_BLOCK_SIZE;
+    memcpy(rmw->buf.get() + offyu, ctx->data.get(), ctx->request.len);
+    ctx->data.swap(rmw->buf);
+    int ret = blob->handle_->AsyncWrite(
+            ctx->data.get(), ctx->align_length, ctx->align_offset,
+            RMWWriteDone, rmw);
+    if (ret != 0) {
+        LOG(ERROR) << "BlobInstance::RMW write failed offset="
+                   << ctx->align_offset << ", len=" << ctx->align_length
+                   << ", ret=" << ret;
+        blob->FinishRMW(rmw, ret);
+    }
+}
+
+void BlobInstance::RMWWriteDone(int rc, void *arg) {
+    RMWContext *rmw = static_cast<RMWContext *>(arg);
+    rmw->blob->FinishRMW(rmw, rc);
+}
+
+void BlobInstance::FinishRMW(RMWContext *rmw, int rc) {
+    IOContext *ctx = rmw->ctx;
+    delete rmw;
+    // 解锁可能在当前线程启动排队的非对齐写
+    range_lock_->Unlock(ctx->align_offset, ctx->align_length);
+    ctx->cb(rc, ctx);
+}
+
+bool BlobInstance::Trim(IOContext *ctx) {
+    if (btestmem_ || btestfile_) {
+        ctx->ret = 0;
+        ctx->cb(0, ctx);
+        return true;
+    }
+
+    auto offset = ctx->request.from;
+    auto length = ctx->request.len;
+    LOG(INFO) << "try trim offset=" << offset << " len=" << length;
+    // 出错时只通过回调返回
+    int ret = handle_->AsyncDiscard(offset, length, ctx->cb, ctx);
+    return ret == 0;
 }
 
 void BlobInstance::Flush(IOContext *ctx) {
@@ -250,10 +346,11 @@ uint64_t BlobInstance::GetBlobSize() {
 }
 
 bool BlobInstance::TestMemRead(IOContext *ctx) {
-    int buflen = sizeof(nbd_reply) + ctx->request.len;
-    char *buf = new char[buflen];
-    memset(buf, 0, buflen);
-    ctx->data.reset(buf);
+    int buflen = ctx->request.from % CYPRE_BLOCK_SIZE + ctx->request.len;
+    if (!ctx->data.alloc(buflen)) {
+        return false;
+    }
+    memset(ctx->data.get(), 0, buflen);
     ctx->cb(0, ctx);
     return true;
 }
@@ -266,9 +363,11 @@ bool BlobInstance::TestMemWrite(IOContext *ctx) {
 bool BlobInstance::TestFileRead(IOContext *ctx) {
     auto offset = ctx->request.from;
     auto len = ctx->request.len;
-    auto buflen = sizeof(nbd_reply) + len;
-    ctx->data.reset(new char[buflen]);
-    uint8_t *buf = (uint8_t *)ctx->data.get() + sizeof(nbd_reply);
+    auto offyu = offset % CYPRE_BLOCK_SIZE;
+    if (!ctx->data.alloc(offyu + len)) {
+        return false;
+    }
+    uint8_t *buf = (uint8_t *)ctx->data.get() + offyu;
     int ret = 0;
 
     while (len > 0) {
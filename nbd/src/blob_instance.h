@@ -14,7 +14,9 @@
 #include <string>
 #include <stdlib.h>
 
+#include "io_buf.h"
 #include "libcypre.h"
+#include "range_lock.h"
 
 namespace cyprestore {
 namespace nbd {
@@ -30,7 +32,8 @@ struct IOContext {
     // 请求类型
     int command = 0;
     NBDServer* server = nullptr;
-    std::unique_ptr<char[]> data;
+    // 4K对齐，读请求的数据从data + request.from % CYPRE_BLOCK_SIZE开始
+    IOBuf data;
 
     // 对齐的offset
     uint64_t align_offset = 0;
@@ -47,6 +50,8 @@ struct IOContext {
 
 typedef IOContext *IOContextPtr;
 
+struct RMWContext;
+
 // 封装blob相关接口
 class BlobInstance {
 public:
@@ -80,10 +85,10 @@ public:
     virtual bool Write(IOContext *ctx, bool flush = false);
 
     /**
-     * @brief trim请求
+     * @brief 异步trim请求，只丢弃请求区间内4K对齐的部分
      * @param ctx trim请求信息
      */
-    virtual void Trim(IOContext *ctx);
+    virtual bool Trim(IOContext *ctx);
 
     /**
      * @brief flush请求
@@ -97,7 +102,25 @@ public:
      *         获取失败返回错误码（负值）
      */
     virtual uint64_t GetBlobSize();
+
+    /**
+     * @brief 设置非对齐写使用的区间锁，同一设备的所有连接应共享
+     */
+    void SetRangeLock(RangeLockPtr range_lock) {
+        range_lock_ = range_lock;
+    }
+
 private:
+    /**
+     * @brief 非对齐写：锁住对齐区间，并行读取首尾块，合并后写回
+     */
+    bool StartRMW(IOContext *ctx);
+    void FinishRMW(RMWContext *rmw, int rc);
+
+    static void RMWLocked(void *arg);
+    static void RMWReadDone(int rc, void *arg);
+    static void RMWWriteDone(int rc, void *arg);
+
     // cypre
     clients::CypreRBD *cyprerbd_;
     cyprestore::clients::RBDStreamHandlePtr handle_;
@@ -107,6 +130,7 @@ private:
     std::string blobid_;
     std::string extent_manager_ip_;
     int extent_manager_port_;
+    RangeLockPtr range_lock_;
 
     bool TestMemRead(IOContext *ctx);
     bool TestMemWrite(IOContext *ctx);
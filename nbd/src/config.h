@@ -47,6 +47,8 @@ struct NBDConfig {
     std::string devpath;
 
     int multi_conns = 1;
+    // 请求分发线程数，所有连接共享
+    int dispatch_threads = 4;
     bool debug = false;
     bool foreground = false;
     bool nullio = false;
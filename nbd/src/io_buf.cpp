@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#include "io_buf.h"
+
+#include <butil/logging.h>
+#include <stdlib.h>
+
+namespace cyprestore {
+namespace nbd {
+
+IOBufPool::IOBufPool(uint32_t max_slab, uint64_t max_cached)
+        : max_slab_(max_slab), max_cached_(max_cached), cached_(0) {
+    slabs_.resize(max_slab_ / kIOUnitSize_);
+    for (auto &slab : slabs_) {
+        slab.reset(new Slab());
+    }
+}
+
+IOBufPool::~IOBufPool() {
+    for (auto &slab : slabs_) {
+        for (auto buf : slab->bufs) {
+            free(buf);
+        }
+    }
+}
+
+IOBufPool *IOBufPool::Instance() {
+    // 不析构，退出时仍在进行的请求可以安全归还缓冲区
+    static IOBufPool *pool = new IOBufPool();
+    return pool;
+}
+
+char *IOBufPool::Get(uint64_t size) {
+    uint64_t unit_size = align(size > 0 ? size : 1);
+    uint32_t index = get_index(unit_size);
+    if (index < slabs_.size()) {
+        Slab *slab = slabs_[index].get();
+        char *buf = nullptr;
+        slab->lock.lock();
+        if (!slab->bufs.empty()) {
+            buf = slab->bufs.back();
+            slab->bufs.pop_back();
+        }
+        slab->lock.unlock();
+        if (buf != nullptr) {
+            cached_ -= unit_size;
+            return buf;
+        }
+    }
+
+    void *buf = nullptr;
+    int ret = posix_memalign(&buf, kIOUnitSize_, unit_size);
+    if (ret != 0) {
+        LOG(ERROR) << "allocate io buf failed, size=" << unit_size
+                   << " ret=" << ret;
+        return nullptr;
+    }
+    return static_cast<char *>(buf);
+}
+
+void IOBufPool::Put(char *buf, uint64_t size) {
+    uint64_t unit_size = align(size > 0 ? size : 1);
+    uint32_t index = get_index(unit_size);
+    if (index < slabs_.size() && cached_ + unit_size <= max_cached_) {
+        cached_ += unit_size;
+        Slab *slab = slabs_[index].get();
+        slab->lock.lock();
+        slab->bufs.push_back(buf);
+        slab->lock.unlock();
+        return;
+    }
+
+    free(buf);
+}
+
+bool IOBuf::alloc(uint64_t size) {
+    reset();
+    data_ = IOBufPool::Instance()->Get(size);
+    if (data_ == nullptr) {
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+void IOBuf::reset() {
+    if (data_ != nullptr) {
+        IOBufPool::Instance()->Put(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+}  // namespace nbd
+}  // namespace cyprestore
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#ifndef NBD_SRC_IOBUF_H_
+#define NBD_SRC_IOBUF_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "spin_lock.h"
+
+namespace cyprestore {
+namespace nbd {
+
+// 4K对齐的请求数据缓冲区池，按4K整数倍分级缓存释放的缓冲区
+// 超过max_slab的缓冲区不缓存，直接分配和释放
+class IOBufPool {
+public:
+    explicit IOBufPool(
+            uint32_t max_slab = 1 << 20, uint64_t max_cached = 256 << 20);
+    ~IOBufPool();
+
+    static IOBufPool *Instance();
+
+    /**
+     * @brief 分配缓冲区，大小向上取整到4K
+     * @return 失败返回nullptr
+     */
+    char *Get(uint64_t size);
+
+    /**
+     * @brief 归还缓冲区，size为Get时的大小
+     */
+    void Put(char *buf, uint64_t size);
+
+private:
+    struct Slab {
+        spin_lock lock;
+        std::vector<char *> bufs;
+    };
+
+    uint64_t align(uint64_t size) {
+        return (size + kIOUnitSize_ - 1) / kIOUnitSize_ * kIOUnitSize_;
+    }
+
+    uint32_t get_index(uint64_t unit_size) {
+        return (unit_size / kIOUnitSize_) - 1;
+    }
+
+    // 4k
+    const uint32_t kIOUnitSize_ = 4 << 10;
+    uint32_t max_slab_;
+    uint64_t max_cached_;
+    std::atomic<uint64_t> cached_;
+    std::vector<std::unique_ptr<Slab>> slabs_;
+};
+
+// IOContext的数据缓冲区，析构时归还IOBufPool
+class IOBuf {
+public:
+    IOBuf() : data_(nullptr), size_(0) {}
+    ~IOBuf() {
+        reset();
+    }
+
+    IOBuf(const IOBuf &) = delete;
+    IOBuf &operator=(const IOBuf &) = delete;
+
+    /**
+     * @brief 释放原有缓冲区，重新分配至少size字节
+     */
+    bool alloc(uint64_t size);
+
+    void reset();
+
+    void swap(IOBuf &other) {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    char *get() const {
+        return data_;
+    }
+
+private:
+    char *data_;
+    uint64_t size_;
+};
+
+}  // namespace nbd
+}  // namespace cyprestore
+
+#endif  // NBD_SRC_IOBUF_H_
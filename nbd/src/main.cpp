@@ -88,6 +88,7 @@ static void Usage() {
               << "  -timeout=<seconds>     set nbd request timeout\n"
               /* TODO: << "  -try_netlink           use the nbd netlink interface\n" */
               << "  -multi_conns=<conns>   multiple connections to a single nbd device, default is 1\n"
+              << "  -dispatch_threads=<n>  threads submitting requests of all connections, default is 4\n"
               << "  -em_endpoint           extentmanager server ip and port(ip:port)\n"
               << "  -client_core_mask=<brpc_core>\n"
               << "                         set brpc worker core mask\n"
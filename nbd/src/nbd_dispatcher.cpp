@@ -0,0 +1,80 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#include "nbd_dispatcher.h"
+
+#include "nbd_server.h"
+
+namespace cyprestore {
+namespace nbd {
+
+NBDDispatcher::NBDDispatcher(int thread_num)
+        : thread_num_(thread_num > 0 ? thread_num : 1), stop_(false) {}
+
+NBDDispatcher::~NBDDispatcher() {
+    Stop();
+}
+
+void NBDDispatcher::Start() {
+    if (!threads_.empty()) {
+        return;
+    }
+
+    stop_ = false;
+    for (int i = 0; i < thread_num_; i++) {
+        threads_.push_back(std::thread(&NBDDispatcher::DispatchFunc, this));
+    }
+    LOG(NOTICE) << "NBDDispatcher started, threads=" << thread_num_;
+}
+
+void NBDDispatcher::Stop() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    for (auto &th : threads_) {
+        if (th.joinable()) {
+            th.join();
+        }
+    }
+    threads_.clear();
+}
+
+void NBDDispatcher::Submit(std::vector<IOContext *> *ctxs) {
+    if (ctxs->empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        queue_.insert(queue_.end(), ctxs->begin(), ctxs->end());
+    }
+    if (ctxs->size() > 1) {
+        cond_.notify_all();
+    } else {
+        cond_.notify_one();
+    }
+    ctxs->clear();
+}
+
+void NBDDispatcher::DispatchFunc() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (true) {
+        cond_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            break;  // stop_
+        }
+
+        IOContext *ctx = queue_.front();
+        queue_.pop_front();
+        lk.unlock();
+        ctx->server->StartRequest(ctx);
+        lk.lock();
+    }
+}
+
+}  // namespace nbd
+}  // namespace cyprestore
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#ifndef NBD_SRC_NBDDISPATCHER_H_
+#define NBD_SRC_NBDDISPATCHER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blob_instance.h"
+
+namespace cyprestore {
+namespace nbd {
+
+// 同一nbd设备所有连接共享的请求分发线程池
+// 连接的接收线程只负责解析请求，请求由这里的线程提交给后端，
+// 提交时阻塞的请求（如非对齐写）不会卡住连接上后续请求的接收
+class NBDDispatcher {
+public:
+    explicit NBDDispatcher(int thread_num);
+    ~NBDDispatcher();
+
+    void Start();
+
+    /**
+     * @brief 停止分发线程，已入队的请求仍会被提交
+     */
+    void Stop();
+
+    /**
+     * @brief 批量提交一个连接解析出的请求，ctxs被清空
+     */
+    void Submit(std::vector<IOContext *> *ctxs);
+
+private:
+    void DispatchFunc();
+
+    int thread_num_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<IOContext *> queue_;
+    bool stop_;
+};
+using NBDDispatcherPtr = std::shared_ptr<NBDDispatcher>;
+
+}  // namespace nbd
+}  // namespace cyprestore
+
+#endif  // NBD_SRC_NBDDISPATCHER_H_
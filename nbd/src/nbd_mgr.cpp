@@ -29,6 +29,9 @@ NBDMgr::~NBDMgr() {
         NBDServerPtr server_ptr = nbd_servers_.at(i);
         server_ptr->Shutdown();
     }
+    if (dispatcher_ != nullptr) {
+        dispatcher_->Stop();
+    }
     delete cyprerbd_;  //要放在ServerPtr->Shutdown() 析构之后
 
     for (unsigned int i = 0; i < socket_pairs_.size(); i++) {
@@ -111,6 +114,9 @@ int NBDMgr::Connect(NBDConfig *cfg) {
 
     int64_t file_size = 0;
 
+    dispatcher_ = std::make_shared<NBDDispatcher>(cfg->dispatch_threads);
+    // 不同连接上重叠的非对齐写也要互斥
+    RangeLockPtr range_lock = std::make_shared<RangeLock>();
     for (unsigned int i = 0; i < sock_seconds.size(); i++) {
         // 初始化打开文件
         BlobPtr blob_instance = GenerateBlob(em_ip, em_port, cyprerbd_);
@@ -119,6 +125,7 @@ int NBDMgr::Connect(NBDConfig *cfg) {
             LOG(ERROR) << "cypre_ndb: Could not open image.";
             return ret;
         }
+        blob_instance->SetRangeLock(range_lock);
 
         // 判断文件大小是否符合预期
         if (i == 0) {
@@ -129,8 +136,8 @@ int NBDMgr::Connect(NBDConfig *cfg) {
             }
         }
 
-        NBDServerPtr nbd_server =
-                std::make_shared<NBDServer>(sock_seconds.at(i), blob_instance);
+        NBDServerPtr nbd_server = std::make_shared<NBDServer>(
+                sock_seconds.at(i), blob_instance, dispatcher_);
         nbd_servers_.push_back(nbd_server);
     }
 
@@ -174,6 +181,8 @@ int NBDMgr::List(std::vector<DeviceInfo> *infos, bool show_err) {
 }
 
 void NBDMgr::RunServerUntilQuit() {
+    dispatcher_->Start();
+
     // start nbd server
     for (unsigned int i = 0; i < nbd_servers_.size(); i++) {
         nbd_servers_.at(i)->Start();
@@ -12,6 +12,7 @@
 
 #include "config.h"
 #include "nbd_ctrl.h"
+#include "nbd_dispatcher.h"
 #include "nbd_server.h"
 #include "nbd_watch.h"
 #include "texttable.h"
@@ -93,6 +94,8 @@ private:
 private:
     std::vector<NBDSocketPair *> socket_pairs_;
     std::vector<NBDServerPtr> nbd_servers_;
+    // 所有连接共享的请求分发线程
+    NBDDispatcherPtr dispatcher_;
     std::shared_ptr<NBDWatchContext> nbd_watch_ctx_;
 };
 
@@ -9,6 +9,8 @@
 #include <netinet/in.h>
 #include <signal.h>
 
+#include <algorithm>
+
 #include "bvar/bvar.h"
 #include "config.h"
 #include "util.h"
@@ -21,6 +23,28 @@ extern std::shared_ptr<NBDConfig> g_nbd_config;
 extern bvar::LatencyRecorder g_latency_cypre_nbd_read;
 extern bvar::LatencyRecorder g_latency_cypre_nbd_write;
 
+// 回复数及发送回复用的系统调用数
+static bvar::Adder<int64_t> g_nbd_replies("cypre_nbd_replies");
+static bvar::Adder<int64_t> g_nbd_reply_syscalls("cypre_nbd_reply_syscalls");
+static bvar::Window<bvar::Adder<int64_t>> g_nbd_replies_window(
+        &g_nbd_replies, 10);
+static bvar::Window<bvar::Adder<int64_t>> g_nbd_reply_syscalls_window(
+        &g_nbd_reply_syscalls, 10);
+
+static double GetSyscallsPerReply(void *) {
+    int64_t replies = g_nbd_replies_window.get_value();
+    if (replies <= 0) {
+        return 0;
+    }
+    return (double)g_nbd_reply_syscalls_window.get_value() / replies;
+}
+
+static bvar::PassiveStatus<double> g_nbd_syscalls_per_reply(
+        "cypre_nbd_syscalls_per_reply", GetSyscallsPerReply, NULL);
+
+// 单次writev的iov数，每个回复最多占用两个
+static const int kMaxReplyIov = 512;
+
 #define REQUEST_TYPE_MASK 0x0000ffff
 
 static std::ostream &operator<<(std::ostream &os, const IOContext &ctx) {
@@ -90,9 +114,12 @@ void NBDAioCallback(int rc, void *vctx) {
     }
 }
 
-NBDServer::NBDServer(int sock, std::shared_ptr<BlobInstance> blobInstance)
+NBDServer::NBDServer(
+        int sock, std::shared_ptr<BlobInstance> blobInstance,
+        NBDDispatcherPtr dispatcher)
         : sock_(sock), pending_request_counts_(0), started_(false),
-          terminated_(false), blob_(blobInstance) {
+          terminated_(false), blob_(blobInstance), dispatcher_(dispatcher),
+          sender_stopped_(false) {
     safe_io_ = std::make_shared<SafeIO>();
 }
 
@@ -106,6 +133,7 @@ void NBDServer::Start() {
     }
 
     started_ = true;
+    sender_thread_ = std::thread(&NBDServer::SenderFunc, this);
     reader_thread_ = std::thread(&NBDServer::ReaderFunc, this);
 }
 
@@ -119,13 +147,28 @@ void NBDServer::WaitForDisconnect() {
         disconnect_cond_.wait(lk);
 }
 
+void NBDServer::Stop() {
+    bool expected = false;
+    if (terminated_.compare_exchange_strong(expected, true)) {
+        shutdown(sock_, SHUT_RDWR);
+    }
+    {
+        // 发送线程在reply_mtx_下检查terminated_，加锁避免丢失唤醒
+        std::lock_guard<std::mutex> lk(reply_mtx_);
+    }
+    reply_cond_.notify_all();
+}
+
 void NBDServer::Shutdown() {
     if (!started_)
         return;
     LOG(NOTICE) << "going to shutdown, terminated " << terminated_;
-    bool expected = false;
-    if (terminated_.compare_exchange_strong(expected, true)) {
-        shutdown(sock_, SHUT_RDWR);
+    Stop();
+
+    std::lock_guard<std::mutex> lk(shutdown_mtx_);
+    if (sender_thread_.joinable()
+            && std::this_thread::get_id() != sender_thread_.get_id()) {
+        sender_thread_.join();
     }
     if (reader_thread_.joinable()
             && std::this_thread::get_id() != reader_thread_.get_id()) {
@@ -136,23 +179,16 @@ void NBDServer::Shutdown() {
 }
 
 void NBDServer::ReaderFunc() {
-    ssize_t r = 0;
-    bool disconnect = false;
-    const int BufSize = 1048576;
-    unsigned char buf[BufSize] = { 0 };
+    const uint32_t BufSize = 131072;
+    const uint32_t RequestHeadSize = sizeof(struct nbd_request);
+    std::unique_ptr<char[]> buf(new char[BufSize]);
     uint32_t bufpos = 0;
-    uint32_t begin = 0;
-    const int RequestHeadSize = sizeof(nbd_request);
-    struct nbd_request *request;
-    uint32_t datalen = 0;
-    int command = 0;
-    uint32_t request_type;
-    uint64_t request_from;
-    uint32_t request_len;
-
-    while (!terminated_) {
-        LOG(INFO) << "read begin sock_=" << sock_ << " pos=" << bufpos;
-        r = read(sock_, buf + bufpos, BufSize - bufpos);
+    bool disconnect = false;
+    // 一次read解析出的请求一起提交
+    std::vector<IOContext *> batch;
+
+    while (!terminated_ && !disconnect) {
+        ssize_t r = read(sock_, buf.get() + bufpos, BufSize - bufpos);
         if (r < 0) {
             if (errno == EINTR) {
                 continue;
@@ -163,167 +199,148 @@ void NBDServer::ReaderFunc() {
         } else if (r == 0) {
             LOG(ERROR) << "end of connection sock=" << sock_;
             break;
-        } else {
-            bufpos += r;
-            LOG(INFO) << "read end ret=" << r << " pos=" << bufpos;
         }
+        bufpos += r;
 
-        if (bufpos < RequestHeadSize) continue;
-
-        begin = 0;
-        while (begin < bufpos) {
-            if (begin + RequestHeadSize > bufpos) {
-                if (begin > BufSize - RequestHeadSize) {
-                    memcpy(buf, buf + begin, bufpos - begin);
-                    bufpos = bufpos - begin;
-                    begin = 0;
-                }
-                break;
-            }
-
-            request = (nbd_request *)(buf + begin);
+        uint32_t begin = 0;
+        while (bufpos - begin >= RequestHeadSize) {
+            const struct nbd_request *request =
+                    (const struct nbd_request *)(buf.get() + begin);
             if (request->magic != htonl(NBD_REQUEST_MAGIC)) {
                 LOG(ERROR) << "Invalid nbd request magic " << request->magic;
                 disconnect = true;
                 break;
             }
 
-            request_type = ntohl(request->type);
-            request_from = Ntohll(request->from);
-            request_len = ntohl(request->len);
-
-            command = request_type & REQUEST_TYPE_MASK;
-            if (command == NBD_CMD_WRITE)
-                datalen = request_len;
-            else
-                datalen = 0;
-
-            LOG(INFO) << "OnRecvPack datalen=" << datalen
-                       << " begin=" << begin << " bufpos=" << bufpos << " command=" << command;
-            if (begin + RequestHeadSize + datalen < bufpos) {
-                disconnect = !OnRecvPack(
-                        request_type, request_from, request_len,
-                        request->handle, buf + begin + RequestHeadSize,
-                        datalen);
-                begin += RequestHeadSize + datalen;
-            } else if (begin + RequestHeadSize + datalen == bufpos) {
-                disconnect = !OnRecvPack(
-                        request_type, request_from, request_len,
-                        request->handle, buf + begin + RequestHeadSize,
-                        datalen);
-                begin = 0;
-                bufpos = 0;
-                break;
-            } else if (begin + RequestHeadSize + datalen > bufpos) {
-                datalen = bufpos - begin - RequestHeadSize;
-                disconnect = !OnRecvPack(
-                        request_type, request_from, request_len,
-                        request->handle, buf + begin + RequestHeadSize,
-                        datalen);
-                begin = 0;
-                bufpos = 0;
+            IOContext *ctx = NewContext(request);
+            begin += RequestHeadSize;
+            if (ctx->command == NBD_CMD_DISC) {
+                LOG(NOTICE) << "Receive DISC request";
+                delete ctx;
+                disconnect = true;
                 break;
             }
 
-            if (disconnect) break;
+            if (ctx->command == NBD_CMD_WRITE) {
+                uint32_t len = ctx->request.len;
+                uint32_t buflen = std::min(len, bufpos - begin);
+                if (!ctx->data.alloc(len)) {
+                    delete ctx;
+                    disconnect = true;
+                    break;
+                }
+                memcpy(ctx->data.get(), buf.get() + begin, buflen);
+                begin += buflen;
+                if (buflen < len) {
+                    // 写请求未读完，先提交之前的请求再继续读取数据
+                    SubmitRequests(&batch);
+                    ssize_t ret = safe_io_->ReadExact(
+                            sock_, ctx->data.get() + buflen, len - buflen);
+                    if (ret < 0) {
+                        LOG(ERROR) << "failed to read nbd request data "
+                                   << CppStrerror(ret);
+                        delete ctx;
+                        disconnect = true;
+                        break;
+                    }
+                }
+            }
+            batch.push_back(ctx);
         }
 
-        if (disconnect) {
-            LOG(NOTICE) << "ReaderFunc() disconnect";
-            break;
+        // 已完整接收的请求在断开前仍然提交
+        SubmitRequests(&batch);
+
+        // 未完整的请求头移到缓冲区开头
+        if (begin > 0 && begin < bufpos) {
+            memmove(buf.get(), buf.get() + begin, bufpos - begin);
         }
+        bufpos -= std::min(begin, bufpos);
+    }
+
+    if (disconnect) {
+        LOG(NOTICE) << "ReaderFunc() disconnect";
     }
 
     std::lock_guard<std::mutex> lk(disconnect_mtx_);
     disconnect_cond_.notify_all();
     LOG(NOTICE) << "ReaderFunc terminated!";
     blob_->Close();
-    Shutdown();
+    Stop();
 }
 
-bool NBDServer::OnRecvPack(
-        uint32_t request_type, uint64_t request_from, uint32_t request_len,
-        const char *request_handle, const unsigned char *buf, uint32_t buflen) {
-    bool disconnect = false;
-
-    std::unique_ptr<IOContext> ctx(new IOContext());
+IOContext *NBDServer::NewContext(const struct nbd_request *request) {
+    IOContext *ctx = new IOContext();
     ctx->server = this;
-    ctx->request.type = request_type;
-    ctx->request.from = request_from;
-    ctx->request.len = request_len;
-    LOG(INFO) << "nbd request: from=" << ctx->request.from
-               << " len=" << ctx->request.len << " buflen=" << buflen;
+    ctx->request.type = ntohl(request->type);
+    ctx->request.from = Ntohll(request->from);
+    ctx->request.len = ntohl(request->len);
 
     ctx->reply.magic = htonl(NBD_REPLY_MAGIC);
-    memcpy(ctx->reply.handle, request_handle, sizeof(ctx->reply.handle));
+    memcpy(ctx->reply.handle, request->handle, sizeof(ctx->reply.handle));
     ctx->reply.error = 0;
 
     ctx->command = ctx->request.type & REQUEST_TYPE_MASK;
+    return ctx;
+}
 
-    switch (ctx->command) {
-        case NBD_CMD_DISC:
-            LOG(NOTICE) << "Receive DISC request";
-            disconnect = true;
-            break;
-        case NBD_CMD_WRITE: {
-            char *p = new char[ctx->request.len];
-            ctx->data.reset(p);
-            if (buflen > 0) memcpy(p, buf, buflen);
-            LOG(INFO) << "nbd write: buflen=" << buflen << " request.len=" << ctx->request.len;
-            if (buflen < ctx->request.len) {
-                // 写请求未读完，继续读取数据
-                ssize_t r = safe_io_->ReadExact(sock_, p + buflen, ctx->request.len - buflen);
-                if (r < 0) {
-                    LOG(ERROR) << "OnRecvPack failed to read nbd request data "
-                               << CppStrerror(r);
-                    disconnect = true;
-                }
-            }
-        } break;
-        case NBD_CMD_READ:
-            break;
+void NBDServer::SubmitRequests(std::vector<IOContext *> *batch) {
+    if (dispatcher_ != nullptr) {
+        dispatcher_->Submit(batch);
+        return;
     }
 
-    if (disconnect) {
-        LOG(NOTICE) << "ReaderFunc() disconnect";
-        return false;
+    for (auto ctx : *batch) {
+        StartRequest(ctx);
     }
+    batch->clear();
+}
 
+void NBDServer::StartRequest(IOContext *ctx) {
     OnRequestStart();
-
-    IOContext *pctx = ctx.get();
-    bool ret = StartAioRequest(ctx.release());
-    if (!ret) {
-        pctx->ret = -1;
-        OnRequestFinish(pctx);
-        return false;
+    if (!StartAioRequest(ctx)) {
+        ctx->ret = -1;
+        ctx->reply.error = htonl(EIO);
+        OnRequestFinish(ctx);
     }
-
-    return true;
 }
 
-void NBDServer::SendReply(IOContext *ctx) {
-    LOG(INFO) << "SendReply offset=" << ctx->request.from;
-    ssize_t r = 0;
+void NBDServer::SendReplies(const std::vector<IOContext *> &replies) {
     const size_t kReplySize = sizeof(struct nbd_reply);
-    if (ctx->command == NBD_CMD_READ && ctx->reply.error == htonl(0)) {
-        int offyu = ctx->request.from % CYPRE_BLOCK_SIZE;
-        char *buf = ctx->data.get() + offyu;
-        memcpy(buf, &ctx->reply, kReplySize);
-
-        r = safe_io_->Write(sock_, buf, kReplySize + ctx->request.len);
-        if (r < 0) {
-            LOG(ERROR) << *ctx
-                       << ": faield to write reply data : " << CppStrerror(r);
-            return;
+    struct iovec iov[kMaxReplyIov];
+    int iovcnt = 0;
+    size_t i = 0;
+    size_t sent = 0;
+
+    while (sent < replies.size()) {
+        // 凑满一批iov或回复已全部加入时发送
+        if (i < replies.size() && iovcnt + 2 <= kMaxReplyIov) {
+            IOContext *ctx = replies[i++];
+            LOG(INFO) << "SendReply offset=" << ctx->request.from;
+            iov[iovcnt].iov_base = &ctx->reply;
+            iov[iovcnt].iov_len = kReplySize;
+            iovcnt++;
+            if (ctx->command == NBD_CMD_READ && ctx->reply.error == htonl(0)) {
+                int offyu = ctx->request.from % CYPRE_BLOCK_SIZE;
+                iov[iovcnt].iov_base = ctx->data.get() + offyu;
+                iov[iovcnt].iov_len = ctx->request.len;
+                iovcnt++;
+            }
+            continue;
         }
-    } else {
-        r = safe_io_->Write(sock_, &ctx->reply, kReplySize);
+
+        ssize_t r = safe_io_->Writev(sock_, iov, iovcnt);
         if (r < 0) {
-            LOG(ERROR) << *ctx << ": failed to write reply header : "
-                       << CppStrerror(r);
+            LOG(ERROR) << *replies[sent] << ": failed to write "
+                       << i - sent << " replies : " << CppStrerror(r);
+            // 回复流已不完整，客户端无法再对应后续回复，断开连接
+            Stop();
             return;
         }
+        g_nbd_replies << i - sent;
+        g_nbd_reply_syscalls << r;
+        sent = i;
+        iovcnt = 0;
     }
 }
 
@@ -335,10 +352,52 @@ void NBDServer::OnRequestStart() {
 void NBDServer::OnRequestFinish(IOContext *ctx) {
     pending_request_counts_--;
     LOG(INFO) << __func__ << " pending_request=" << pending_request_counts_;
-    sock_spin_lock_.lock();
-    SendReply(ctx);
-    sock_spin_lock_.unlock();
-    delete ctx;
+
+    bool wakeup = false;
+    {
+        std::lock_guard<std::mutex> lk(reply_mtx_);
+        if (!sender_stopped_) {
+            wakeup = replies_.empty();
+            replies_.push_back(ctx);
+            ctx = nullptr;
+        }
+    }
+    if (ctx != nullptr) {
+        // 连接已关闭，不再回复
+        delete ctx;
+        return;
+    }
+    if (wakeup) {
+        reply_cond_.notify_one();
+    }
+}
+
+void NBDServer::SenderFunc() {
+    std::vector<IOContext *> replies;
+    std::unique_lock<std::mutex> lk(reply_mtx_);
+    while (true) {
+        reply_cond_.wait(
+                lk, [this] { return terminated_ || !replies_.empty(); });
+        if (terminated_) {
+            break;
+        }
+
+        replies.swap(replies_);
+        lk.unlock();
+        SendReplies(replies);
+        for (auto ctx : replies) {
+            delete ctx;
+        }
+        replies.clear();
+        lk.lock();
+    }
+
+    sender_stopped_ = true;
+    for (auto ctx : replies_) {
+        delete ctx;
+    }
+    replies_.clear();
+    LOG(NOTICE) << "SenderFunc terminated!";
 }
 
 bool NBDServer::StartAioRequest(IOContext *ctx) {
@@ -358,7 +417,7 @@ bool NBDServer::StartAioRequest(IOContext *ctx) {
             break;
         case NBD_CMD_TRIM:
             ctx->cb = NBDAioCallback;
-            blob_->Trim(ctx);
+            ret = blob_->Trim(ctx);
             break;
         default:
             LOG(ERROR) << "Invalid request type: " << *ctx;
@@ -15,11 +15,12 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "blob_instance.h"
 #include "nbd_ctrl.h"
+#include "nbd_dispatcher.h"
 #include "safe_io.h"
-#include "spin_lock.h"
 
 namespace cyprestore {
 namespace nbd {
@@ -29,10 +30,16 @@ namespace nbd {
  */
 void NBDAioCallback(int rc, void *vctx);
 
-// NBDServer负责与nbd内核进行数据通信
+// NBDServer负责与nbd内核的一个连接进行数据通信
+// 接收线程解析请求，交由dispatcher提交给后端，发送线程负责回复
 class NBDServer {
 public:
-    NBDServer(int sock, std::shared_ptr<BlobInstance> blobInstance);
+    /**
+     * @param dispatcher 为空时由接收线程直接提交请求
+     */
+    NBDServer(
+            int sock, std::shared_ptr<BlobInstance> blobInstance,
+            NBDDispatcherPtr dispatcher = nullptr);
 
     ~NBDServer();
 
@@ -70,7 +77,15 @@ public:
      */
     void OnRequestFinish(IOContext *ctx);
 
-    void SendReply(IOContext *ctx);
+    /**
+     * @brief 向后端提交请求，失败时直接回复错误
+     */
+    void StartRequest(IOContext *ctx);
+
+    /**
+     * @brief 合并回复，尽量用一次writev发送多个请求的回复头和读数据
+     */
+    void SendReplies(const std::vector<IOContext *> &replies);
 
 private:
     bool StartAioRequest(IOContext *ctx);
@@ -80,15 +95,31 @@ private:
      */
     void ReaderFunc();
 
+    /**
+     * @brief 发送线程执行函数
+     */
+    void SenderFunc();
+
+    /**
+     * @brief 由请求头创建请求上下文，写请求的数据由调用者填充
+     */
+    IOContext *NewContext(const struct nbd_request *request);
+
+    /**
+     * @brief 提交接收到的一批请求，batch被清空
+     */
+    void SubmitRequests(std::vector<IOContext *> *batch);
+
+    /**
+     * @brief 停止收发，不等待线程退出
+     */
+    void Stop();
+
     /**
      * @brief 异步请求开始时执行函数
      */
     void OnRequestStart();
 
-    bool OnRecvPack(
-            uint32_t request_type, uint64_t request_from, uint32_t request_len,
-            const char *request_handle, const unsigned char *buf,
-            uint32_t buflen);
 private:
     // 与内核通信的socket fd
     int sock_;
@@ -100,14 +131,23 @@ private:
     // server是否停止
     std::atomic<bool> terminated_;
 
-    spin_lock sock_spin_lock_;
-
     std::shared_ptr<BlobInstance> blob_;
     std::shared_ptr<SafeIO> safe_io_;
+    NBDDispatcherPtr dispatcher_;
 
     // 读线程
     std::thread reader_thread_;
 
+    // 发送线程及待回复的请求
+    std::thread sender_thread_;
+    std::mutex reply_mtx_;
+    std::condition_variable reply_cond_;
+    std::vector<IOContext *> replies_;
+    bool sender_stopped_;
+
+    // 保证线程只被join一次
+    std::mutex shutdown_mtx_;
+
     // 等待断开连接锁/条件变量
     std::mutex disconnect_mtx_;
     std::condition_variable disconnect_cond_;
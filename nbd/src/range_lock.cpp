@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#include "range_lock.h"
+
+#include <butil/logging.h>
+
+#include <vector>
+
+namespace cyprestore {
+namespace nbd {
+
+bool RangeLock::overlapHeld(const Range &range) {
+    for (auto &held : held_) {
+        if (held.Overlap(range)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RangeLock::Lock(
+        uint64_t offset, uint64_t length, LockedCallback cb, void *arg) {
+    Range range = { offset, length, cb, arg };
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        // 与排队中的区间重叠时也要排队，保证重叠区间按顺序持有
+        bool wait = overlapHeld(range);
+        for (auto it = waiters_.begin(); !wait && it != waiters_.end(); ++it) {
+            wait = it->Overlap(range);
+        }
+        if (wait) {
+            waiters_.push_back(range);
+            return;
+        }
+        held_.push_back(range);
+    }
+    cb(arg);
+}
+
+void RangeLock::Unlock(uint64_t offset, uint64_t length) {
+    std::vector<Range> granted;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = held_.begin();
+        for (; it != held_.end(); ++it) {
+            if (it->offset == offset && it->length == length) {
+                break;
+            }
+        }
+        if (it == held_.end()) {
+            LOG(ERROR) << "Unlock range not held, offset=" << offset
+                       << " length=" << length;
+            return;
+        }
+        held_.erase(it);
+
+        // 排在前面仍在等待的区间优先
+        std::vector<Range> blocked;
+        it = waiters_.begin();
+        while (it != waiters_.end()) {
+            bool wait = overlapHeld(*it);
+            for (size_t i = 0; !wait && i < blocked.size(); i++) {
+                wait = blocked[i].Overlap(*it);
+            }
+            if (wait) {
+                blocked.push_back(*it);
+                ++it;
+                continue;
+            }
+            held_.push_back(*it);
+            granted.push_back(*it);
+            it = waiters_.erase(it);
+        }
+    }
+
+    for (auto &range : granted) {
+        range.cb(range.arg);
+    }
+}
+
+}  // namespace nbd
+}  // namespace cyprestore
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangbing1
+ */
+
+#ifndef NBD_SRC_RANGELOCK_H_
+#define NBD_SRC_RANGELOCK_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace cyprestore {
+namespace nbd {
+
+// 异步区间锁，重叠区间按加锁顺序依次持有，等待时不阻塞线程
+class RangeLock {
+public:
+    typedef void (*LockedCallback)(void *arg);
+
+    RangeLock() = default;
+    ~RangeLock() = default;
+
+    /**
+     * @brief 加锁[offset, offset + length)
+     * 无冲突时在当前线程调用cb，否则排队，由释放冲突区间的线程调用cb
+     */
+    void Lock(uint64_t offset, uint64_t length, LockedCallback cb, void *arg);
+
+    /**
+     * @brief 释放Lock加锁的区间
+     */
+    void Unlock(uint64_t offset, uint64_t length);
+
+private:
+    struct Range {
+        uint64_t offset;
+        uint64_t length;
+        LockedCallback cb;
+        void *arg;
+
+        bool Overlap(const Range &other) const {
+            return offset < other.offset + other.length
+                   && other.offset < offset + length;
+        }
+    };
+
+    bool overlapHeld(const Range &range);
+
+    std::mutex mtx_;
+    std::list<Range> held_;
+    std::list<Range> waiters_;
+};
+using RangeLockPtr = std::shared_ptr<RangeLock>;
+
+}  // namespace nbd
+}  // namespace cyprestore
+
+#endif  // NBD_SRC_RANGELOCK_H_
@@ -22,5 +22,9 @@ ssize_t SafeIO::Write(int fd, const void *buf, size_t count) {
     return SafeWrite(fd, buf, count);
 }
 
+ssize_t SafeIO::Writev(int fd, struct iovec *iov, int iovcnt) {
+    return SafeWritev(fd, iov, iovcnt);
+}
+
 }  // namespace nbd
 }  // namespace cyprestore
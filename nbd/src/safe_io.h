@@ -9,6 +9,8 @@
 #include <cstddef>
 #include <cstdio>
 
+struct iovec;
+
 namespace cyprestore {
 namespace nbd {
 
@@ -21,6 +23,7 @@ public:
     virtual ssize_t ReadExact(int fd, void *buf, size_t count);
     virtual ssize_t Read(int fd, void *buf, size_t count);
     virtual ssize_t Write(int fd, const void *buf, size_t count);
+    virtual ssize_t Writev(int fd, struct iovec *iov, int iovcnt);
 };
 
 }  // namespace nbd
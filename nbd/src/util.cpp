@@ -238,6 +238,18 @@ int ParseArgs(
                 *err_msg << "cypre_ndb: Invalid argument for multi_conns!";
                 return -EINVAL;
             }
+        } else if (argparse_witharg(
+                           args, i, &cfg->dispatch_threads, err,
+                           "-dispatch_threads",
+                           (char *)NULL)) {  // NOLINT
+            if (!err.str().empty()) {
+                *err_msg << "cypre_ndb: " << err.str();
+                return -EINVAL;
+            }
+            if (cfg->dispatch_threads < 1) {
+                *err_msg << "cypre_ndb: Invalid argument for dispatch_threads!";
+                return -EINVAL;
+            }
         } else if (argparse_witharg(
                            args, i, &cfg->dummy_port, err, "-dummy_port",
                            (char *)NULL)) {
@@ -640,6 +652,31 @@ ssize_t SafeWrite(int fd, const void *buf, size_t count) {
     return 0;
 }
 
+ssize_t SafeWritev(int fd, struct iovec *iov, int iovcnt) {
+    ssize_t calls = 0;
+    while (iovcnt > 0) {
+        ssize_t r = writev(fd, iov, iovcnt);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        ++calls;
+        // 跳过已写完的iov，部分写入的从剩余位置继续
+        while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + r;  // NOLINT
+            iov->iov_len -= r;
+        }
+    }
+    return calls;
+}
+
 int NbdErrno(int errcode) {
     switch (errcode) {
         case EPERM:
@@ -6,6 +6,8 @@
 #ifndef NBD_SRC_UTIL_H_
 #define NBD_SRC_UTIL_H_
 
+#include <sys/uio.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -84,6 +86,9 @@ ssize_t SafeRead(int fd, void *buf, size_t count);
 
 ssize_t SafeWrite(int fd, const void *buf, size_t count);
 
+// 写完iov中的全部数据，iov会被修改，返回writev调用次数或-errno
+ssize_t SafeWritev(int fd, struct iovec *iov, int iovcnt);
+
 // 网络字节序转换
 inline uint64_t Ntohll(uint64_t val) {
     return ((val >> 56) | ((val >> 40) & 0xff00ull)
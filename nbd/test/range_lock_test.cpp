@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "src/range_lock.h"
+
+namespace cyprestore {
+namespace nbd {
+
+struct Locker {
+    Locker(int i, std::vector<int> *o) : id(i), order(o) {}
+
+    static void OnLocked(void *arg) {
+        Locker *locker = static_cast<Locker *>(arg);
+        locker->order->push_back(locker->id);
+    }
+
+    int id;
+    std::vector<int> *order;
+};
+
+TEST(RangeLockTest, LockFreeRangeInline) {
+    RangeLock lock;
+    std::vector<int> order;
+    Locker a(1, &order), b(2, &order);
+
+    lock.Lock(0, 4096, Locker::OnLocked, &a);
+    lock.Lock(4096, 4096, Locker::OnLocked, &b);
+    // 不重叠的区间立即在调用线程持有
+    ASSERT_EQ(std::vector<int>({ 1, 2 }), order);
+
+    lock.Unlock(0, 4096);
+    lock.Unlock(4096, 4096);
+    lock.Lock(0, 8192, Locker::OnLocked, &a);
+    ASSERT_EQ(std::vector<int>({ 1, 2, 1 }), order);
+    lock.Unlock(0, 8192);
+}
+
+TEST(RangeLockTest, OverlapGrantedInOrder) {
+    RangeLock lock;
+    std::vector<int> order;
+    Locker a(1, &order), b(2, &order), c(3, &order), d(4, &order);
+
+    lock.Lock(0, 8192, Locker::OnLocked, &a);
+    // 冲突时Lock直接返回，不阻塞调用线程
+    lock.Lock(4096, 8192, Locker::OnLocked, &b);
+    // 只与排队中的b重叠，也排在b之后
+    lock.Lock(8192, 8192, Locker::OnLocked, &c);
+    lock.Lock(16384, 4096, Locker::OnLocked, &d);
+    ASSERT_EQ(std::vector<int>({ 1, 4 }), order);
+
+    // 释放者的线程里调用被授予者的回调
+    lock.Unlock(0, 8192);
+    ASSERT_EQ(std::vector<int>({ 1, 4, 2 }), order);
+    lock.Unlock(16384, 4096);
+    ASSERT_EQ(std::vector<int>({ 1, 4, 2 }), order);
+    lock.Unlock(4096, 8192);
+    ASSERT_EQ(std::vector<int>({ 1, 4, 2, 3 }), order);
+    lock.Unlock(8192, 8192);
+}
+
+}  // namespace nbd
+}  // namespace cyprestore
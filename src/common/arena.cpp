@@ -24,10 +24,13 @@ Arena::~Arena() {
     if (head_.next != nullptr) Release();
 }
 
-void *
-Arena::allocate_mem(uint64_t size, uint64_t align_size, bool use_hugepage) {
+void *Arena::allocate_mem(
+        uint64_t size, uint64_t align_size, bool use_hugepage, int socket_id) {
     if (use_hugepage) {
-        return spdk_dma_zmalloc(size, align_size, nullptr);
+        if (socket_id < 0) {
+            return spdk_dma_zmalloc(size, align_size, nullptr);
+        }
+        return spdk_dma_zmalloc_socket(size, align_size, nullptr, socket_id);
     }
     return aligned_alloc(size, align_size);
 }
@@ -87,7 +90,8 @@ Arena::Allocate(uint64_t size, uint32_t num, std::vector<void *> *addrs) {
     // allcote needed mem at least
     alloc_size = std::max(alloc_size, num * size);
     void *mem = allocate_mem(
-            alloc_size, options_.align_size, options_.use_hugepage);
+            alloc_size, options_.align_size, options_.use_hugepage,
+            options_.socket_id);
     if (!mem) {
         LOG(ERROR) << "Couldn't alloc mem"
                    << ", block_size:" << block_size_
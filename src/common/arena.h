@@ -19,19 +19,21 @@ namespace common {
 struct ArenaOptions {
     ArenaOptions()
             : align_size(0), initial_block_size(0), max_block_size(0),
-              lock_free(false), use_hugepage(true) {}
+              lock_free(false), use_hugepage(true), socket_id(-1) {}
     ArenaOptions(
             uint64_t align_size_, uint64_t initial_block_size_,
-            uint64_t max_block_size_, bool lock_free_, bool use_hugepage_)
+            uint64_t max_block_size_, bool lock_free_, bool use_hugepage_,
+            int socket_id_ = -1)
             : align_size(align_size_), initial_block_size(initial_block_size_),
               max_block_size(max_block_size_), lock_free(lock_free_),
-              use_hugepage(use_hugepage_) {}
+              use_hugepage(use_hugepage_), socket_id(socket_id_) {}
 
     uint64_t align_size;          // 内存对齐大小
     uint64_t initial_block_size;  // 分配块初始值
     uint64_t max_block_size;      // 分配块最大值
     bool lock_free;
     bool use_hugepage;
+    int socket_id;                // 大页内存numa节点, -1为任意
 };
 
 class Arena {
@@ -54,8 +56,9 @@ public:
 private:
     DISALLOW_COPY_AND_ASSIGN(Arena);
     void reset();
-    static void *
-    allocate_mem(uint64_t size, uint64_t align_size, bool use_hugepage);
+    static void *allocate_mem(
+            uint64_t size, uint64_t align_size, bool use_hugepage,
+            int socket_id = -1);
     static void free_mem(void *p, bool use_hugepage);
     void lock() {
         if (!options_.lock_free) {
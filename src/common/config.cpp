@@ -234,6 +234,8 @@ int Config::Parse(const std::string &config_path) {
         }
         extentserver_.replication_type = ini_parser.GetString(
                 kSectionExtentServer, "replication_type", "standard");
+        extentserver_.star_replication_pools = ini_parser.GetString(
+                kSectionExtentServer, "star_replication_pools", "");
         extentserver_.spdk_request_ring_size =
                 static_cast<int>(ini_parser.GetInteger(
                         kSectionExtentServer, "spdk_request_ring_size",
@@ -243,6 +245,47 @@ int Config::Parse(const std::string &config_path) {
         extentserver_.spdk_worker_core_mask = ini_parser.GetString(kSectionExtentServer, "spdk_worker_core_mask", "");
         extentserver_.slow_request_time = static_cast<int>(ini_parser.GetInteger(
                 kSectionExtentServer, "slow_request_time", 400));
+        extentserver_.zero_copy_write = ini_parser.GetBoolean(
+                kSectionExtentServer, "zero_copy_write", false);
+        extentserver_.vectored_io = ini_parser.GetBoolean(
+                kSectionExtentServer, "vectored_io", false);
+        extentserver_.persist_flush_interval_us =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "persist_flush_interval_us",
+                        200));
+        extentserver_.persist_batch_size =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "persist_batch_size", 128));
+        extentserver_.meta_store = ini_parser.GetString(
+                kSectionExtentServer, "meta_store", "rocksdb");
+        extentserver_.meta_region_size = ini_parser.GetInteger(
+                kSectionExtentServer, "meta_region_size", 1ULL << 30);
+        extentserver_.recovery_threads = static_cast<int>(ini_parser.GetInteger(
+                kSectionExtentServer, "recovery_threads", 8));
+        extentserver_.enable_log_engine = ini_parser.GetBoolean(
+                kSectionExtentServer, "enable_log_engine", false);
+        extentserver_.log_region_size = ini_parser.GetInteger(
+                kSectionExtentServer, "log_region_size", 256ULL << 20);
+        extentserver_.log_max_io_size = static_cast<int>(ini_parser.GetInteger(
+                kSectionExtentServer, "log_max_io_size", 64 << 10));
+        extentserver_.log_flush_batch_size =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "log_flush_batch_size", 4 << 20));
+        extentserver_.log_flush_interval_ms =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "log_flush_interval_ms", 10));
+        extentserver_.replicate_stream = ini_parser.GetBoolean(
+                kSectionExtentServer, "replicate_stream", false);
+        extentserver_.replicate_streams_per_peer =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "replicate_streams_per_peer", 4));
+        extentserver_.write_quorum = static_cast<int>(ini_parser.GetInteger(
+                kSectionExtentServer, "write_quorum", 0));
+        extentserver_.replica_max_lag_bytes = ini_parser.GetInteger(
+                kSectionExtentServer, "replica_max_lag_bytes", 256ULL << 20);
+        extentserver_.replica_lag_wait_ms =
+                static_cast<int>(ini_parser.GetInteger(
+                        kSectionExtentServer, "replica_lag_wait_ms", 1000));
     }
 
     return 0;
@@ -168,10 +168,29 @@ struct ExtentServerCfg {
     std::string dev_name;
     std::string dev_type;
     std::string replication_type;
+    // comma separated, clients write every replica of these pools
+    std::string star_replication_pools;
     int spdk_request_ring_size;
     int num_spdk_workers;
     std::string spdk_worker_core_mask;
     int slow_request_time;
+    bool zero_copy_write;
+    bool vectored_io;
+    int persist_flush_interval_us;
+    int persist_batch_size;
+    std::string meta_store;
+    uint64_t meta_region_size;
+    int recovery_threads;
+    bool enable_log_engine;
+    uint64_t log_region_size;
+    int log_max_io_size;
+    int log_flush_batch_size;
+    int log_flush_interval_ms;
+    bool replicate_stream;
+    int replicate_streams_per_peer;
+    int write_quorum;
+    uint64_t replica_max_lag_bytes;
+    int replica_lag_wait_ms;
 };
 
 // Config
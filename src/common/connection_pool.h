@@ -32,13 +32,17 @@ public:
     ~ConnectionPool() = default;
 
     ConnectionPtr GetConnection(const std::string &ip, int port) {
-        std::string conn_id = get_connection_id(ip, port);
+        // called for every replica of every write, the key buffer is
+        // reused so a hit allocates nothing
+        static thread_local std::string key;
+        key.assign(ip).append(":").append(std::to_string(port));
         {
             ReadLock lock(lock_);
-            auto it = connection_pool_.find(conn_id);
+            auto it = connection_pool_.find(key);
             if (it != connection_pool_.end()) return it->second;
         }
 
+        std::string conn_id = key;
         {
             WriteLock lock(lock_);
             auto it = connection_pool_.find(conn_id);
@@ -56,17 +60,11 @@ public:
     }
 
 private:
-    std::string get_connection_id(const std::string &ip, int port) {
-        std::stringstream ss;
-        ss << ip << ":" << port;
-        return ss.str();
-    }
-
     std::unordered_map<std::string, ConnectionPtr> connection_pool_;
     RWLock lock_;
 };
 
-// WARNING(zhangliang): NOT Thread safe
+// connections of a blob's handle, taken by every thread doing its io
 class ConnectionPool2 {
 public:
     ConnectionPool2() = default;
@@ -74,6 +72,7 @@ public:
 
     // TODO(zhangliang): use ip | port ?
     ConnectionPtr GetConnection(int es_id) {
+        ReadLock lock(lock_);
         auto it = connection_pool_.find(es_id);
         if (it != connection_pool_.end()) {
             return it->second;
@@ -83,6 +82,11 @@ public:
 
     ConnectionPtr NewConnection(int es_id, const std::string &ip, int port) {
         std::string conn_id = get_connection_id(ip, port);
+        WriteLock lock(lock_);
+        auto it = connection_pool_.find(es_id);
+        if (it != connection_pool_.end()) {
+            return it->second;
+        }
         auto conn = std::make_shared<Connection>();
         conn->channel.reset(new brpc::Channel());
         // TODO: 设置channel options
@@ -94,9 +98,11 @@ public:
     }
 
     void Erase(int es_id) {
+        WriteLock lock(lock_);
         connection_pool_.erase(es_id);
     }
     void Clear() {
+        WriteLock lock(lock_);
         connection_pool_.clear();
     }
 
@@ -108,6 +114,7 @@ private:
     }
 
     std::unordered_map<uint64_t, ConnectionPtr> connection_pool_;
+    RWLock lock_;
 };
 
 }  // namespace common
@@ -24,6 +24,7 @@ const std::string kESKvPrefix = "0x02";
 const std::string kERKvPrefix = "0x03";
 const std::string kRGKvPrefix = "0x04";
 const std::string kBlobKvPrefix = "0x05";
+const std::string kBRKvPrefix = "0x06";
 
 // Blob && Extent && Block
 const uint64_t kMaxBlobSize = 32 * (1ULL << 40);     // 32TB
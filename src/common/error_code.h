@@ -41,6 +41,7 @@ const int CYPRE_C_HANDLE_NOT_FOUND = -2004;
 const int CYPRE_C_RING_FULL = -2005;
 const int CYPRE_C_RING_EMPTY = -2006;
 const int CYPRE_C_CRC_ERROR = -2007;
+const int CYPRE_C_READ_OVERTAKEN = -2008;  // other copy of read won
 
 // -3000 ~ -3999 ExtentManager
 const int CYPRE_EM_POOL_NOT_FOUND = -3000;
@@ -99,6 +100,13 @@ const int CYPRE_ES_RTE_RING_FULL = -4028;
 const int CYPRE_ES_RTE_RING_EMPTY = -4029;
 const int CYPRE_ES_PTHREAD_BIND_CORE_ERROR = -4030;
 const int CYPRE_ES_CHECKSUM_ERROR = -4031;
+const int CYPRE_ES_META_IO_ERROR = -4032;
+const int CYPRE_ES_META_CORRUPTION = -4033;
+const int CYPRE_ES_META_NO_SPACE = -4034;
+const int CYPRE_ES_LOG_IO_ERROR = -4035;
+const int CYPRE_ES_LOG_CORRUPTION = -4036;
+const int CYPRE_ES_STREAM_ERROR = -4037;
+const int CYPRE_ES_CONNECT_PEER_FAIL = -4038;
 
 // -5000 ~ -5999 SetManager
 const int CYPRE_SM_NOT_READY = -5000;
@@ -7,6 +7,8 @@
 #ifndef CYPRESTORE_COMMON_EXTENT_ID_GENERATOR_H_
 #define CYPRESTORE_COMMON_EXTENT_ID_GENERATOR_H_
 
+#include <stdlib.h>
+
 #include <sstream>
 #include <string>
 
@@ -26,6 +28,13 @@ public:
         auto index = extent_id.find('.');
         return extent_id.substr(0, index);
     }
+
+    // 0 if extent_id has no index
+    static uint64_t GetExtentIndex(const std::string &extent_id) {
+        auto index = extent_id.find('.');
+        if (index == std::string::npos) return 0;
+        return strtoull(extent_id.c_str() + index + 1, NULL, 10);
+    }
 };
 
 }  // namespace common
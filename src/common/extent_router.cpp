@@ -6,8 +6,13 @@
 
 #include "extent_router.h"
 
+#include <brpc/callback.h>
 #include <butil/logging.h>
 
+#include <algorithm>
+#include <thread>
+
+#include "common/extent_id_generator.h"
 #include "extentmanager/pb/router.pb.h"
 
 namespace cyprestore {
@@ -15,6 +20,25 @@ namespace common {
 
 thread_local ExtentRouterMap ExtentRouterMgr::tls_extent_router_map_;
 
+// extents in one query routers call and such calls in flight at once
+// while prefetching a blob
+const size_t kPrefetchBatch = 256;
+const size_t kPrefetchWindow = 8;
+// swapped out routers kept before waiting readers and freeing them
+const size_t kMaxRetired = 64;
+
+static ExtentRouterPtr
+toExtentRouter(const common::pb::ExtentRouter &pb_router, uint32_t version) {
+    ExtentRouterPtr router = std::make_shared<ExtentRouter>();
+    router->version = version;
+    router->extent_id = pb_router.extent_id();
+    router->primary = toESInstance(pb_router.primary());
+    for (int i = 0; i < pb_router.secondaries_size(); ++i) {
+        router->secondaries.push_back(toESInstance(pb_router.secondaries(i)));
+    }
+    return router;
+}
+
 ExtentRouterPtr ExtentRouterMgr::QueryRouter(const std::string &extent_id) {
     if (use_thread_local_) {
         auto it = tls_extent_router_map_.find(extent_id);
@@ -78,27 +102,212 @@ ExtentRouterPtr ExtentRouterMgr::queryFromRemote(const std::string &extent_id) {
         return nullptr;
     }
 
-    ExtentRouterPtr router = std::make_shared<ExtentRouter>();
-    if (resp.has_router()) {
-        assert((extent_id == resp.router().extent_id())
-               && "router extent_id inconsistency");
-        router->extent_id = extent_id;
-        router->primary = toESInstance(resp.router().primary());
-        for (int i = 0; i < resp.router().secondaries_size(); ++i) {
-            router->secondaries.push_back(
-                    toESInstance(resp.router().secondaries(i)));
-        }
-    } else {
+    if (!resp.has_router()) {
         LOG(ERROR) << "Query router but empty"
                    << ", extent_id:" << extent_id;
         return nullptr;
     }
+    ExtentRouterPtr router =
+            toExtentRouter(resp.router(), resp.router_version());
+    assert((extent_id == router->extent_id)
+           && "router extent_id inconsistency");
 
     LOG(DEBUG) << "Query router finished"
               << ", extent_id:" << extent_id;
     return router;
 }
 
+BlobRouterCachePtr
+ExtentRouterMgr::OpenBlob(const std::string &blob_id, uint64_t num_extents) {
+    std::lock_guard<std::mutex> lock(blobs_mutex_);
+    auto it = blobs_.find(blob_id);
+    if (it != blobs_.end()) {
+        BlobRouterCachePtr cache = it->second.lock();
+        if (cache && cache->NumExtents() == num_extents) return cache;
+    }
+
+    // drop caches of closed blobs while here, opens are rare
+    for (auto iter = blobs_.begin(); iter != blobs_.end();) {
+        if (iter->second.expired()) {
+            iter = blobs_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    BlobRouterCachePtr cache =
+            std::make_shared<BlobRouterCache>(this, blob_id, num_extents);
+    blobs_[blob_id] = cache;
+    return cache;
+}
+
+BlobRouterCache::BlobRouterCache(
+        ExtentRouterMgr *mgr, const std::string &blob_id, uint64_t num_extents)
+        : mgr_(mgr), blob_id_(blob_id), num_extents_(num_extents),
+          slots_(new std::atomic<ExtentRouterPtr *>[num_extents]),
+          version_(0), epoch_(0) {
+    for (uint64_t i = 0; i < num_extents_; ++i) {
+        slots_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    readers_[0].store(0, std::memory_order_relaxed);
+    readers_[1].store(0, std::memory_order_relaxed);
+}
+
+BlobRouterCache::~BlobRouterCache() {
+    for (uint64_t i = 0; i < num_extents_; ++i) {
+        delete slots_[i].load(std::memory_order_relaxed);
+    }
+    delete[] slots_;
+    for (auto router : retired_) {
+        delete router;
+    }
+}
+
+bool BlobRouterCache::lookup(uint64_t extent_index, ExtentRouterPtr *router) {
+    // pin an epoch, retired slots are freed once readers of it are gone
+    uint32_t epoch;
+    while (true) {
+        epoch = epoch_.load() & 1;
+        readers_[epoch].fetch_add(1);
+        if ((epoch_.load() & 1) == epoch) break;
+        readers_[epoch].fetch_sub(1);
+    }
+
+    bool found = false;
+    ExtentRouterPtr *slot = slots_[extent_index - 1].load();
+    uint32_t version = version_.load(std::memory_order_relaxed);
+    if (slot != nullptr
+        && static_cast<uint32_t>((*slot)->version) >= version) {
+        *router = *slot;
+        found = true;
+    }
+    readers_[epoch].fetch_sub(1, std::memory_order_release);
+    return found;
+}
+
+void BlobRouterCache::install(
+        uint64_t extent_index, const ExtentRouterPtr &router) {
+    ExtentRouterPtr *slot = new ExtentRouterPtr(router);
+    ExtentRouterPtr *old = slots_[extent_index - 1].exchange(slot);
+    if (old == nullptr) return;
+
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    retired_.push_back(old);
+    if (retired_.size() < kMaxRetired) return;
+
+    // every retired slot was swapped out before the flip, so readers
+    // entering after it can't see them, wait the ones before
+    uint32_t epoch = epoch_.fetch_add(1) & 1;
+    while (readers_[epoch].load() != 0) {
+        std::this_thread::yield();
+    }
+    for (auto r : retired_) {
+        delete r;
+    }
+    retired_.clear();
+}
+
+ExtentRouterPtr BlobRouterCache::QueryRouter(uint64_t extent_index) {
+    if (extent_index == 0 || extent_index > num_extents_) {
+        return mgr_->QueryRouter(
+                ExtentIDGenerator::GenerateExtentID(blob_id_, extent_index));
+    }
+
+    ExtentRouterPtr router;
+    if (lookup(extent_index, &router)) return router;
+
+    std::string extent_id =
+            ExtentIDGenerator::GenerateExtentID(blob_id_, extent_index);
+    router = mgr_->queryFromRemote(extent_id);
+    if (!router) {
+        LOG(ERROR) << "Couldn't query extent router from remote"
+                   << ", extent_id:" << extent_id;
+        return nullptr;
+    }
+    install(extent_index, router);
+    return router;
+}
+
+void BlobRouterCache::UpdateVersion(uint32_t version) {
+    uint32_t cur = version_.load(std::memory_order_relaxed);
+    while (cur < version) {
+        if (version_.compare_exchange_weak(cur, version)) {
+            LOG(INFO) << "Router version of blob " << blob_id_ << " is "
+                      << version << " now, cached routers are stale";
+            return;
+        }
+    }
+}
+
+int BlobRouterCache::Prefetch() {
+    struct Query {
+        brpc::Controller cntl;
+        extentmanager::pb::QueryRoutersRequest req;
+        extentmanager::pb::QueryRoutersResponse resp;
+    };
+
+    std::vector<uint64_t> missing;
+    for (uint64_t index = 1; index <= num_extents_; ++index) {
+        ExtentRouterPtr router;
+        if (!lookup(index, &router)) missing.push_back(index);
+    }
+    int cached = static_cast<int>(num_extents_ - missing.size());
+
+    extentmanager::pb::RouterService_Stub stub(mgr_->em_channel_);
+    std::vector<Query> queries(kPrefetchWindow);
+    size_t next = 0;
+    while (next < missing.size()) {
+        size_t num = 0;
+        for (; next < missing.size() && num < kPrefetchWindow; ++num) {
+            Query &q = queries[num];
+            q.cntl.Reset();
+            q.req.Clear();
+            q.resp.Clear();
+            q.req.set_blob_id(blob_id_);
+            size_t end = std::min(next + kPrefetchBatch, missing.size());
+            for (; next < end; ++next) {
+                q.req.add_extent_indexes(missing[next]);
+            }
+            stub.QueryRouters(&q.cntl, &q.req, &q.resp, brpc::DoNothing());
+        }
+
+        for (size_t i = 0; i < num; ++i) {
+            Query &q = queries[i];
+            brpc::Join(q.cntl.call_id());
+            if (q.cntl.Failed()) {
+                LOG(WARNING) << "Couldn't send query routers, "
+                             << q.cntl.ErrorText() << ", blob_id:" << blob_id_;
+                continue;
+            } else if (q.resp.status().code() != 0) {
+                LOG(WARNING) << "Couldn't query routers, "
+                             << q.resp.status().message()
+                             << ", blob_id:" << blob_id_;
+                continue;
+            }
+
+            // routers come in order asked, missing ones left out
+            int r = 0;
+            for (int j = 0; j < q.req.extent_indexes_size()
+                            && r < q.resp.routers_size();
+                 ++j) {
+                uint64_t index = q.req.extent_indexes(j);
+                const common::pb::ExtentRouter &pb_router = q.resp.routers(r);
+                if (pb_router.extent_id()
+                    != ExtentIDGenerator::GenerateExtentID(blob_id_, index)) {
+                    continue;
+                }
+                install(index,
+                        toExtentRouter(pb_router, q.resp.router_version()));
+                ++cached;
+                ++r;
+            }
+        }
+    }
+
+    LOG(INFO) << "Prefetched routers of blob " << blob_id_ << ", " << cached
+              << " of " << num_extents_ << " extents cached";
+    return cached;
+}
+
 ESInstance toESInstance(const common::pb::EsInstance &pb_es) {
     ESInstance es;
     es.es_id = pb_es.es_id();
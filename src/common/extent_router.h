@@ -9,7 +9,9 @@
 
 #include <brpc/channel.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -23,10 +25,12 @@ namespace common {
 
 struct ExtentRouter;
 class ExtentRouterMgr;
+class BlobRouterCache;
 
 typedef std::shared_ptr<ExtentRouter> ExtentRouterPtr;
 typedef std::unordered_map<std::string, ExtentRouterPtr> ExtentRouterMap;
 typedef std::shared_ptr<ExtentRouterMgr> ExtentRouterMgrPtr;
+typedef std::shared_ptr<BlobRouterCache> BlobRouterCachePtr;
 
 struct ESInstance {
     ESInstance() : public_port(0), private_port(0) {}
@@ -78,8 +82,13 @@ public:
     ExtentRouterPtr QueryRouter(const std::string &extent_id);
     void DeleteRouter(const std::string &extent_id);
     void Clear();
+    // router cache of blob shared by everyone opening it, created on first
+    // open and gone when the last user drops it
+    BlobRouterCachePtr
+    OpenBlob(const std::string &blob_id, uint64_t num_extents);
 
 private:
+    friend class BlobRouterCache;
     ExtentRouterPtr queryFromRemote(const std::string &extent_id);
 
     brpc::Channel *em_channel_;
@@ -87,6 +96,52 @@ private:
     ExtentRouterMap extent_router_map_;
     RWLock rwlock_;
     bool use_thread_local_;
+    std::unordered_map<std::string, std::weak_ptr<BlobRouterCache>> blobs_;
+    std::mutex blobs_mutex_;
+};
+
+// Routers of one blob by extent index (from 1). Lookups take no lock, a
+// slot is swapped as a whole when its router is fetched again, and the
+// swapped out ones are freed in batch after readers of the epoch they
+// were swapped in have left. A router older than the newest router
+// version seen in responses is stale and fetched again on next lookup.
+class BlobRouterCache {
+public:
+    BlobRouterCache(
+            ExtentRouterMgr *mgr, const std::string &blob_id,
+            uint64_t num_extents);
+    ~BlobRouterCache();
+
+    ExtentRouterPtr QueryRouter(uint64_t extent_index);
+    // router version in a response from em or es
+    void UpdateVersion(uint32_t version);
+    // fetch routers missing or stale, returns how many are cached
+    int Prefetch();
+
+    const std::string &BlobId() const {
+        return blob_id_;
+    }
+    uint64_t NumExtents() const {
+        return num_extents_;
+    }
+
+private:
+    BlobRouterCache(const BlobRouterCache &) = delete;
+    BlobRouterCache &operator=(const BlobRouterCache &) = delete;
+
+    // copies router if cached and not stale
+    bool lookup(uint64_t extent_index, ExtentRouterPtr *router);
+    void install(uint64_t extent_index, const ExtentRouterPtr &router);
+
+    ExtentRouterMgr *mgr_;
+    const std::string blob_id_;
+    const uint64_t num_extents_;
+    std::atomic<ExtentRouterPtr *> *slots_;
+    std::atomic<uint32_t> version_;
+    std::atomic<uint32_t> epoch_;
+    std::atomic<int64_t> readers_[2];  // lookups in flight by epoch parity
+    std::vector<ExtentRouterPtr *> retired_;
+    std::mutex retired_mutex_;
 };
 
 ESInstance toESInstance(const common::pb::EsInstance &pb_es);
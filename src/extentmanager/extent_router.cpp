@@ -29,6 +29,42 @@ ExtentRouter::ExtentRouter(
     update_time_ = create_time_;
 }
 
+BlobRouter::BlobRouter(const std::string &blob_id, const std::string &pool_id)
+        : blob_id_(blob_id), pool_id_(pool_id) {
+    create_time_ = utils::Chrono::DateString();
+    update_time_ = create_time_;
+}
+
+bool BlobRouter::query_rg(uint64_t index, std::string *rg_id) const {
+    if (index == 0 || index > extent_rgs_.size()) {
+        return false;
+    }
+    if (!overrides_.empty()) {
+        auto iter = overrides_.find(index);
+        if (iter != overrides_.end()) {
+            *rg_id = iter->second;
+            return true;
+        }
+    }
+    *rg_id = rgs_[extent_rgs_[index - 1]];
+    return true;
+}
+
+void BlobRouter::append(const std::vector<std::string> &rg_ids) {
+    for (auto &rg_id : rg_ids) {
+        // a blob spans a few rgs, a scan beats a map here
+        uint32_t i = 0;
+        while (i < rgs_.size() && rgs_[i] != rg_id) {
+            ++i;
+        }
+        if (i == rgs_.size()) {
+            rgs_.push_back(rg_id);
+        }
+        extent_rgs_.push_back(i);
+    }
+    update_time_ = utils::Chrono::DateString();
+}
+
 RouterManager::RouterManager(std::shared_ptr<kvstore::RocksStore> kv_store)
         : kv_store_(kv_store) {
     int num = 1 << GlobalConfig().extentmanager().router_inst_shift;
@@ -42,6 +78,125 @@ RouterManager::RouterManager(std::shared_ptr<kvstore::RocksStore> kv_store)
 Status RouterManager::create_router(
         const std::string &pool_id, const std::string &blob_id, int begin,
         int end, const std::vector<std::string> &rg_ids) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    std::shared_ptr<BlobRouter> br;
+    if (begin == 1) {
+        br = std::make_shared<BlobRouter>(blob_id, pool_id);
+    } else {
+        auto old = get_blob_router(blob_id, true);
+        if (!old) {
+            // resize of a blob having a row per extent
+            return create_extent_routers(pool_id, blob_id, begin, end, rg_ids);
+        }
+        if (old->extent_num() != uint64_t(begin - 1)) {
+            LOG(ERROR) << "Create router failed, blob has "
+                       << old->extent_num() << " extents, begin: " << begin
+                       << ", blob_id: " << blob_id;
+            return Status(
+                    common::CYPRE_ER_INVALID_ARGUMENT,
+                    "extents not following blob's");
+        }
+        br = std::make_shared<BlobRouter>(*old);
+    }
+    if (end < begin || rg_ids.size() < size_t(end - begin + 1)) {
+        LOG(ERROR) << "Create router failed, " << rg_ids.size()
+                   << " rgs for extents [" << begin << ", " << end
+                   << "], blob_id: " << blob_id;
+        return Status(common::CYPRE_ER_INVALID_ARGUMENT, "rgs not enough");
+    }
+    br->append(std::vector<std::string>(
+            rg_ids.begin(), rg_ids.begin() + (end - begin + 1)));
+    return put_blob_router(br);
+}
+
+Status RouterManager::delete_blob_router(
+        const std::string &blob_id, uint64_t extent_num) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    auto br = get_blob_router(blob_id, true);
+    if (!br) {
+        for (uint64_t index = 1; index <= extent_num; index++) {
+            auto status = delete_router(
+                    common::ExtentIDGenerator::GenerateExtentID(
+                            blob_id, index));
+            if (!status.ok()) {
+                return status;
+            }
+        }
+        boost::unique_lock<boost::shared_mutex> blob_lock(blob_mutex_);
+        blob_router_map_.erase(blob_id);
+        return Status();
+    }
+
+    auto kv_status = kv_store_->Delete(br->kv_key());
+    if (!kv_status.ok()) {
+        LOG(ERROR) << "Delete blob router meta from store failed, blob_id: "
+                   << blob_id;
+        return Status(
+                common::CYPRE_EM_DELETE_ERROR,
+                "delete blob router meta failed");
+    }
+    boost::unique_lock<boost::shared_mutex> blob_lock(blob_mutex_);
+    blob_router_map_.erase(blob_id);
+    return Status();
+}
+
+std::shared_ptr<BlobRouter> RouterManager::get_blob_router(
+        const std::string &blob_id, bool load_from_store) {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(blob_mutex_);
+        auto iter = blob_router_map_.find(blob_id);
+        if (iter != blob_router_map_.end()) {
+            return iter->second;
+        }
+    }
+    if (!load_from_store) {
+        return nullptr;
+    }
+
+    auto br = std::make_shared<BlobRouter>();
+    br->blob_id_ = blob_id;
+    std::string value;
+    auto status = kv_store_->Get(br->kv_key(), &value);
+    if (!status.ok()) {
+        if (!status.IsNotFound()) {
+            LOG(ERROR) << "Get blob router from store failed, blob_id: "
+                       << blob_id;
+            return nullptr;
+        }
+        // a router put meanwhile is kept
+        boost::unique_lock<boost::shared_mutex> lock(blob_mutex_);
+        auto ret = blob_router_map_.insert(
+                std::make_pair(blob_id, std::shared_ptr<BlobRouter>()));
+        return ret.first->second;
+    }
+    if (!utils::Serializer<BlobRouter>::Decode(value, *br.get())) {
+        LOG(ERROR) << "Decode blob router failed, blob_id: " << blob_id;
+        return nullptr;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(blob_mutex_);
+    auto ret = blob_router_map_.insert(std::make_pair(blob_id, br));
+    return ret.first->second;
+}
+
+Status RouterManager::put_blob_router(std::shared_ptr<BlobRouter> br) {
+    std::string value = utils::Serializer<BlobRouter>::Encode(*br.get());
+    auto status = kv_store_->Put(br->kv_key(), value);
+    if (!status.ok()) {
+        LOG(ERROR) << "Persist blob router meta to store failed, blob_id: "
+                   << br->blob_id_;
+        return Status(
+                common::CYPRE_EM_STORE_ERROR,
+                "persist blob router meta failed");
+    }
+    boost::unique_lock<boost::shared_mutex> lock(blob_mutex_);
+    blob_router_map_[br->blob_id_] = br;
+    return Status();
+}
+
+Status RouterManager::create_extent_routers(
+        const std::string &pool_id, const std::string &blob_id, int begin,
+        int end, const std::vector<std::string> &rg_ids) {
     std::map<std::string, std::string> map;
     int index = 0;
     for (int i = begin; i <= end; i++) {
@@ -102,6 +257,42 @@ Status RouterManager::query_router(
         std::string *rg_id) {
     butil::Timer timer;
     timer.start();
+    auto blob_id = common::ExtentIDGenerator::GetBlobId(extent_id);
+    // blobs of a row per extent are in extent cache once queried
+    auto br = get_blob_router(blob_id, false);
+    if (!br) {
+        std::string extent_pool_id;
+        std::string extent_rg_id;
+        if (look_in_cache(extent_id, &extent_pool_id, &extent_rg_id).ok()) {
+            *pool_id = extent_pool_id;
+            *rg_id = extent_rg_id;
+            timer.stop();
+            g_latency_query << timer.u_elapsed();
+            return Status();
+        }
+        br = get_blob_router(blob_id, true);
+    }
+    if (!br) {
+        return query_extent_router(extent_id, pool_id, rg_id);
+    }
+
+    if (!br->query_rg(
+                common::ExtentIDGenerator::GetExtentIndex(extent_id), rg_id)) {
+        LOG(INFO) << "Extent router not exist, extent_id: " << extent_id;
+        return Status(
+                common::CYPRE_EM_ROUTER_NOT_FOUND, "Extent router not found.");
+    }
+    *pool_id = br->pool_id_;
+    timer.stop();
+    g_latency_query << timer.u_elapsed();
+    return Status();
+}
+
+Status RouterManager::query_extent_router(
+        const std::string &extent_id, std::string *pool_id,
+        std::string *rg_id) {
+    butil::Timer timer;
+    timer.start();
     // 1. look in cache
     auto ret = look_in_cache(extent_id, pool_id, rg_id);
     if (ret.ok()) {
@@ -10,10 +10,15 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <cereal/access.hpp>
+#include <cereal/types/map.hpp>
 #include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <map>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "common/constants.h"
 #include "common/status.h"
@@ -58,6 +63,52 @@ private:
     std::string update_time_;
 };
 
+// Routers of all extents of a blob in one row. The rgs a blob spans are
+// kept once, each extent holds an index into them by its order in blob.
+// The row has room for overrides of extents moved to another rg.
+class BlobRouter {
+public:
+    BlobRouter() = default;
+    BlobRouter(const std::string &blob_id, const std::string &pool_id);
+    ~BlobRouter() = default;
+
+    std::string kv_key() {
+        std::stringstream ss(
+                common::kBRKvPrefix, std::ios_base::app | std::ios_base::out);
+        ss << "_" << blob_id_;
+        return ss.str();
+    }
+
+    uint64_t extent_num() const {
+        return extent_rgs_.size();
+    }
+    // extent index from 1, false if the blob hasn't this extent
+    bool query_rg(uint64_t index, std::string *rg_id) const;
+    // rgs of extents following the last one
+    void append(const std::vector<std::string> &rg_ids);
+
+private:
+    friend class RouterManager;
+    friend class cereal::access;
+    template <class Archive>
+    void serialize(Archive &archive, const std::uint32_t version) {
+        archive(blob_id_);
+        archive(pool_id_);
+        archive(rgs_);
+        archive(extent_rgs_);
+        archive(overrides_);
+        archive(create_time_);
+        archive(update_time_);
+    }
+    std::string blob_id_;
+    std::string pool_id_;
+    std::vector<std::string> rgs_;
+    std::vector<uint32_t> extent_rgs_;  // of extent index - 1, into rgs_
+    std::map<uint64_t, std::string> overrides_;
+    std::string create_time_;
+    std::string update_time_;
+};
+
 using common::Status;
 
 class RouterManager {
@@ -74,8 +125,24 @@ public:
             const std::string &pool_id, const std::string &blob_id, int begin,
             int end, const std::vector<std::string> &rg_ids);
     Status delete_router(const std::string &extent_id);
+    // routers of every extent of blob, extent_num of them
+    Status delete_blob_router(const std::string &blob_id, uint64_t extent_num);
 
 private:
+    // blobs created before blob routers have a row per extent
+    Status create_extent_routers(
+            const std::string &pool_id, const std::string &blob_id, int begin,
+            int end, const std::vector<std::string> &rg_ids);
+    Status query_extent_router(
+            const std::string &extent_id, std::string *pool_id,
+            std::string *rg_id);
+    // null if blob has no blob router, load_from_store looks in kv too.
+    // A blob found without one in kv is cached as null, so legacy and
+    // unknown blobs don't go to kv on every query.
+    std::shared_ptr<BlobRouter>
+    get_blob_router(const std::string &blob_id, bool load_from_store);
+    Status put_blob_router(std::shared_ptr<BlobRouter> br);
+
     Status look_in_cache(
             const std::string &extent_id, std::string *pool_id,
             std::string *rg_id);
@@ -88,11 +155,19 @@ private:
             int, std::unordered_map<std::string, std::shared_ptr<ExtentRouter>>>
             multi_extent_router_map_;
     std::unique_ptr<boost::shared_mutex[]> mutexs_;
+
+    // blob routers are replaced as a whole on change, readers keep theirs,
+    // null for blobs known to have none
+    std::unordered_map<std::string, std::shared_ptr<BlobRouter>>
+            blob_router_map_;
+    boost::shared_mutex blob_mutex_;
+    std::mutex update_mutex_;  // one change to blob routers at a time
 };
 
 }  // namespace extentmanager
 }  // namespace cyprestore
 
 CEREAL_CLASS_VERSION(cyprestore::extentmanager::ExtentRouter, 0);
+CEREAL_CLASS_VERSION(cyprestore::extentmanager::BlobRouter, 0);
 
 #endif  // CYPRESTORE_EXTENTMANAGER_EXTENT_ROUTER_H_
@@ -215,16 +215,16 @@ Status GcManager::deleteOneBlob(
                 return status;
             }
         }
+    }
 
-        // delete router info
-        status =
-                ExtentManager::GlobalInstance().get_router_mgr()->delete_router(
-                        id);
-        if (!status.ok()) {
-            LOG(ERROR) << "[gc manager] Delete extent router: " << id
-                       << " failed";
-            return status;
-        }
+    // delete router info, kept till now so a retry finds every extent
+    status = ExtentManager::GlobalInstance()
+                     .get_router_mgr()
+                     ->delete_blob_router(blob_id, extent_num);
+    if (!status.ok()) {
+        LOG(ERROR) << "[gc manager] Delete routers of blob: " << blob_id
+                   << " failed";
+        return status;
     }
     return ExtentManager::GlobalInstance().get_pool_mgr()->delete_blob(
             pool_id, blob_id);
@@ -236,44 +236,42 @@ Status GcManager::deleteRemoteExtent(const std::string &extent_id) {
     if (!status.ok()) {
         return status;
     }
-    for (uint64_t offset = 0;
-         offset < GlobalConfig().extentmanager().extent_size;
-         offset += block_size_) {
-        status = deleteOneBlock(extent_id, offset, router);
-        if (!status.ok()) {
-            return status;
-        }
+    // whole extent in one discard instead of a delete per 4K block
+    status = discardExtent(extent_id, router);
+    if (!status.ok()) {
+        return status;
     }
     return reclaimExtent(extent_id, router);
 }
 
-Status GcManager::deleteOneBlock(
-        const std::string &extent_id, uint64_t offset,
-        const common::pb::ExtentRouter &router) {
+Status GcManager::discardExtent(
+        const std::string &extent_id, const common::pb::ExtentRouter &router) {
     int replicas = 1 + router.secondaries().size();
     std::vector<common::ConnectionPtr> conns;
     if (getConns(router, &conns) != 0) {
         return Status(
                 common::CYPRE_EM_GET_CONN_ERROR, "couldn't get connections");
     }
-    std::vector<DeleteContext> ctxs(replicas);
+    std::vector<DiscardContext> ctxs(replicas);
     for (int i = 0; i < replicas; ++i) {
         extentserver::pb::ExtentIOService_Stub stub(conns[i]->channel.get());
-        extentserver::pb::DeleteRequest req;
-        req.set_extent_id(extent_id);
-        req.set_offset(offset);
-        req.set_size(block_size_);
-        stub.Delete(&ctxs[i].cntl, &req, &ctxs[i].response, brpc::DoNothing());
+        extentserver::pb::DiscardRequest req;
+        auto range = req.add_ranges();
+        range->set_extent_id(extent_id);
+        range->set_offset(0);
+        range->set_size(GlobalConfig().extentmanager().extent_size);
+        stub.Discard(
+                &ctxs[i].cntl, &req, &ctxs[i].response, brpc::DoNothing());
     }
 
     for (int i = 0; i < replicas; ++i) {
         brpc::Join(ctxs[i].cntl.call_id());
         if (ctxs[i].cntl.Failed()) {
-            LOG(ERROR) << "Couldn't send delete request: "
+            LOG(ERROR) << "Couldn't send discard request: "
                        << ctxs[i].cntl.ErrorText();
             return Status(common::CYPRE_EM_BRPC_SEND_FAIL);
         } else if (ctxs[i].response.status().code() != 0) {
-            LOG(ERROR) << "Couldn't delete: "
+            LOG(ERROR) << "Couldn't discard: "
                        << ctxs[i].response.status().message();
             return Status(ctxs[i].response.status().code());
         }
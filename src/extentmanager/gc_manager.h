@@ -39,8 +39,8 @@ private:
             const std::string &pool_id, const std::string &blob_id,
             bool delete_remote);
     Status deleteRemoteExtent(const std::string &extent_id);
-    Status deleteOneBlock(
-            const std::string &extent_id, uint64_t offset,
+    Status discardExtent(
+            const std::string &extent_id,
             const common::pb::ExtentRouter &router);
     Status reclaimExtent(
             const std::string &extent_id,
@@ -52,7 +52,6 @@ private:
             std::vector<common::ConnectionPtr> *conns);
 
     volatile bool gcing_;
-    const uint64_t block_size_ = 4 << 10;  // 4k
     std::unique_ptr<common::ConnectionPool> conn_pool_;
 
     struct ReclaimContext {
@@ -60,8 +59,8 @@ private:
         brpc::Controller cntl;
     };
 
-    struct DeleteContext {
-        extentserver::pb::DeleteResponse response;
+    struct DiscardContext {
+        extentserver::pb::DiscardResponse response;
         brpc::Controller cntl;
     };
 };
@@ -725,6 +725,41 @@ Status PoolManager::query_es_router(
     return iter->second->get_es_mgr()->query_es_router(es_group, router);
 }
 
+Status PoolManager::query_blob_routers(
+        const std::string &pool_id, const std::string &blob_id,
+        google::protobuf::RepeatedPtrField<common::pb::ExtentRouter> *routers,
+        uint32_t *router_version) {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    auto iter = pool_map_.find(pool_id);
+    if (iter == pool_map_.end()
+        || iter->second->status_ != kPoolStatusEnabled) {
+        LOG(ERROR) << "query routers failed, not found pool: " << pool_id;
+        return Status(common::CYPRE_EM_POOL_NOT_FOUND, "not found pool");
+    }
+    if (!iter->second->get_blob_mgr()->blob_valid(blob_id)) {
+        LOG(ERROR) << "query routers failed, not found blob: " << blob_id;
+        return Status(common::CYPRE_EM_BLOB_NOT_FOUND, "not found blob");
+    }
+
+    // a blob spreads over a few rgs, resolve each of them once
+    std::unordered_map<std::string, common::pb::ExtentRouter> rg_routers;
+    for (auto &router : *routers) {
+        auto rg_iter = rg_routers.find(router.rg_id());
+        if (rg_iter == rg_routers.end()) {
+            common::pb::ExtentRouter &es_router = rg_routers[router.rg_id()];
+            auto es_group =
+                    iter->second->get_rg_mgr()->query_es_group(router.rg_id());
+            iter->second->get_es_mgr()->query_es_router(es_group, &es_router);
+            rg_iter = rg_routers.find(router.rg_id());
+        }
+        *router.mutable_primary() = rg_iter->second.primary();
+        *router.mutable_secondaries() = rg_iter->second.secondaries();
+    }
+    *router_version = iter->second->router_version_;
+    return Status();
+}
+
 /*
  * replication group api
  */
@@ -192,6 +192,13 @@ public:
     Status query_es_router(
             const std::string &pool_id, const std::vector<int> &es_group,
             common::pb::ExtentRouter *router);
+    // fill es of routers (extent_id and rg_id set) of one blob, pool and
+    // blob are checked once and es of an rg are looked up once
+    Status query_blob_routers(
+            const std::string &pool_id, const std::string &blob_id,
+            google::protobuf::RepeatedPtrField<common::pb::ExtentRouter>
+                    *routers,
+            uint32_t *router_version);
 
     // replication group
     Status query_rg(
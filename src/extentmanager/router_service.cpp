@@ -9,6 +9,8 @@
 #include <brpc/server.h>
 #include <butil/logging.h>
 
+#include <vector>
+
 #include "common/error_code.h"
 #include "common/extent_id_generator.h"
 #include "common/pb/types.pb.h"
@@ -17,6 +19,9 @@
 namespace cyprestore {
 namespace extentmanager {
 
+// extents in one QueryRouters call, about 64k of response
+const uint64_t kMaxQueryRouters = 1024;
+
 void RouterServiceImpl::QueryRouter(
         google::protobuf::RpcController *cntl_base,
         const pb::QueryRouterRequest *request,
@@ -75,5 +80,90 @@ void RouterServiceImpl::QueryRouter(
     response->mutable_status()->set_code(common::CYPRE_OK);
 }
 
+void RouterServiceImpl::QueryRouters(
+        google::protobuf::RpcController *cntl_base,
+        const pb::QueryRoutersRequest *request,
+        pb::QueryRoutersResponse *response, google::protobuf::Closure *done) {
+    brpc::ClosureGuard done_guard(done);
+    // 1. check param
+    std::vector<uint64_t> indexes;
+    if (request->extent_indexes_size() > 0) {
+        indexes.assign(
+                request->extent_indexes().begin(),
+                request->extent_indexes().end());
+    } else if (request->has_begin_index() && request->has_end_index()
+               && request->begin_index() <= request->end_index()
+               && request->end_index() - request->begin_index()
+                          < kMaxQueryRouters) {
+        for (uint64_t i = request->begin_index(); i <= request->end_index();
+             ++i) {
+            indexes.push_back(i);
+        }
+    }
+    if (request->blob_id().empty() || indexes.empty()
+        || indexes.size() > kMaxQueryRouters) {
+        LOG(ERROR) << "Query routers failed, invalid blob id or extents"
+                   << ", blob_id:" << request->blob_id();
+        response->mutable_status()->set_code(common::CYPRE_ER_INVALID_ARGUMENT);
+        response->mutable_status()->set_message(
+                "blob id empty or too many extents");
+        return;
+    }
+
+    // 2. query rg_id & pool_id of every extent
+    std::string pool_id;
+    for (auto index : indexes) {
+        std::string extent_id = common::ExtentIDGenerator::GenerateExtentID(
+                request->blob_id(), index);
+        std::string rg_id;
+        std::string extent_pool_id;
+        auto status =
+                ExtentManager::GlobalInstance().get_router_mgr()->query_router(
+                        extent_id, &extent_pool_id, &rg_id);
+        if (status.code() == common::CYPRE_EM_ROUTER_NOT_FOUND) {
+            continue;
+        } else if (!status.ok()) {
+            LOG(ERROR) << "Query routers failed, status: " << status.ToString()
+                       << ", extent_id:" << extent_id;
+            response->mutable_status()->set_code(status.code());
+            response->mutable_status()->set_message(status.ToString());
+            return;
+        }
+        if (pool_id.empty()) {
+            pool_id = extent_pool_id;
+        } else if (pool_id != extent_pool_id) {
+            LOG(ERROR) << "Query routers, extent in another pool"
+                       << ", extent_id:" << extent_id;
+            continue;
+        }
+        common::pb::ExtentRouter *router = response->add_routers();
+        router->set_extent_id(extent_id);
+        router->set_rg_id(rg_id);
+    }
+    if (response->routers_size() == 0) {
+        response->mutable_status()->set_code(common::CYPRE_EM_ROUTER_NOT_FOUND);
+        response->mutable_status()->set_message("extent router not found");
+        return;
+    }
+
+    // 3. check pool and blob once, then query es of every rg
+    uint32_t router_version = 0;
+    auto status =
+            ExtentManager::GlobalInstance().get_pool_mgr()->query_blob_routers(
+                    pool_id, request->blob_id(), response->mutable_routers(),
+                    &router_version);
+    if (!status.ok()) {
+        LOG(ERROR) << "Query routers failed, pool or blob not valid, may have "
+                      "be deleted, blob_id:"
+                   << request->blob_id();
+        response->clear_routers();
+        response->mutable_status()->set_code(common::CYPRE_EM_BLOB_NOT_FOUND);
+        response->mutable_status()->set_message("extent router not found");
+        return;
+    }
+    response->set_router_version(router_version);
+    response->mutable_status()->set_code(common::CYPRE_OK);
+}
+
 }  // namespace extentmanager
 }  // namespace cyprestore
@@ -21,6 +21,12 @@ public:
             google::protobuf::RpcController *cntl_base,
             const pb::QueryRouterRequest *request,
             pb::QueryRouterResponse *response, google::protobuf::Closure *done);
+
+    virtual void QueryRouters(
+            google::protobuf::RpcController *cntl_base,
+            const pb::QueryRoutersRequest *request,
+            pb::QueryRoutersResponse *response,
+            google::protobuf::Closure *done);
 };
 
 }  // namespace extentmanager
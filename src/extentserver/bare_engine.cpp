@@ -44,7 +44,7 @@ Status BareEngine::Init() {
     if (!s.ok()) return s;
 
     extent_loc_mgr_.reset(new extentserver::ExtentLocationMgr());
-    return extent_loc_mgr_->Init(bdev_->capacity());
+    return extent_loc_mgr_->Init(bdev_);
 }
 
 Status BareEngine::unbindBDev() {
@@ -89,13 +89,79 @@ Status BareEngine::handleWrite(Request *req) {
 }
 
 Status BareEngine::handleDelete(Request *req) {
+    if (req->Offset() == 0 && req->Size() == se_->ExtentSize()) {
+        return deallocateExtent(req);
+    }
+
     auto status = extent_loc_mgr_->QueryLocation(req->ExtentID(), req, false);
     if (!status.ok()) {
-        return status;
+        // unallocated extent reads as zeros already
+        return Status(common::CYPRE_ES_EXTENT_EMPTY, "extent empty");
     }
+    // unmapped blocks may not read back as zeros, keep writing zeros
     return bdev_->ProcessRequest(req);
 }
 
+Status BareEngine::deallocateExtent(Request *req) {
+    uint64_t offset = 0, size = 0;
+    auto status =
+            extent_loc_mgr_->DetachExtent(req->ExtentID(), &offset, &size);
+    if (!status.ok()) {
+        return status;
+    }
+    if (size == 0) {
+        return Status(common::CYPRE_ES_EXTENT_EMPTY, "extent empty");
+    }
+    se_->waitLogClean(req->ExtentID());
+
+    // space goes back to allocator zeroed, a later extent reads zeros there
+    std::unique_ptr<DetachedSpace> space(new DetachedSpace());
+    space->engine = this;
+    space->offset = offset;
+    space->size = size;
+    space->user_cb = req->UserCallback();
+    space->user_arg = req->UserArg();
+    if (req->GetRequestType() == RequestType::kTypeReclaimExtent) {
+        req->SetReclaimSize(size);
+    }
+    req->SetPhysicalOffset(offset);
+    req->SetDeallocate(true);
+    req->SetUserCallback(deallocateDone);
+    req->SetUserArg(space.get());
+    status = bdev_->ProcessRequest(req);
+    if (!status.ok()) {
+        // not zeroed, kept out of allocator
+        LOG(ERROR) << "Couldn't zero space of " << req->ExtentID()
+                   << ", offset:" << offset << ", size:" << size;
+        req->SetDeallocate(false);
+        req->SetUserCallback(space->user_cb);
+        req->SetUserArg(space->user_arg);
+        return status;
+    }
+    // owned by deallocateDone now
+    space.release();
+    return status;
+}
+
+void *BareEngine::deallocateDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    DetachedSpace *space = static_cast<DetachedSpace *>(req->UserArg());
+    if (req->Result()) {
+        space->engine->extent_loc_mgr_->FreeSpace(space->offset, space->size);
+    } else {
+        // old data may still be there, kept out of allocator
+        LOG(ERROR) << "Couldn't zero space of " << req->ExtentID()
+                   << ", offset:" << space->offset << ", size:" << space->size;
+    }
+
+    UserCallback_t user_cb = space->user_cb;
+    req->SetDeallocate(false);
+    req->SetUserCallback(user_cb);
+    req->SetUserArg(space->user_arg);
+    delete space;
+    return user_cb(req);
+}
+
 Status BareEngine::handleScrub(Request *req) {
     auto status = extent_loc_mgr_->QueryLocation(req->ExtentID(), req, false);
     if (!status.ok()) {
@@ -106,7 +172,7 @@ Status BareEngine::handleScrub(Request *req) {
 
 Status BareEngine::handleReclaimExtent(Request *req) {
     se_->ExtentRouterMgr()->DeleteRouter(req->ExtentID());
-    return extent_loc_mgr_->ReclaimExtent(req->ExtentID());
+    return deallocateExtent(req);
 }
 
 Status BareEngine::PeriodDeviceAdmin() {
@@ -125,14 +191,16 @@ Status BareEngine::PeriodDeviceAdmin() {
 }
 
 Status BareEngine::ProcessRequest(Request *req) {
+    if (req->Discard()) {
+        return handleDelete(req);
+    }
+
     switch (req->GetRequestType()) {
         case RequestType::kTypeRead:
             return handleRead(req);
         case RequestType::kTypeWrite:
         case RequestType::kTypeReplicate:
             return handleWrite(req);
-        case RequestType::kTypeDelete:
-            return handleDelete(req);
         case RequestType::kTypeScrub:
             return handleScrub(req);
         case RequestType::kTypeReclaimExtent:
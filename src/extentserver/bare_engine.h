@@ -57,12 +57,24 @@ public:
 
 private:
     DISALLOW_COPY_AND_ASSIGN(BareEngine);
+
+    // space of a detached extent, freed once it reads as zeros
+    struct DetachedSpace {
+        BareEngine *engine;
+        uint64_t offset;
+        uint64_t size;
+        UserCallback_t user_cb;
+        void *user_arg;
+    };
+
+    static void *deallocateDone(void *arg);
     Status bindBDev();
     Status unbindBDev();
     Status handleRead(Request *req);
     Status handleWrite(Request *req);
     Status handleReplicate(Request *req);
     Status handleDelete(Request *req);
+    Status deallocateExtent(Request *req);
     Status handleScrub(Request *req);
     Status handleReclaimExtent(Request *req);
 
@@ -9,6 +9,11 @@
 #include <butil/fast_rand.h>
 #include <butil/logging.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
 
 #include "common/constants.h"
@@ -16,43 +21,64 @@
 namespace cyprestore {
 namespace extentserver {
 
+Chunk::Chunk(uint64_t chunk_idx, uint64_t num_blocks, uint64_t block_size)
+        : chunk_idx_(chunk_idx), num_blocks_(num_blocks),
+          num_free_blocks_(num_blocks), last_free_bit_(0),
+          block_size_(block_size) {
+    uint64_t num_units = (num_blocks + kBlocksPerUnit - 1) / kBlocksPerUnit;
+    data_.resize(num_units, 0);
+    summary_.resize((num_units + kBlocksPerUnit - 1) / kBlocksPerUnit, 0);
+
+    // padding bits never allocated
+    uint64_t tail = num_blocks % kBlocksPerUnit;
+    if (tail != 0) {
+        data_[num_units - 1] = kFullUnit << tail;
+    }
+    uint64_t summary_tail = num_units % kBlocksPerUnit;
+    if (summary_tail != 0) {
+        summary_[summary_.size() - 1] = kFullUnit << summary_tail;
+    }
+}
+
 Status Chunk::Allocate(uint64_t num_blocks, AUnit *aunit) {
     std::lock_guard<std::mutex> lock(lock_);
     if (!avaliable(num_blocks))
         return Status(common::CYPRE_ES_DISK_NO_SPACE, "no enough free blocks");
 
-    uint64_t begin = last_free_bit_;
-    uint64_t end = num_blocks_ - num_blocks;
-    while (begin <= end) {
-        uint64_t count = 0, index = 0, offset = 0;
-        while (count < num_blocks) {
-            index = getIndex(begin, count);
-            offset = getOffset(begin, count);
-            uint64_t val = data_[index] & (1ULL << offset);
-            if (val != 0) {
-                begin += num_blocks;
-                break;
-            }
-            ++count;
-        }
-        if (count == num_blocks) {
-            aunit->offset = (globalBlockIndex() + begin) * block_size_;
-            aunit->size = num_blocks * block_size_;
-            setBlock(begin, begin + num_blocks);
-            return Status();
-        }
+    // next fit from last allocation, then wrap around
+    uint64_t begin = findFreeRun(last_free_bit_, num_blocks_, num_blocks);
+    if (begin == kNoBlock && last_free_bit_ != 0) {
+        uint64_t limit = std::min(last_free_bit_ + num_blocks - 1, num_blocks_);
+        begin = findFreeRun(0, limit, num_blocks);
+    }
+    if (begin == kNoBlock) {
+        return Status(common::CYPRE_ES_DISK_NO_SPACE, "no enough space");
     }
 
-    return Status(common::CYPRE_ES_DISK_NO_SPACE, "no enough space");
+    aunit->offset = (globalBlockIndex() + begin) * block_size_;
+    aunit->size = num_blocks * block_size_;
+    setBlock(begin, begin + num_blocks);
+    last_free_bit_ = begin + num_blocks;
+    return Status();
 }
 
 void Chunk::Mark(uint64_t offset, uint64_t size) {
+    std::lock_guard<std::mutex> lock(lock_);
     uint64_t block_idx = offset / block_size_;
     uint64_t begin = block_idx - globalBlockIndex();
     uint64_t end = begin + size / block_size_;
     setBlock(begin, end);
 }
 
+void Chunk::MarkBatch(const AUnit *aunits, size_t num) {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (size_t i = 0; i < num; ++i) {
+        uint64_t begin = aunits[i].offset / block_size_ - globalBlockIndex();
+        uint64_t end = begin + aunits[i].size / block_size_;
+        setBlock(begin, end);
+    }
+}
+
 void Chunk::Free(uint64_t offset, uint64_t size) {
     std::lock_guard<std::mutex> lock(lock_);
     uint64_t block_idx = offset / block_size_;
@@ -61,31 +87,121 @@ void Chunk::Free(uint64_t offset, uint64_t size) {
     unsetBlock(begin, end);
 }
 
+uint64_t Chunk::nextNonFullUnit(uint64_t unit) {
+    uint64_t num_units = data_.size();
+    while (unit < num_units) {
+        uint64_t index = unit / kBlocksPerUnit;
+        uint64_t free_units =
+                ~summary_[index] & (kFullUnit << (unit % kBlocksPerUnit));
+        if (free_units != 0) {
+            return index * kBlocksPerUnit + __builtin_ctzll(free_units);
+        }
+        unit = (index + 1) * kBlocksPerUnit;
+    }
+    return num_units;
+}
+
+uint64_t Chunk::findUsed(uint64_t begin, uint64_t end) {
+    uint64_t unit = begin / kBlocksPerUnit;
+    uint64_t last_unit = (end - 1) / kBlocksPerUnit;
+    uint64_t used = data_[unit] & (kFullUnit << (begin % kBlocksPerUnit));
+    if (used != 0) {
+        return std::min(unit * kBlocksPerUnit + __builtin_ctzll(used), end);
+    }
+    if (unit == last_unit) {
+        return end;
+    }
+
+    ++unit;
+#ifdef __AVX2__
+    // 4 units (256 blocks) each step
+    while (unit + 4 <= last_unit) {
+        __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(&data_[unit]));
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+        unit += 4;
+    }
+#endif
+    for (; unit <= last_unit; ++unit) {
+        if (data_[unit] != 0) {
+            uint64_t block =
+                    unit * kBlocksPerUnit + __builtin_ctzll(data_[unit]);
+            return std::min(block, end);
+        }
+    }
+    return end;
+}
+
+uint64_t Chunk::findFreeRun(
+        uint64_t begin, uint64_t limit, uint64_t num_blocks) {
+    while (begin + num_blocks <= limit) {
+        uint64_t unit = begin / kBlocksPerUnit;
+        uint64_t free_bits =
+                ~data_[unit] & (kFullUnit << (begin % kBlocksPerUnit));
+        if (free_bits == 0) {
+            begin = nextNonFullUnit(unit + 1) * kBlocksPerUnit;
+            continue;
+        }
+
+        begin = unit * kBlocksPerUnit + __builtin_ctzll(free_bits);
+        if (begin + num_blocks > limit) {
+            break;
+        }
+        uint64_t used = findUsed(begin, begin + num_blocks);
+        if (used == begin + num_blocks) {
+            return begin;
+        }
+        begin = used + 1;
+    }
+    return kNoBlock;
+}
+
+void Chunk::updateSummary(uint64_t begin_unit, uint64_t end_unit) {
+    for (uint64_t unit = begin_unit; unit < end_unit; ++unit) {
+        uint64_t bit = 1ULL << (unit % kBlocksPerUnit);
+        if (data_[unit] == kFullUnit) {
+            summary_[unit / kBlocksPerUnit] |= bit;
+        } else {
+            summary_[unit / kBlocksPerUnit] &= ~bit;
+        }
+    }
+}
+
+// mask of bits [begin, end) in unit
+static inline uint64_t unitMask(uint64_t unit, uint64_t begin, uint64_t end) {
+    uint64_t first = unit * kBlocksPerUnit;
+    uint64_t lo = begin > first ? begin - first : 0;
+    uint64_t hi = std::min(end - first, kBlocksPerUnit);
+    uint64_t mask = hi == kBlocksPerUnit ? kFullUnit : ((1ULL << hi) - 1);
+    return mask & (kFullUnit << lo);
+}
+
 void Chunk::setBlock(uint64_t begin, uint64_t end) {
-    uint64_t index = 0, offset = 0;
-    uint64_t count = end - begin;
-    for (uint64_t i = 0; i < count; ++i) {
-        index = getIndex(begin, i);
-        offset = getOffset(begin, i);
-        assert((data_[index] & (1ULL << offset)) == 0 && "bit not equals 0");
-        data_[index] |= (1ULL << offset);
+    uint64_t begin_unit = begin / kBlocksPerUnit;
+    uint64_t end_unit = (end + kBlocksPerUnit - 1) / kBlocksPerUnit;
+    for (uint64_t unit = begin_unit; unit < end_unit; ++unit) {
+        uint64_t mask = unitMask(unit, begin, end);
+        assert((data_[unit] & mask) == 0 && "bit not equals 0");
+        data_[unit] |= mask;
     }
+    updateSummary(begin_unit, end_unit);
 
-    num_free_blocks_ -= count;
-    last_free_bit_ = end;
+    num_free_blocks_ -= end - begin;
 }
 
 void Chunk::unsetBlock(uint64_t begin, uint64_t end) {
-    uint64_t index = 0, offset = 0;
-    uint64_t count = end - begin;
-    for (uint64_t i = 0; i < count; ++i) {
-        index = getIndex(begin, i);
-        offset = getOffset(begin, i);
-        assert((data_[index] & (1ULL << offset)) == 1 && "bit not equals 1");
-        data_[index] &= ~(1ULL << offset);
+    uint64_t begin_unit = begin / kBlocksPerUnit;
+    uint64_t end_unit = (end + kBlocksPerUnit - 1) / kBlocksPerUnit;
+    for (uint64_t unit = begin_unit; unit < end_unit; ++unit) {
+        uint64_t mask = unitMask(unit, begin, end);
+        assert((data_[unit] & mask) == mask && "bit not equals 1");
+        data_[unit] &= ~mask;
     }
+    updateSummary(begin_unit, end_unit);
 
-    num_free_blocks_ += count;
+    num_free_blocks_ += end - begin;
     if (begin < last_free_bit_) last_free_bit_ = begin;
 }
 
@@ -147,5 +263,23 @@ void BitmapAllocator::Mark(uint64_t offset, uint64_t size) {
     chunks_[chunk_index]->Mark(offset, size);
 }
 
+void BitmapAllocator::MarkBatch(std::vector<AUnit> *aunits) {
+    std::sort(
+            aunits->begin(), aunits->end(),
+            [](const AUnit &a, const AUnit &b) { return a.offset < b.offset; });
+
+    size_t begin = 0;
+    while (begin < aunits->size()) {
+        uint64_t chunk_index = calcChunkIdxByOffset((*aunits)[begin].offset);
+        size_t end = begin + 1;
+        while (end < aunits->size()
+               && calcChunkIdxByOffset((*aunits)[end].offset) == chunk_index) {
+            ++end;
+        }
+        chunks_[chunk_index]->MarkBatch(&(*aunits)[begin], end - begin);
+        begin = end;
+    }
+}
+
 }  // namespace extentserver
 }  // namespace cyprestore
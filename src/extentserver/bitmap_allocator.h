@@ -24,6 +24,8 @@ const uint64_t kBlocksPerByte = 8;
 const uint64_t kBytesPerUnit = sizeof(uint64_t);                 // 8
 const uint64_t kBlocksPerUnit = kBlocksPerByte * kBytesPerUnit;  // 8 * 8 = 64
 const uint64_t kMaxBlocksPerChunk = 1024 * 1024;
+const uint64_t kFullUnit = ~0ULL;
+const uint64_t kNoBlock = ~0ULL;
 
 struct AUnit {
     AUnit() : offset(0), size(0) {}
@@ -40,18 +42,18 @@ struct AUnit {
 
 using common::Status;
 
+// Bit set means block used. Bits past num_blocks are set so the tail unit
+// looks like any other, and summary_ has one bit per full unit of data_
+// so that fully used regions are skipped 64 units at a time.
 class Chunk {
 public:
-    Chunk(uint64_t chunk_idx, uint64_t num_blocks, uint64_t block_size)
-            : chunk_idx_(chunk_idx), num_blocks_(num_blocks),
-              num_free_blocks_(num_blocks), last_free_bit_(0),
-              block_size_(block_size) {
-        data_.resize((num_blocks + kBlocksPerUnit - 1) / kBlocksPerUnit, 0);
-    }
+    Chunk(uint64_t chunk_idx, uint64_t num_blocks, uint64_t block_size);
 
     Status Allocate(uint64_t num_blocks, AUnit *aunit);
     void Free(uint64_t offset, uint64_t size);
     void Mark(uint64_t offset, uint64_t size);
+    // units must belong to this chunk, marked under one lock
+    void MarkBatch(const AUnit *aunits, size_t num);
 
     uint64_t UsedBlocks() {
         return num_blocks_ - FreeBlocks();
@@ -64,18 +66,19 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Chunk);
     void setBlock(uint64_t begin, uint64_t end);
     void unsetBlock(uint64_t begin, uint64_t end);
+    void updateSummary(uint64_t begin_unit, uint64_t end_unit);
+    // first block of a free run of num_blocks in [begin, limit)
+    uint64_t findFreeRun(uint64_t begin, uint64_t limit, uint64_t num_blocks);
+    // first used block in [begin, end), end if all free
+    uint64_t findUsed(uint64_t begin, uint64_t end);
+    // first unit not full at or after unit
+    uint64_t nextNonFullUnit(uint64_t unit);
     bool avaliable(uint64_t num_blocks) {
         return num_free_blocks_ >= num_blocks;
     }
     uint64_t globalBlockIndex() {
         return chunk_idx_ * kMaxBlocksPerChunk;
     }
-    uint64_t getIndex(uint64_t begin, uint64_t count) {
-        return (begin + count) / kBlocksPerUnit;
-    }
-    uint64_t getOffset(uint64_t begin, uint64_t count) {
-        return (begin + count) % kBlocksPerUnit;
-    }
 
     uint64_t chunk_idx_;
     uint64_t num_blocks_;
@@ -84,6 +87,7 @@ private:
     uint64_t block_size_;
     std::mutex lock_;
     std::vector<uint64_t> data_;
+    std::vector<uint64_t> summary_;
 };
 
 class BitmapAllocator {
@@ -95,6 +99,8 @@ public:
     Status Allocate(uint64_t want_size, AUnit *aunit);
     void Free(uint64_t offset, uint64_t size);
     void Mark(uint64_t offset, uint64_t size);
+    // sorts aunits by offset, marks them chunk by chunk
+    void MarkBatch(std::vector<AUnit> *aunits);
 
     uint64_t NumBlocks() {
         return capacity_ / block_size_;
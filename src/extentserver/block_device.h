@@ -62,6 +62,9 @@ public:
     virtual Status Close() = 0;
     virtual Status PeriodDeviceAdmin() = 0;
     virtual Status ProcessRequest(Request *req) = 0;
+    // dma memory for meta io
+    virtual void *AllocIOMem(size_t size) = 0;
+    virtual void FreeIOMem(void *p) = 0;
 
     void dump();
 
@@ -16,6 +16,28 @@
 namespace cyprestore {
 namespace extentserver {
 
+void *ExtentControlServiceImpl::ReclaimExtentDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    auto &op_ctx = req->GetOperationContext();
+    brpc::ClosureGuard done_guard(op_ctx.done);
+
+    pb::ReclaimExtentRequest *request =
+            static_cast<pb::ReclaimExtentRequest *>(op_ctx.request);
+    pb::ReclaimExtentResponse *response =
+            static_cast<pb::ReclaimExtentResponse *>(op_ctx.response);
+    if (!req->Result()) {
+        LOG(ERROR) << "Couldn't reclaim extent"
+                   << ", extent_id:" << request->extent_id();
+        response->mutable_status()->set_code(
+                common::CYPRE_ES_PROCESS_REQ_ERROR);
+        response->mutable_status()->set_message("reclaim error");
+    } else {
+        response->mutable_status()->set_code(common::CYPRE_OK);
+    }
+    ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
+    return nullptr;
+}
+
 void ExtentControlServiceImpl::ReclaimExtent(
         google::protobuf::RpcController *cntl_base,
         const pb::ReclaimExtentRequest *request,
@@ -33,22 +55,24 @@ void ExtentControlServiceImpl::ReclaimExtent(
         response->mutable_status()->set_message("internal io error");
         return;
     }
-    // sync
-    auto storage_engine = ExtentServer::GlobalInstance().StorageEngine();
+
+    // async, space is zeroed or unmapped before it goes back to allocator
+    done_guard.release();
     req->SetOperationContext(
             cntl, const_cast<pb::ReclaimExtentRequest *>(request), response,
             done);
+    req->SetUserCallback(ReclaimExtentDone);
+    auto storage_engine = ExtentServer::GlobalInstance().StorageEngine();
     auto s = storage_engine->ProcessRequest(req);
-    ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
-    if (!s.ok()) {
+    if (s.IsEmpty()) {
+        req->SetResult(true);
+        ReclaimExtentDone((void *)req);
+    } else if (!s.ok()) {
         LOG(ERROR) << "Couldn't process reclaim extent request, "
                    << s.ToString() << ", extent_id:" << request->extent_id();
-        response->mutable_status()->set_code(
-                common::CYPRE_ES_PROCESS_REQ_ERROR);
-        response->mutable_status()->set_message(s.ToString());
-        return;
+        req->SetResult(false);
+        ReclaimExtentDone((void *)req);
     }
-    response->mutable_status()->set_code(common::CYPRE_OK);
 }
 
 }  // namespace extentserver
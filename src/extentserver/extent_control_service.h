@@ -26,6 +26,9 @@ public:
             const pb::ReclaimExtentRequest *request,
             pb::ReclaimExtentResponse *response,
             google::protobuf::Closure *done);
+
+private:
+    static void *ReclaimExtentDone(void *arg);
 };
 
 }  // namespace extentserver
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "extent_index.h"
+
+#include <stdlib.h>
+
+#include <new>  // placement new
+
+#include "bthread/bthread.h"
+#include "butil/logging.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+const uint64_t ExtentIndex::kMinCapacity;
+
+ExtentKey ExtentKey::FromExtentID(const std::string &extent_id) {
+    return FromExtentID(butil::StringPiece(extent_id));
+}
+
+ExtentKey ExtentKey::FromExtentID(const butil::StringPiece &extent_id) {
+    uint64_t hash[2];
+    auto pos = extent_id.rfind('.');
+    if (pos == butil::StringPiece::npos || pos + 1 == extent_id.size()) {
+        butil::MurmurHash3_x64_128(
+                extent_id.data(), extent_id.size(), 0, hash);
+        return ExtentKey(hash[0], 0);
+    }
+
+    // blob_id.extent_index, otherwise the whole id is treated as blob
+    uint64_t extent_index = 0;
+    for (size_t i = pos + 1; i < extent_id.size(); ++i) {
+        if (extent_id[i] < '0' || extent_id[i] > '9') {
+            butil::MurmurHash3_x64_128(
+                    extent_id.data(), extent_id.size(), 0, hash);
+            return ExtentKey(hash[0], 0);
+        }
+        extent_index = extent_index * 10 + (extent_id[i] - '0');
+    }
+    butil::MurmurHash3_x64_128(extent_id.data(), pos, 0, hash);
+    return ExtentKey(hash[0], extent_index);
+}
+
+uint64_t ExtentKey::Hash() const {
+    return butil::fmix64(blob_hash ^ butil::fmix64(extent_index));
+}
+
+ExtentIndex::Table::Table(uint64_t capacity_)
+        : capacity(capacity_), mask(capacity_ - 1), erase_seq(0),
+          slots(nullptr) {
+    void *mem = nullptr;
+    if (posix_memalign(&mem, alignof(Slot), sizeof(Slot) * capacity) != 0) {
+        LOG(FATAL) << "Couldn't alloc extent index, capacity: " << capacity;
+    }
+    slots = static_cast<Slot *>(mem);
+    for (uint64_t i = 0; i < capacity; ++i) {
+        new (&slots[i]) Slot();
+    }
+}
+
+ExtentIndex::Table::~Table() {
+    for (uint64_t i = 0; i < capacity; ++i) {
+        slots[i].~Slot();
+    }
+    free(slots);
+}
+
+ExtentIndex::ExtentIndex(uint64_t init_capacity) : table_(nullptr), size_(0) {
+    uint64_t capacity = kMinCapacity;
+    while (capacity < init_capacity) {
+        capacity <<= 1;
+    }
+    tables_.emplace_back(new Table(capacity));
+    table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+bool ExtentIndex::Lookup(
+        const ExtentKey &key, uint64_t *offset, uint64_t *size) const {
+    const Table *table = table_.load(std::memory_order_acquire);
+    uint64_t home = key.Hash() & table->mask;
+    while (true) {
+        uint64_t erase_seq = table->erase_seq.load(std::memory_order_acquire);
+        for (uint64_t i = 0; i < table->capacity; ++i) {
+            const Slot &slot = table->slots[(home + i) & table->mask];
+            uint32_t seq, state;
+            uint64_t blob_hash, extent_index, off, sz;
+            do {
+                seq = slot.seq.load(std::memory_order_acquire);
+                state = slot.state.load(std::memory_order_relaxed);
+                blob_hash = slot.blob_hash.load(std::memory_order_relaxed);
+                extent_index =
+                        slot.extent_index.load(std::memory_order_relaxed);
+                off = slot.offset.load(std::memory_order_relaxed);
+                sz = slot.size.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1)
+                     || seq != slot.seq.load(std::memory_order_relaxed));
+
+            if (state == kSlotEmpty) {
+                break;
+            }
+            if (blob_hash == key.blob_hash
+                && extent_index == key.extent_index) {
+                *offset = off;
+                *size = sz;
+                return true;
+            }
+        }
+
+        // entries may be shifted backward by erase while probing
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(erase_seq & 1)
+            && erase_seq == table->erase_seq.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+}
+
+void ExtentIndex::writeSlot(
+        Slot *slot, uint32_t state, uint64_t blob_hash, uint64_t extent_index,
+        uint64_t offset, uint64_t size) {
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->state.store(state, std::memory_order_relaxed);
+    slot->blob_hash.store(blob_hash, std::memory_order_relaxed);
+    slot->extent_index.store(extent_index, std::memory_order_relaxed);
+    slot->offset.store(offset, std::memory_order_relaxed);
+    slot->size.store(size, std::memory_order_relaxed);
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+uint64_t ExtentIndex::findSlot(
+        const Table *table, const ExtentKey &key, bool *found) {
+    uint64_t pos = key.Hash() & table->mask;
+    while (true) {
+        const Slot &slot = table->slots[pos];
+        if (slot.state.load(std::memory_order_relaxed) == kSlotEmpty) {
+            *found = false;
+            return pos;
+        }
+        if (slot.blob_hash.load(std::memory_order_relaxed) == key.blob_hash
+            && slot.extent_index.load(std::memory_order_relaxed)
+                       == key.extent_index) {
+            *found = true;
+            return pos;
+        }
+        pos = (pos + 1) & table->mask;
+    }
+}
+
+void ExtentIndex::growIfNeeded() {
+    Table *table = table_.load(std::memory_order_relaxed);
+    // keep load factor under 0.5, probing stays short
+    if ((size_.load(std::memory_order_relaxed) + 1) * 2 <= table->capacity) {
+        return;
+    }
+
+    Table *new_table = new Table(table->capacity << 1);
+    for (uint64_t i = 0; i < table->capacity; ++i) {
+        const Slot &slot = table->slots[i];
+        if (slot.state.load(std::memory_order_relaxed) != kSlotUsed) {
+            continue;
+        }
+        ExtentKey key(
+                slot.blob_hash.load(std::memory_order_relaxed),
+                slot.extent_index.load(std::memory_order_relaxed));
+        bool found = false;
+        uint64_t pos = findSlot(new_table, key, &found);
+        writeSlot(
+                &new_table->slots[pos], kSlotUsed, key.blob_hash,
+                key.extent_index, slot.offset.load(std::memory_order_relaxed),
+                slot.size.load(std::memory_order_relaxed));
+    }
+
+    // readers still probing the old table see a consistent snapshot
+    tables_.emplace_back(new_table);
+    table_.store(new_table, std::memory_order_release);
+    LOG(INFO) << "Extent index grows to " << new_table->capacity;
+}
+
+void ExtentIndex::Insert(const ExtentKey &key, uint64_t offset, uint64_t size) {
+    std::lock_guard<std::mutex> lock(lock_);
+    growIfNeeded();
+
+    Table *table = table_.load(std::memory_order_relaxed);
+    bool found = false;
+    uint64_t pos = findSlot(table, key, &found);
+    writeSlot(
+            &table->slots[pos], kSlotUsed, key.blob_hash, key.extent_index,
+            offset, size);
+    if (!found) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool ExtentIndex::Erase(const ExtentKey &key) {
+    std::lock_guard<std::mutex> lock(lock_);
+    Table *table = table_.load(std::memory_order_relaxed);
+    bool found = false;
+    uint64_t hole = findSlot(table, key, &found);
+    if (!found) {
+        return false;
+    }
+
+    uint64_t erase_seq = table->erase_seq.load(std::memory_order_relaxed);
+    table->erase_seq.store(erase_seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // backward shift: move following entries whose home is not in
+    // (hole, pos] into the hole, so no tombstone is needed
+    uint64_t pos = hole;
+    while (true) {
+        pos = (pos + 1) & table->mask;
+        Slot *slot = &table->slots[pos];
+        if (slot->state.load(std::memory_order_relaxed) == kSlotEmpty) {
+            break;
+        }
+
+        ExtentKey moved(
+                slot->blob_hash.load(std::memory_order_relaxed),
+                slot->extent_index.load(std::memory_order_relaxed));
+        uint64_t home = moved.Hash() & table->mask;
+        bool in_range = (hole <= pos) ? (hole < home && home <= pos)
+                                      : (hole < home || home <= pos);
+        if (in_range) {
+            continue;
+        }
+
+        writeSlot(
+                &table->slots[hole], kSlotUsed, moved.blob_hash,
+                moved.extent_index,
+                slot->offset.load(std::memory_order_relaxed),
+                slot->size.load(std::memory_order_relaxed));
+        hole = pos;
+    }
+    writeSlot(&table->slots[hole], kSlotEmpty, 0, 0, 0, 0);
+
+    table->erase_seq.store(erase_seq + 2, std::memory_order_release);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::atomic<int64_t> *ExtentIOGates::Enter(const ExtentKey &key) {
+    Gate &gate = gates_[key.Hash() & (kNumStripes - 1)];
+    while (true) {
+        uint64_t epoch = gate.epoch.load();
+        std::atomic<int64_t> *inflight = &gate.inflight[epoch & 1];
+        inflight->fetch_add(1);
+        // a drain flipped the epoch meanwhile and may have missed us
+        if (gate.epoch.load() == epoch) {
+            return inflight;
+        }
+        inflight->fetch_sub(1);
+    }
+}
+
+void ExtentIOGates::Drain(const ExtentKey &key) {
+    Gate &gate = gates_[key.Hash() & (kNumStripes - 1)];
+    uint64_t epoch = gate.epoch.fetch_add(1);
+    while (gate.inflight[epoch & 1].load() != 0) {
+        bthread_usleep(100);
+    }
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
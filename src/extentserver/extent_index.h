@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_EXTENT_INDEX_H_
+#define CYPRESTORE_EXTENTSERVER_EXTENT_INDEX_H_
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <butil/strings/string_piece.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cyprestore {
+namespace extentserver {
+
+// numeric form of extent id "blob_id.extent_index"
+struct ExtentKey {
+    ExtentKey() : blob_hash(0), extent_index(0) {}
+    ExtentKey(uint64_t blob_hash_, uint64_t extent_index_)
+            : blob_hash(blob_hash_), extent_index(extent_index_) {}
+
+    static ExtentKey FromExtentID(const std::string &extent_id);
+    static ExtentKey FromExtentID(const butil::StringPiece &extent_id);
+    static ExtentKey FromExtentID(const char *extent_id) {
+        return FromExtentID(butil::StringPiece(extent_id));
+    }
+
+    bool operator==(const ExtentKey &other) const {
+        return blob_hash == other.blob_hash
+               && extent_index == other.extent_index;
+    }
+
+    uint64_t Hash() const;
+
+    uint64_t blob_hash;
+    uint64_t extent_index;
+};
+
+// Open addressing (linear probing) table of extent locations.
+// Readers are lock free: every slot is a seqlock so a hit costs one cache
+// line, and a miss is validated by the table's erase sequence because
+// erase shifts entries backward instead of leaving tombstones.
+// Writers are serialized by a mutex, tables replaced by growth are
+// retired and released with the index.
+class ExtentIndex {
+public:
+    explicit ExtentIndex(uint64_t init_capacity = kMinCapacity);
+    ~ExtentIndex() = default;
+
+    bool Lookup(const ExtentKey &key, uint64_t *offset, uint64_t *size) const;
+    void Insert(const ExtentKey &key, uint64_t offset, uint64_t size);
+    bool Erase(const ExtentKey &key);
+
+    uint64_t Size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+    uint64_t Capacity() const {
+        return table_.load(std::memory_order_acquire)->capacity;
+    }
+
+    static const uint64_t kMinCapacity = 1024;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ExtentIndex);
+
+    enum SlotState {
+        kSlotEmpty = 0,
+        kSlotUsed,
+    };
+
+    struct alignas(64) Slot {
+        Slot()
+                : seq(0), state(kSlotEmpty), blob_hash(0), extent_index(0),
+                  offset(0), size(0) {}
+
+        std::atomic<uint32_t> seq;  // odd while writer updating
+        std::atomic<uint32_t> state;
+        std::atomic<uint64_t> blob_hash;
+        std::atomic<uint64_t> extent_index;
+        std::atomic<uint64_t> offset;
+        std::atomic<uint64_t> size;
+    };
+
+    struct Table {
+        explicit Table(uint64_t capacity_);
+        ~Table();
+
+        uint64_t capacity;
+        uint64_t mask;
+        std::atomic<uint64_t> erase_seq;  // odd while erase shifting slots
+        Slot *slots;                      // cache line aligned
+    };
+
+    // writer side, with lock_ held
+    static void writeSlot(
+            Slot *slot, uint32_t state, uint64_t blob_hash,
+            uint64_t extent_index, uint64_t offset, uint64_t size);
+    void growIfNeeded();
+    static uint64_t findSlot(
+            const Table *table, const ExtentKey &key, bool *found);
+
+    std::atomic<Table *> table_;
+    std::atomic<uint64_t> size_;
+    std::vector<std::unique_ptr<Table>> tables_;  // current and retired
+    std::mutex lock_;
+};
+
+// striped allocation locks, nothing to release when extent is gone.
+// bthread mutex, holder may suspend while its location is persisted
+class ExtentLockStripes {
+public:
+    ExtentLockStripes() = default;
+    ~ExtentLockStripes() = default;
+
+    bthread::Mutex &GetLock(const ExtentKey &key) {
+        return locks_[key.Hash() & (kNumStripes - 1)];
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ExtentLockStripes);
+
+    static const uint32_t kNumStripes = 64;
+    bthread::Mutex locks_[kNumStripes];
+};
+
+// io holding a physical offset of an extent is counted in the gate of its
+// stripe till the request is put back, so space of a detached extent is
+// kept till io that may have seen its location is done. Drain flips the
+// epoch of the gate and waits io entered in the previous one out.
+// Stripes match ExtentLockStripes, drains are serialized by extent lock.
+class ExtentIOGates {
+public:
+    ExtentIOGates() = default;
+    ~ExtentIOGates() = default;
+
+    // counter to decrease once the io is done
+    std::atomic<int64_t> *Enter(const ExtentKey &key);
+    void Drain(const ExtentKey &key);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ExtentIOGates);
+
+    struct Gate {
+        Gate() : epoch(0) {
+            inflight[0] = 0;
+            inflight[1] = 0;
+        }
+
+        std::atomic<uint64_t> epoch;
+        std::atomic<int64_t> inflight[2];
+    };
+
+    static const uint32_t kNumStripes = 64;
+    Gate gates_[kNumStripes];
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_EXTENT_INDEX_H_
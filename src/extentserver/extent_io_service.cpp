@@ -8,9 +8,12 @@
 
 #include <brpc/server.h>
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "extentserver.h"
+#include "replicate_receiver.h"
 #include "request_context.h"
 #include "storage_engine.h"
 #include "utils/crc32.h"
@@ -24,6 +27,17 @@ void ExtentIOServiceImpl::ReclaimIOUnit(void *arg) {
     ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
 }
 
+void ExtentIOServiceImpl::ReclaimVecIOUnit(void *arg) {
+    IOUnitSlot *slot = static_cast<IOUnitSlot *>(arg);
+    Request *req = slot->req;
+    req->GetIOMemMgr()->PutIOUnit(slot->io);
+    // last unit released, give back iovec table and request
+    if (req->FetchAndSubRef() == 1) {
+        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
+        ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
+    }
+}
+
 void* ExtentIOServiceImpl::ReadDone(void *arg) {
     Request *req = static_cast<Request *>(arg);
     auto &op_ctx = req->GetOperationContext();
@@ -42,7 +56,19 @@ void* ExtentIOServiceImpl::ReadDone(void *arg) {
                 common::CYPRE_ES_PROCESS_REQ_ERROR);
         response->mutable_status()->set_message("read io error");
     } else {
-        if (req->IOUnit() != nullptr) {
+        if (req->IOUnit() != nullptr && req->Vectored()) {
+            req->EndTraceTime();
+            // each unit is released by its own block of the response
+            struct iovec *iovs = req->IOVecs();
+            IOUnitSlot *slots = req->IOUnitSlots();
+            req->SetRefCount(req->NumIOVecs());
+            for (uint32_t i = 0; i < req->NumIOVecs(); ++i) {
+                op_ctx.cntl->response_attachment().append_user_data(
+                        iovs[i].iov_base, iovs[i].iov_len, ReclaimVecIOUnit,
+                        &slots[i]);
+            }
+            reclaimed = true;
+        } else if (req->IOUnit() != nullptr) {
             req->EndTraceTime();
             op_ctx.cntl->response_attachment().append_user_data(
                     req->IOUnit()->data, req->Size(), ReclaimIOUnit, req);
@@ -50,8 +76,8 @@ void* ExtentIOServiceImpl::ReadDone(void *arg) {
         }
         response->mutable_status()->set_code(common::CYPRE_OK);
     }
-    if (req->IOUnit() != nullptr && !reclaimed) {
-        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
+    if (!reclaimed) {
+        req->ReleaseIOUnits();
     }
 
     if (!reclaimed) {
@@ -67,6 +93,8 @@ void ExtentIOServiceImpl::Read(
         google::protobuf::Closure *done) {
     brpc::ClosureGuard done_guard(done);
     brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+    response->set_router_version(
+            ExtentServer::GlobalInstance().RouterVersion());
 
     Request *req = ExtentServer::GlobalInstance().RequestMgr()->GetRequest(
             RequestType::kTypeRead);
@@ -129,9 +157,7 @@ void *ExtentIOServiceImpl::WriteDone(void *arg) {
     } else {
         response->mutable_status()->set_code(common::CYPRE_OK);
     }
-    if (req->IOUnit() != nullptr) {
-        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
-    }
+    req->ReleaseIOUnits();
     req->EndTraceTime();
     ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
     return nullptr;
@@ -143,6 +169,8 @@ void ExtentIOServiceImpl::Write(
         google::protobuf::Closure *done) {
     brpc::ClosureGuard done_guard(done);
     brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+    response->set_router_version(
+            ExtentServer::GlobalInstance().RouterVersion());
 
     Request *req = ExtentServer::GlobalInstance().RequestMgr()->GetRequest(
             RequestType::kTypeWrite);
@@ -198,9 +226,7 @@ void *ExtentIOServiceImpl::DeleteDone(void *arg) {
     } else {
         response->mutable_status()->set_code(common::CYPRE_OK);
     }
-    if (req->IOUnit() != nullptr) {
-        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
-    }
+    req->ReleaseIOUnits();
     req->EndTraceTime();
     ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
     return nullptr;
@@ -234,7 +260,10 @@ void ExtentIOServiceImpl::Delete(
     req->SetUserCallback(DeleteDone);
     auto storage_engine = ExtentServer::GlobalInstance().StorageEngine();
     auto s = storage_engine->ProcessRequest(req);
-    if (!s.ok()) {
+    if (s.IsEmpty()) {
+        req->SetResult(true);
+        DeleteDone((void *)req);
+    } else if (!s.ok()) {
         LOG(ERROR) << "Couldn't process delete request, " << s.ToString()
                    << ", extent_id:" << request->extent_id()
                    << ", offset:" << request->offset()
@@ -244,6 +273,129 @@ void ExtentIOServiceImpl::Delete(
     }
 }
 
+namespace {
+
+const int kMaxDiscardRanges = 1024;
+
+// one discard rpc, answered when its last range is done
+struct DiscardBatch {
+    pb::DiscardResponse *response;
+    google::protobuf::Closure *done;
+    std::vector<pb::WriteRequest> ranges;
+    // ranges in flight plus the submitter
+    std::atomic<int> pending;
+    std::atomic<bool> failed;
+
+    DiscardBatch() : pending(0), failed(false) {}
+};
+
+void putDiscardBatch(DiscardBatch *batch) {
+    if (batch->pending.fetch_sub(1) != 1) {
+        return;
+    }
+
+    if (batch->failed) {
+        batch->response->mutable_status()->set_code(
+                common::CYPRE_ES_PROCESS_REQ_ERROR);
+        batch->response->mutable_status()->set_message("discard error");
+    } else {
+        batch->response->mutable_status()->set_code(common::CYPRE_OK);
+    }
+    batch->done->Run();
+    delete batch;
+}
+
+}  // namespace
+
+void *ExtentIOServiceImpl::DiscardRangeDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    // local discard and replicas, like a write
+    if (req->FetchAndSubRef() != 1) {
+        return nullptr;
+    }
+    DiscardBatch *batch = static_cast<DiscardBatch *>(req->UserArg());
+    if (!req->Result()) {
+        auto &op_ctx = req->GetOperationContext();
+        pb::WriteRequest *range =
+                static_cast<pb::WriteRequest *>(op_ctx.request);
+        LOG(ERROR) << "Couldn't discard extent"
+                   << ", extent_id:" << range->extent_id()
+                   << ", offset:" << range->offset()
+                   << ", size:" << range->size();
+        batch->failed = true;
+    }
+    req->ReleaseIOUnits();
+    req->EndTraceTime();
+    ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
+    putDiscardBatch(batch);
+    return nullptr;
+}
+
+void ExtentIOServiceImpl::Discard(
+        google::protobuf::RpcController *cntl_base,
+        const pb::DiscardRequest *request, pb::DiscardResponse *response,
+        google::protobuf::Closure *done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+
+    if (request->ranges_size() > kMaxDiscardRanges) {
+        LOG(ERROR) << "Too many discard ranges:" << request->ranges_size();
+        response->mutable_status()->set_code(common::CYPRE_ER_INVALID_ARGUMENT);
+        response->mutable_status()->set_message("too many ranges");
+        return;
+    }
+
+    DiscardBatch *batch = new DiscardBatch();
+    batch->response = response;
+    batch->done = done_guard.release();
+    batch->ranges.resize(request->ranges_size());
+    batch->pending = request->ranges_size() + 1;
+    auto storage_engine = ExtentServer::GlobalInstance().StorageEngine();
+    for (int i = 0; i < request->ranges_size(); ++i) {
+        // ranges are replicated like writes without data, so secondaries
+        // get them in order with writes, and zeroed like deletes
+        const pb::DiscardRange &range = request->ranges(i);
+        pb::WriteRequest *discard = &batch->ranges[i];
+        discard->set_extent_id(range.extent_id());
+        discard->set_offset(range.offset());
+        discard->set_size(range.size());
+        discard->set_discard(true);
+        if (request->client_replicated()) {
+            discard->set_client_replicated(true);
+        }
+
+        Request *req = ExtentServer::GlobalInstance().RequestMgr()->GetRequest(
+                RequestType::kTypeWrite);
+        if (req == nullptr) {
+            LOG(ERROR) << "Couldn't get [Request]"
+                       << ", extent_id:" << range.extent_id()
+                       << ", offset:" << range.offset()
+                       << ", size:" << range.size();
+            batch->failed = true;
+            putDiscardBatch(batch);
+            continue;
+        }
+
+        req->BeginTraceTime();
+        req->SetOperationContext(cntl, discard, nullptr, nullptr);
+        req->SetUserCallback(DiscardRangeDone);
+        req->SetUserArg(batch);
+        auto s = storage_engine->ProcessRequest(req);
+        if (s.IsEmpty()) {
+            req->SetResult(true);
+            DiscardRangeDone((void *)req);
+        } else if (!s.ok()) {
+            LOG(ERROR) << "Couldn't process discard request, " << s.ToString()
+                       << ", extent_id:" << range.extent_id()
+                       << ", offset:" << range.offset()
+                       << ", size:" << range.size();
+            req->SetResult(false);
+            DiscardRangeDone((void *)req);
+        }
+    }
+    putDiscardBatch(batch);
+}
+
 void *ExtentIOServiceImpl::ReplicateDone(void *arg) {
     Request *req = static_cast<Request *>(arg);
     auto &op_ctx = req->GetOperationContext();
@@ -264,9 +416,7 @@ void *ExtentIOServiceImpl::ReplicateDone(void *arg) {
     } else {
         response->mutable_status()->set_code(common::CYPRE_OK);
     }
-    if (req->IOUnit() != nullptr) {
-        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
-    }
+    req->ReleaseIOUnits();
     req->EndTraceTime();
     ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
     return nullptr;
@@ -300,7 +450,11 @@ void ExtentIOServiceImpl::Replicate(
     req->SetUserCallback(ReplicateDone);
     auto storage_engine = ExtentServer::GlobalInstance().StorageEngine();
     auto s = storage_engine->ProcessRequest(req);
-    if (!s.ok()) {
+    if (s.IsEmpty()) {
+        // discard of a range never written here
+        req->SetResult(true);
+        ReplicateDone((void *)req);
+    } else if (!s.ok()) {
         LOG(ERROR) << "Couldn't process replicate request, " << s.ToString()
                    << ", extent_id:" << request->extent_id()
                    << ", offset:" << request->offset()
@@ -310,6 +464,30 @@ void ExtentIOServiceImpl::Replicate(
     }
 }
 
+void ExtentIOServiceImpl::OpenReplicateStream(
+        google::protobuf::RpcController *cntl_base,
+        const pb::OpenReplicateStreamRequest *request,
+        pb::OpenReplicateStreamResponse *response,
+        google::protobuf::Closure *done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+
+    auto s = ReplicateStreamReceiver::Accept(cntl, *request, this);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't accept replicate stream, " << s.ToString()
+                   << ", primary:" << request->primary()
+                   << ", first_seq:" << request->first_seq();
+        response->mutable_status()->set_code(s.code());
+        response->mutable_status()->set_message(s.ToString());
+        return;
+    }
+
+    LOG(INFO) << "Accepted replicate stream"
+              << ", primary:" << request->primary()
+              << ", first_seq:" << request->first_seq();
+    response->mutable_status()->set_code(common::CYPRE_OK);
+}
+
 void *ExtentIOServiceImpl::ScrubDone(void *arg) {
     Request *req = static_cast<Request *>(arg);
     auto &op_ctx = req->GetOperationContext();
@@ -333,9 +511,7 @@ void *ExtentIOServiceImpl::ScrubDone(void *arg) {
         }
         response->mutable_status()->set_code(common::CYPRE_OK);
     }
-    if (req->IOUnit() != nullptr) {
-        req->GetIOMemMgr()->PutIOUnit(req->IOUnit());
-    }
+    req->ReleaseIOUnits();
     req->EndTraceTime();
     ExtentServer::GlobalInstance().RequestMgr()->PutRequest(req);
     return nullptr;
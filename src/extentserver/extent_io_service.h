@@ -22,6 +22,7 @@ public:
     virtual ~ExtentIOServiceImpl() = default;
 
     static void ReclaimIOUnit(void *arg);
+    static void ReclaimVecIOUnit(void *arg);
     static void *ReadDone(void *arg);
     virtual void
     Read(google::protobuf::RpcController *cntl_base,
@@ -40,12 +41,25 @@ public:
            const pb::DeleteRequest *request, pb::DeleteResponse *response,
            google::protobuf::Closure *done);
 
+    static void *DiscardRangeDone(void *arg);
+    virtual void
+    Discard(google::protobuf::RpcController *cntl_base,
+            const pb::DiscardRequest *request, pb::DiscardResponse *response,
+            google::protobuf::Closure *done);
+
     static void *ReplicateDone(void *arg);
     virtual void Replicate(
             google::protobuf::RpcController *cntl_base,
             const pb::ReplicateRequest *request,
             pb::ReplicateResponse *response, google::protobuf::Closure *done);
 
+    // frames of the stream go through Replicate as well
+    virtual void OpenReplicateStream(
+            google::protobuf::RpcController *cntl_base,
+            const pb::OpenReplicateStreamRequest *request,
+            pb::OpenReplicateStreamResponse *response,
+            google::protobuf::Closure *done);
+
     static void *ScrubDone(void *arg);
     virtual void
     Scrub(google::protobuf::RpcController *cntl_base,
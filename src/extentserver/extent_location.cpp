@@ -6,12 +6,20 @@
 
 #include "extent_location.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <cereal/archives/binary.hpp>
 #include <sstream>
+#include <thread>
 #include <utility>
 
 #include "butil/logging.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "common/constants.h"
 #include "extentserver.h"
+#include "meta_journal.h"
 #include "utils/coding.h"
 #include "utils/crc32.h"
 #include "utils/serializer.h"
@@ -19,59 +27,157 @@
 namespace cyprestore {
 namespace extentserver {
 
-Status ExtentLocationMgr::Init(uint64_t disk_capacity) {
-    space_alloc_.reset(new extentserver::SpaceAlloc(disk_capacity));
+bvar::LatencyRecorder g_extent_alloc_latency("extent_alloc_latency");
+bvar::Status<int64_t> g_recovery_time_ms("extent_recovery_time_ms", 0);
+bvar::Status<int64_t> g_recovery_extents("extent_recovery_extents", 0);
+bvar::Status<int64_t> g_recovery_rate("extent_recovery_extents_per_second", 0);
+
+namespace {
+
+// extent offsets are block aligned, so the low byte of a cereal encoded
+// value (offset first) is always 0, never this tag
+const char kExtentLocFixedTag = 'L';
+const size_t kExtentLocFixedSize = 1 + 8 + 8 + 4;
+
+}  // namespace
+
+std::string ExtentLocation::Encode() const {
+    std::string value;
+    value.reserve(kExtentLocFixedSize + extent_id.size());
+    value.push_back(kExtentLocFixedTag);
+    value.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
+    value.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    value.append(extent_id);
+    utils::Coding::PutFixed32(&value, utils::Crc32::Checksum(value));
+    return value;
+}
+
+bool ExtentLocationView::Decode(
+        const std::string &value, ExtentLocationView *view) {
+    if (value.size() < kExtentLocFixedSize || value[0] != kExtentLocFixedTag) {
+        return false;
+    }
+
+    size_t len = value.size() - 4;
+    uint32_t crc = utils::Coding::DecodeFixed32(value.data() + len);
+    if (crc != utils::Crc32::Checksum(value.data(), len)) {
+        return false;
+    }
+    memcpy(&view->offset, value.data() + 1, sizeof(view->offset));
+    memcpy(&view->size, value.data() + 9, sizeof(view->size));
+    view->extent_id.set(value.data() + 17, len - 17);
+    return true;
+}
+
+Status ExtentLocationMgr::Init(const BlockDevicePtr &bdev) {
+    space_alloc_.reset(new extentserver::SpaceAlloc(bdev->capacity()));
     if (space_alloc_->Init() != 0) {
         return Status(
                 common::CYPRE_ES_INIT_SPACE_ALLOC_FAIL,
                 "couldn't init space allocator");
     }
 
-    kvstore::RocksOption rocks_option;
-    rocks_option.db_path = GlobalConfig().rocksdb().db_path;
-    rocks_option.compact_threads = GlobalConfig().rocksdb().compact_threads;
-    rocks_store_.reset(new kvstore::RocksStore(rocks_option));
-    auto status = rocks_store_->Open();
+    auto status = initMetaStore(bdev);
     if (!status.ok()) {
-        LOG(ERROR) << "Couldn't open rocksdb "
-                   << GlobalConfig().rocksdb().db_path << ", "
-                   << status.ToString();
-        return Status(common::CYPRE_ES_OPEN_ROCKSDB_ERROR, status.ToString());
+        return status;
     }
 
-    return Status();
+    persister_.reset(new ExtentPersister(
+            meta_store_, GlobalConfig().extentserver().persist_flush_interval_us,
+            GlobalConfig().extentserver().persist_batch_size));
+    return persister_->Start();
 }
 
-Status ExtentLocationMgr::Close() {
-    auto s = rocks_store_->Close();
-    if (!s.ok()) {
-        LOG(ERROR) << "Couldn't close rocksdb "
-                   << GlobalConfig().rocksdb().db_path << ", " << s.ToString();
-        return Status(common::CYPRE_ES_CLOSE_ROCKSDB_ERROR, s.ToString());
+Status ExtentLocationMgr::initMetaStore(const BlockDevicePtr &bdev) {
+    const std::string &meta_store = GlobalConfig().extentserver().meta_store;
+    if (meta_store == kMetaStoreRocksDB) {
+        kvstore::RocksOption rocks_option;
+        rocks_option.db_path = GlobalConfig().rocksdb().db_path;
+        rocks_option.compact_threads =
+                GlobalConfig().rocksdb().compact_threads;
+        meta_store_.reset(new RocksMetaStore(rocks_option));
+    } else if (meta_store == kMetaStoreJournal) {
+        // journal lives at device head, extents never allocated there
+        uint64_t block_size = space_alloc_->BlockSize();
+        uint64_t region_size =
+                (GlobalConfig().extentserver().meta_region_size + block_size
+                 - 1)
+                / block_size * block_size;
+        space_alloc_->Mark(0, region_size);
+        reserved_.emplace_back(0, region_size);
+        meta_store_.reset(new MetaJournal(bdev, 0, region_size));
+    } else {
+        LOG(ERROR) << "Invalid meta store " << meta_store;
+        return Status(
+                common::CYPRE_ER_NOT_SUPPORTED, "meta store not supported");
+    }
+
+    auto status = meta_store_->Open();
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't open meta store " << meta_store << ", "
+                   << status.ToString();
     }
+    return status;
+}
 
+Status ExtentLocationMgr::ReserveTailRegion(
+        uint64_t want_size, uint64_t *offset, uint64_t *size) {
+    uint64_t block_size = space_alloc_->BlockSize();
+    uint64_t usable = space_alloc_->Capacity() / block_size * block_size;
+    uint64_t region_size = (want_size + block_size - 1) / block_size * block_size;
+    if (region_size == 0 || region_size >= usable) {
+        LOG(ERROR) << "Couldn't reserve region, size:" << want_size
+                   << ", capacity:" << usable;
+        return Status(
+                common::CYPRE_ES_DISK_NO_SPACE, "no space for reserved region");
+    }
+
+    *offset = usable - region_size;
+    *size = region_size;
+    space_alloc_->Mark(*offset, region_size);
+    reserved_.emplace_back(*offset, region_size);
     return Status();
 }
 
+Status ExtentLocationMgr::Close() {
+    // drain pending locations before meta store goes away
+    persister_->Stop();
+    return meta_store_->Close();
+}
+
 void ExtentLocationMgr::addExtent(const ExtentLocationPtr &extent_loc) {
-    common::WriteLock lock(lock_);
-    extent_loc_map_.insert(std::make_pair(extent_loc->extent_id, extent_loc));
+    extent_index_.Insert(
+            ExtentKey::FromExtentID(extent_loc->extent_id), extent_loc->offset,
+            extent_loc->size);
 }
 
 void ExtentLocationMgr::removeExtent(const std::string &extent_id) {
-    common::WriteLock lock(lock_);
-    extent_loc_map_.erase(extent_id);
+    extent_index_.Erase(ExtentKey::FromExtentID(extent_id));
 }
 
 Status ExtentLocationMgr::QueryLocation(
         const std::string &extent_id, Request *req, bool alloc_if_not_exists) {
-    {
-        common::ReadLock lock(lock_);
-        auto it = extent_loc_map_.find(extent_id);
-        if (it != extent_loc_map_.end()) {
-            req->SetPhysicalOffset(it->second->offset + req->Offset());
-            return Status();
-        }
+    return queryLocation(
+            extent_id, ExtentKey::FromExtentID(extent_id), req,
+            alloc_if_not_exists);
+}
+
+Status ExtentLocationMgr::queryLocation(
+        const std::string &extent_id, const ExtentKey &key, Request *req,
+        bool alloc_if_not_exists) {
+    uint64_t offset = 0, size = 0;
+    // held before lookup, a detach removing the location after it waits
+    bool held = req->HoldsLocation();
+    if (!held) {
+        req->HoldLocation(io_gates_.Enter(key));
+    }
+    if (extent_index_.Lookup(key, &offset, &size)) {
+        req->SetPhysicalOffset(offset + req->Offset());
+        return Status();
+    }
+    // not held while waiting the extent lock, a drain holds it
+    if (!held) {
+        req->ReleaseLocation();
     }
 
     if (!alloc_if_not_exists) {
@@ -80,13 +186,14 @@ Status ExtentLocationMgr::QueryLocation(
                 "extent location not found");
     }
     // 锁住extent
-    std::lock_guard<std::mutex> lock(extent_lock_mgr_.GetLock(extent_id));
+    std::lock_guard<bthread::Mutex> lock(extent_locks_.GetLock(key));
     // 查询是否已经分配
-    auto status = QueryLocation(extent_id, req, false);
+    auto status = queryLocation(extent_id, key, req, false);
     if (status.ok()) {
         return status;
     }
 
+    int64_t start_us = butil::cpuwide_time_us();
     std::unique_ptr<AUnit> aunit(new AUnit());
     status = space_alloc_->Allocate(extent_size_, &aunit);
     if (!status.ok()) {
@@ -104,17 +211,23 @@ Status ExtentLocationMgr::QueryLocation(
         space_alloc_->Free(&aunit);
         return status;
     }
+    g_extent_alloc_latency << butil::cpuwide_time_us() - start_us;
+    // no drain of this stripe runs while the extent lock is held
+    if (!req->HoldsLocation()) {
+        req->HoldLocation(io_gates_.Enter(key));
+    }
     req->SetPhysicalOffset(aunit->offset + req->Offset());
     return Status();
 }
 
 Status ExtentLocationMgr::persistExtent(const ExtentLocationPtr extent_loc) {
     std::string key = extent_loc->GenerateKey();
-    std::string value = utils::Serializer<ExtentLocation>::Encode(*extent_loc);
-    auto s = rocks_store_->Put(key, value);
+    std::string value = extent_loc->Encode();
+    // grouped with concurrent allocations, returns once durable
+    auto s = persister_->Persist(key, value);
     if (!s.ok()) {
         LOG(ERROR) << "Couldn't put extent " << extent_loc->extent_id
-                   << " to rocks_store, " << s.ToString();
+                   << " to meta store, " << s.ToString();
         return Status(
                 common::CYPRE_ES_ROCKSDB_STORE_ERROR, "couldn't store extent");
     }
@@ -124,20 +237,20 @@ Status ExtentLocationMgr::persistExtent(const ExtentLocationPtr extent_loc) {
 }
 
 ExtentLocationPtr ExtentLocationMgr::queryExtent(const std::string &extent_id) {
-    common::ReadLock lock(lock_);
-    auto it = extent_loc_map_.find(extent_id);
-    if (it != extent_loc_map_.end()) {
-        return it->second;
+    uint64_t offset = 0, size = 0;
+    if (!extent_index_.Lookup(
+                ExtentKey::FromExtentID(extent_id), &offset, &size)) {
+        return nullptr;
     }
-    return nullptr;
+    return std::make_shared<ExtentLocation>(offset, size, extent_id);
 }
 
 Status ExtentLocationMgr::deleteExtent(const ExtentLocationPtr extent_loc) {
     std::string key = extent_loc->GenerateKey();
-    auto s = rocks_store_->Delete(key);
+    auto s = persister_->Delete(key);
     if (!s.ok()) {
         LOG(ERROR) << "Couldn't delete extent " << extent_loc->extent_id
-                   << " from rocks_store, " << s.ToString();
+                   << " from meta store, " << s.ToString();
         return Status(
                 common::CYPRE_ES_ROCKSDB_STORE_ERROR, "couldn't delete extent");
     }
@@ -146,13 +259,17 @@ Status ExtentLocationMgr::deleteExtent(const ExtentLocationPtr extent_loc) {
     return Status();
 }
 
-Status ExtentLocationMgr::ReclaimExtent(const std::string &extent_id) {
+Status ExtentLocationMgr::DetachExtent(
+        const std::string &extent_id, uint64_t *offset, uint64_t *size) {
+    *offset = 0;
+    *size = 0;
     auto loc = queryExtent(extent_id);
     if (!loc) {
         return Status();
     }
 
-    std::lock_guard<std::mutex> lock(extent_lock_mgr_.GetLock(extent_id));
+    ExtentKey key = ExtentKey::FromExtentID(extent_id);
+    std::lock_guard<bthread::Mutex> lock(extent_locks_.GetLock(key));
     loc = queryExtent(extent_id);
     if (!loc) {
         return Status();
@@ -162,47 +279,132 @@ Status ExtentLocationMgr::ReclaimExtent(const std::string &extent_id) {
     if (!s.ok()) {
         return s;
     }
+    // io that may have seen the location is done after this
+    io_gates_.Drain(key);
 
-    space_alloc_->Free(loc->offset, loc->size);
+    *offset = loc->offset;
+    *size = loc->size;
     return Status();
 }
 
-Status ExtentLocationMgr::LoadExtents() {
-    std::unique_ptr<kvstore::KVIterator> kv_iter;
-    kvstore::RocksStatus s =
-            rocks_store_->ScanPrefix(kExtentLocPrefix, &kv_iter);
-    if (!s.ok()) {
-        LOG(ERROR) << "Couldn't Load extent locs, " << s.ToString();
-        return Status(
-                common::CYPRE_ES_ROCKSDB_LOAD_ERROR,
-                "couldn't load extents from rocks store");
-    }
-
-    std::stringstream ss;
-    while (kv_iter->Valid()) {
-        ExtentLocation loc;
-        if (!utils::Serializer<ExtentLocation>::Decode(kv_iter->value(), loc)) {
-            LOG(ERROR) << "Couldn't Load extent locs";
-            return Status(
-                    common::CYPRE_ES_DECODE_ERROR,
-                    "couldn't load extents from rocks store");
+std::vector<ExtentLoadRange> ExtentLocationMgr::splitLoadRanges(int num_ranges) {
+    // blob ids are kBlobIdPrefix + upper case guid, split on its first char
+    const std::string kSplitChars = "0123456789ABCDEF";
+    const std::string blob_prefix = kExtentLocPrefix + common::kBlobIdPrefix;
+    num_ranges = std::max(1, std::min<int>(num_ranges, kSplitChars.size()));
+
+    std::vector<ExtentLoadRange> ranges(num_ranges);
+    ranges[0].start = kExtentLocPrefix;
+    for (int i = 1; i < num_ranges; ++i) {
+        ranges[i].start = blob_prefix
+                          + kSplitChars[i * kSplitChars.size() / num_ranges];
+        ranges[i - 1].end = ranges[i].start;
+    }
+    // first key after all keys with kExtentLocPrefix
+    std::string prefix_end = kExtentLocPrefix;
+    prefix_end.back()++;
+    ranges[num_ranges - 1].end = prefix_end;
+    return ranges;
+}
+
+Status ExtentLocationMgr::loadRange(
+        const ExtentLoadRange &range, std::vector<ExtentKey> *keys,
+        std::vector<AUnit> *aunits) {
+    return meta_store_->LoadRange(
+            range.start, range.end,
+            [keys, aunits](const std::string &key, const std::string &value) {
+                ExtentLocationView view;
+                if (ExtentLocationView::Decode(value, &view)) {
+                    keys->push_back(ExtentKey::FromExtentID(view.extent_id));
+                    aunits->emplace_back(view.offset, view.size);
+                    return Status();
+                }
+
+                // written by older version
+                ExtentLocation loc;
+                if (!utils::Serializer<ExtentLocation>::Decode(value, loc)) {
+                    LOG(ERROR) << "Couldn't decode extent loc, key:" << key;
+                    return Status(
+                            common::CYPRE_ES_DECODE_ERROR,
+                            "couldn't load extents from meta store");
+                }
+                keys->push_back(ExtentKey::FromExtentID(loc.extent_id));
+                aunits->emplace_back(loc.offset, loc.size);
+                return Status();
+            });
+}
+
+Status ExtentLocationMgr::checkReserved(const std::vector<AUnit> &aunits) {
+    // reserved regions are marked before extents are loaded, an extent
+    // there means the region moved under existing data
+    for (const auto &aunit : aunits) {
+        for (const auto &region : reserved_) {
+            if (aunit.offset < region.offset + region.size
+                && region.offset < aunit.offset + aunit.size) {
+                LOG(ERROR) << "Extent space overlaps reserved region, offset:"
+                           << aunit.offset << ", size:" << aunit.size
+                           << ", region offset:" << region.offset
+                           << ", region size:" << region.size;
+                return Status(
+                        common::CYPRE_ES_META_CORRUPTION,
+                        "extent in reserved region");
+            }
         }
+    }
+    return Status();
+}
 
-        LOG(INFO) << "Load extent from rocksdb"
-                  << ", extent_id:" << loc.extent_id
-                  << ", offset:" << loc.offset << ", size:" << loc.size;
+Status ExtentLocationMgr::LoadExtents() {
+    int64_t start_us = butil::gettimeofday_us();
+    auto ranges =
+            splitLoadRanges(GlobalConfig().extentserver().recovery_threads);
+    std::vector<std::vector<ExtentKey>> keys(ranges.size());
+    std::vector<std::vector<AUnit>> aunits(ranges.size());
+    std::vector<Status> status(ranges.size());
 
-        ExtentLocationPtr extent_loc = std::make_shared<ExtentLocation>(loc);
-        // 加入内存结构
-        extent_loc_map_.insert(
-                std::make_pair(extent_loc->extent_id, extent_loc));
-        // 标记bitmap allocator
-        space_alloc_->Mark(extent_loc->offset, extent_loc->size);
+    // scan and decode key ranges in parallel
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        threads.emplace_back([this, i, &ranges, &keys, &aunits, &status]() {
+            status[i] = loadRange(ranges[i], &keys[i], &aunits[i]);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
-        kv_iter->Next();
+    std::vector<AUnit> all_aunits;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (!status[i].ok()) {
+            LOG(ERROR) << "Couldn't Load extent locs, range:["
+                       << ranges[i].start << ", " << ranges[i].end << "), "
+                       << status[i].ToString();
+            return status[i];
+        }
+        // 加入内存结构
+        for (size_t j = 0; j < keys[i].size(); ++j) {
+            extent_index_.Insert(
+                    keys[i][j], aunits[i][j].offset, aunits[i][j].size);
+        }
+        all_aunits.insert(
+                all_aunits.end(), aunits[i].begin(), aunits[i].end());
+    }
+    auto s = checkReserved(all_aunits);
+    if (!s.ok()) {
+        return s;
     }
+    // 标记bitmap allocator, 每个chunk加锁一次
+    space_alloc_->MarkBatch(&all_aunits);
 
-    LOG(INFO) << "Load extents finished";
+    int64_t cost_ms = (butil::gettimeofday_us() - start_us) / 1000;
+    int64_t num_extents = static_cast<int64_t>(all_aunits.size());
+    int64_t rate = num_extents * 1000 / std::max<int64_t>(cost_ms, 1);
+    g_recovery_time_ms.set_value(cost_ms);
+    g_recovery_extents.set_value(num_extents);
+    g_recovery_rate.set_value(rate);
+    LOG(INFO) << "Load extents finished, extents:" << num_extents
+              << ", threads:" << ranges.size() << ", cost:" << cost_ms
+              << " ms, " << rate << " extents/s";
     return Status();
 }
 
@@ -8,17 +8,20 @@
 #define CYPRESTORE_EXTENTSERVER_EXTENT_LOCATION_H_
 
 #include <butil/macros.h>
+#include <butil/strings/string_piece.h>
 
 #include <cereal/types/string.hpp>
 #include <memory>
 #include <sstream>
 #include <string>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
-#include "common/rwlock.h"
+#include "block_device.h"
 #include "common/status.h"
-#include "kvstore/rocks_store.h"
+#include "extent_index.h"
+#include "extent_persister.h"
+#include "meta_store.h"
 #include "request_context.h"
 #include "space_alloc.h"
 
@@ -29,7 +32,6 @@ struct ExtentLocation;
 class ExtentLocationMgr;
 
 typedef std::shared_ptr<ExtentLocation> ExtentLocationPtr;
-typedef std::unordered_map<std::string, ExtentLocationPtr> ExtentLocationMap;
 typedef std::shared_ptr<ExtentLocationMgr> ExtentLocationMgrPtr;
 
 const std::string kExtentLocPrefix = "extent_loc_";
@@ -46,19 +48,40 @@ struct ExtentLocation {
         return ss.str();
     }
 
-    // cereal序列化和反序列化函数
+    // cereal序列化和反序列化函数, 旧格式, 仅用于加载
     template <class Archive> void serialize(Archive &archive) {
         archive(offset);
         archive(size);
         archive(extent_id);
     }
 
+    // fixed layout: tag(1) | offset(8) | size(8) | extent_id | crc32(4)
+    std::string Encode() const;
+
     uint64_t offset;
     uint64_t size;
     std::string extent_id;
     // TODO: 补充其它属性
 };
 
+// decoded fixed layout value, extent_id points into the value
+struct ExtentLocationView {
+    ExtentLocationView() : offset(0), size(0) {}
+
+    // false if value is not fixed layout or corrupted
+    static bool Decode(const std::string &value, ExtentLocationView *view);
+
+    uint64_t offset;
+    uint64_t size;
+    butil::StringPiece extent_id;
+};
+
+// range of meta keys loaded by one recovery thread
+struct ExtentLoadRange {
+    std::string start;
+    std::string end;
+};
+
 using common::Status;
 
 class ExtentLocationMgr {
@@ -66,13 +89,23 @@ public:
     ExtentLocationMgr() = default;
     ~ExtentLocationMgr() = default;
 
-    Status Init(uint64_t disk_capacity);
+    Status Init(const BlockDevicePtr &bdev);
     Status Close();
     Status QueryLocation(
             const std::string &extent_id, Request *req,
             bool alloc_if_not_exists = true);
-    Status ReclaimExtent(const std::string &extent_id);
+    // forgets the location of extent and waits io holding it, keeps its
+    // space allocated till FreeSpace, size is 0 if extent has no location
+    Status DetachExtent(
+            const std::string &extent_id, uint64_t *offset, uint64_t *size);
+    void FreeSpace(uint64_t offset, uint64_t size) {
+        space_alloc_->Free(offset, size);
+    }
+    // fails if a loaded extent lies in a reserved region
     Status LoadExtents();
+    // keeps [offset, offset + size) at device tail out of allocation
+    Status ReserveTailRegion(
+            uint64_t want_size, uint64_t *offset, uint64_t *size);
 
     void SetExtentSize(uint64_t extent_size) {
         extent_size_ = extent_size;
@@ -87,15 +120,26 @@ private:
     void addExtent(const ExtentLocationPtr &extent_loc);
     void removeExtent(const std::string &extent_id);
     ExtentLocationPtr queryExtent(const std::string &extent_id);
+    Status queryLocation(
+            const std::string &extent_id, const ExtentKey &key, Request *req,
+            bool alloc_if_not_exists);
     Status persistExtent(const ExtentLocationPtr extent_loc);
     Status deleteExtent(const ExtentLocationPtr extent_loc);
+    Status initMetaStore(const BlockDevicePtr &bdev);
+    Status checkReserved(const std::vector<AUnit> &aunits);
+    Status loadRange(
+            const ExtentLoadRange &range, std::vector<ExtentKey> *keys,
+            std::vector<AUnit> *aunits);
+    static std::vector<ExtentLoadRange> splitLoadRanges(int num_ranges);
 
     uint64_t extent_size_;
-    kvstore::RocksStorePtr rocks_store_;
+    MetaStorePtr meta_store_;
+    std::unique_ptr<ExtentPersister> persister_;
     SpaceAllocPtr space_alloc_;
-    common::ExtentLockMgr extent_lock_mgr_;
-    ExtentLocationMap extent_loc_map_;
-    common::RWLock lock_;
+    ExtentLockStripes extent_locks_;
+    ExtentIOGates io_gates_;
+    ExtentIndex extent_index_;
+    std::vector<AUnit> reserved_;  // journal and log regions
 };
 
 }  // namespace extentserver
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "extent_persister.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+bvar::LatencyRecorder g_persist_latency("extent_persist_latency");
+bvar::IntRecorder g_persist_batch("extent_persist_batch_size");
+
+ExtentPersister::ExtentPersister(
+        const MetaStorePtr &meta_store, int flush_interval_us,
+        int max_batch_size)
+        : meta_store_(meta_store),
+          flush_interval_us_(flush_interval_us > 0 ? flush_interval_us : 0),
+          max_batch_size_(max_batch_size > 0 ? max_batch_size : 1),
+          started_(false), stop_(false), tid_(0) {}
+
+ExtentPersister::~ExtentPersister() {
+    Stop();
+}
+
+Status ExtentPersister::Start() {
+    if (started_) return Status();
+
+    int ret = pthread_create(&tid_, NULL, ExtentPersister::flushThread, this);
+    if (ret != 0) {
+        LOG(ERROR) << "Couldn't create extent persist thread, ret:" << ret;
+        return Status(
+                common::CYPRE_ES_PTHREAD_CREATE_ERROR,
+                "couldn't create extent persist thread");
+    }
+
+    started_ = true;
+    return Status();
+}
+
+void ExtentPersister::Stop() {
+    if (!started_) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    pthread_join(tid_, NULL);
+    started_ = false;
+}
+
+Status ExtentPersister::Persist(
+        const std::string &key, const std::string &value) {
+    PersistTask task(MetaRecord::kPut, key, value);
+    return submit(&task);
+}
+
+Status ExtentPersister::Delete(const std::string &key) {
+    PersistTask task(MetaRecord::kDelete, key, std::string());
+    return submit(&task);
+}
+
+Status ExtentPersister::submit(PersistTask *task) {
+    task->start_us = butil::cpuwide_time_us();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            return Status(
+                    common::CYPRE_ES_ROCKSDB_STORE_ERROR,
+                    "extent persister stopped");
+        }
+        pending_.push_back(task);
+        // flusher only sleeps on empty queue or a partial batch
+        if (pending_.size() == 1 || pending_.size() >= max_batch_size_) {
+            cond_.notify_one();
+        }
+    }
+
+    // suspends bthread only, the worker goes on with other requests
+    task->done.wait();
+    g_persist_latency << butil::cpuwide_time_us() - task->start_us;
+    return task->status;
+}
+
+void *ExtentPersister::flushThread(void *arg) {
+    static_cast<ExtentPersister *>(arg)->run();
+    return NULL;
+}
+
+void ExtentPersister::run() {
+    std::vector<PersistTask *> batch;
+    batch.reserve(max_batch_size_);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                break;  // stopped and drained
+            }
+
+            // collect followers until batch full or interval expires
+            auto deadline = std::chrono::steady_clock::now()
+                            + std::chrono::microseconds(flush_interval_us_);
+            cond_.wait_until(lock, deadline, [this] {
+                return stop_ || pending_.size() >= max_batch_size_;
+            });
+
+            size_t n = std::min(pending_.size(), max_batch_size_);
+            batch.assign(pending_.begin(), pending_.begin() + n);
+            pending_.erase(pending_.begin(), pending_.begin() + n);
+        }
+        flush(&batch);
+    }
+    LOG(INFO) << "Extent persist thread exits";
+}
+
+void ExtentPersister::flush(std::vector<PersistTask *> *batch) {
+    std::vector<MetaRecord> records;
+    records.reserve(batch->size());
+    for (auto *task : *batch) {
+        records.push_back(std::move(task->record));
+    }
+
+    // one durable write for the whole group
+    Status s = meta_store_->Write(records);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't write extent batch to meta store"
+                   << ", batch size:" << batch->size() << ", "
+                   << s.ToString();
+    }
+    g_persist_batch << batch->size();
+
+    // task lives on waiter's stack, don't touch it after signal
+    for (auto *task : *batch) {
+        task->status = s;
+        task->done.signal();
+    }
+    batch->clear();
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
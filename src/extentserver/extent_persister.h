@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_EXTENT_PERSISTER_H_
+#define CYPRESTORE_EXTENTSERVER_EXTENT_PERSISTER_H_
+
+#include <bthread/countdown_event.h>
+#include <butil/macros.h>
+#include <pthread.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/status.h"
+#include "meta_store.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+// Group commit of extent locations.
+// Concurrent callers are gathered into one write of the meta store,
+// flushed when the batch is full or the flush interval expires, and
+// each caller returns after its batch is durable.
+class ExtentPersister {
+public:
+    ExtentPersister(
+            const MetaStorePtr &meta_store, int flush_interval_us,
+            int max_batch_size);
+    ~ExtentPersister();
+
+    Status Start();
+    void Stop();
+    Status Persist(const std::string &key, const std::string &value);
+    Status Delete(const std::string &key);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ExtentPersister);
+
+    struct PersistTask {
+        PersistTask(
+                MetaRecord::Op op, const std::string &key,
+                const std::string &value)
+                : record(op, key, value), done(1) {}
+
+        MetaRecord record;
+        int64_t start_us;
+        Status status;
+        bthread::CountdownEvent done;
+    };
+
+    Status submit(PersistTask *task);
+    static void *flushThread(void *arg);
+    void run();
+    void flush(std::vector<PersistTask *> *batch);
+
+    MetaStorePtr meta_store_;
+    int flush_interval_us_;
+    size_t max_batch_size_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<PersistTask *> pending_;
+    bool started_;
+    bool stop_;
+    pthread_t tid_;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_EXTENT_PERSISTER_H_
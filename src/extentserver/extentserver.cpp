@@ -26,8 +26,19 @@ ExtentServer &ExtentServer::GlobalInstance() {
 
 ExtentServer::ExtentServer()
         : instance_id_(-1), set_id_(-1),
-          status_(ExtentServer::kExtentServerStarting), em_channel_(nullptr),
-          stop_(false) {}
+          status_(ExtentServer::kExtentServerStarting), router_version_(0),
+          em_channel_(nullptr), stop_(false) {}
+
+void ExtentServer::UpdateRouterVersion(uint32_t version) {
+    uint32_t old = router_version_.exchange(version);
+    if (old == version) return;
+
+    // routers cached before may be gone, fetch them again on use
+    LOG(INFO) << "Router version changed from " << old << " to " << version;
+    if (storage_engine_ && storage_engine_->ExtentRouterMgr()) {
+        storage_engine_->ExtentRouterMgr()->Clear();
+    }
+}
 
 void ExtentServer::initMyself() {
     instance_id_ = GlobalConfig().common().instance;
@@ -11,6 +11,7 @@
 #include <brpc/server.h>
 #include <butil/macros.h>
 
+#include <atomic>
 #include <string>
 
 #include "common/config.h"
@@ -79,6 +80,13 @@ public:
     }
     void WaitEsReady();
 
+    // router version of pool, from heartbeat. it's in io responses so
+    // clients know when their cached routers are stale
+    uint32_t RouterVersion() const {
+        return router_version_.load(std::memory_order_relaxed);
+    }
+    void UpdateRouterVersion(uint32_t version);
+
 private:
     DISALLOW_COPY_AND_ASSIGN(ExtentServer);
     friend class HeartbeatReporter;
@@ -98,6 +106,7 @@ private:
     std::string rack_;
 
     ExtentServerStatus status_;
+    std::atomic<uint32_t> router_version_;
     HeartbeatReporterPtr heartbeat_reporter_;
     StorageEnginePtr storage_engine_;
     RequestMgrPtr request_mgr_;
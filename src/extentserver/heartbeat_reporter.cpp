@@ -55,6 +55,10 @@ void HeartbeatReporter::DoHeartbeatReport() {
         return;
     }
 
+    if (response.has_router_version()) {
+        es_->UpdateRouterVersion(
+                static_cast<uint32_t>(response.router_version()));
+    }
     if (!once_) {
         es_->storage_engine_->SetExtentSize(response.extent_size());
         es_->SetEsReady();
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_IO_ENGINE_H
+#define CYPRESTORE_EXTENTSERVER_IO_ENGINE_H
+
+#include <butil/macros.h>
+
+#include "common/status.h"
+#include "request_context.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+class StorageEngine;
+
+using common::Status;
+
+// engine stacked on the bare engine of a storage engine
+class IOEngine {
+public:
+    IOEngine(StorageEngine *se) : se_(se) {}
+    virtual ~IOEngine() {}
+
+    virtual Status Init() = 0;
+    virtual Status Close() = 0;
+    virtual Status DoRecovery() = 0;
+    virtual Status ProcessRequest(Request *req) = 0;
+
+protected:
+    StorageEngine *se_;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IOEngine);
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_IO_ENGINE_H
@@ -14,7 +14,7 @@ namespace extentserver {
 Status IOMem::Init() {
     ArenaOptions options(
             common::kAlignSize, init_block_size_, max_block_size_,
-            type_ == CypreRing::CypreRingType::TYPE_SP_SC, true);
+            type_ == CypreRing::CypreRingType::TYPE_SP_SC, true, socket_id_);
     Arena *arena = new Arena(options);
     if (!arena)
         return Status(common::CYPRE_ER_OUT_OF_MEMORY, "new arena failed");
@@ -109,7 +109,7 @@ Status IOMemMgr::Init() {
     int index = 0;
     io_mems_.resize(max_slab_ / init_slab);
     while (init_slab <= max_slab_) {
-        IOMem *io_mem = new IOMem(init_slab, type_);
+        IOMem *io_mem = new IOMem(init_slab, type_, socket_id_);
         if (!io_mem)
             return Status(common::CYPRE_ER_OUT_OF_MEMORY, "out of memory");
         auto status = io_mem->Init();
@@ -183,6 +183,34 @@ void IOMemMgr::PutIOUnits(uint32_t num, io_u **ios) {
     return free_direct(num, ios);
 }
 
+Status IOMemMgr::GetIOUnitsVec(
+        uint64_t size, uint32_t max_units, io_u **ios, uint32_t *num) {
+    uint32_t num_full = size / max_slab_;
+    uint64_t tail_size = size % max_slab_;
+    uint32_t num_units = num_full + (tail_size != 0 ? 1 : 0);
+    if (num_units == 0 || num_units > max_units) {
+        return Status(
+                common::CYPRE_ER_INVALID_ARGUMENT,
+                "size invalid, too many io units");
+    }
+
+    if (num_full > 0) {
+        auto status = GetIOUnitsBulk(max_slab_, num_full, ios);
+        if (!status.ok()) return status;
+    }
+
+    if (tail_size != 0) {
+        auto status = GetIOUnitBulk(tail_size, &ios[num_full]);
+        if (!status.ok()) {
+            if (num_full > 0) PutIOUnits(num_full, ios);
+            return status;
+        }
+    }
+
+    *num = num_units;
+    return Status();
+}
+
 Status IOMemMgr::alloc_direct(uint64_t unit_size, uint32_t num, io_u **ios) {
     std::vector<void *> addrs;
     auto status = Arena::AllocateDirect(unit_size, true, num, &addrs);
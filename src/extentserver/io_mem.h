@@ -33,8 +33,11 @@ struct io_u {
 
 class IOMem {
 public:
-    explicit IOMem(uint32_t mem_unit_size, CypreRing::CypreRingType type)
-            : mem_unit_size_(mem_unit_size), max_units_(0), type_(type) {}
+    explicit IOMem(
+            uint32_t mem_unit_size, CypreRing::CypreRingType type,
+            int socket_id = -1)
+            : mem_unit_size_(mem_unit_size), max_units_(0), type_(type),
+              socket_id_(socket_id) {}
     ~IOMem() = default;
 
     Status Init();
@@ -60,15 +63,18 @@ private:
     uint32_t mem_unit_size_;
     uint32_t max_units_;
     CypreRing::CypreRingType type_;
+    int socket_id_;
     uint32_t init_block_size_ = 4 << 20;
     uint32_t max_block_size_ = 8 << 20;
 };
 
 class IOMemMgr {
 public:
+    // socket_id: numa socket of io memory, -1 means any socket
     explicit IOMemMgr(
-            CypreRing::CypreRingType type, uint32_t max_slab = 1 << 20)
-            : max_slab_(max_slab), type_(type) {}
+            CypreRing::CypreRingType type, uint32_t max_slab = 1 << 20,
+            int socket_id = -1)
+            : max_slab_(max_slab), type_(type), socket_id_(socket_id) {}
     ~IOMemMgr() = default;
 
     Status Init();
@@ -82,6 +88,10 @@ public:
     Status GetIOUnitsBulk(uint64_t unit_size, uint32_t num, io_u **ios);
     void PutIOUnits(uint32_t num, io_u **ios);
 
+    // scatter-gather api, split size into max slab units and a tail unit
+    Status GetIOUnitsVec(
+            uint64_t size, uint32_t max_units, io_u **ios, uint32_t *num);
+
 private:
     uint32_t get_index(uint64_t unit_size) {
         return (unit_size / kIOUnitSize_) - 1;
@@ -95,6 +105,7 @@ private:
     const uint32_t kIOUnitSize_ = 4 << 10;
     uint32_t max_slab_;
     CypreRing::CypreRingType type_;
+    int socket_id_;
     std::vector<std::unique_ptr<IOMem>> io_mems_;
 };
 
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "log_engine.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "butil/logging.h"
+#include "common/config.h"
+#include "storage_engine.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+Status LogEngine::Init() {
+    const auto &bare_engine = se_->bare_engine_;
+    uint64_t region_offset = 0, region_size = 0;
+    // log lives at device tail, extents never allocated there
+    Status s = bare_engine->ExtentLocationMgr()->ReserveTailRegion(
+            GlobalConfig().extentserver().log_region_size, &region_offset,
+            &region_size);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't reserve log region, " << s.ToString();
+        return s;
+    }
+
+    write_log_.reset(new WriteLog(
+            bare_engine->bdev(), region_offset, region_size,
+            GlobalConfig().extentserver().log_flush_batch_size,
+            GlobalConfig().extentserver().log_flush_interval_ms));
+    max_io_size_ = std::min<uint64_t>(
+            GlobalConfig().extentserver().log_max_io_size,
+            write_log_->MaxIOSize());
+    LOG(INFO) << "Log engine region offset:" << region_offset
+              << ", size:" << region_size << ", max io size:" << max_io_size_;
+    return Status();
+}
+
+Status LogEngine::Close() {
+    // everything goes home before bare engine closes
+    return write_log_->Close();
+}
+
+Status LogEngine::DoRecovery() {
+    // replays log after extent locations are loaded
+    return write_log_->Open();
+}
+
+Status LogEngine::ProcessRequest(Request *req) {
+    if (req->Discard()) {
+        return handleBypass(req, req->Offset(), req->Size());
+    }
+
+    switch (req->GetRequestType()) {
+        case RequestType::kTypeWrite:
+        case RequestType::kTypeReplicate:
+            return handleWrite(req);
+        case RequestType::kTypeRead:
+        case RequestType::kTypeScrub:
+            return handleRead(req);
+        case RequestType::kTypeReclaimExtent:
+            return handleBypass(req, 0, se_->ExtentSize());
+        default:
+            break;
+    }
+    return se_->bare_engine_->ProcessRequest(req);
+}
+
+Status LogEngine::handleWrite(Request *req) {
+    if (req->Size() > max_io_size_
+        || req->Offset() % WriteLog::kLogBlockSize != 0
+        || req->Size() % WriteLog::kLogBlockSize != 0) {
+        return handleBypass(req, req->Offset(), req->Size());
+    }
+
+    const butil::IOBuf &data =
+            req->GetOperationContext().cntl->request_attachment();
+    if (data.size() != req->Size()) {
+        return Status(
+                common::CYPRE_ER_INVALID_ARGUMENT,
+                "data size not equal to request size");
+    }
+
+    // home allocated now, flusher and replay write there
+    std::string extent_id = req->ExtentID();
+    Status s = se_->bare_engine_->ExtentLocationMgr()->QueryLocation(
+            extent_id, req);
+    if (!s.ok()) return s;
+
+    return write_log_->Append(
+            req, extent_id, req->Offset(), req->PhysicalOffset(), data);
+}
+
+Status LogEngine::handleRead(Request *req) {
+    std::unique_ptr<ReadOverlay> overlay(new ReadOverlay());
+    uint64_t hit = write_log_->Snapshot(
+            req->ExtentID(), req->Offset(), req->Size(), &overlay->runs);
+    if (hit == 0) {
+        return se_->bare_engine_->ProcessRequest(req);
+    }
+
+    // all in log, no device io
+    if (hit == req->Size() && req->GetRequestType() == RequestType::kTypeRead) {
+        auto &attachment =
+                req->GetOperationContext().cntl->response_attachment();
+        for (const auto &run : overlay->runs) {
+            attachment.append(run.data);
+        }
+        req->SetResult(true);
+        req->UserCallback()(req);
+        return Status();
+    }
+
+    overlay->user_cb = req->UserCallback();
+    overlay->user_arg = req->UserArg();
+    req->SetUserCallback(readDone);
+    req->SetUserArg(overlay.get());
+    Status s = se_->bare_engine_->ProcessRequest(req);
+    if (!s.ok()) {
+        req->SetUserCallback(overlay->user_cb);
+        req->SetUserArg(overlay->user_arg);
+        return s;
+    }
+    // owned by readDone now
+    overlay.release();
+    return s;
+}
+
+Status LogEngine::handleBypass(Request *req, uint64_t offset, uint64_t size) {
+    // older log blocks must not be flushed or replayed over this io
+    write_log_->WaitClean(req->ExtentID(), offset, size);
+    return se_->bare_engine_->ProcessRequest(req);
+}
+
+void *LogEngine::readDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    ReadOverlay *overlay = static_cast<ReadOverlay *>(req->UserArg());
+    if (req->Result() && req->IOUnit() != nullptr) {
+        for (const auto &run : overlay->runs) {
+            copyToRequest(req, run.offset - req->Offset(), run.data);
+        }
+    }
+
+    UserCallback_t user_cb = overlay->user_cb;
+    req->SetUserCallback(user_cb);
+    req->SetUserArg(overlay->user_arg);
+    delete overlay;
+    return user_cb(req);
+}
+
+void LogEngine::copyToRequest(
+        Request *req, uint64_t pos, const std::string &data) {
+    if (!req->Vectored()) {
+        memcpy(static_cast<char *>(req->IOUnit()->data) + pos, data.data(),
+               data.size());
+        return;
+    }
+
+    struct iovec *iovs = req->IOVecs();
+    uint64_t base = 0;
+    size_t copied = 0;
+    for (uint32_t i = 0; i < req->NumIOVecs() && copied < data.size(); ++i) {
+        uint64_t len = iovs[i].iov_len;
+        if (pos + copied < base + len) {
+            uint64_t off = pos + copied - base;
+            size_t n = std::min<uint64_t>(len - off, data.size() - copied);
+            memcpy(static_cast<char *>(iovs[i].iov_base) + off,
+                   data.data() + copied, n);
+            copied += n;
+        }
+        base += len;
+    }
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
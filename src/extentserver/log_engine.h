@@ -8,8 +8,10 @@
 #define CYPRESTORE_EXTENTSERVER_LOG_ENGINE_H
 
 #include <memory>
+#include <vector>
 
 #include "io_engine.h"
+#include "write_log.h"
 
 namespace cyprestore {
 namespace extentserver {
@@ -17,10 +19,42 @@ namespace extentserver {
 class LogEngine;
 typedef std::shared_ptr<LogEngine> LogEnginePtr;
 
+// Small writes are acknowledged once appended to the write log and go
+// home later in batches. Reads overlay log resident blocks on home data,
+// io bypassing the log waits until its range is out of the log.
 class LogEngine : public IOEngine {
 public:
     LogEngine(StorageEngine *se) : IOEngine(se) {}
     virtual ~LogEngine() {}
+
+    virtual Status Init();
+    virtual Status Close();
+    virtual Status DoRecovery();
+    virtual Status ProcessRequest(Request *req);
+    void WaitClean(
+            const std::string &extent_id, uint64_t offset, uint64_t size) {
+        write_log_->WaitClean(extent_id, offset, size);
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(LogEngine);
+
+    // log resident blocks copied into a read after it is done
+    struct ReadOverlay {
+        UserCallback_t user_cb;
+        void *user_arg;
+        std::vector<LogRun> runs;
+    };
+
+    static void *readDone(void *arg);
+    static void copyToRequest(
+            Request *req, uint64_t pos, const std::string &data);
+    Status handleRead(Request *req);
+    Status handleWrite(Request *req);
+    Status handleBypass(Request *req, uint64_t offset, uint64_t size);
+
+    std::unique_ptr<WriteLog> write_log_;
+    uint64_t max_io_size_;
 };
 
 }  // namespace extentserver
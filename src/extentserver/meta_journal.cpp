@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "meta_journal.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "bthread/countdown_event.h"
+#include "butil/fast_rand.h"
+#include "butil/logging.h"
+#include "utils/coding.h"
+#include "utils/crc32.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+namespace {
+
+const uint64_t kSuperBlockMagic = 0x4a4d455250594343ULL;  // "CCYPREMJ"
+const uint32_t kSuperBlockVersion = 1;
+const uint32_t kEntryMagic = 0x4d4a4e4c;  // "LNJM"
+
+uint64_t alignUp(uint64_t size, uint64_t align) {
+    return (size + align - 1) / align * align;
+}
+
+uint64_t alignDown(uint64_t size, uint64_t align) {
+    return size / align * align;
+}
+
+}  // namespace
+
+const uint64_t MetaJournal::kMetaBlockSize;
+const uint64_t MetaJournal::kMinRegionSize;
+const uint64_t MetaJournal::kIOChunkSize;
+
+MetaJournal::MetaJournal(
+        const BlockDevicePtr &bdev, uint64_t region_offset,
+        uint64_t region_size)
+        : bdev_(bdev), region_offset_(region_offset),
+          region_size_(region_size), next_lsn_(1), journal_pos_(0),
+          since_ckpt_(0), io_buf_(nullptr), opened_(false) {
+    memset(&sb_, 0, sizeof(sb_));
+    // a quarter of region for each checkpoint, the rest for journal
+    ckpt_size_ = alignDown(
+            (region_size_ - 2 * kMetaBlockSize) / 4, kMetaBlockSize);
+    journal_offset_ = region_offset_ + 2 * kMetaBlockSize + 2 * ckpt_size_;
+    journal_size_ = alignDown(
+            region_offset_ + region_size_ - journal_offset_, kMetaBlockSize);
+}
+
+MetaJournal::~MetaJournal() {
+    if (io_buf_ != nullptr) {
+        bdev_->FreeIOMem(io_buf_);
+    }
+}
+
+void *MetaJournal::ioDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    // waiter owns req, don't touch it after signal
+    static_cast<bthread::CountdownEvent *>(req->UserArg())->signal();
+    return nullptr;
+}
+
+Status MetaJournal::doIO(
+        RequestType type, uint64_t offset, void *buf, uint64_t size) {
+    Request req(type);
+    bthread::CountdownEvent done(1);
+    req.SetMetaBuf(buf, size);
+    req.SetPhysicalOffset(offset);
+    req.SetUserCallback(ioDone);
+    req.SetUserArg(&done);
+
+    Status s = bdev_->ProcessRequest(&req);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't submit meta io, offset:" << offset
+                   << ", size:" << size << ", " << s.ToString();
+        return s;
+    }
+    done.wait();
+
+    if (!req.Result()) {
+        LOG(ERROR) << "Meta io error, type:" << type << ", offset:" << offset
+                   << ", size:" << size;
+        return Status(common::CYPRE_ES_META_IO_ERROR, "meta io error");
+    }
+    return Status();
+}
+
+Status
+MetaJournal::readRegion(uint64_t offset, uint64_t size, std::string *data) {
+    data->clear();
+    data->reserve(size);
+    uint64_t left = size;
+    while (left > 0) {
+        uint64_t len = std::min(left, kIOChunkSize);
+        Status s = doIO(
+                RequestType::kTypeMetaRead, offset, io_buf_,
+                alignUp(len, kMetaBlockSize));
+        if (!s.ok()) return s;
+
+        data->append(static_cast<char *>(io_buf_), len);
+        offset += alignUp(len, kMetaBlockSize);
+        left -= len;
+    }
+    return Status();
+}
+
+Status MetaJournal::writeRegion(uint64_t offset, const std::string &data) {
+    uint64_t pos = 0;
+    while (pos < data.size()) {
+        uint64_t len = std::min(data.size() - pos, kIOChunkSize);
+        uint64_t io_len = alignUp(len, kMetaBlockSize);
+        memcpy(io_buf_, data.data() + pos, len);
+        memset(static_cast<char *>(io_buf_) + len, 0, io_len - len);
+        Status s = doIO(
+                RequestType::kTypeMetaWrite, offset + pos, io_buf_, io_len);
+        if (!s.ok()) return s;
+
+        pos += len;
+    }
+    return Status();
+}
+
+Status MetaJournal::Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (opened_) return Status();
+
+    if (region_size_ < kMinRegionSize || bdev_->block_size() == 0
+        || kMetaBlockSize % bdev_->block_size() != 0) {
+        LOG(ERROR) << "Invalid meta region, size:" << region_size_
+                   << ", device block size:" << bdev_->block_size();
+        return Status(common::CYPRE_ES_META_NO_SPACE, "invalid meta region");
+    }
+
+    io_buf_ = bdev_->AllocIOMem(kIOChunkSize);
+    if (io_buf_ == nullptr) {
+        return Status(
+                common::CYPRE_ES_GET_REQ_UNIT_FAIL,
+                "couldn't alloc meta io buffer");
+    }
+
+    SuperBlock sb;
+    bool found = false;
+    Status s = loadSuperBlock(&sb, &found);
+    if (!s.ok()) return s;
+
+    if (!found) {
+        s = format();
+        if (!s.ok()) return s;
+    } else {
+        s = loadCheckpoint(sb);
+        if (!s.ok()) return s;
+        s = replay(sb);
+        if (!s.ok()) return s;
+        sb_ = sb;
+    }
+
+    opened_ = true;
+    LOG(INFO) << "Open meta journal, generation:" << sb_.generation
+              << ", records:" << entries_.size() << ", next lsn:" << next_lsn_
+              << ", journal pos:" << journal_pos_
+              << ", journal size:" << journal_size_;
+    return Status();
+}
+
+Status MetaJournal::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!opened_) return Status();
+
+    // nothing to replay on next open
+    Status s = checkpoint();
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't checkpoint meta journal on close, "
+                   << s.ToString();
+    }
+    opened_ = false;
+    return s;
+}
+
+Status MetaJournal::format() {
+    memset(&sb_, 0, sizeof(sb_));
+    sb_.magic = kSuperBlockMagic;
+    sb_.version = kSuperBlockVersion;
+    sb_.journal_id = butil::fast_rand() | 1;
+    sb_.ckpt_area = 1;  // first checkpoint goes to area 0
+    sb_.region_size = region_size_;
+    entries_.clear();
+    next_lsn_ = 1;
+    journal_pos_ = 0;
+    since_ckpt_ = 0;
+
+    Status s = checkpoint();
+    if (!s.ok()) return s;
+
+    // both slots belong to this journal from now on
+    s = writeSuperBlock(sb_, (sb_.generation + 1) % 2);
+    if (!s.ok()) return s;
+
+    LOG(INFO) << "Format meta journal, region offset:" << region_offset_
+              << ", region size:" << region_size_
+              << ", journal id:" << sb_.journal_id;
+    return Status();
+}
+
+Status MetaJournal::loadSuperBlock(SuperBlock *sb, bool *found) {
+    std::string data;
+    Status s = readRegion(region_offset_, 2 * kMetaBlockSize, &data);
+    if (!s.ok()) return s;
+
+    *found = false;
+    bool formatted = false;
+    for (int slot = 0; slot < 2; ++slot) {
+        SuperBlock cur;
+        memcpy(&cur, data.data() + slot * kMetaBlockSize, sizeof(cur));
+        if (cur.magic != kSuperBlockMagic) {
+            continue;
+        }
+        formatted = true;
+
+        uint32_t crc = cur.crc;
+        cur.crc = 0;
+        if (cur.version != kSuperBlockVersion
+            || crc != utils::Crc32::Checksum(&cur, sizeof(cur))) {
+            LOG(WARNING) << "Invalid meta super block, slot:" << slot;
+            continue;
+        }
+        cur.crc = crc;
+        if (!*found || cur.generation > sb->generation) {
+            *sb = cur;
+            *found = true;
+        }
+    }
+
+    // never format over a corrupted region
+    if (formatted && !*found) {
+        LOG(ERROR) << "No valid meta super block";
+        return Status(
+                common::CYPRE_ES_META_CORRUPTION, "no valid meta super block");
+    }
+    if (*found && sb->region_size != region_size_) {
+        LOG(ERROR) << "Meta region size changed, formatted with "
+                   << sb->region_size << ", configured " << region_size_;
+        return Status(
+                common::CYPRE_ES_META_CORRUPTION, "meta region size changed");
+    }
+    return Status();
+}
+
+Status MetaJournal::writeSuperBlock(const SuperBlock &sb, int slot) {
+    SuperBlock cur = sb;
+    cur.crc = 0;
+    cur.crc = utils::Crc32::Checksum(&cur, sizeof(cur));
+    std::string data(reinterpret_cast<const char *>(&cur), sizeof(cur));
+    return writeRegion(region_offset_ + slot * kMetaBlockSize, data);
+}
+
+Status MetaJournal::loadCheckpoint(const SuperBlock &sb) {
+    std::string data;
+    Status s = readRegion(ckptOffset(sb.ckpt_area), sb.ckpt_len, &data);
+    if (!s.ok()) return s;
+
+    if (utils::Crc32::Checksum(data) != sb.ckpt_crc) {
+        LOG(ERROR) << "Meta checkpoint crc mismatch, generation:"
+                   << sb.generation << ", area:" << sb.ckpt_area;
+        return Status(
+                common::CYPRE_ES_META_CORRUPTION, "meta checkpoint corrupted");
+    }
+    return applyRecords(data.data(), data.size());
+}
+
+Status MetaJournal::replay(const SuperBlock &sb) {
+    uint64_t pos = sb.replay_pos;
+    uint64_t lsn = sb.replay_lsn;
+    uint64_t replayed = 0;
+    uint64_t num_entries = 0;
+    std::string data;
+    while (true) {
+        Status s = readRegion(journal_offset_ + pos, kMetaBlockSize, &data);
+        if (!s.ok()) return s;
+
+        EntryHeader header;
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != kEntryMagic || header.journal_id != sb.journal_id
+            || header.lsn != lsn) {
+            break;
+        }
+        uint64_t total = alignUp(sizeof(header) + header.len, kMetaBlockSize);
+        if (pos + total > journal_size_) {
+            break;
+        }
+        if (total > kMetaBlockSize) {
+            std::string rest;
+            s = readRegion(
+                    journal_offset_ + pos + kMetaBlockSize,
+                    total - kMetaBlockSize, &rest);
+            if (!s.ok()) return s;
+            data.append(rest);
+        }
+
+        // torn write at tail
+        uint32_t crc = header.crc;
+        header.crc = 0;
+        memcpy(&data[0], &header, sizeof(header));
+        if (crc
+            != utils::Crc32::Checksum(data.data(), sizeof(header) + header.len)) {
+            LOG(WARNING) << "Meta journal entry crc mismatch, lsn:" << lsn
+                         << ", pos:" << pos;
+            break;
+        }
+
+        ++lsn;
+        if (header.flags & kEntryWrap) {
+            replayed += journal_size_ - pos;
+            pos = 0;
+            continue;
+        }
+
+        s = applyRecords(data.data() + sizeof(header), header.len);
+        if (!s.ok()) return s;
+
+        replayed += total;
+        ++num_entries;
+        pos += total;
+        if (pos == journal_size_) {
+            pos = 0;
+        }
+    }
+
+    next_lsn_ = lsn;
+    journal_pos_ = pos;
+    since_ckpt_ = replayed;
+    LOG(INFO) << "Replay meta journal, entries:" << num_entries
+              << ", bytes:" << replayed << ", next lsn:" << next_lsn_;
+    return Status();
+}
+
+Status MetaJournal::checkpoint() {
+    std::string payload;
+    for (const auto &entry : entries_) {
+        encodeRecord(
+                MetaRecord(MetaRecord::kPut, entry.first, entry.second),
+                &payload);
+    }
+    if (payload.size() > ckpt_size_) {
+        LOG(ERROR) << "Meta checkpoint too large, size:" << payload.size()
+                   << ", checkpoint area:" << ckpt_size_;
+        return Status(
+                common::CYPRE_ES_META_NO_SPACE, "meta checkpoint area full");
+    }
+
+    // write idle area first, super block switches to it atomically
+    SuperBlock sb = sb_;
+    sb.generation = sb_.generation + 1;
+    sb.ckpt_area = 1 - sb_.ckpt_area;
+    sb.ckpt_len = payload.size();
+    sb.ckpt_crc = utils::Crc32::Checksum(payload);
+    sb.replay_lsn = next_lsn_;
+    sb.replay_pos = journal_pos_;
+    Status s = writeRegion(ckptOffset(sb.ckpt_area), payload);
+    if (!s.ok()) return s;
+    s = writeSuperBlock(sb, sb.generation % 2);
+    if (!s.ok()) return s;
+
+    sb_ = sb;
+    since_ckpt_ = 0;
+    return Status();
+}
+
+Status MetaJournal::writeEntry(const std::string &payload, uint32_t flags) {
+    EntryHeader header;
+    header.magic = kEntryMagic;
+    header.crc = 0;
+    header.journal_id = sb_.journal_id;
+    header.lsn = next_lsn_;
+    header.len = static_cast<uint32_t>(payload.size());
+    header.flags = flags;
+
+    std::string data(reinterpret_cast<const char *>(&header), sizeof(header));
+    data.append(payload);
+    header.crc = utils::Crc32::Checksum(data);
+    memcpy(&data[0], &header, sizeof(header));
+
+    Status s = writeRegion(journal_offset_ + journal_pos_, data);
+    if (!s.ok()) return s;
+
+    ++next_lsn_;
+    return Status();
+}
+
+Status MetaJournal::appendEntry(const std::string &payload) {
+    uint64_t total = alignUp(sizeof(EntryHeader) + payload.size(), kMetaBlockSize);
+    if (total > journal_size_ / 4) {
+        return Status(common::CYPRE_ES_META_NO_SPACE, "meta entry too large");
+    }
+
+    // live journal stays within half of the area, never overwritten
+    uint64_t skip = 0;
+    if (journal_pos_ + total > journal_size_) {
+        skip = journal_size_ - journal_pos_;
+    }
+    if (since_ckpt_ + skip + total > journal_size_ / 2) {
+        Status s = checkpoint();
+        if (!s.ok()) return s;
+    }
+
+    if (skip > 0) {
+        Status s = writeEntry(std::string(), kEntryWrap);
+        if (!s.ok()) return s;
+        since_ckpt_ += skip;
+        journal_pos_ = 0;
+    }
+
+    Status s = writeEntry(payload, 0);
+    if (!s.ok()) return s;
+
+    since_ckpt_ += total;
+    journal_pos_ += total;
+    if (journal_pos_ == journal_size_) {
+        journal_pos_ = 0;
+    }
+    return Status();
+}
+
+Status MetaJournal::Write(const std::vector<MetaRecord> &records) {
+    std::string payload;
+    for (const auto &record : records) {
+        encodeRecord(record, &payload);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!opened_) {
+        return Status(common::CYPRE_ES_META_IO_ERROR, "meta journal closed");
+    }
+
+    Status s = appendEntry(payload);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't append meta journal, records:"
+                   << records.size() << ", " << s.ToString();
+        return s;
+    }
+
+    for (const auto &record : records) {
+        applyRecord(record);
+    }
+    return Status();
+}
+
+Status MetaJournal::Load(const std::string &prefix, const MetaLoadFunc &func) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.lower_bound(prefix);
+         it != entries_.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+        Status s = func(it->first, it->second);
+        if (!s.ok()) return s;
+    }
+    return Status();
+}
+
+Status MetaJournal::LoadRange(
+        const std::string &start, const std::string &end,
+        const MetaLoadFunc &func) {
+    // copy out, so concurrent loaders don't serialize on mutex_ in func
+    std::vector<std::pair<std::string, std::string>> range;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        range.assign(entries_.lower_bound(start), entries_.lower_bound(end));
+    }
+    for (const auto &kv : range) {
+        Status s = func(kv.first, kv.second);
+        if (!s.ok()) return s;
+    }
+    return Status();
+}
+
+// op(1) | key_len(4) | value_len(4) | key | value
+void MetaJournal::encodeRecord(const MetaRecord &record, std::string *dst) {
+    dst->push_back(static_cast<char>(record.op));
+    utils::Coding::PutFixed32(dst, static_cast<uint32_t>(record.key.size()));
+    utils::Coding::PutFixed32(dst, static_cast<uint32_t>(record.value.size()));
+    dst->append(record.key);
+    dst->append(record.value);
+}
+
+Status MetaJournal::applyRecords(const char *data, uint64_t len) {
+    const uint64_t kRecordHeaderSize = 9;
+    uint64_t pos = 0;
+    while (pos < len) {
+        if (pos + kRecordHeaderSize > len) {
+            break;
+        }
+        MetaRecord record;
+        record.op = static_cast<MetaRecord::Op>(data[pos]);
+        uint32_t key_len = utils::Coding::DecodeFixed32(data + pos + 1);
+        uint32_t value_len = utils::Coding::DecodeFixed32(data + pos + 5);
+        pos += kRecordHeaderSize;
+        if (pos + key_len + value_len > len
+            || (record.op != MetaRecord::kPut
+                && record.op != MetaRecord::kDelete)) {
+            pos = len + 1;
+            break;
+        }
+        record.key.assign(data + pos, key_len);
+        record.value.assign(data + pos + key_len, value_len);
+        pos += key_len + value_len;
+        applyRecord(record);
+    }
+
+    if (pos != len) {
+        LOG(ERROR) << "Couldn't decode meta records, len:" << len;
+        return Status(
+                common::CYPRE_ES_META_CORRUPTION, "couldn't decode meta records");
+    }
+    return Status();
+}
+
+void MetaJournal::applyRecord(const MetaRecord &record) {
+    if (record.op == MetaRecord::kPut) {
+        entries_[record.key] = record.value;
+    } else {
+        entries_.erase(record.key);
+    }
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_META_JOURNAL_H_
+#define CYPRESTORE_EXTENTSERVER_META_JOURNAL_H_
+
+#include <butil/macros.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "block_device.h"
+#include "meta_store.h"
+#include "request_context.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+// Metadata kept in a reserved region of the block device instead of rocksdb.
+//
+// Region layout:
+//   | super block A | super block B | checkpoint 0 | checkpoint 1 | journal |
+//
+// Every Write appends one journal entry (header + records, padded to
+// kMetaBlockSize). When the journal written since last checkpoint grows
+// over half of the journal area, all live records are written to the idle
+// checkpoint area and a new super block generation points to it, together
+// with the journal position replay starts from. So the live part of the
+// journal never wraps onto itself.
+// Open loads the newest valid super block and checkpoint, then replays the
+// journal until an entry with unexpected lsn or bad crc (torn tail).
+class MetaJournal : public MetaStore {
+public:
+    MetaJournal(
+            const BlockDevicePtr &bdev, uint64_t region_offset,
+            uint64_t region_size);
+    virtual ~MetaJournal();
+
+    virtual Status Open();
+    virtual Status Close();
+    virtual Status Write(const std::vector<MetaRecord> &records);
+    virtual Status Load(const std::string &prefix, const MetaLoadFunc &func);
+    virtual Status LoadRange(
+            const std::string &start, const std::string &end,
+            const MetaLoadFunc &func);
+
+    uint64_t NumRecords() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+    static const uint64_t kMetaBlockSize = 4096;
+    static const uint64_t kMinRegionSize = 4 << 20;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetaJournal);
+
+    struct SuperBlock {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t crc;
+        uint64_t journal_id;  // random per format, rejects stale entries
+        uint64_t generation;
+        uint32_t ckpt_area;
+        uint32_t ckpt_crc;
+        uint64_t ckpt_len;
+        uint64_t replay_lsn;
+        uint64_t replay_pos;  // relative to journal area
+        uint64_t region_size;
+    };
+
+    struct EntryHeader {
+        uint32_t magic;
+        uint32_t crc;  // header with crc 0, then payload
+        uint64_t journal_id;
+        uint64_t lsn;
+        uint32_t len;  // payload bytes
+        uint32_t flags;
+    };
+
+    enum EntryFlags {
+        kEntryWrap = 1,  // journal continues from area start
+    };
+
+    static void *ioDone(void *arg);
+    Status doIO(RequestType type, uint64_t offset, void *buf, uint64_t size);
+    Status readRegion(uint64_t offset, uint64_t size, std::string *data);
+    Status writeRegion(uint64_t offset, const std::string &data);
+
+    Status format();
+    Status loadSuperBlock(SuperBlock *sb, bool *found);
+    Status writeSuperBlock(const SuperBlock &sb, int slot);
+    Status loadCheckpoint(const SuperBlock &sb);
+    Status replay(const SuperBlock &sb);
+    Status checkpoint();
+    Status appendEntry(const std::string &payload);
+    Status writeEntry(const std::string &payload, uint32_t flags);
+
+    static void encodeRecord(const MetaRecord &record, std::string *dst);
+    Status applyRecords(const char *data, uint64_t len);
+    void applyRecord(const MetaRecord &record);
+
+    uint64_t ckptOffset(uint32_t area) const {
+        return region_offset_ + 2 * kMetaBlockSize + area * ckpt_size_;
+    }
+
+    BlockDevicePtr bdev_;
+    uint64_t region_offset_;
+    uint64_t region_size_;
+    uint64_t ckpt_size_;       // size of each checkpoint area
+    uint64_t journal_offset_;  // absolute offset of journal area
+    uint64_t journal_size_;
+
+    std::mutex mutex_;
+    SuperBlock sb_;           // current super block
+    uint64_t next_lsn_;
+    uint64_t journal_pos_;    // next append position
+    uint64_t since_ckpt_;     // journal bytes written since checkpoint
+    std::map<std::string, std::string> entries_;  // live records
+    void *io_buf_;            // dma buffer of kIOChunkSize
+    bool opened_;
+
+    static const uint64_t kIOChunkSize = 1 << 20;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_META_JOURNAL_H_
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "meta_store.h"
+
+#include "butil/logging.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+Status RocksMetaStore::Open() {
+    rocks_store_.reset(new kvstore::RocksStore(rocks_option_));
+    auto status = rocks_store_->Open();
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't open rocksdb " << rocks_option_.db_path
+                   << ", " << status.ToString();
+        return Status(common::CYPRE_ES_OPEN_ROCKSDB_ERROR, status.ToString());
+    }
+    return Status();
+}
+
+Status RocksMetaStore::Close() {
+    auto status = rocks_store_->Close();
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't close rocksdb " << rocks_option_.db_path
+                   << ", " << status.ToString();
+        return Status(common::CYPRE_ES_CLOSE_ROCKSDB_ERROR, status.ToString());
+    }
+    return Status();
+}
+
+Status RocksMetaStore::Write(const std::vector<MetaRecord> &records) {
+    kvstore::RocksWriteBatch write_batch;
+    for (const auto &record : records) {
+        if (record.op == MetaRecord::kPut) {
+            write_batch.Put(record.key, record.value);
+        } else {
+            write_batch.Delete(record.key);
+        }
+    }
+
+    auto status = rocks_store_->Write(write_batch);
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't write batch to rocksdb, batch size:"
+                   << records.size() << ", " << status.ToString();
+        return Status(
+                common::CYPRE_ES_ROCKSDB_STORE_ERROR, status.ToString());
+    }
+    return Status();
+}
+
+Status
+RocksMetaStore::Load(const std::string &prefix, const MetaLoadFunc &func) {
+    std::unique_ptr<kvstore::KVIterator> kv_iter;
+    auto status = rocks_store_->ScanPrefix(prefix, &kv_iter);
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't scan rocksdb, prefix:" << prefix << ", "
+                   << status.ToString();
+        return Status(
+                common::CYPRE_ES_ROCKSDB_LOAD_ERROR, status.ToString());
+    }
+
+    for (; kv_iter->Valid(); kv_iter->Next()) {
+        Status s = func(kv_iter->key(), kv_iter->value());
+        if (!s.ok()) return s;
+    }
+    return Status();
+}
+
+Status RocksMetaStore::LoadRange(
+        const std::string &start, const std::string &end,
+        const MetaLoadFunc &func) {
+    std::unique_ptr<kvstore::KVIterator> kv_iter;
+    auto status = rocks_store_->ScanRange(start, end, &kv_iter);
+    if (!status.ok()) {
+        LOG(ERROR) << "Couldn't scan rocksdb, range:[" << start << ", " << end
+                   << "), " << status.ToString();
+        return Status(
+                common::CYPRE_ES_ROCKSDB_LOAD_ERROR, status.ToString());
+    }
+
+    for (; kv_iter->Valid(); kv_iter->Next()) {
+        Status s = func(kv_iter->key(), kv_iter->value());
+        if (!s.ok()) return s;
+    }
+    return Status();
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
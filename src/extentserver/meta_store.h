@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_META_STORE_H_
+#define CYPRESTORE_EXTENTSERVER_META_STORE_H_
+
+#include <butil/macros.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/status.h"
+#include "kvstore/rocks_store.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+class MetaStore;
+typedef std::shared_ptr<MetaStore> MetaStorePtr;
+
+const std::string kMetaStoreRocksDB = "rocksdb";
+const std::string kMetaStoreJournal = "journal";
+
+using common::Status;
+
+struct MetaRecord {
+    enum Op {
+        kPut = 1,
+        kDelete = 2,
+    };
+
+    MetaRecord() : op(kPut) {}
+    MetaRecord(Op op_, const std::string &key_, const std::string &value_)
+            : op(op_), key(key_), value(value_) {}
+
+    Op op;
+    std::string key;
+    std::string value;
+};
+
+typedef std::function<Status(const std::string &key, const std::string &value)>
+        MetaLoadFunc;
+
+// key value store of extentserver metadata
+class MetaStore {
+public:
+    MetaStore() = default;
+    virtual ~MetaStore() = default;
+
+    virtual Status Open() = 0;
+    virtual Status Close() = 0;
+    // records are durable when returns
+    virtual Status Write(const std::vector<MetaRecord> &records) = 0;
+    // calls func on every key with prefix
+    virtual Status Load(const std::string &prefix, const MetaLoadFunc &func) = 0;
+    // calls func on every key in [start, end), may run concurrently
+    virtual Status LoadRange(
+            const std::string &start, const std::string &end,
+            const MetaLoadFunc &func) = 0;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetaStore);
+};
+
+class RocksMetaStore : public MetaStore {
+public:
+    explicit RocksMetaStore(const kvstore::RocksOption &rocks_option)
+            : rocks_option_(rocks_option) {}
+    virtual ~RocksMetaStore() = default;
+
+    virtual Status Open();
+    virtual Status Close();
+    virtual Status Write(const std::vector<MetaRecord> &records);
+    virtual Status Load(const std::string &prefix, const MetaLoadFunc &func);
+    virtual Status LoadRange(
+            const std::string &start, const std::string &end,
+            const MetaLoadFunc &func);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RocksMetaStore);
+
+    kvstore::RocksOption rocks_option_;
+    kvstore::RocksStorePtr rocks_store_;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_META_STORE_H_
@@ -8,7 +8,10 @@
 
 #include <butil/logging.h>
 
+#include <algorithm>
+
 #include "common/config.h"
+#include "common/constants.h"
 #include "common/cypre_ring.h"
 
 namespace cyprestore {
@@ -67,6 +70,14 @@ Status NVMeDevice::Open() {
     align_size_ = spdk_mgr_->GetBufAlignSize() * block_size_;
     write_unit_size_ = spdk_mgr_->GetWriteUnitSize() * block_size_;
 
+    if (GlobalConfig().extentserver().zero_copy_write) {
+        s = spdk_mgr_->EnableZeroCopyWrite();
+        if (!s.ok()) {
+            LOG(ERROR) << "Couldn't enable zero copy write, " << s.ToString();
+            return s;
+        }
+    }
+
     s = spdk_mgr_->StartWorkers();
     if (!s.ok()) {
         LOG(ERROR) << "Couldn't start worker threads, " << s.ToString();
@@ -107,5 +118,15 @@ Status NVMeDevice::PeriodDeviceAdmin() {
 Status NVMeDevice::ProcessRequest(Request *req) {
     return spdk_mgr_->ProcessRequest(req);
 }
+
+void *NVMeDevice::AllocIOMem(size_t size) {
+    return spdk_mgr_->AllocIOMem(
+            size, std::max<size_t>(align_size_, common::kSpdkBDevAlignSize));
+}
+
+void NVMeDevice::FreeIOMem(void *p) {
+    spdk_mgr_->FreeIOMem(p);
+}
+
 }  // namespace extentserver
 }  // namespace cyprestore
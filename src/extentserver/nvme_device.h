@@ -31,6 +31,8 @@ public:
     virtual Status Close();
     virtual Status PeriodDeviceAdmin();
     virtual Status ProcessRequest(Request *req);
+    virtual void *AllocIOMem(size_t size);
+    virtual void FreeIOMem(void *p);
 
 private:
     DISALLOW_COPY_AND_ASSIGN(NVMeDevice);
@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "quorum_write.h"
+
+#include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
+#include <bthread/unstable.h>
+#include <butil/logging.h>
+#include <butil/object_pool.h>
+#include <butil/time.h>
+
+#include <algorithm>
+
+#include "extentserver.h"
+#include "replicate_engine.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+const int kReplayRetryMs = 100;
+const int kResyncRetryMs = 1000;
+const uint64_t kResyncChunkSize = 1 << 20;
+
+void ReplicaSlot::Prepare(UserCallback_t cb) {
+    req.Reset(RequestType::kTypeWrite);
+    req.SetOperationContext(&write->cntl, &write->request, nullptr, nullptr);
+    req.SetExtentRouter(write->router);
+    req.SetUserCallback(cb);
+    req.SetUserArg(this);
+}
+
+QuorumWrite *QuorumWrite::Get() {
+    return butil::get_object<QuorumWrite>();
+}
+
+void QuorumWrite::Init(Request *client_req, int replicas, int acks) {
+    auto &op_ctx = client_req->GetOperationContext();
+    request.CopyFrom(*static_cast<pb::WriteRequest *>(op_ctx.request));
+    // secondaries don't serve reads of it, see isSecondaryReadable
+    request.set_quorum_acked(true);
+    // share the (dma) blocks of client's attachment, no copy here
+    cntl.request_attachment() = op_ctx.cntl->request_attachment();
+    router = client_req->GetExtentRouter();
+    // nothing to answer if primary's copy alone is the quorum
+    req = acks > 0 ? client_req : nullptr;
+    num_replicas = replicas;
+    quorum = acks;
+    acked = 0;
+    failed = 0;
+    // one per slot and one for the sender
+    refs = replicas + 1;
+    for (int i = 0; i < replicas; ++i) {
+        slots[i].write = this;
+        slots[i].catchup = nullptr;
+        slots[i].reported = false;
+    }
+}
+
+void QuorumWrite::Report(ReplicaSlot *slot, bool success) {
+    if (slot->reported) return;
+    slot->reported = true;
+
+    // acks and failures can't both reach their mark, replicas would be
+    // more than num_replicas
+    bool decided = false;
+    if (success) {
+        decided = acked.fetch_add(1) + 1 == quorum;
+    } else {
+        decided = failed.fetch_add(1) + 1 == num_replicas - quorum + 1;
+    }
+    if (!decided) return;
+
+    // slot isn't unref'ed yet, write outlives the reply
+    Request *client_req = req;
+    req = nullptr;
+    client_req->SetResult(success);
+    client_req->UserCallback()(client_req);
+}
+
+void QuorumWrite::Unref() {
+    if (refs.fetch_sub(1) != 1) return;
+
+    // Reset drops the attachment, client's blocks aren't held in pool
+    cntl.Reset();
+    request.Clear();
+    router.reset();
+    butil::return_object(this);
+}
+
+void *QuorumWrite::OnReplicaDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    ReplicaSlot *slot = static_cast<ReplicaSlot *>(req->UserArg());
+    bool success = req->Result();
+    slot->write->Report(slot, success);
+    slot->catchup->OnDirectDone(slot, success);
+    return nullptr;
+}
+
+ReplicaCatchup::ReplicaCatchup(
+        ReplicateEngine *engine, const common::ESInstance &peer,
+        uint64_t max_lag_bytes, int lag_wait_ms)
+        : engine_(engine), peer_(peer),
+          name_("replica_" + peer.public_ip + ":"
+                + std::to_string(peer.public_port)),
+          max_lag_bytes_(max_lag_bytes), lag_wait_ms_(lag_wait_ms),
+          direct_inflight_(0), replaying_(nullptr), retry_pending_(false),
+          backlog_bytes_(0), out_of_sync_(false), resyncing_(false) {
+    lag_writes_.expose_as(name_, "lag_writes");
+    lag_bytes_.expose_as(name_, "lag_bytes");
+    replayed_writes_.expose_as(name_, "replayed_writes");
+    out_of_sync_var_.expose_as(name_, "out_of_sync");
+    resynced_extents_.expose_as(name_, "resynced_extents");
+}
+
+// bytes a slot holds in backlog, none for a discard
+static uint64_t lagSize(const ReplicaSlot *slot) {
+    return slot->write->cntl.request_attachment().size();
+}
+
+bool ReplicaCatchup::Enqueue(ReplicaSlot *slot) {
+    const std::string &extent_id = slot->write->request.extent_id();
+    uint64_t size = lagSize(slot);
+    std::deque<ReplicaSlot *> dropped;
+    ReplicaSlot *next = nullptr;
+    {
+        std::unique_lock<bthread::Mutex> lock(mutex_);
+        if (!out_of_sync_ && !dirtyLocked(extent_id) && !laggingLocked()) {
+            ++direct_inflight_;
+            return false;
+        }
+
+        // a single write larger than the limit still fits an empty backlog
+        timespec deadline = butil::milliseconds_from_now(lag_wait_ms_);
+        while (!out_of_sync_ && !dirtyLocked(extent_id) && backlog_bytes_ > 0
+               && backlog_bytes_ + size > max_lag_bytes_) {
+            if (room_cond_.wait_until(lock, deadline) == ETIMEDOUT) {
+                markOutOfSync(&dropped);
+            }
+        }
+
+        if (out_of_sync_ || dirtyLocked(extent_id)) {
+            // resync copies it, a send could race the copy
+            markDirty(extent_id, &dropped);
+            dropped.push_back(slot);
+        } else {
+            backlog_.push_back(slot);
+            backlog_bytes_ += size;
+            lag_writes_ << 1;
+            lag_bytes_ << size;
+            next = nextReplay();
+        }
+    }
+
+    for (auto dropped_slot : dropped) {
+        drop(dropped_slot);
+    }
+    if (next != nullptr) {
+        replay(next);
+    }
+    return true;
+}
+
+void ReplicaCatchup::OnDirectDone(ReplicaSlot *slot, bool success) {
+    std::deque<ReplicaSlot *> dropped;
+    ReplicaSlot *next = nullptr;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        --direct_inflight_;
+        if (!success) {
+            // not resent, a newer overlapping write may have landed already
+            markDirty(slot->write->request.extent_id(), &dropped);
+        }
+        next = nextReplay();
+    }
+
+    if (!dropped.empty()) {
+        room_cond_.notify_all();
+    }
+    for (auto dropped_slot : dropped) {
+        drop(dropped_slot);
+    }
+    slot->write->Unref();
+    if (next != nullptr) {
+        replay(next);
+    }
+}
+
+ReplicaSlot *ReplicaCatchup::nextReplay() {
+    if (replaying_ != nullptr || direct_inflight_ > 0 || retry_pending_
+        || out_of_sync_) {
+        return nullptr;
+    }
+
+    std::deque<ReplicaSlot *> &queue = retry_.empty() ? backlog_ : retry_;
+    if (queue.empty()) return nullptr;
+    replaying_ = queue.front();
+    queue.pop_front();
+    return replaying_;
+}
+
+void ReplicaCatchup::replay(ReplicaSlot *slot) {
+    slot->Prepare(onReplayDone);
+    Status s = engine_->SendTo(&slot->req, peer_);
+    if (!s.ok()) {
+        slot->req.SetResult(false);
+        onReplayDone(&slot->req);
+    }
+}
+
+void *ReplicaCatchup::onReplayDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    ReplicaSlot *slot = static_cast<ReplicaSlot *>(req->UserArg());
+    bool success = req->Result();
+    slot->write->Report(slot, success);
+    slot->catchup->replayDone(slot, success);
+    return nullptr;
+}
+
+void ReplicaCatchup::replayDone(ReplicaSlot *slot, bool success) {
+    std::deque<ReplicaSlot *> dropped;
+    bool retry = false;
+    ReplicaSlot *next = nullptr;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        replaying_ = nullptr;
+        if (!success && !out_of_sync_) {
+            LOG(WARNING) << "Couldn't replay write to " << name_
+                         << ", extent_id:" << slot->write->request.extent_id()
+                         << ", offset:" << slot->write->request.offset()
+                         << ", size:" << slot->write->request.size()
+                         << ", retry in " << kReplayRetryMs << "ms";
+            retry_.push_front(slot);
+            retry_pending_ = true;
+            retry = true;
+        } else {
+            unlag(slot);
+            if (success) {
+                replayed_writes_ << 1;
+            } else {
+                markDirty(slot->write->request.extent_id(), &dropped);
+            }
+            next = nextReplay();
+        }
+    }
+
+    if (retry) {
+        bthread_timer_t timer;
+        bthread_timer_add(
+                &timer, butil::milliseconds_from_now(kReplayRetryMs),
+                retryReplay, this);
+        return;
+    }
+    room_cond_.notify_all();
+    for (auto dropped_slot : dropped) {
+        drop(dropped_slot);
+    }
+    slot->write->Unref();
+    if (next != nullptr) {
+        replay(next);
+    }
+}
+
+void ReplicaCatchup::retryReplay(void *arg) {
+    // timer thread mustn't block on connecting or stream back pressure
+    bthread_t tid;
+    if (bthread_start_background(&tid, NULL, kickReplay, arg) != 0) {
+        kickReplay(arg);
+    }
+}
+
+void *ReplicaCatchup::kickReplay(void *arg) {
+    ReplicaCatchup *catchup = static_cast<ReplicaCatchup *>(arg);
+    ReplicaSlot *next = nullptr;
+    {
+        std::lock_guard<bthread::Mutex> lock(catchup->mutex_);
+        catchup->retry_pending_ = false;
+        next = catchup->nextReplay();
+    }
+    if (next != nullptr) {
+        catchup->replay(next);
+    }
+    return nullptr;
+}
+
+void ReplicaCatchup::markOutOfSync(std::deque<ReplicaSlot *> *dropped) {
+    LOG(ERROR) << "Replica " << name_ << " out of sync"
+               << ", lag writes:" << retry_.size() + backlog_.size()
+               << ", lag bytes:" << backlog_bytes_;
+    out_of_sync_ = true;
+    out_of_sync_var_ << 1;
+    for (auto slot : retry_) {
+        unlag(slot);
+        dirty_.insert(slot->write->request.extent_id());
+        dropped->push_back(slot);
+    }
+    for (auto slot : backlog_) {
+        unlag(slot);
+        dirty_.insert(slot->write->request.extent_id());
+        dropped->push_back(slot);
+    }
+    retry_.clear();
+    backlog_.clear();
+    room_cond_.notify_all();
+    startResync();
+}
+
+void ReplicaCatchup::markDirty(
+        const std::string &extent_id, std::deque<ReplicaSlot *> *dropped) {
+    dirty_.insert(extent_id);
+    // queued writes of the extent would race its copy
+    for (auto queue : {&retry_, &backlog_}) {
+        for (auto it = queue->begin(); it != queue->end();) {
+            if ((*it)->write->request.extent_id() != extent_id) {
+                ++it;
+                continue;
+            }
+            unlag(*it);
+            dropped->push_back(*it);
+            it = queue->erase(it);
+        }
+    }
+    startResync();
+}
+
+void ReplicaCatchup::startResync() {
+    if (resyncing_) return;
+    bthread_t tid;
+    resyncing_ = bthread_start_background(&tid, NULL, resyncEntry, this) == 0;
+    if (!resyncing_) {
+        LOG(ERROR) << "Couldn't start resync of " << name_;
+    }
+}
+
+void ReplicaCatchup::unlag(ReplicaSlot *slot) {
+    uint64_t size = lagSize(slot);
+    backlog_bytes_ -= size;
+    lag_writes_ << -1;
+    lag_bytes_ << -static_cast<int64_t>(size);
+}
+
+void ReplicaCatchup::drop(ReplicaSlot *slot) {
+    slot->write->Report(slot, false);
+    slot->write->Unref();
+}
+
+static void *onResyncIODone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    // waiter owns req, don't touch it after signal
+    static_cast<bthread::CountdownEvent *>(req->UserArg())->signal();
+    return nullptr;
+}
+
+void *ReplicaCatchup::resyncEntry(void *arg) {
+    static_cast<ReplicaCatchup *>(arg)->resync();
+    return nullptr;
+}
+
+void ReplicaCatchup::resync() {
+    while (true) {
+        std::string extent_id;
+        {
+            std::lock_guard<bthread::Mutex> lock(mutex_);
+            resync_extent_.clear();
+            if (tryRejoin()) return;
+            nextResync(&extent_id);
+        }
+        if (extent_id.empty()) {
+            // sends in flight may still land after a copy, or still miss
+            bthread_usleep(kReplayRetryMs * 1000);
+            continue;
+        }
+
+        Status s = resyncExtent(extent_id);
+        if (s.ok()) {
+            resynced_extents_ << 1;
+            continue;
+        }
+        LOG(WARNING) << "Couldn't resync extent to " << name_
+                     << ", extent_id:" << extent_id << ", " << s.ToString()
+                     << ", retry in " << kResyncRetryMs << "ms";
+        {
+            std::lock_guard<bthread::Mutex> lock(mutex_);
+            dirty_.insert(extent_id);
+        }
+        bthread_usleep(kResyncRetryMs * 1000);
+    }
+}
+
+bool ReplicaCatchup::nextResync(std::string *extent_id) {
+    if (direct_inflight_ > 0) return false;
+    for (auto it = dirty_.begin(); it != dirty_.end(); ++it) {
+        if (replaying_ != nullptr
+            && replaying_->write->request.extent_id() == *it) {
+            continue;
+        }
+        *extent_id = *it;
+        resync_extent_ = *it;
+        dirty_.erase(it);
+        return true;
+    }
+    return false;
+}
+
+bool ReplicaCatchup::tryRejoin() {
+    if (!dirty_.empty()) return false;
+    if (out_of_sync_) {
+        if (direct_inflight_ > 0 || replaying_ != nullptr) return false;
+        out_of_sync_ = false;
+        out_of_sync_var_ << -1;
+        LOG(INFO) << "Replica " << name_ << " resynced, back in sync";
+    }
+    resyncing_ = false;
+    return true;
+}
+
+Status ReplicaCatchup::resyncExtent(const std::string &extent_id) {
+    // writes that dirtied the extent may not be on local disk yet
+    engine_->WaitWrites(extent_id);
+
+    uint64_t extent_size =
+            ExtentServer::GlobalInstance().StorageEngine()->ExtentSize();
+    for (uint64_t offset = 0; offset < extent_size;
+         offset += kResyncChunkSize) {
+        uint64_t size = std::min(kResyncChunkSize, extent_size - offset);
+        butil::IOBuf data;
+        Status s = readLocal(extent_id, offset, size, &data);
+        if (s.IsEmpty()) {
+            // no location here, a discard may have freed what the
+            // secondary still has
+            return sendResync(extent_id, 0, extent_size, nullptr);
+        }
+        if (!s.ok()) return s;
+
+        s = sendResync(extent_id, offset, size, &data);
+        if (!s.ok()) return s;
+    }
+    return Status();
+}
+
+Status ReplicaCatchup::readLocal(
+        const std::string &extent_id, uint64_t offset, uint64_t size,
+        butil::IOBuf *data) {
+    auto &es = ExtentServer::GlobalInstance();
+    Request *req = es.RequestMgr()->GetRequest(RequestType::kTypeRead);
+    if (req == nullptr) {
+        return Status(
+                common::CYPRE_ES_GET_REQ_UNIT_FAIL, "get request unit fail");
+    }
+
+    brpc::Controller cntl;
+    pb::ReadRequest request;
+    pb::ReadResponse response;
+    request.set_extent_id(extent_id);
+    request.set_offset(offset);
+    request.set_size(size);
+    bthread::CountdownEvent done(1);
+    req->SetOperationContext(&cntl, &request, &response, nullptr);
+    req->SetUserCallback(onResyncIODone);
+    req->SetUserArg(&done);
+
+    Status s = es.StorageEngine()->ProcessRequest(req);
+    if (s.ok()) {
+        done.wait();
+        if (!req->Result()) {
+            s = Status(common::CYPRE_ES_PROCESS_REQ_ERROR, "read io error");
+        } else if (req->IOUnit() != nullptr && req->Vectored()) {
+            struct iovec *iovs = req->IOVecs();
+            for (uint32_t i = 0; i < req->NumIOVecs(); ++i) {
+                data->append(iovs[i].iov_base, iovs[i].iov_len);
+            }
+        } else if (req->IOUnit() != nullptr) {
+            data->append(req->IOUnit()->data, size);
+        } else {
+            // served from write log, no device io
+            data->append(cntl.response_attachment());
+        }
+        if (s.ok() && data->size() != size) {
+            s = Status(
+                    common::CYPRE_ES_PROCESS_REQ_ERROR,
+                    "short read of " + std::to_string(data->size()) + "/"
+                            + std::to_string(size));
+        }
+    }
+    req->ReleaseIOUnits();
+    es.RequestMgr()->PutRequest(req);
+    return s;
+}
+
+Status ReplicaCatchup::sendResync(
+        const std::string &extent_id, uint64_t offset, uint64_t size,
+        const butil::IOBuf *data) {
+    brpc::Controller cntl;
+    pb::WriteRequest request;
+    request.set_extent_id(extent_id);
+    request.set_offset(offset);
+    request.set_size(size);
+    request.set_quorum_acked(true);
+    if (data != nullptr) {
+        cntl.request_attachment() = *data;
+    } else {
+        request.set_discard(true);
+    }
+
+    Request req(RequestType::kTypeWrite);
+    bthread::CountdownEvent done(1);
+    req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+    req.SetUserCallback(onResyncIODone);
+    req.SetUserArg(&done);
+    Status s = engine_->SendTo(&req, peer_);
+    if (!s.ok()) return s;
+
+    done.wait();
+    if (!req.Result()) {
+        return Status(
+                common::CYPRE_ES_REPLICATE_PART_FAIL,
+                "couldn't write secondary");
+    }
+    return Status();
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
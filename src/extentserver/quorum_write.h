@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_QUORUM_WRITE_H_
+#define CYPRESTORE_EXTENTSERVER_QUORUM_WRITE_H_
+
+#include <brpc/controller.h>
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <bvar/bvar.h>
+
+#include <atomic>
+#include <deque>
+#include <set>
+#include <string>
+
+#include "common/extent_router.h"
+#include "common/status.h"
+#include "request_context.h"
+#include "pb/extent_io.pb.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+using common::Status;
+
+class ReplicateEngine;
+class ReplicaCatchup;
+struct QuorumWrite;
+
+const int kMaxQuorumReplicas = 4;  // secondaries of one extent
+
+// Copy of a quorum write for one secondary. It is a write request of its
+// own, so rpc and stream replication carry it like any replicated write,
+// and it lives on after the client is acked till the secondary has it.
+struct ReplicaSlot {
+    ReplicaSlot()
+            : req(RequestType::kTypeWrite), write(nullptr), catchup(nullptr),
+              reported(false) {}
+
+    // req is reset before every send, result of a send is sticky
+    void Prepare(UserCallback_t cb);
+
+    Request req;
+    QuorumWrite *write;
+    ReplicaCatchup *catchup;
+    bool reported;  // first outcome counted for quorum
+};
+
+// A write acked to client once quorum of secondaries have it. Taken from
+// butil object pool like replicate contexts, it shares the blocks of
+// client's attachment till every secondary has them or gives up.
+struct QuorumWrite {
+    QuorumWrite() : req(nullptr), num_replicas(0), quorum(0) {}
+
+    static QuorumWrite *Get();
+    void Init(Request *client_req, int replicas, int acks);
+    // first outcome of slot, client is answered once quorum is decided
+    void Report(ReplicaSlot *slot, bool success);
+    // a slot is done with or the sender is, the last one releases write
+    void Unref();
+    // user callback of directly sent slots
+    static void *OnReplicaDone(void *arg);
+
+    brpc::Controller cntl;  // holds the shared attachment
+    pb::WriteRequest request;
+    common::ExtentRouterPtr router;
+    Request *req;  // client's, null once answered
+    int num_replicas;
+    int quorum;  // acks of secondaries needed, 0 for primary alone
+    std::atomic<int> acked;
+    std::atomic<int> failed;
+    std::atomic<int> refs;
+    ReplicaSlot slots[kMaxQuorumReplicas];
+};
+
+// Writes a secondary is behind on. A secondary lags once a direct send to
+// it fails. The missed write isn't resent, a newer overlapping one may have
+// landed already, its extent is marked dirty instead and a resync copies
+// the extent from local storage once writes that dirtied it are done here
+// and no send to the secondary is in flight. Writes to a dirty extent fail
+// for the secondary till it's copied, writes to others queue while it lags
+// and are replayed one by one in order. Backlog is bounded by
+// max_lag_bytes, a writer waits lag_wait_ms for room before the secondary
+// is given up as out of sync, every write to it fails and dirties its
+// extent from then on, and it rejoins when no dirty extent is left.
+class ReplicaCatchup {
+public:
+    ReplicaCatchup(
+            ReplicateEngine *engine, const common::ESInstance &peer,
+            uint64_t max_lag_bytes, int lag_wait_ms);
+    ~ReplicaCatchup() = default;
+
+    // false if secondary is in sync and slot is to be sent directly
+    bool Enqueue(ReplicaSlot *slot);
+    void OnDirectDone(ReplicaSlot *slot, bool success);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ReplicaCatchup);
+
+    static void *onReplayDone(void *arg);
+    static void retryReplay(void *arg);
+    static void *kickReplay(void *arg);
+
+    bool laggingLocked() const {
+        return !retry_.empty() || !backlog_.empty() || replaying_ != nullptr
+               || resyncing_;
+    }
+    bool dirtyLocked(const std::string &extent_id) const {
+        return dirty_.count(extent_id) > 0 || resync_extent_ == extent_id;
+    }
+    // with mutex_ held, next slot to replay if replay may go on
+    ReplicaSlot *nextReplay();
+    void replay(ReplicaSlot *slot);
+    void replayDone(ReplicaSlot *slot, bool success);
+    // with mutex_ held, queued slots moved to dropped
+    void markOutOfSync(std::deque<ReplicaSlot *> *dropped);
+    // with mutex_ held, queued slots of the extent moved to dropped
+    void markDirty(
+            const std::string &extent_id, std::deque<ReplicaSlot *> *dropped);
+    void startResync();
+    void drop(ReplicaSlot *slot);
+    void unlag(ReplicaSlot *slot);
+
+    static void *resyncEntry(void *arg);
+    void resync();
+    // with mutex_ held, dirty extent to copy if none may race the copy
+    bool nextResync(std::string *extent_id);
+    // with mutex_ held, true if the secondary is in sync again
+    bool tryRejoin();
+    Status resyncExtent(const std::string &extent_id);
+    Status readLocal(
+            const std::string &extent_id, uint64_t offset, uint64_t size,
+            butil::IOBuf *data);
+    // the range is discarded on the secondary if data is null
+    Status sendResync(
+            const std::string &extent_id, uint64_t offset, uint64_t size,
+            const butil::IOBuf *data);
+
+    ReplicateEngine *engine_;
+    common::ESInstance peer_;
+    std::string name_;
+    uint64_t max_lag_bytes_;
+    int lag_wait_ms_;
+
+    bthread::Mutex mutex_;
+    bthread::ConditionVariable room_cond_;
+    int direct_inflight_;
+    std::deque<ReplicaSlot *> retry_;    // failed replay, goes first
+    std::deque<ReplicaSlot *> backlog_;  // queued while lagging, in order
+    ReplicaSlot *replaying_;
+    bool retry_pending_;  // replay backs off after a failure
+    uint64_t backlog_bytes_;  // of retry_, backlog_ and replaying_
+    bool out_of_sync_;
+    std::set<std::string> dirty_;  // extents missed by the secondary
+    std::string resync_extent_;    // being copied
+    bool resyncing_;
+
+    bvar::Adder<int64_t> lag_writes_;
+    bvar::Adder<int64_t> lag_bytes_;
+    bvar::Adder<int64_t> replayed_writes_;
+    bvar::Adder<int64_t> out_of_sync_var_;
+    bvar::Adder<int64_t> resynced_extents_;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_QUORUM_WRITE_H_
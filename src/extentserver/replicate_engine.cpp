@@ -7,15 +7,101 @@
 #include "replicate_engine.h"
 
 #include <butil/logging.h>
+#include <butil/object_pool.h>
+
+#include <atomic>
 
 #include "pb/extent_io.pb.h"
 
 namespace cyprestore {
 namespace extentserver {
 
+void ReplicateEngine::EnableStream(
+        const std::string &primary, int streams_per_peer) {
+    primary_ = primary;
+    streams_per_peer_ = streams_per_peer > 0 ? streams_per_peer : 1;
+}
+
+ReplicateStream *ReplicateEngine::getStream(const std::string &ip, int port) {
+    static std::atomic<int> next_worker(0);
+    static thread_local int worker = next_worker.fetch_add(1);
+    static thread_local std::string key;
+    key.assign(ip).append(":").append(std::to_string(port));
+    size_t index = static_cast<size_t>(worker % streams_per_peer_);
+    {
+        common::ReadLock lock(streams_lock_);
+        auto it = streams_.find(key);
+        if (it != streams_.end()) return it->second[index].get();
+    }
+
+    common::WriteLock lock(streams_lock_);
+    StreamGroup &group = streams_[key];
+    if (group.empty()) {
+        // streams connect lazily on first send
+        for (int i = 0; i < streams_per_peer_; ++i) {
+            group.emplace_back(new ReplicateStream(primary_, key, i));
+        }
+    }
+    return group[index].get();
+}
+
+void ReplicateEngine::EnableQuorum(
+        int write_quorum, uint64_t max_lag_bytes, int lag_wait_ms) {
+    write_quorum_ = write_quorum > 0 ? write_quorum : 0;
+    max_lag_bytes_ = max_lag_bytes;
+    lag_wait_ms_ = lag_wait_ms;
+}
+
+ReplicaCatchup *ReplicateEngine::getCatchup(const common::ESInstance &peer) {
+    static thread_local std::string key;
+    key.assign(peer.public_ip)
+            .append(":")
+            .append(std::to_string(peer.public_port));
+    {
+        common::ReadLock lock(catchups_lock_);
+        auto it = catchups_.find(key);
+        if (it != catchups_.end()) return it->second.get();
+    }
+
+    common::WriteLock lock(catchups_lock_);
+    std::unique_ptr<ReplicaCatchup> &catchup = catchups_[key];
+    if (!catchup) {
+        catchup.reset(new ReplicaCatchup(
+                this, peer, max_lag_bytes_, lag_wait_ms_));
+    }
+    return catchup.get();
+}
+
+Status ReplicateEngine::SendTo(
+        Request *req, const common::ESInstance &peer) {
+    auto conn = conn_pool_->GetConnection(peer.public_ip, peer.public_port);
+    if (!conn) {
+        return Status(
+                common::CYPRE_ES_CONNECT_PEER_FAIL,
+                "couldn't connect to peer es");
+    }
+    if (streams_per_peer_ == 0) {
+        sendOneReplicate(req, conn);
+        return Status();
+    }
+    auto stream = getStream(peer.public_ip, peer.public_port);
+    return stream->Send(req, conn);
+}
+
+void ReplicateEngine::WaitWrites(const std::string &extent_id) {
+    std::lock_guard<bthread::Mutex> lock(drain_mutex_);
+    write_gates_.Drain(ExtentKey::FromExtentID(extent_id));
+}
+
 Status ReplicateEngine::Send(Request *req) {
     // 获取路由
     auto extent_router = req->GetExtentRouter();
+    int num_secondaries = static_cast<int>(extent_router->secondaries.size());
+    if (write_quorum_ > 0 && write_quorum_ <= num_secondaries
+        && num_secondaries <= kMaxQuorumReplicas) {
+        return sendQuorum(req);
+    }
+
     bool failed = false;
     req->SetRefCount(1 + extent_router->secondaries.size());
     for (size_t i = 0; i < extent_router->secondaries.size(); ++i) {
@@ -23,21 +109,18 @@ Status ReplicateEngine::Send(Request *req) {
             req->UserCallback()(req);
             continue;
         }
-        auto conn = conn_pool_->GetConnection(
-                extent_router->secondaries[i].public_ip,
-                extent_router->secondaries[i].public_port);
-        if (!conn) {
-            LOG(ERROR) << "Couldn't connect to peer es"
+        Status s = SendTo(req, extent_router->secondaries[i]);
+        if (!s.ok()) {
+            LOG(ERROR) << "Couldn't replicate to peer es"
                        << ", extent_id:" << req->ExtentID()
                        << ", offset:" << req->Offset()
                        << ", size:" << req->Size() << ", peer_addr:"
-                       << extent_router->secondaries[i].address();
+                       << extent_router->secondaries[i].address()
+                       << ", status:" << s.ToString();
             failed = true;
             req->SetResult(false);
             req->UserCallback()(req);
-            continue;
         }
-        sendOneReplicate(req, conn);
     }
 
     if (failed) {
@@ -48,48 +131,103 @@ Status ReplicateEngine::Send(Request *req) {
     return Status();
 }
 
+Status ReplicateEngine::sendQuorum(Request *req) {
+    auto extent_router = req->GetExtentRouter();
+    int num_secondaries = static_cast<int>(extent_router->secondaries.size());
+    QuorumWrite *write = QuorumWrite::Get();
+    int acks = write_quorum_ - 1;
+    write->Init(req, num_secondaries, acks);
+    // before any secondary may skip it, see ReplicaCatchup resync
+    req->HoldReplicaWrite(write_gates_.Enter(
+            ExtentKey::FromExtentID(write->request.extent_id())));
+    // local write and quorum of secondaries, if primary alone isn't one
+    req->SetRefCount(acks > 0 ? 2 : 1);
+    for (int i = 0; i < num_secondaries; ++i) {
+        ReplicaSlot *slot = &write->slots[i];
+        slot->catchup = getCatchup(extent_router->secondaries[i]);
+        if (slot->catchup->Enqueue(slot)) {
+            continue;
+        }
+
+        slot->Prepare(QuorumWrite::OnReplicaDone);
+        Status s = SendTo(&slot->req, extent_router->secondaries[i]);
+        if (!s.ok()) {
+            LOG(ERROR) << "Couldn't replicate to peer es"
+                       << ", extent_id:" << req->ExtentID()
+                       << ", offset:" << req->Offset()
+                       << ", size:" << req->Size() << ", peer_addr:"
+                       << extent_router->secondaries[i].address()
+                       << ", status:" << s.ToString();
+            slot->req.SetResult(false);
+            QuorumWrite::OnReplicaDone(&slot->req);
+        }
+    }
+    // failures are answered by quorum, secondaries catch up on their own
+    write->Unref();
+    return Status();
+}
+
 void ReplicateEngine::sendOneReplicate(
         Request *req, common::ConnectionPtr conn) {
-    // TODO(yangchunxin3): 避免内存分配
-    brpc::Controller *cntl = new brpc::Controller();
-    pb::ReplicateResponse *repl_resp = new pb::ReplicateResponse();
-    pb::ExtentIOService_Stub stub(conn->channel.get());
-    pb::ReplicateRequest repl_req;
-    repl_req.set_extent_id(req->ExtentID());
-    repl_req.set_offset(req->Offset());
-    repl_req.set_size(req->Size());
-
     auto &op_ctx = req->GetOperationContext();
     pb::WriteRequest *request = static_cast<pb::WriteRequest *>(op_ctx.request);
+    ReplicateContext *ctx = ReplicateContext::Get();
+    ctx->req = req;
+    // fields of a reused request keep their capacity
+    pb::ReplicateRequest &repl_req = ctx->request;
+    repl_req.set_extent_id(request->extent_id());
+    repl_req.set_offset(request->offset());
+    repl_req.set_size(request->size());
     if (request->has_crc32()) {
         repl_req.set_crc32(request->crc32());
     }
-    cntl->request_attachment() = req->GetOperationContext().cntl->request_attachment();
-    google::protobuf::Closure *done = brpc::NewCallback<brpc::Controller*,
-            pb::ReplicateResponse*,
-            void*>
-            (&ReplicateEngine::HandleResponse, cntl, repl_resp, req);
-    stub.Replicate(cntl, &repl_req, repl_resp, done);
+    if (request->discard()) {
+        repl_req.set_discard(true);
+    }
+    if (request->quorum_acked()) {
+        repl_req.set_quorum_acked(true);
+    }
+    // share the (dma) blocks of client's attachment, no copy here
+    ctx->cntl.request_attachment() = op_ctx.cntl->request_attachment();
+    pb::ExtentIOService_Stub stub(conn->channel.get());
+    stub.Replicate(&ctx->cntl, &repl_req, &ctx->response, ctx);
 }
 
-void ReplicateEngine::HandleResponse(
-        brpc::Controller *cntl, pb::ReplicateResponse *repl_resp, void *arg) {
-    std::unique_ptr<brpc::Controller> cntl_guard(cntl);
-    std::unique_ptr<pb::ReplicateResponse> response_guard(repl_resp);
+void ReplicateEngine::HandleResponse(ReplicateContext *ctx) {
     bool success = false;
-    if (cntl->Failed()) {
-        LOG(ERROR) << "Couldn't send replicate request, " << cntl->ErrorText();
-    } else if (repl_resp->status().code() != 0) {
+    if (ctx->cntl.Failed()) {
+        LOG(ERROR) << "Couldn't send replicate request, "
+                   << ctx->cntl.ErrorText();
+    } else if (ctx->response.status().code() != 0) {
         LOG(ERROR) << "Couldn't replicate extent, "
-                   << repl_resp->status().message();
+                   << ctx->response.status().message();
     } else {
         success = true;
     }
 
-    Request *req = static_cast<Request *>(arg);
+    Request *req = ctx->req;
     req->SetResult(success);
     req->UserCallback()(req);
 }
 
+ReplicateContext *ReplicateContext::Get() {
+    return butil::get_object<ReplicateContext>();
+}
+
+void ReplicateContext::Run() {
+    ReplicateEngine::HandleResponse(this);
+    Release();
+}
+
+void ReplicateContext::Release() {
+    // like deleting controller in done, brpc doesn't touch it after Run.
+    // Reset drops the attachment, client's blocks aren't held in pool
+    cntl.Reset();
+    request.Clear();
+    response.Clear();
+    req = nullptr;
+    butil::return_object(this);
+}
+
 }  // namespace extentserver
 }  // namespace cyprestore
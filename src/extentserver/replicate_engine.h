@@ -7,11 +7,22 @@
 #ifndef CYPRESTORE_EXTENTSERVER_REPLICATOR_H_
 #define CYPRESTORE_EXTENTSERVER_REPLICATOR_H_
 
+#include <brpc/controller.h>
+#include <bthread/mutex.h>
+#include <google/protobuf/stubs/callback.h>
+
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "common/connection_pool.h"
 #include "common/extent_router.h"
+#include "common/rwlock.h"
 #include "common/status.h"
+#include "extent_index.h"
+#include "quorum_write.h"
+#include "replicate_stream.h"
 #include "request_context.h"
 #include "pb/extent_io.pb.h"
 
@@ -23,22 +34,74 @@ typedef std::shared_ptr<ReplicateEngine> ReplicateEnginePtr;
 
 using common::Status;
 
+// State of one replicate rpc to a secondary, the context itself is the
+// rpc's done closure. Contexts are taken from butil object pool, which
+// keeps free objects in thread local blocks of each worker, so the write
+// path allocates nothing once the pool is warm.
+struct ReplicateContext : public google::protobuf::Closure {
+    ReplicateContext() : req(nullptr) {}
+    virtual ~ReplicateContext() {}
+
+    static ReplicateContext *Get();
+    // done of rpc, the context goes back to pool after HandleResponse
+    virtual void Run();
+    void Release();
+
+    brpc::Controller cntl;
+    pb::ReplicateRequest request;
+    pb::ReplicateResponse response;
+    Request *req;
+};
+
 class ReplicateEngine {
 public:
     ReplicateEngine(const common::ExtentRouterMgrPtr router_mgr)
-            : router_mgr_(router_mgr) {
+            : router_mgr_(router_mgr), streams_per_peer_(0), write_quorum_(0),
+              max_lag_bytes_(0), lag_wait_ms_(0) {
         conn_pool_.reset(new common::ConnectionPool());
     }
     ~ReplicateEngine() = default;
 
-    static void HandleResponse(brpc::Controller *cntl, pb::ReplicateResponse *resp, void *arg);
+    // replicate over long lived streams instead of a rpc per write, each
+    // worker thread sticks to one of streams_per_peer streams of a peer.
+    // primary is the endpoint secondaries know this es by
+    void EnableStream(const std::string &primary, int streams_per_peer);
+    // ack client once write_quorum copies, primary included, have a write.
+    // at least one secondary is waited for, lagging ones catch up later
+    void EnableQuorum(
+            int write_quorum, uint64_t max_lag_bytes, int lag_wait_ms);
+
+    static void HandleResponse(ReplicateContext *ctx);
     Status Send(Request *req);
+    // req's user callback runs unless sending fails
+    Status SendTo(Request *req, const common::ESInstance &peer);
+    // waits quorum writes of extent sent so far done locally
+    void WaitWrites(const std::string &extent_id);
 
 private:
+    typedef std::vector<std::unique_ptr<ReplicateStream>> StreamGroup;
+
+    Status sendQuorum(Request *req);
     void sendOneReplicate(Request *req, common::ConnectionPtr conn);
+    ReplicateStream *getStream(const std::string &ip, int port);
+    ReplicaCatchup *getCatchup(const common::ESInstance &peer);
 
     common::ExtentRouterMgrPtr router_mgr_;
     std::unique_ptr<common::ConnectionPool> conn_pool_;
+
+    std::string primary_;
+    int streams_per_peer_;  // 0 if streaming is disabled
+    std::unordered_map<std::string, StreamGroup> streams_;
+    common::RWLock streams_lock_;
+
+    int write_quorum_;  // 0 if every replica is waited for
+    uint64_t max_lag_bytes_;
+    int lag_wait_ms_;
+    std::unordered_map<std::string, std::unique_ptr<ReplicaCatchup>>
+            catchups_;
+    common::RWLock catchups_lock_;
+    ExtentIOGates write_gates_;  // quorum writes in flight
+    bthread::Mutex drain_mutex_;
 };
 
 }  // namespace extentserver
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "replicate_receiver.h"
+
+#include <string.h>
+
+#include <butil/logging.h>
+#include <butil/object_pool.h>
+
+#include "common/error_code.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+const uint32_t ReplicateFrame::kMagic;
+const uint8_t ReplicateFrame::kFlagCrc32;
+const uint8_t ReplicateFrame::kFlagDiscard;
+const uint8_t ReplicateFrame::kFlagQuorumAcked;
+
+void ReplicateStreamContext::Run() {
+    receiver->OnDone(
+            seq, response.has_status()
+                         && response.status().code() == common::CYPRE_OK);
+    receiver.reset();
+    cntl.Reset();
+    request.Clear();
+    response.Clear();
+    seq = 0;
+    butil::return_object(this);
+}
+
+ReplicateStreamReceiver::ReplicateStreamReceiver(
+        const std::string &primary, uint64_t first_seq,
+        pb::ExtentIOService *service)
+        : primary_(primary), service_(service),
+          stream_id_(brpc::INVALID_STREAM_ID), next_seq_(first_seq),
+          acked_(first_seq - 1), ack_blocked_(false), closed_(false) {}
+
+Status ReplicateStreamReceiver::Accept(
+        brpc::Controller *cntl, const pb::OpenReplicateStreamRequest &req,
+        pb::ExtentIOService *service) {
+    if (req.first_seq() == 0) {
+        return Status(common::CYPRE_ER_INVALID_ARGUMENT, "invalid first seq");
+    }
+
+    std::shared_ptr<ReplicateStreamReceiver> receiver(
+            new ReplicateStreamReceiver(
+                    req.primary(), req.first_seq(), service));
+    brpc::StreamOptions options;
+    options.handler = receiver.get();
+    // frames arrive once primary gets the response
+    if (brpc::StreamAccept(&receiver->stream_id_, *cntl, &options) != 0) {
+        return Status(
+                common::CYPRE_ES_STREAM_ERROR,
+                "couldn't accept replicate stream");
+    }
+    receiver->self_ = receiver;
+    return Status();
+}
+
+int ReplicateStreamReceiver::on_received_messages(
+        brpc::StreamId id, butil::IOBuf *const messages[], size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        butil::IOBuf *msg = messages[i];
+        ReplicateFrame frame;
+        bool valid = msg->cutn(&frame, sizeof(frame)) == sizeof(frame)
+                     && frame.magic == ReplicateFrame::kMagic
+                     && frame.type == ReplicateFrame::kFrameWrite
+                     && frame.id_len != 0 && frame.seq == next_seq_;
+        bool discard = valid && (frame.flags & ReplicateFrame::kFlagDiscard);
+        if (!valid
+            || msg->size() != frame.id_len + (discard ? 0 : frame.size)) {
+            LOG(ERROR) << "Invalid replicate frame from " << primary_
+                       << ", expected seq:" << next_seq_
+                       << ", close replicate stream";
+            brpc::StreamClose(id);
+            return 0;
+        }
+        ++next_seq_;
+
+        ReplicateStreamContext *ctx =
+                butil::get_object<ReplicateStreamContext>();
+        ctx->seq = frame.seq;
+        ctx->receiver = shared_from_this();
+        std::string *extent_id = ctx->request.mutable_extent_id();
+        extent_id->resize(frame.id_len);
+        msg->cutn(&(*extent_id)[0], frame.id_len);
+        ctx->request.set_offset(frame.offset);
+        ctx->request.set_size(frame.size);
+        if (frame.flags & ReplicateFrame::kFlagCrc32) {
+            ctx->request.set_crc32(frame.crc32);
+        }
+        if (discard) {
+            ctx->request.set_discard(true);
+        }
+        if (frame.flags & ReplicateFrame::kFlagQuorumAcked) {
+            ctx->request.set_quorum_acked(true);
+        }
+        ctx->cntl.request_attachment().swap(*msg);
+        // same as a replicate rpc, ctx runs when it is done
+        service_->Replicate(&ctx->cntl, &ctx->request, &ctx->response, ctx);
+    }
+    return 0;
+}
+
+void ReplicateStreamReceiver::on_closed(brpc::StreamId id) {
+    // writes in flight keep receiver till they are done
+    std::shared_ptr<ReplicateStreamReceiver> self;
+    std::lock_guard<bthread::Mutex> lock(mutex_);
+    LOG(INFO) << "Replicate stream from " << primary_
+              << " closed, acked seq:" << acked_;
+    closed_ = true;
+    self.swap(self_);
+}
+
+void ReplicateStreamReceiver::OnDone(uint64_t seq, bool success) {
+    std::lock_guard<bthread::Mutex> lock(mutex_);
+    if (closed_) {
+        return;  // primary fails writes of a closed stream
+    }
+    if (!success) {
+        writeFrame(ReplicateFrame::kFrameNack, seq);
+    }
+    if (seq != acked_ + 1) {
+        done_.insert(seq);
+        return;
+    }
+
+    acked_ = seq;
+    while (!done_.empty() && *done_.begin() == acked_ + 1) {
+        done_.erase(done_.begin());
+        ++acked_;
+    }
+    writeFrame(ReplicateFrame::kFrameAck, acked_);
+}
+
+void ReplicateStreamReceiver::writeFrame(uint8_t type, uint64_t seq) {
+    if (ack_blocked_) {
+        // a later ack covers this one, nacks must not be lost
+        if (type == ReplicateFrame::kFrameNack) {
+            nacks_.push_back(seq);
+        }
+        return;
+    }
+
+    ReplicateFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = ReplicateFrame::kMagic;
+    frame.type = type;
+    frame.seq = seq;
+    butil::IOBuf msg;
+    msg.append(&frame, sizeof(frame));
+    int rc = brpc::StreamWrite(stream_id_, msg);
+    if (rc == EAGAIN) {
+        ack_blocked_ = true;
+        if (type == ReplicateFrame::kFrameNack) {
+            nacks_.push_back(seq);
+        }
+        brpc::StreamWait(
+                stream_id_, NULL, onWritable,
+                new std::shared_ptr<ReplicateStreamReceiver>(
+                        shared_from_this()));
+    } else if (rc != 0) {
+        // primary fails unacked writes once stream is closed
+        LOG(ERROR) << "Couldn't ack replicate stream of " << primary_
+                   << ", seq:" << seq << ", rc:" << rc;
+    }
+}
+
+void ReplicateStreamReceiver::onWritable(
+        brpc::StreamId id, void *arg, int error_code) {
+    std::unique_ptr<std::shared_ptr<ReplicateStreamReceiver>> ref(
+            static_cast<std::shared_ptr<ReplicateStreamReceiver> *>(arg));
+    ReplicateStreamReceiver *receiver = ref->get();
+    std::lock_guard<bthread::Mutex> lock(receiver->mutex_);
+    receiver->ack_blocked_ = false;
+    if (error_code != 0 || receiver->closed_) {
+        return;
+    }
+
+    std::vector<uint64_t> nacks;
+    nacks.swap(receiver->nacks_);
+    for (auto seq : nacks) {
+        receiver->writeFrame(ReplicateFrame::kFrameNack, seq);
+    }
+    receiver->writeFrame(ReplicateFrame::kFrameAck, receiver->acked_);
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
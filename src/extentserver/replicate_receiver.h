@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_REPLICATE_RECEIVER_H_
+#define CYPRESTORE_EXTENTSERVER_REPLICATE_RECEIVER_H_
+
+#include <brpc/controller.h>
+#include <brpc/stream.h>
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <google/protobuf/stubs/callback.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common/status.h"
+#include "pb/extent_io.pb.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+using common::Status;
+
+// Frame on a replicate stream, host byte order. A write frame is followed
+// by extent id and data, an ack covers every write up to seq, a nack
+// marks one failed write and is always followed by an ack covering it.
+struct ReplicateFrame {
+    enum Type {
+        kFrameWrite = 1,
+        kFrameAck,
+        kFrameNack,
+    };
+
+    static const uint32_t kMagic = 0x52504c53;  // "SLPR"
+    static const uint8_t kFlagCrc32 = 0x1;
+    static const uint8_t kFlagDiscard = 0x2;  // size is zeroed, no data
+    static const uint8_t kFlagQuorumAcked = 0x4;
+
+    uint32_t magic;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t id_len;
+    uint32_t size;
+    uint32_t crc32;
+    uint64_t seq;
+    uint64_t offset;
+};
+
+class ReplicateStreamReceiver;
+
+// secondary side state of one framed write, the context is the done of
+// the replicate it is processed as
+struct ReplicateStreamContext : public google::protobuf::Closure {
+    ReplicateStreamContext() : seq(0) {}
+    virtual ~ReplicateStreamContext() {}
+
+    virtual void Run();
+
+    brpc::Controller cntl;  // holds data only
+    pb::ReplicateRequest request;
+    pb::ReplicateResponse response;
+    uint64_t seq;
+    std::shared_ptr<ReplicateStreamReceiver> receiver;
+};
+
+// Secondary side of a replicate stream. Framed writes go through the
+// same path as Replicate rpc, completions are acked cumulatively.
+class ReplicateStreamReceiver
+        : public brpc::StreamInputHandler,
+          public std::enable_shared_from_this<ReplicateStreamReceiver> {
+public:
+    static Status Accept(
+            brpc::Controller *cntl, const pb::OpenReplicateStreamRequest &req,
+            pb::ExtentIOService *service);
+    virtual ~ReplicateStreamReceiver() {}
+
+    virtual int on_received_messages(
+            brpc::StreamId id, butil::IOBuf *const messages[], size_t size);
+    virtual void on_idle_timeout(brpc::StreamId id) {}
+    virtual void on_closed(brpc::StreamId id);
+
+    void OnDone(uint64_t seq, bool success);
+
+private:
+    ReplicateStreamReceiver(
+            const std::string &primary, uint64_t first_seq,
+            pb::ExtentIOService *service);
+    DISALLOW_COPY_AND_ASSIGN(ReplicateStreamReceiver);
+
+    static void onWritable(brpc::StreamId id, void *arg, int error_code);
+    // with mutex_ held
+    void writeFrame(uint8_t type, uint64_t seq);
+
+    std::string primary_;
+    pb::ExtentIOService *service_;
+    bthread::Mutex mutex_;
+    brpc::StreamId stream_id_;
+    uint64_t next_seq_;             // of next write frame
+    uint64_t acked_;                // every write up to it is done
+    std::set<uint64_t> done_;       // done after a gap
+    std::vector<uint64_t> nacks_;   // not sent while blocked
+    bool ack_blocked_;              // waiting for stream writable
+    bool closed_;
+    std::shared_ptr<ReplicateStreamReceiver> self_;  // until closed
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_REPLICATE_RECEIVER_H_
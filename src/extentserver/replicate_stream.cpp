@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "replicate_stream.h"
+
+#include <butil/logging.h>
+#include <butil/time.h>
+
+#include <iterator>
+
+#include "common/error_code.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+ReplicateStream::ReplicateStream(
+        const std::string &primary, const std::string &peer, int index)
+        : primary_(primary),
+          name_("replicate_stream_" + peer + "_" + std::to_string(index)),
+          stream_id_(brpc::INVALID_STREAM_ID), num_open_streams_(0),
+          next_seq_(1) {
+    lag_writes_.expose_as(name_, "lag_writes");
+    lag_bytes_.expose_as(name_, "lag_bytes");
+    ack_latency_.expose(name_, "ack_latency");
+}
+
+ReplicateStream::~ReplicateStream() {
+    std::unique_lock<bthread::Mutex> lock(mutex_);
+    if (stream_id_ != brpc::INVALID_STREAM_ID) {
+        brpc::StreamClose(stream_id_);
+    }
+    // brpc calls on_closed of every stream of this handler
+    while (num_open_streams_ > 0) {
+        if (closed_cond_.wait_for(lock, 1000000) == ETIMEDOUT) {
+            LOG(WARNING) << "Replicate stream " << name_
+                         << " not closed in time";
+            break;
+        }
+    }
+}
+
+Status ReplicateStream::open(const common::ConnectionPtr &conn) {
+    brpc::Controller cntl;
+    brpc::StreamOptions options;
+    options.handler = this;
+    brpc::StreamId stream_id = brpc::INVALID_STREAM_ID;
+    if (brpc::StreamCreate(&stream_id, cntl, &options) != 0) {
+        LOG(ERROR) << "Couldn't create replicate stream " << name_;
+        return Status(
+                common::CYPRE_ES_STREAM_ERROR,
+                "couldn't create replicate stream");
+    }
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        ++num_open_streams_;
+    }
+
+    // secondary acks from first seq on, seq moves only under send_mutex_
+    pb::OpenReplicateStreamRequest request;
+    pb::OpenReplicateStreamResponse response;
+    request.set_primary(primary_);
+    request.set_first_seq(next_seq_);
+    pb::ExtentIOService_Stub stub(conn->channel.get());
+    stub.OpenReplicateStream(&cntl, &request, &response, NULL);
+    if (cntl.Failed() || response.status().code() != common::CYPRE_OK) {
+        LOG(ERROR) << "Couldn't open replicate stream " << name_ << ", "
+                   << (cntl.Failed() ? cntl.ErrorText()
+                                     : response.status().message());
+        brpc::StreamClose(stream_id);
+        return Status(
+                common::CYPRE_ES_STREAM_ERROR,
+                "couldn't open replicate stream");
+    }
+
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        stream_id_ = stream_id;
+    }
+    LOG(INFO) << "Replicate stream " << name_ << " opened"
+              << ", first seq:" << next_seq_;
+    return Status();
+}
+
+Status ReplicateStream::Send(Request *req, const common::ConnectionPtr &conn) {
+    auto &op_ctx = req->GetOperationContext();
+    pb::WriteRequest *request = static_cast<pb::WriteRequest *>(op_ctx.request);
+    const std::string &extent_id = request->extent_id();
+    ReplicateFrame frame;
+    frame.magic = ReplicateFrame::kMagic;
+    frame.type = ReplicateFrame::kFrameWrite;
+    frame.flags = request->has_crc32() ? ReplicateFrame::kFlagCrc32 : 0;
+    if (request->discard()) {
+        frame.flags |= ReplicateFrame::kFlagDiscard;
+    }
+    if (request->quorum_acked()) {
+        frame.flags |= ReplicateFrame::kFlagQuorumAcked;
+    }
+    frame.id_len = static_cast<uint16_t>(extent_id.size());
+    frame.size = static_cast<uint32_t>(request->size());
+    frame.crc32 = request->has_crc32() ? request->crc32() : 0;
+    frame.offset = request->offset();
+    uint64_t data_size = op_ctx.cntl->request_attachment().size();
+
+    // frames are written in seq order, a writer waiting for window or
+    // opening the stream holds only send_mutex_, acks and closing take
+    // mutex_
+    std::lock_guard<bthread::Mutex> send_lock(send_mutex_);
+    bool opened = false;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        opened = stream_id_ != brpc::INVALID_STREAM_ID;
+    }
+    if (!opened) {
+        Status s = open(conn);
+        if (!s.ok()) return s;
+    }
+
+    brpc::StreamId stream_id = brpc::INVALID_STREAM_ID;
+    butil::IOBuf msg;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        if (stream_id_ == brpc::INVALID_STREAM_ID) {
+            // closed right after open, next write opens again
+            return Status(
+                    common::CYPRE_ES_STREAM_ERROR,
+                    "replicate stream closed");
+        }
+        stream_id = stream_id_;
+        frame.seq = next_seq_++;
+        msg.append(&frame, sizeof(frame));
+        msg.append(extent_id);
+        // share the (dma) blocks of client's attachment, no copy here
+        msg.append(op_ctx.cntl->request_attachment());
+        // pending before it's written, the stream may break meanwhile and
+        // complete req, don't touch req after this
+        pending_.push_back(
+                {frame.seq, req, data_size, butil::cpuwide_time_us(), false});
+        lag_writes_ << 1;
+        lag_bytes_ << data_size;
+    }
+
+    int rc = brpc::StreamWrite(stream_id, msg);
+    while (rc == EAGAIN) {
+        // secondary is a window behind, back pressure writers
+        rc = brpc::StreamWait(stream_id, NULL);
+        if (rc == 0) {
+            rc = brpc::StreamWrite(stream_id, msg);
+        }
+    }
+    if (rc == 0) {
+        return Status();
+    }
+
+    Status s;
+    std::deque<PendingWrite> failed;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        LOG(ERROR) << "Couldn't write replicate stream " << name_
+                   << ", seq:" << frame.seq << ", rc:" << rc;
+        // caller fails this write itself, unless a close failed it already
+        for (auto it = pending_.rbegin(); it != pending_.rend(); ++it) {
+            if (it->seq == frame.seq) {
+                pending_.erase(std::next(it).base());
+                lag_writes_ << -1;
+                lag_bytes_ << -static_cast<int64_t>(data_size);
+                s = Status(
+                        common::CYPRE_ES_STREAM_ERROR,
+                        "couldn't write replicate stream");
+                break;
+            }
+        }
+        if (stream_id_ == stream_id) {
+            breakStream(&failed);
+        }
+    }
+    complete(&failed);
+    return s;
+}
+
+void ReplicateStream::breakStream(std::deque<PendingWrite> *failed) {
+    brpc::StreamClose(stream_id_);
+    stream_id_ = brpc::INVALID_STREAM_ID;
+    for (auto &write : pending_) {
+        write.failed = true;
+    }
+    failed->swap(pending_);
+}
+
+int ReplicateStream::on_received_messages(
+        brpc::StreamId id, butil::IOBuf *const messages[], size_t size) {
+    std::deque<PendingWrite> done;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        if (id != stream_id_) {
+            return 0;  // writes of a broken stream are failed already
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            ReplicateFrame frame;
+            if (messages[i]->copy_to(&frame, sizeof(frame)) != sizeof(frame)
+                || frame.magic != ReplicateFrame::kMagic) {
+                LOG(ERROR) << "Invalid ack of replicate stream " << name_;
+                continue;
+            }
+
+            if (frame.type == ReplicateFrame::kFrameNack) {
+                for (auto &write : pending_) {
+                    if (write.seq == frame.seq) {
+                        write.failed = true;
+                        break;
+                    }
+                }
+            } else if (frame.type == ReplicateFrame::kFrameAck) {
+                while (!pending_.empty() && pending_.front().seq <= frame.seq) {
+                    done.push_back(pending_.front());
+                    pending_.pop_front();
+                }
+            }
+        }
+    }
+    complete(&done);
+    return 0;
+}
+
+void ReplicateStream::on_closed(brpc::StreamId id) {
+    std::deque<PendingWrite> failed;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        --num_open_streams_;
+        if (id == stream_id_) {
+            LOG(WARNING) << "Replicate stream " << name_ << " closed"
+                         << ", unacked writes:" << pending_.size();
+            stream_id_ = brpc::INVALID_STREAM_ID;
+            for (auto &write : pending_) {
+                write.failed = true;
+            }
+            failed.swap(pending_);
+        }
+    }
+    closed_cond_.notify_all();
+    complete(&failed);
+}
+
+void ReplicateStream::complete(std::deque<PendingWrite> *done) {
+    int64_t now_us = butil::cpuwide_time_us();
+    for (auto &write : *done) {
+        lag_writes_ << -1;
+        lag_bytes_ << -static_cast<int64_t>(write.size);
+        if (!write.failed) {
+            ack_latency_ << now_us - write.start_us;
+        }
+        write.req->SetResult(!write.failed);
+        write.req->UserCallback()(write.req);
+    }
+    done->clear();
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
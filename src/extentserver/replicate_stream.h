@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_REPLICATE_STREAM_H_
+#define CYPRESTORE_EXTENTSERVER_REPLICATE_STREAM_H_
+
+#include <brpc/stream.h>
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <bvar/bvar.h>
+
+#include <deque>
+#include <string>
+
+#include "common/connection_pool.h"
+#include "common/status.h"
+#include "replicate_receiver.h"
+#include "request_context.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+// Primary side of one long lived ordered stream to a secondary.
+// Writes are framed and pipelined without per write rpc, acks of the
+// secondary are cumulative. Unacked writes are the replica lag of the
+// stream, exposed as bvars with the stream's name as prefix.
+class ReplicateStream : public brpc::StreamInputHandler {
+public:
+    ReplicateStream(
+            const std::string &primary, const std::string &peer, int index);
+    virtual ~ReplicateStream();
+
+    // req's user callback runs once the secondary acks or the stream breaks
+    Status Send(Request *req, const common::ConnectionPtr &conn);
+
+    virtual int on_received_messages(
+            brpc::StreamId id, butil::IOBuf *const messages[], size_t size);
+    virtual void on_idle_timeout(brpc::StreamId id) {}
+    virtual void on_closed(brpc::StreamId id);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ReplicateStream);
+
+    struct PendingWrite {
+        uint64_t seq;
+        Request *req;
+        uint64_t size;
+        int64_t start_us;
+        bool failed;
+    };
+
+    // with send_mutex_ held, the rpc doesn't block acks and closes
+    Status open(const common::ConnectionPtr &conn);
+    // with mutex_ held, pending writes moved to failed
+    void breakStream(std::deque<PendingWrite> *failed);
+    void complete(std::deque<PendingWrite> *done);
+
+    std::string primary_;
+    std::string name_;
+    bthread::Mutex send_mutex_;  // held across stream back pressure
+    bthread::Mutex mutex_;
+    bthread::ConditionVariable closed_cond_;
+    brpc::StreamId stream_id_;
+    int num_open_streams_;  // closed but not notified yet
+    uint64_t next_seq_;
+    std::deque<PendingWrite> pending_;  // by seq
+
+    bvar::Adder<int64_t> lag_writes_;
+    bvar::Adder<int64_t> lag_bytes_;
+    bvar::LatencyRecorder ack_latency_;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_REPLICATE_STREAM_H_
@@ -12,7 +12,8 @@
 namespace cyprestore {
 namespace extentserver {
 
-std::string Request::ExtentID() const {
+const std::string &Request::ExtentID() const {
+    static const std::string kNoExtentID;
     switch (request_type_) {
         case RequestType::kTypeRead:
             return (static_cast<pb::ReadRequest *>(op_ctx_.request))
@@ -36,7 +37,7 @@ std::string Request::ExtentID() const {
             break;
     }
 
-    return std::string();
+    return kNoExtentID;
 }
 
 uint64_t Request::Offset() const {
@@ -76,7 +77,10 @@ uint64_t Request::Size() const {
         case RequestType::kTypeDelete:
             return (static_cast<pb::DeleteRequest *>(op_ctx_.request))->size();
         case RequestType::kTypeReclaimExtent:
-            return 0;
+            return reclaim_size_;
+        case RequestType::kTypeMetaRead:
+        case RequestType::kTypeMetaWrite:
+            return meta_size_;
         default:
             break;
     }
@@ -84,6 +88,23 @@ uint64_t Request::Size() const {
     return 0;
 }
 
+bool Request::Discard() const {
+    switch (request_type_) {
+        case RequestType::kTypeWrite:
+            return (static_cast<pb::WriteRequest *>(op_ctx_.request))
+                    ->discard();
+        case RequestType::kTypeReplicate:
+            return (static_cast<pb::ReplicateRequest *>(op_ctx_.request))
+                    ->discard();
+        case RequestType::kTypeDelete:
+            return true;
+        default:
+            break;
+    }
+
+    return false;
+}
+
 void Request::SetOperationContext(
         brpc::Controller *cntl, google::protobuf::Message *request,
         google::protobuf::Message *response, google::protobuf::Closure *done) {
@@ -93,6 +114,21 @@ void Request::SetOperationContext(
     op_ctx_.done = done;
 }
 
+void Request::ReleaseIOUnits() {
+    if (io_unit_ == nullptr) {
+        return;
+    }
+
+    if (vectored_) {
+        IOUnitSlot *slots = IOUnitSlots();
+        for (uint32_t i = 0; i < num_iovecs_; ++i) {
+            iomem_mgr_->PutIOUnit(slots[i].io);
+        }
+    }
+    iomem_mgr_->PutIOUnit(io_unit_);
+    io_unit_ = nullptr;
+}
+
 int RequestMgr::Init() {
     auto ctxmem_mgr = new common::CtxMemMgr<Request>(
             "request", CypreRing::CypreRingType::TYPE_MP_MC, true);
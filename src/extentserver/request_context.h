@@ -10,6 +10,7 @@
 #include <brpc/channel.h>
 #include <butil/macros.h>
 #include <google/protobuf/message.h>
+#include <sys/uio.h>
 
 #include <atomic>
 #include <memory>
@@ -25,6 +26,7 @@ namespace extentserver {
 
 typedef void *(*UserCallback_t)(void *arg);
 
+class Request;
 class RequestMgr;
 typedef std::shared_ptr<RequestMgr> RequestMgrPtr;
 
@@ -35,9 +37,22 @@ enum RequestType {
     kTypeScrub,
     kTypeDelete,
     kTypeReclaimExtent,
+    kTypeMetaRead,   // raw io of metadata region
+    kTypeMetaWrite,
     kTypeNoop = -1,
 };
 
+// Vectored requests keep iovecs and the pooled units behind them in one
+// 4K table unit: iovecs first, then a release slot per unit.
+struct IOUnitSlot {
+    Request *req;
+    io_u *io;
+};
+
+const uint64_t kIOTableUnitSize = 4 << 10;
+const uint32_t kMaxTableIOVecs =
+        kIOTableUnitSize / (sizeof(struct iovec) + sizeof(IOUnitSlot));
+
 struct OperationContext {
     OperationContext()
             : cntl(nullptr), request(nullptr), response(nullptr),
@@ -54,13 +69,20 @@ public:
     Request(RequestType request_type)
             : result_(true), ref_count_(1), request_type_(request_type),
               user_cb_(nullptr), io_unit_(nullptr), iomem_mgr_(nullptr),
-              extent_router_(nullptr), physical_offset_(0), crc32_(0) {
+              extent_router_(nullptr), physical_offset_(0), crc32_(0),
+              zero_copy_(false), vectored_(false), num_iovecs_(0),
+              meta_buf_(nullptr), meta_size_(0), worker_hint_(0),
+              user_arg_(nullptr), deallocate_(false), reclaim_size_(0),
+              location_pin_(nullptr),
+              replica_pin_(nullptr) {
         req_begin_ = {0, 0};
         req_end_ = {0, 0};
     }
     ~Request() = default;
 
     void Reset(RequestType request_type) {
+        ReleaseLocation();
+        ReleaseReplicaWrite();
         result_ = true;
         ref_count_ = 1;
         request_type_ = request_type;
@@ -70,6 +92,15 @@ public:
         extent_router_ = nullptr;
         physical_offset_ = 0;
         crc32_ = 0;
+        zero_copy_ = false;
+        vectored_ = false;
+        num_iovecs_ = 0;
+        meta_buf_ = nullptr;
+        meta_size_ = 0;
+        worker_hint_ = 0;
+        user_arg_ = nullptr;
+        deallocate_ = false;
+        reclaim_size_ = 0;
         req_begin_ = {0, 0};
         req_end_ = {0, 0};
     }
@@ -113,9 +144,13 @@ public:
             google::protobuf::Message *response,
             google::protobuf::Closure *done);
 
-    std::string ExtentID() const;
+    // field of the protobuf request, empty for meta io
+    const std::string &ExtentID() const;
     uint64_t Offset() const;
     uint64_t Size() const;
+    // range is zeroed instead of written, a delete or a discard replicated
+    // like a write
+    bool Discard() const;
 
     io_u *IOUnit() {
         return io_unit_;
@@ -156,6 +191,108 @@ public:
         crc32_ = crc32;
     }
 
+    // io unit holds iovec table of attachment blocks instead of data
+    bool ZeroCopy() const {
+        return zero_copy_;
+    }
+    void SetZeroCopy(bool zero_copy) {
+        zero_copy_ = zero_copy;
+    }
+
+    // io unit holds iovec table of pooled data units
+    bool Vectored() const {
+        return vectored_;
+    }
+    void SetVectored(bool vectored) {
+        vectored_ = vectored;
+    }
+
+    uint32_t NumIOVecs() const {
+        return num_iovecs_;
+    }
+    void SetNumIOVecs(uint32_t num_iovecs) {
+        num_iovecs_ = num_iovecs;
+    }
+    struct iovec *IOVecs() {
+        return static_cast<struct iovec *>(io_unit_->data);
+    }
+    IOUnitSlot *IOUnitSlots() {
+        return reinterpret_cast<IOUnitSlot *>(IOVecs() + kMaxTableIOVecs);
+    }
+
+    // meta io reads or writes caller's dma buffer, no io unit needed
+    bool IsMetaIO() const {
+        return request_type_ == RequestType::kTypeMetaRead
+               || request_type_ == RequestType::kTypeMetaWrite;
+    }
+    void *MetaBuf() const {
+        return meta_buf_;
+    }
+    void SetMetaBuf(void *buf, uint64_t size) {
+        meta_buf_ = buf;
+        meta_size_ = size;
+    }
+
+    // meta io has no extent id, workers are picked by hint instead,
+    // e.g. home offset of the data, see SpdkMgr::selectWorker
+    uint64_t WorkerHint() const {
+        return worker_hint_;
+    }
+    void SetWorkerHint(uint64_t hint) {
+        worker_hint_ = hint;
+    }
+
+    void *UserArg() const {
+        return user_arg_;
+    }
+    void SetUserArg(void *user_arg) {
+        user_arg_ = user_arg;
+    }
+
+    // delete may unmap the range instead of writing zeros, only for space
+    // nothing reads any more, see SpdkMgr::UnmapZeroes
+    bool Deallocate() const {
+        return deallocate_;
+    }
+    void SetDeallocate(bool deallocate) {
+        deallocate_ = deallocate;
+    }
+
+    // reclaim carries no range, size is known once extent is detached
+    void SetReclaimSize(uint64_t size) {
+        reclaim_size_ = size;
+    }
+
+    // location of extent is kept till the request is put back,
+    // see ExtentIOGates
+    bool HoldsLocation() const {
+        return location_pin_ != nullptr;
+    }
+    void HoldLocation(std::atomic<int64_t> *pin) {
+        location_pin_ = pin;
+    }
+    void ReleaseLocation() {
+        if (location_pin_ != nullptr) {
+            location_pin_->fetch_sub(1);
+            location_pin_ = nullptr;
+        }
+    }
+
+    // quorum write is counted till the request is put back, so a resync
+    // of the extent waits it done locally, see ReplicaCatchup
+    void HoldReplicaWrite(std::atomic<int64_t> *pin) {
+        replica_pin_ = pin;
+    }
+    void ReleaseReplicaWrite() {
+        if (replica_pin_ != nullptr) {
+            replica_pin_->fetch_sub(1);
+            replica_pin_ = nullptr;
+        }
+    }
+
+    // give io unit (and data units of vectored request) back to iomem_mgr
+    void ReleaseIOUnits();
+
     void BeginTraceTime() { utils::Chrono::GetTime(&req_begin_); }
     void EndTraceTime() {
         utils::Chrono::GetTime(&req_end_);
@@ -186,6 +323,17 @@ private:
 
     uint64_t physical_offset_;
     uint32_t crc32_;
+    bool zero_copy_;
+    bool vectored_;
+    uint32_t num_iovecs_;
+    void *meta_buf_;
+    uint64_t meta_size_;
+    uint64_t worker_hint_;
+    void *user_arg_;
+    bool deallocate_;
+    uint64_t reclaim_size_;
+    std::atomic<int64_t> *location_pin_;
+    std::atomic<int64_t> *replica_pin_;
 
     struct timespec req_begin_;
     struct timespec req_end_;
@@ -51,5 +51,9 @@ void SpaceAlloc::Mark(uint64_t offset, uint64_t size) {
     bitmap_alloc_->Mark(offset, size);
 }
 
+void SpaceAlloc::MarkBatch(std::vector<AUnit> *aunits) {
+    bitmap_alloc_->MarkBatch(aunits);
+}
+
 }  // namespace extentserver
 }  // namespace cyprestore
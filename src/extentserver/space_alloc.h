@@ -8,6 +8,7 @@
 #define CYPRESTORE_EXTENTSERVER_SPACE_ALLOC_H
 
 #include <memory>
+#include <vector>
 
 #include "bitmap_allocator.h"
 #include "common/status.h"
@@ -31,6 +32,7 @@ public:
     void Free(const std::unique_ptr<AUnit> *aunit);
     void Free(uint64_t offset, uint64_t size);
     void Mark(uint64_t offset, uint64_t size);
+    void MarkBatch(std::vector<AUnit> *aunits);
 
     uint64_t BlockSize() const {
         return bitmap_alloc_->BlockSize();
@@ -6,18 +6,38 @@
 
 #include "spdk_mgr.h"
 
+#include <butil/iobuf.h>
 #include <butil/string_splitter.h>
 
 #include "common/config.h"
 #include "spdk/conf.h"   // spdk_conf_allocate
 #include "spdk/env.h"    // spdk_unaffinitize_thread/spdk_env_opts
 #include "spdk/event.h"  // SPDK_DEFAULT_RPC_ADDR
+#include "spdk/nvme.h"
 #include "spdk/rpc.h"
 #include "spdk_internal/event.h"  // spdk_app_json_config_load/spdk_subsystem_init
+#include "utils/hash.h"
 #include "utils/set_cpu_affinity.h"
 
+namespace butil {
+namespace iobuf {
+// Defined in butil/iobuf.cpp, used to allocate data of IOPortal blocks
+extern void *(*portal_blockmem_allocate)(size_t);
+extern void (*portal_blockmem_deallocate)(void *);
+}  // namespace iobuf
+}  // namespace butil
+
+extern "C" {
+// Defined in module/bdev/nvme, null if bdev is not a nvme bdev
+struct spdk_nvme_ctrlr *spdk_bdev_nvme_get_ctrlr(struct spdk_bdev *bdev);
+}
+
 namespace cyprestore {
 namespace extentserver {
+
+// freed dma blocks are cached here, rte_malloc is too slow for hot path
+static CypreRing *g_iobuf_block_cache = nullptr;
+
 void SpdkMgr::initBdevSubsystemDoneCallback(int rc, void *arg) {
     Context *ctx = static_cast<Context *>(arg);
     ctx->rc = initSpdkRpc(ctx->arg);
@@ -327,6 +347,30 @@ struct spdk_thread *SpdkMgr::getSpdkThread() {
     return spdk_get_thread();
 }
 
+// only nvme namespaces reporting deallocated blocks read as zeros qualify
+static bool unmapReadsZero(struct spdk_bdev *bdev) {
+    if (!spdk_bdev_io_type_supported(bdev, SPDK_BDEV_IO_TYPE_UNMAP)) {
+        return false;
+    }
+    struct spdk_nvme_ctrlr *ctrlr = spdk_bdev_nvme_get_ctrlr(bdev);
+    // nvme bdevs are named <controller>n<nsid>
+    const char *nsid = strrchr(spdk_bdev_get_name(bdev), 'n');
+    if (ctrlr == nullptr || nsid == nullptr) {
+        return false;
+    }
+    struct spdk_nvme_ns *ns =
+            spdk_nvme_ctrlr_get_ns(ctrlr, strtoul(nsid + 1, nullptr, 10));
+    return ns != nullptr && spdk_nvme_ns_is_active(ns)
+           && spdk_nvme_ns_get_dealloc_logical_block_read_value(ns)
+                      == SPDK_NVME_DEALLOC_READ_00;
+}
+
+static bool sglSupported(struct spdk_bdev *bdev) {
+    struct spdk_nvme_ctrlr *ctrlr = spdk_bdev_nvme_get_ctrlr(bdev);
+    return ctrlr != nullptr
+           && (spdk_nvme_ctrlr_get_flags(ctrlr) & SPDK_NVME_CTRLR_SGL_SUPPORTED);
+}
+
 void SpdkMgr::openSpdkBdevFunc(void *arg) {
     Context *ctx = static_cast<Context *>(arg);
     SpdkMgr *mgr = static_cast<SpdkMgr *>(ctx->arg);
@@ -339,6 +383,11 @@ void SpdkMgr::openSpdkBdevFunc(void *arg) {
 
     ctx->rc = spdk_bdev_open(
             mgr->handler_.bdev, true, NULL, NULL, &mgr->handler_.desc);
+    mgr->unmap_zeroes_ = unmapReadsZero(mgr->handler_.bdev);
+    mgr->sgl_supported_ = sglSupported(mgr->handler_.bdev);
+    LOG(INFO) << "Deleted space is "
+              << (mgr->unmap_zeroes_ ? "unmapped" : "zeroed") << " on "
+              << ctx->dev_name;
     ctx->done = true;
 }
 
@@ -456,6 +505,54 @@ void SpdkMgr::FreeIOMem(void *p) {
     spdk_dma_free(p);
 }
 
+void *SpdkMgr::AllocIOBufBlock(size_t size) {
+    if (size != butil::IOBuf::DEFAULT_BLOCK_SIZE) {
+        return nullptr;
+    }
+
+    void *p = nullptr;
+    if (g_iobuf_block_cache->Dequeue(&p) != 0) {
+        return p;
+    }
+
+    // hugepage exhausted, iobuf takes a heap block and write path copies
+    return spdk_dma_malloc(size, kIOBufBlockAlign, nullptr);
+}
+
+void SpdkMgr::FreeIOBufBlock(void *p) {
+    // only dma data of portal blocks comes here, heap blocks are freed by
+    // iobuf itself
+    if (g_iobuf_block_cache->Enqueue(&p) == 0) {
+        spdk_dma_free(p);
+    }
+}
+
+bool SpdkMgr::IsDMAMemory(const void *p) {
+    return spdk_vtophys(const_cast<void *>(p), nullptr) != SPDK_VTOPHYS_ERROR;
+}
+
+Status SpdkMgr::EnableZeroCopyWrite() {
+    if (zero_copy_write_) return Status();
+
+    CypreRing *ring = new CypreRing(
+            "iobuf_block_cache", CypreRing::TYPE_MP_MC,
+            kIOBufBlockCacheSize);
+    Status s = ring->Init();
+    if (!s.ok()) {
+        delete ring;
+        return s;
+    }
+
+    g_iobuf_block_cache = ring;
+    butil::iobuf::portal_blockmem_deallocate = FreeIOBufBlock;
+    butil::iobuf::portal_blockmem_allocate = AllocIOBufBlock;
+    zero_copy_write_ = true;
+    LOG(INFO) << "Enable zero copy write, received iobuf blocks come from "
+                 "dma memory, sgl supported:"
+              << sgl_supported_;
+    return Status();
+}
+
 uint32_t SpdkMgr::GetBlockSize() {
     return spdk_bdev_get_block_size(handler_.bdev);
 }
@@ -521,8 +618,21 @@ Status SpdkMgr::PeriodDeviceAdmin() {
     return Status();
 }
 
+size_t SpdkMgr::selectWorker(Request *req) {
+    if (req->IsMetaIO()) {
+        uint64_t hint = req->WorkerHint();
+        unsigned int hash =
+                utils::HashUtil::mur_mur_hash(&hint, sizeof(hint));
+        return hash % task_queues_.size();
+    }
+    const std::string &extent_id = req->ExtentID();
+    unsigned int hash =
+            utils::HashUtil::mur_mur_hash(extent_id.c_str(), extent_id.length());
+    return hash % task_queues_.size();
+}
+
 Status SpdkMgr::ProcessRequest(Request *req) {
-    size_t count = task_queue_->Enqueue((void **)&req);
+    size_t count = task_queues_[selectWorker(req)]->Enqueue((void **)&req);
     if (count == 0)
         return Status(
                 common::CYPRE_ES_RTE_RING_FULL, "couldn't submit request");
@@ -545,19 +655,22 @@ void SpdkMgr::getCoreMask(std::vector<int> &core_mask_vector) {
 }
 
 Status SpdkMgr::StartWorkers() {
-    // 初始化
-    CypreRing *ring = new CypreRing(
-            "spdk_request_ring", CypreRing::TYPE_MP_MC,
-            GlobalConfig().extentserver().spdk_request_ring_size);
-    if (!ring) {
-        return Status(
-                common::CYPRE_ER_OUT_OF_MEMORY, "couldn't create spdk_io_ring");
-    }
-    Status s = ring->Init();
-    if (!s.ok()) return s;
-
-    task_queue_.reset(ring);
+    // 初始化, 每个worker一个请求队列
     auto num_workers = GlobalConfig().extentserver().num_spdk_workers;
+    task_queues_.resize(num_workers);
+    for (int i = 0; i < num_workers; ++i) {
+        CypreRing *ring = new CypreRing(
+                "spdk_request_ring_" + std::to_string(i), CypreRing::TYPE_MP_SC,
+                GlobalConfig().extentserver().spdk_request_ring_size);
+        if (!ring) {
+            return Status(
+                    common::CYPRE_ER_OUT_OF_MEMORY,
+                    "couldn't create spdk_io_ring");
+        }
+        Status s = ring->Init();
+        if (!s.ok()) return s;
+        task_queues_[i].reset(ring);
+    }
     workers_.resize(num_workers);
 
     // parse core mask
@@ -573,7 +686,8 @@ Status SpdkMgr::StartWorkers() {
     }
 
     for (int i = 0; i < num_workers; ++i) {
-        workers_[i] = new SpdkWorker(this, task_queue_);
+        workers_[i] = new SpdkWorker(
+                this, task_queues_[i], set_affinity ? core_mask[i] : -1);
         int ret = pthread_create(
                 workers_[i]->ThreadId(), NULL, SpdkWorker::SpdkWorkerFunc,
                 (void *)workers_[i]);
@@ -628,6 +742,7 @@ Status SpdkMgr::StopWorkers() {
         delete workers_[i];
     }
     workers_.clear();
+    task_queues_.clear();
     return Status();
 }
 
@@ -26,6 +26,8 @@ namespace cyprestore {
 namespace extentserver {
 
 const int SPDK_RPC_SELECT_INTERVAL = 4000;  // 4ms
+const size_t kIOBufBlockCacheSize = 8192;   // 8192 * 8K = 64MB
+const size_t kIOBufBlockAlign = 4096;        // data of blocks is page aligned
 
 enum SpdkMgrStatus {
     kSpdkMgrInit = 0,
@@ -62,7 +64,9 @@ using common::Status;
 class SpdkMgr {
 public:
     explicit SpdkMgr(const SpdkEnvOptions &options)
-            : options_(options), status_(kSpdkMgrInit) {}
+            : options_(options), zero_copy_write_(false),
+              unmap_zeroes_(false), sgl_supported_(false),
+              status_(kSpdkMgrInit) {}
 
     ~SpdkMgr() = default;
 
@@ -75,6 +79,17 @@ public:
     void *AllocIOMem(size_t size, size_t align = 0x1000);
     void FreeIOMem(void *p);
 
+    // brpc IOBuf allocator of data of blocks received into, page aligned
+    // dma memory, so that the data can be submitted to bdev without
+    // copying. Block headers and other blocks stay on heap.
+    static void *AllocIOBufBlock(size_t size);
+    static void FreeIOBufBlock(void *p);
+    static bool IsDMAMemory(const void *p);
+    Status EnableZeroCopyWrite();
+    bool ZeroCopyWrite() const {
+        return zero_copy_write_;
+    }
+
     uint32_t GetBlockSize();
     uint64_t GetNumBlocks();
     uint32_t GetWriteUnitSize();
@@ -95,6 +110,14 @@ public:
     Status StopWorkers();
 
     bool WriteCacheEnabled();
+    // unmapped blocks read back as zeros, else deletes write zeros
+    bool UnmapZeroes() const {
+        return unmap_zeroes_;
+    }
+    // nvme sgl takes any dword aligned iovecs, else prp rules apply
+    bool SGLSupported() const {
+        return sgl_supported_;
+    }
 
 private:
     friend class SpdkWorker;
@@ -127,6 +150,8 @@ private:
     static void closeSpdkBdevFunc(void *arg);
 
     void getCoreMask(std::vector<int> &core_mask_vector);
+    // one extent always goes to the same worker, meta io by its hint
+    size_t selectWorker(Request *req);
 
     struct Context {
         Context() : done(false), rc(0), arg(nullptr) {}
@@ -142,9 +167,13 @@ private:
 
     SpdkEnvOptions options_;
     SpdkHandler handler_;
-    std::shared_ptr<CypreRing> task_queue_;
+    // per worker MP_SC queue, shared nothing between workers
+    std::vector<std::shared_ptr<CypreRing>> task_queues_;
     std::vector<SpdkWorker *> workers_;
     struct spdk_poller *spdk_rpc_poller_;
+    bool zero_copy_write_;
+    bool unmap_zeroes_;
+    bool sgl_supported_;
     volatile SpdkMgrStatus status_;
 };
 
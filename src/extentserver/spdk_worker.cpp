@@ -6,12 +6,23 @@
 
 #include "spdk_worker.h"
 
-#include "bthread/bthread.h"
+#include <algorithm>
+
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "common/config.h"
+#include "spdk/env.h"
 #include "spdk_mgr.h"
 
 namespace cyprestore {
 namespace extentserver {
 
+bvar::LatencyRecorder g_completion_delay("spdk_completion_queue_delay");
+bvar::IntRecorder g_completion_batch("spdk_completion_batch_size");
+
+// bdev completions are always polled on the worker's own thread
+static __thread SpdkWorker *tls_worker = nullptr;
+
 void *SpdkWorker::SpdkWorkerFunc(void *arg) {
     SpdkWorker *worker = static_cast<SpdkWorker *>(arg);
     worker->run();
@@ -26,13 +37,33 @@ void SpdkWorker::worker_callback(
         struct spdk_bdev_io *io, bool success, void *arg) {
     Request *req = static_cast<Request *>(arg);
     req->SetResult(success);
-    bthread_t th;
-    while (bthread_start_background(&th, nullptr, req->UserCallback(), arg)
-           != 0) {
-        LOG(FATAL) << "Fail to start user callback";
-    }
     // Complete the I/O
     spdk_bdev_free_io(io);
+
+    Completion completion(req, butil::cpuwide_time_us());
+    if (bthread::execution_queue_execute(
+                tls_worker->completion_queue_, completion)
+        != 0) {
+        LOG(ERROR) << "Couldn't queue completion, run user callback inline";
+        req->UserCallback()(req);
+    }
+}
+
+int SpdkWorker::runCompletions(
+        void *meta, bthread::TaskIterator<Completion> &iter) {
+    if (iter.is_queue_stopped()) {
+        return 0;
+    }
+
+    int64_t now_us = butil::cpuwide_time_us();
+    int64_t batch = 0;
+    for (; iter; ++iter) {
+        g_completion_delay << (now_us - iter->complete_us);
+        iter->req->UserCallback()(iter->req);
+        ++batch;
+    }
+    g_completion_batch << batch;
+    return 0;
 }
 
 void SpdkWorker::initWorkerEnv() {
@@ -42,10 +73,30 @@ void SpdkWorker::initWorkerEnv() {
     io_channel_ = spdk_mgr_->getSpdkIoChannel();
     assert(io_channel_ != nullptr && "couldn't create spdk io channel");
 
-    iomem_mgr_.reset(new IOMemMgr(CypreRing::CypreRingType::TYPE_MP_SC));
+    // io memory from the numa node of the bound core
+    int socket_id = SPDK_ENV_SOCKET_ID_ANY;
+    if (core_id_ >= 0) {
+        socket_id = static_cast<int>(spdk_env_get_socket_id(core_id_));
+    }
+
+    // vectored io splits requests into 64K units, no need for bigger slabs
+    vectored_io_ = GlobalConfig().extentserver().vectored_io;
+    if (vectored_io_) {
+        iomem_mgr_.reset(new IOMemMgr(
+                CypreRing::CypreRingType::TYPE_MP_SC, kVecIOUnitSize,
+                socket_id));
+    } else {
+        iomem_mgr_.reset(new IOMemMgr(
+                CypreRing::CypreRingType::TYPE_MP_SC, 1 << 20, socket_id));
+    }
     assert(iomem_mgr_ != nullptr && "couldn't alloc IOMemMgr");
     auto status = iomem_mgr_->Init();
     assert(status.ok() && "Init io mem manager failed");
+
+    tls_worker = this;
+    int rc = bthread::execution_queue_start(
+            &completion_queue_, nullptr, runCompletions, nullptr);
+    assert(rc == 0 && "couldn't start completion queue");
 }
 
 void SpdkWorker::run() {
@@ -68,15 +119,25 @@ void SpdkWorker::run() {
         }
 
         for (size_t i = 0; i < count;) {
-            io_u *io = nullptr;
+            if (reqs[i]->IsMetaIO()) {
+                doMetaIO(reqs[i]);
+                ++i;
+                continue;
+            }
+
+            // discard carries no data, a whole extent is too big for a unit
+            if (reqs[i]->Discard() || reqs[i]->Deallocate()) {
+                doDelete(reqs[i]);
+                ++i;
+                continue;
+            }
+
             // if can't get io unit, infinite retry
-            s = iomem_mgr_->GetIOUnitBulk(reqs[i]->Size(), &io);
+            s = prepareIOUnit(reqs[i]);
             if (!s.ok()) {
                 LOG(ERROR) << "Couldn't get io unit " << s.ToString();
                 continue;
             }
-            reqs[i]->SetIOMemMgr(iomem_mgr_);
-            reqs[i]->SetIOUnit(io);
 
             switch (reqs[i]->GetRequestType()) {
                 case RequestType::kTypeRead:
@@ -87,11 +148,6 @@ void SpdkWorker::run() {
                 case RequestType::kTypeReplicate:
                     doWrite(reqs[i]);
                     break;
-                // here no need IOUnit, but for code unification,
-                // do not treat special
-                case RequestType::kTypeDelete:
-                    doDelete(reqs[i]);
-                    break;
                 default:
                     LOG(ERROR) << "Invalid cmd type: "
                                << reqs[i]->GetRequestType();
@@ -103,6 +159,9 @@ void SpdkWorker::run() {
     }
 
     s = spdk_mgr_->finishSpdkIoThread(io_thread_, io_channel_);
+    // run the callbacks left in completion queue
+    bthread::execution_queue_stop(completion_queue_);
+    bthread::execution_queue_join(completion_queue_);
     if (!s.ok()) {
         LOG(ERROR) << "Couldn't close io channel or spdk thread. Error: "
                    << s.ToString();
@@ -114,10 +173,128 @@ void SpdkWorker::run() {
     pthread_exit((void *)(&status_));
 }
 
+Status SpdkWorker::prepareIOUnit(Request *req) {
+    // zero copy write only needs iovec table of attachment blocks
+    bool zero_copy = zeroCopyWritable(req);
+    if (!zero_copy && vectorable(req)) {
+        return prepareVecIOUnits(req);
+    }
+
+    io_u *io = nullptr;
+    auto status = iomem_mgr_->GetIOUnitBulk(
+            zero_copy ? kIOTableUnitSize : req->Size(), &io);
+    if (!status.ok()) return status;
+
+    req->SetZeroCopy(zero_copy);
+    req->SetIOMemMgr(iomem_mgr_);
+    req->SetIOUnit(io);
+    return Status();
+}
+
+Status SpdkWorker::prepareVecIOUnits(Request *req) {
+    io_u *table = nullptr;
+    auto status = iomem_mgr_->GetIOUnitBulk(kIOTableUnitSize, &table);
+    if (!status.ok()) return status;
+
+    io_u *ios[kMaxTableIOVecs];
+    uint32_t num = 0;
+    status = iomem_mgr_->GetIOUnitsVec(req->Size(), kMaxTableIOVecs, ios, &num);
+    if (!status.ok()) {
+        iomem_mgr_->PutIOUnit(table);
+        return status;
+    }
+
+    req->SetVectored(true);
+    req->SetNumIOVecs(num);
+    req->SetIOMemMgr(iomem_mgr_);
+    req->SetIOUnit(table);
+
+    uint64_t left = req->Size();
+    struct iovec *iovs = req->IOVecs();
+    IOUnitSlot *slots = req->IOUnitSlots();
+    for (uint32_t i = 0; i < num; ++i) {
+        iovs[i].iov_base = ios[i]->data;
+        iovs[i].iov_len = std::min<uint64_t>(left, ios[i]->size);
+        left -= iovs[i].iov_len;
+        slots[i].req = req;
+        slots[i].io = ios[i];
+    }
+    return Status();
+}
+
+bool SpdkWorker::vectorable(Request *req) {
+    if (!vectored_io_) {
+        return false;
+    }
+
+    switch (req->GetRequestType()) {
+        case RequestType::kTypeRead:
+        case RequestType::kTypeWrite:
+        case RequestType::kTypeReplicate:
+            break;
+        // scrub and delete keep contiguous unit
+        default:
+            return false;
+    }
+
+    uint64_t num_units = (req->Size() + kVecIOUnitSize - 1) / kVecIOUnitSize;
+    return num_units > 0 && num_units <= kMaxTableIOVecs;
+}
+
+bool SpdkWorker::zeroCopyWritable(Request *req) {
+    if (!spdk_mgr_->ZeroCopyWrite()) {
+        return false;
+    }
+    if (req->GetRequestType() != RequestType::kTypeWrite
+        && req->GetRequestType() != RequestType::kTypeReplicate) {
+        return false;
+    }
+
+    const butil::IOBuf &buf =
+            req->GetOperationContext().cntl->request_attachment();
+    size_t num_blocks = buf.backing_block_num();
+    if (buf.size() != req->Size() || num_blocks == 0
+        || num_blocks > kMaxTableIOVecs) {
+        return false;
+    }
+
+    // every block must be dma memory, meet bdev's buffer alignment and
+    // be dword aligned. Without sgl, prp also wants blocks but the first
+    // to start at a page and blocks but the last to end at one.
+    // Otherwise fall back to copy.
+    size_t buf_align = spdk_mgr_->GetBufAlignSize();
+    bool prp = !spdk_mgr_->SGLSupported();
+    for (size_t i = 0; i < num_blocks; ++i) {
+        butil::StringPiece block = buf.backing_block(i);
+        uintptr_t start = reinterpret_cast<uintptr_t>(block.data());
+        uintptr_t end = start + block.size();
+        if (!SpdkMgr::IsDMAMemory(block.data()) || start % buf_align != 0
+            || start % kDwordSize != 0 || block.size() % kDwordSize != 0) {
+            return false;
+        }
+        if (prp && i > 0 && start % kPRPPageSize != 0) {
+            return false;
+        }
+        if (prp && i + 1 < num_blocks && end % kPRPPageSize != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void SpdkWorker::doRead(Request *req) {
-    int rc = spdk_bdev_read(
-            spdk_mgr_->handler_.desc, io_channel_, req->IOUnit()->data,
-            req->PhysicalOffset(), req->Size(), worker_callback, (void *)req);
+    int rc = 0;
+    if (req->Vectored()) {
+        rc = spdk_bdev_readv(
+                spdk_mgr_->handler_.desc, io_channel_, req->IOVecs(),
+                req->NumIOVecs(), req->PhysicalOffset(), req->Size(),
+                worker_callback, (void *)req);
+    } else {
+        rc = spdk_bdev_read(
+                spdk_mgr_->handler_.desc, io_channel_, req->IOUnit()->data,
+                req->PhysicalOffset(), req->Size(), worker_callback,
+                (void *)req);
+    }
     if (rc == 0) {
         return;
     }
@@ -130,11 +307,33 @@ void SpdkWorker::doRead(Request *req) {
 }
 
 void SpdkWorker::doWrite(Request *req) {
+    if (req->ZeroCopy()) {
+        doZeroCopyWrite(req);
+        return;
+    }
+
     auto cntl = req->GetOperationContext().cntl;
-    cntl->request_attachment().copy_to(req->IOUnit()->data, req->Size(), 0);
-    int rc = spdk_bdev_write(
-            spdk_mgr_->handler_.desc, io_channel_, req->IOUnit()->data,
-            req->PhysicalOffset(), req->Size(), worker_callback, (void *)req);
+    int rc = 0;
+    if (req->Vectored()) {
+        struct iovec *iovs = req->IOVecs();
+        size_t pos = 0;
+        for (uint32_t i = 0; i < req->NumIOVecs(); ++i) {
+            cntl->request_attachment().copy_to(
+                    iovs[i].iov_base, iovs[i].iov_len, pos);
+            pos += iovs[i].iov_len;
+        }
+        rc = spdk_bdev_writev(
+                spdk_mgr_->handler_.desc, io_channel_, iovs, req->NumIOVecs(),
+                req->PhysicalOffset(), req->Size(), worker_callback,
+                (void *)req);
+    } else {
+        cntl->request_attachment().copy_to(
+                req->IOUnit()->data, req->Size(), 0);
+        rc = spdk_bdev_write(
+                spdk_mgr_->handler_.desc, io_channel_, req->IOUnit()->data,
+                req->PhysicalOffset(), req->Size(), worker_callback,
+                (void *)req);
+    }
     if (rc == 0) {
         return;
     }
@@ -146,15 +345,76 @@ void SpdkWorker::doWrite(Request *req) {
     req->UserCallback()(req);
 }
 
+void SpdkWorker::doZeroCopyWrite(Request *req) {
+    // attachment is held by cntl until user callback runs
+    const butil::IOBuf &buf =
+            req->GetOperationContext().cntl->request_attachment();
+    struct iovec *iovs = req->IOVecs();
+    size_t num_blocks = buf.backing_block_num();
+    for (size_t i = 0; i < num_blocks; ++i) {
+        butil::StringPiece block = buf.backing_block(i);
+        iovs[i].iov_base = const_cast<char *>(block.data());
+        iovs[i].iov_len = block.size();
+    }
+
+    int rc = spdk_bdev_writev(
+            spdk_mgr_->handler_.desc, io_channel_, iovs, num_blocks,
+            req->PhysicalOffset(), req->Size(), worker_callback, (void *)req);
+    if (rc == 0) {
+        return;
+    }
+
+    LOG(ERROR) << "bdev writev error, rc: " << rc
+               << ", physical offset: " << req->PhysicalOffset()
+               << ", size: " << req->Size() << ", iovcnt: " << num_blocks;
+    req->SetResult(false);
+    req->UserCallback()(req);
+}
+
 void SpdkWorker::doDelete(Request *req) {
-    int rc = spdk_bdev_write_zeroes(
-            spdk_mgr_->handler_.desc, io_channel_, req->PhysicalOffset(),
-            req->Size(), worker_callback, (void *)req);
+    int rc = 0;
+    bool unmap = req->Deallocate() && spdk_mgr_->UnmapZeroes();
+    if (unmap) {
+        // device reads unmapped blocks as zeros, nothing is written
+        rc = spdk_bdev_unmap(
+                spdk_mgr_->handler_.desc, io_channel_, req->PhysicalOffset(),
+                req->Size(), worker_callback, (void *)req);
+    } else {
+        rc = spdk_bdev_write_zeroes(
+                spdk_mgr_->handler_.desc, io_channel_, req->PhysicalOffset(),
+                req->Size(), worker_callback, (void *)req);
+    }
+    if (rc == 0) {
+        return;
+    }
+
+    LOG(ERROR) << "bdev " << (unmap ? "unmap" : "write zeros")
+               << " error, rc: " << rc
+               << ", physical offset: " << req->PhysicalOffset()
+               << ", size: " << req->Size();
+    req->SetResult(false);
+    req->UserCallback()(req);
+}
+
+void SpdkWorker::doMetaIO(Request *req) {
+    int rc = 0;
+    if (req->GetRequestType() == RequestType::kTypeMetaRead) {
+        rc = spdk_bdev_read(
+                spdk_mgr_->handler_.desc, io_channel_, req->MetaBuf(),
+                req->PhysicalOffset(), req->Size(), worker_callback,
+                (void *)req);
+    } else {
+        rc = spdk_bdev_write(
+                spdk_mgr_->handler_.desc, io_channel_, req->MetaBuf(),
+                req->PhysicalOffset(), req->Size(), worker_callback,
+                (void *)req);
+    }
     if (rc == 0) {
         return;
     }
 
-    LOG(ERROR) << "bdev write zeros error, rc: " << rc
+    LOG(ERROR) << "bdev meta io error, rc: " << rc
+               << ", type: " << req->GetRequestType()
                << ", physical offset: " << req->PhysicalOffset()
                << ", size: " << req->Size();
     req->SetResult(false);
@@ -7,8 +7,10 @@
 #ifndef CYPRESTORE_EXTENTSERVER_SPDK_WORKER_H
 #define CYPRESTORE_EXTENTSERVER_SPDK_WORKER_H
 
+#include <bthread/execution_queue.h>
 #include <butil/macros.h>
 #include <pthread.h>
+#include <sys/uio.h>
 #include <memory>
 
 #include "common/cypre_ring.h"
@@ -23,6 +25,16 @@ namespace extentserver {
 
 class SpdkMgr;
 
+// finished bdev io waiting for its user callback
+struct Completion {
+    Completion() : req(nullptr), complete_us(0) {}
+    Completion(Request *req_, int64_t complete_us_)
+            : req(req_), complete_us(complete_us_) {}
+
+    Request *req;
+    int64_t complete_us;
+};
+
 enum SpdkWorkerStatus {
     kSpdkWorkerInit = 0,
     kSpdkWorkerStopping,
@@ -31,9 +43,12 @@ enum SpdkWorkerStatus {
 
 class SpdkWorker {
  public:
-    SpdkWorker(SpdkMgr *spdk_mgr, std::shared_ptr<CypreRing> &task_queue)
+    // core_id: cpu core the worker bound to, -1 means not bound
+    SpdkWorker(SpdkMgr *spdk_mgr, std::shared_ptr<CypreRing> &task_queue,
+               int core_id = -1)
         : spdk_mgr_(spdk_mgr),
           task_queue_(task_queue),
+          core_id_(core_id),
           status_(kSpdkWorkerInit) {
     }
     ~SpdkWorker() = default;
@@ -47,21 +62,38 @@ class SpdkWorker {
 
  private:
     static void worker_callback(struct spdk_bdev_io *io, bool success, void *arg);
+    static int runCompletions(
+            void *meta, bthread::TaskIterator<Completion> &iter);
 
     void initWorkerEnv();
     void run();
 
+    Status prepareIOUnit(Request *req);
+    Status prepareVecIOUnits(Request *req);
+    bool zeroCopyWritable(Request *req);
+    bool vectorable(Request *req);
     void doRead(Request *req);
     void doWrite(Request *req);
+    void doZeroCopyWrite(Request *req);
     void doDelete(Request *req);
+    void doMetaIO(Request *req);
 
 	pthread_t tid_;
 	SpdkMgr *spdk_mgr_;
 	std::shared_ptr<CypreRing> task_queue_;
+    int core_id_;
 	struct spdk_thread *io_thread_;
 	struct spdk_io_channel *io_channel_;
     std::shared_ptr<IOMemMgr> iomem_mgr_;
+    // user callbacks run in batch by the bthread of this queue
+    bthread::ExecutionQueueId<Completion> completion_queue_;
     const int kBatchNums = 1000;
+    // data unit of vectored io, also the max slab of iomem_mgr_
+    const uint32_t kVecIOUnitSize = 64 << 10;
+    // nvme data pointer constraints of zero copy iovecs
+    const uintptr_t kDwordSize = 4;
+    const uintptr_t kPRPPageSize = 4 << 10;
+    bool vectored_io_ = false;
     volatile SpdkWorkerStatus status_;
 };
 
@@ -6,6 +6,9 @@
 
 #include "storage_engine.h"
 
+#include <algorithm>
+#include <sstream>
+
 #include "common/config.h"
 #include "common/constants.h"
 #include "extentserver.h"
@@ -18,8 +21,9 @@ StorageEngine::StorageEngine(
         const std::string &device_type, const std::string &replication_type)
         : engine_type_(StorageEngine::kInvalidEngine),
           replication_type_(StorageEngine::kInvalidReplication),
+          star_pool_(false),
           align_size_(common::kAlignSize), extent_size_(0),
-          enable_log_engine_(false) {
+          enable_log_engine_(GlobalConfig().extentserver().enable_log_engine) {
     if (device_type == kHddDevice) {
         engine_type_ = kHddEngine;
     } else if (device_type == kSsdDevice) {
@@ -33,6 +37,18 @@ StorageEngine::StorageEngine(
     } else if (replication_type == kStarReplicationType) {
         replication_type_ = kStarReplication;
     }
+
+    std::stringstream pools(
+            GlobalConfig().extentserver().star_replication_pools);
+    std::string pool_id;
+    while (std::getline(pools, pool_id, ',')) {
+        pool_id.erase(
+                std::remove(pool_id.begin(), pool_id.end(), ' '),
+                pool_id.end());
+        if (pool_id == GlobalConfig().extentserver().pool_id) {
+            star_pool_ = true;
+        }
+    }
 }
 
 Status StorageEngine::Init() {
@@ -46,18 +62,48 @@ Status StorageEngine::Init() {
     Status s = bare_engine_->Init();
     if (!s.ok()) return s;
 
+    if (enable_log_engine_) {
+        log_engine_.reset(new LogEngine(this));
+        s = log_engine_->Init();
+        if (!s.ok()) return s;
+    }
+
     extent_router_mgr_.reset(new common::ExtentRouterMgr(
             ExtentServer::GlobalInstance().GetEmChannel(), false));
     replica_engine_.reset(new ReplicateEngine(extent_router_mgr_));
+    if (GlobalConfig().extentserver().replicate_stream) {
+        replica_engine_->EnableStream(
+                GlobalConfig().network().public_endpoint(),
+                GlobalConfig().extentserver().replicate_streams_per_peer);
+    }
+    if (GlobalConfig().extentserver().write_quorum > 0) {
+        replica_engine_->EnableQuorum(
+                GlobalConfig().extentserver().write_quorum,
+                GlobalConfig().extentserver().replica_max_lag_bytes,
+                GlobalConfig().extentserver().replica_lag_wait_ms);
+    }
     return doRecovery();
 }
 
 Status StorageEngine::Close() {
+    if (enable_log_engine_) {
+        Status s = log_engine_->Close();
+        if (!s.ok()) return s;
+    }
     return bare_engine_->Close();
 }
 
 Status StorageEngine::doRecovery() {
-    return bare_engine_->DoRecovery();
+    Status s = bare_engine_->DoRecovery();
+    if (!s.ok() || !enable_log_engine_) return s;
+
+    return log_engine_->DoRecovery();
+}
+
+void StorageEngine::waitLogClean(const std::string &extent_id) {
+    if (enable_log_engine_) {
+        log_engine_->WaitClean(extent_id, 0, extent_size_);
+    }
 }
 
 Status StorageEngine::queryRouter(Request *req) {
@@ -85,6 +131,9 @@ Status StorageEngine::ProcessRequest(Request *req) {
     if (!status.ok()) {
         return status;
     }
+    if (req->GetRequestType() == RequestType::kTypeReplicate) {
+        noteReplicate(req);
+    }
 
     status = doReplicate(req);
     if (!status.ok()) {
@@ -94,21 +143,61 @@ Status StorageEngine::ProcessRequest(Request *req) {
     if (!enable_log_engine_) {
         return bare_engine_->ProcessRequest(req);
     }
-
-    // calls log_engine_
-    return Status();
+    return log_engine_->ProcessRequest(req);
 }
 
 Status StorageEngine::doReplicate(Request *req) {
     if (replication_type_ == kStarReplication) {
         return Status();
     }
-    if (req->GetRequestType() != RequestType::kTypeWrite) {
+    if (req->GetRequestType() != RequestType::kTypeWrite
+        || isClientReplicated(req)) {
         return Status();
     }
     return replica_engine_->Send(req);
 }
 
+bool StorageEngine::isClientReplicated(Request *req) {
+    auto &op_ctx = req->GetOperationContext();
+    return static_cast<pb::WriteRequest *>(op_ctx.request)->client_replicated();
+}
+
+bool StorageEngine::isSecondaryReadable(Request *req) {
+    auto &op_ctx = req->GetOperationContext();
+    if (!static_cast<pb::ReadRequest *>(op_ctx.request)->allow_secondary()) {
+        return false;
+    }
+    // client writes every replica itself, it knows its quorum
+    if (replication_type_ == kStarReplication) {
+        return true;
+    }
+    // with a write quorum of the primary an acked write may still be
+    // missing here. Unknown till a replicate of the extent comes, e.g.
+    // after restart, and then read from primary.
+    common::ReadLock lock(full_ack_lock_);
+    return full_ack_extents_.count(req->ExtentID()) != 0;
+}
+
+void StorageEngine::noteReplicate(Request *req) {
+    auto &op_ctx = req->GetOperationContext();
+    bool full_ack = !static_cast<pb::ReplicateRequest *>(op_ctx.request)
+                             ->quorum_acked();
+    const std::string &extent_id = req->ExtentID();
+    {
+        common::ReadLock lock(full_ack_lock_);
+        if ((full_ack_extents_.count(extent_id) != 0) == full_ack) {
+            return;
+        }
+    }
+
+    common::WriteLock lock(full_ack_lock_);
+    if (full_ack) {
+        full_ack_extents_.insert(extent_id);
+    } else {
+        full_ack_extents_.erase(extent_id);
+    }
+}
+
 Status StorageEngine::checkParameters(Request *req) {
     if (req->ExtentID().empty()) {
         return Status(common::CYPRE_ER_INVALID_ARGUMENT, "extent_id empty");
@@ -139,20 +228,33 @@ Status StorageEngine::checkOwnership(Request *req) {
     auto port = GlobalConfig().network().public_port;
     switch (req->GetRequestType()) {
         case RequestType::kTypeRead: {
-            if (!extent_router->IsPrimary(ip, port)) {
+            if (extent_router->IsPrimary(ip, port)) {
+                break;
+            }
+            if (!isSecondaryReadable(req)
+                || !extent_router->IsSecondary(ip, port)) {
                 return Status(
                         common::CYPRE_ER_NO_PERMISSION,
                         "ilegal node, not primary");
             }
+            break;
         }
         case RequestType::kTypeWrite: {
+            // else a client could skip replication of a standard pool
+            if (isClientReplicated(req) && !isStarPool()) {
+                return Status(
+                        common::CYPRE_ER_NO_PERMISSION,
+                        "client replicated write of a non star pool");
+            }
             if (replication_type_ == kStandardReplication
+                && !isClientReplicated(req)
                 && !extent_router->IsPrimary(ip, port)) {
                 return Status(
                         common::CYPRE_ER_NO_PERMISSION,
                         "ilegal node, not primary");
             } else if (
-                    replication_type_ == kStarReplication
+                    (replication_type_ == kStarReplication
+                     || isClientReplicated(req))
                     && !extent_router->IsValid(ip, port)) {
                 return Status(
                         common::CYPRE_ER_NO_PERMISSION,
@@ -10,13 +10,16 @@
 #include <butil/macros.h>
 
 #include <memory>
+#include <string>
+#include <unordered_set>
 
 #include "bare_engine.h"
 #include "common/extent_router.h"
+#include "common/rwlock.h"
 #include "common/status.h"
 #include "replicate_engine.h"
+#include "log_engine.h"
 #include "request_context.h"
-//#include "log_engine.h"
 
 namespace cyprestore {
 namespace extentserver {
@@ -80,16 +83,30 @@ public:
 private:
     DISALLOW_COPY_AND_ASSIGN(StorageEngine);
     friend class BareEngine;
+    friend class LogEngine;
     Status doRecovery();
     Status doSafetyCheck(Request *req);
     Status doReplicate(Request *req);
+    // star write of a client on a standard replication es
+    bool isClientReplicated(Request *req);
+    // clients write every replica of extents here, see star_replication_pools
+    bool isStarPool() const {
+        return replication_type_ == kStarReplication || star_pool_;
+    }
+    // secondary has every write acked to client
+    bool isSecondaryReadable(Request *req);
+    // secondary learns from replicates whether primary acks on a quorum
+    void noteReplicate(Request *req);
     Status checkParameters(Request *req);
     Status checkOwnership(Request *req);
     Status checkChecksum(Request *req);
     Status queryRouter(Request *req);
+    // log blocks of a detached extent go home before its space is freed
+    void waitLogClean(const std::string &extent_id);
 
     EngineType engine_type_;
     ReplicationType replication_type_;
+    bool star_pool_;  // pool of this es is in star_replication_pools
     const uint32_t align_size_;  // 4K对齐
     uint64_t extent_size_;
     common::ExtentRouterMgrPtr extent_router_mgr_;
@@ -99,7 +116,10 @@ private:
     // replicate remote
     ReplicateEnginePtr replica_engine_;
     // read/write log local
-    // LogEnginePtr log_engine_;
+    LogEnginePtr log_engine_;
+    // extents whose primary waits for every replica, see noteReplicate
+    common::RWLock full_ack_lock_;
+    std::unordered_set<std::string> full_ack_extents_;
 };
 
 }  // namespace extentserver
@@ -0,0 +1,796 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "write_log.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "bthread/countdown_event.h"
+#include "butil/fast_rand.h"
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "utils/crc32.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+bvar::LatencyRecorder g_log_append_latency("log_append_latency");
+bvar::LatencyRecorder g_log_flush_latency("log_flush_latency");
+bvar::IntRecorder g_log_flush_batch("log_flush_batch_bytes");
+
+namespace {
+
+const uint64_t kSuperBlockMagic = 0x474f4c5250594343ULL;  // "CCYPRLOG"
+const uint32_t kSuperBlockVersion = 1;
+const uint32_t kRecordMagic = 0x52474f4c;  // "LOGR"
+const uint64_t kIOChunkSize = 1 << 20;
+
+}  // namespace
+
+const uint64_t WriteLog::kLogBlockSize;
+const uint64_t WriteLog::kMinRegionSize;
+
+WriteLog::WriteLog(
+        const BlockDevicePtr &bdev, uint64_t region_offset,
+        uint64_t region_size, uint64_t flush_batch_size,
+        int flush_interval_ms)
+        : bdev_(bdev), region_offset_(region_offset),
+          region_size_(region_size),
+          flush_interval_ms_(flush_interval_ms > 0 ? flush_interval_ms : 1),
+          log_id_(0), epoch_(0), head_(0), next_lsn_(1), ckpt_tail_(0),
+          ckpt_lsn_(1), dirty_bytes_(0), failed_(false), urgent_(false),
+          stop_(false), drain_(false), opened_(false), tid_(0),
+          ring_buf_(nullptr), sb_buf_(nullptr), flush_buf_(nullptr) {
+    memset(&sb_, 0, sizeof(sb_));
+    ring_offset_ = region_offset_ + 2 * kLogBlockSize;
+    ring_size_ = region_size_ > 2 * kLogBlockSize
+                         ? (region_size_ - 2 * kLogBlockSize) / kLogBlockSize
+                                   * kLogBlockSize
+                         : 0;
+    flush_batch_size_ = std::max(
+            flush_batch_size / kLogBlockSize * kLogBlockSize, kLogBlockSize);
+}
+
+WriteLog::~WriteLog() {
+    if (opened_) {
+        // not closed, leave everything in log like a crash
+        {
+            std::lock_guard<bthread::Mutex> lock(mutex_);
+            stop_ = true;
+        }
+        flush_cond_.notify_one();
+        pthread_join(tid_, NULL);
+    }
+
+    for (auto &kv : records_) {
+        delete kv.second;
+    }
+    if (ring_buf_ != nullptr) bdev_->FreeIOMem(ring_buf_);
+    if (sb_buf_ != nullptr) bdev_->FreeIOMem(sb_buf_);
+    if (flush_buf_ != nullptr) bdev_->FreeIOMem(flush_buf_);
+}
+
+void *WriteLog::ioDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    // waiter owns req, don't touch it after signal
+    static_cast<bthread::CountdownEvent *>(req->UserArg())->signal();
+    return nullptr;
+}
+
+Status WriteLog::doIO(
+        RequestType type, uint64_t offset, void *buf, uint64_t size) {
+    Request req(type);
+    bthread::CountdownEvent done(1);
+    req.SetMetaBuf(buf, size);
+    req.SetPhysicalOffset(offset);
+    req.SetUserCallback(ioDone);
+    req.SetUserArg(&done);
+
+    Status s = bdev_->ProcessRequest(&req);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't submit log io, offset:" << offset
+                   << ", size:" << size << ", " << s.ToString();
+        return s;
+    }
+    done.wait();
+
+    if (!req.Result()) {
+        LOG(ERROR) << "Log io error, type:" << type << ", offset:" << offset
+                   << ", size:" << size;
+        return Status(common::CYPRE_ES_LOG_IO_ERROR, "log io error");
+    }
+    return Status();
+}
+
+Status WriteLog::Open() {
+    if (opened_) return Status();
+
+    if (region_size_ < kMinRegionSize || region_offset_ % kLogBlockSize != 0
+        || bdev_->block_size() == 0 || kLogBlockSize % bdev_->block_size() != 0) {
+        LOG(ERROR) << "Invalid log region, offset:" << region_offset_
+                   << ", size:" << region_size_
+                   << ", device block size:" << bdev_->block_size();
+        return Status(common::CYPRE_ER_INVALID_ARGUMENT, "invalid log region");
+    }
+
+    ring_buf_ = static_cast<char *>(bdev_->AllocIOMem(ring_size_));
+    sb_buf_ = bdev_->AllocIOMem(kLogBlockSize);
+    flush_buf_ = bdev_->AllocIOMem(flush_batch_size_);
+    if (ring_buf_ == nullptr || sb_buf_ == nullptr || flush_buf_ == nullptr) {
+        LOG(ERROR) << "Couldn't alloc log buffers, ring size:" << ring_size_
+                   << ", flush batch size:" << flush_batch_size_;
+        return Status(common::CYPRE_ER_OUT_OF_MEMORY, "no memory for log");
+    }
+
+    SuperBlock sb;
+    bool found = false;
+    Status s = loadSuperBlock(&sb, &found);
+    if (!s.ok()) return s;
+
+    if (!found) {
+        s = format();
+    } else if (sb.region_size != region_size_) {
+        LOG(ERROR) << "Log region size changed from " << sb.region_size
+                   << " to " << region_size_;
+        return Status(
+                common::CYPRE_ES_LOG_CORRUPTION, "log region size changed");
+    } else {
+        sb_ = sb;
+        s = replay();
+    }
+    if (!s.ok()) return s;
+
+    log_id_ = sb_.log_id;
+    epoch_ = static_cast<uint32_t>(sb_.epoch);
+    int ret = pthread_create(&tid_, NULL, WriteLog::flushThread, this);
+    if (ret != 0) {
+        LOG(ERROR) << "Couldn't create log flush thread, ret:" << ret;
+        return Status(
+                common::CYPRE_ES_PTHREAD_CREATE_ERROR,
+                "couldn't create log flush thread");
+    }
+    opened_ = true;
+    return Status();
+}
+
+Status WriteLog::Close() {
+    if (!opened_) return Status();
+
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        stop_ = true;
+        drain_ = true;
+    }
+    flush_cond_.notify_one();
+    space_cond_.notify_all();
+    pthread_join(tid_, NULL);
+    opened_ = false;
+
+    std::lock_guard<bthread::Mutex> lock(mutex_);
+    if (!index_.empty()) {
+        LOG(ERROR) << "Log closed with blocks not home, dirty bytes:"
+                   << dirty_bytes_;
+        return Status(common::CYPRE_ES_LOG_IO_ERROR, "couldn't flush log");
+    }
+    return Status();
+}
+
+Status WriteLog::format() {
+    memset(&sb_, 0, sizeof(sb_));
+    sb_.magic = kSuperBlockMagic;
+    sb_.version = kSuperBlockVersion;
+    sb_.log_id = butil::fast_rand() | 1;
+    sb_.epoch = 1;
+    sb_.region_size = region_size_;
+    head_ = 0;
+    next_lsn_ = 1;
+    ckpt_tail_ = 0;
+    ckpt_lsn_ = 1;
+
+    LOG(INFO) << "Format log, region offset:" << region_offset_
+              << ", size:" << region_size_;
+    return writeSuperBlock(head_, next_lsn_);
+}
+
+Status WriteLog::loadSuperBlock(SuperBlock *sb, bool *found) {
+    *found = false;
+    for (int slot = 0; slot < 2; ++slot) {
+        Status s = doIO(
+                RequestType::kTypeMetaRead,
+                region_offset_ + slot * kLogBlockSize, sb_buf_, kLogBlockSize);
+        if (!s.ok()) return s;
+
+        SuperBlock cur;
+        memcpy(&cur, sb_buf_, sizeof(cur));
+        uint32_t crc = cur.crc;
+        cur.crc = 0;
+        if (cur.magic != kSuperBlockMagic || cur.version != kSuperBlockVersion
+            || crc != utils::Crc32::Checksum(&cur, sizeof(cur))) {
+            continue;
+        }
+        cur.crc = crc;
+        if (!*found || cur.generation > sb->generation) {
+            *sb = cur;
+            *found = true;
+        }
+    }
+    return Status();
+}
+
+Status WriteLog::writeSuperBlock(uint64_t tail_pos, uint64_t tail_lsn) {
+    SuperBlock sb = sb_;
+    sb.generation++;
+    sb.tail_pos = tail_pos;
+    sb.tail_lsn = tail_lsn;
+    sb.crc = 0;
+    sb.crc = utils::Crc32::Checksum(&sb, sizeof(sb));
+
+    memset(sb_buf_, 0, kLogBlockSize);
+    memcpy(sb_buf_, &sb, sizeof(sb));
+    Status s = doIO(
+            RequestType::kTypeMetaWrite,
+            region_offset_ + (sb.generation % 2) * kLogBlockSize, sb_buf_,
+            kLogBlockSize);
+    if (!s.ok()) return s;
+
+    sb_ = sb;
+    return Status();
+}
+
+bool WriteLog::validHeader(
+        const RecordHeader *header, uint32_t min_epoch) const {
+    if (header->magic != kRecordMagic || header->log_id != sb_.log_id
+        || header->lsn != next_lsn_ || header->pos != head_
+        || header->epoch < min_epoch || header->epoch > sb_.epoch) {
+        return false;
+    }
+
+    RecordHeader cur = *header;
+    cur.crc = 0;
+    if (header->id_len > kLogBlockSize - sizeof(RecordHeader)) {
+        return false;
+    }
+    std::string buf(reinterpret_cast<const char *>(&cur), sizeof(cur));
+    buf.append(reinterpret_cast<const char *>(header + 1), header->id_len);
+    if (header->crc != utils::Crc32::Checksum(buf)) {
+        return false;
+    }
+
+    // a record never crosses ring end
+    uint64_t left = ring_size_ - head_ % ring_size_;
+    if (header->len < kLogBlockSize || header->len % kLogBlockSize != 0
+        || header->len > left) {
+        return false;
+    }
+    if (header->type == kRecordPad) {
+        return header->len == left;
+    }
+    if (header->type != kRecordWrite
+        || header->size + kLogBlockSize != header->len) {
+        return false;
+    }
+    const char *data = reinterpret_cast<const char *>(header) + kLogBlockSize;
+    return header->data_crc == utils::Crc32::Checksum(data, header->size);
+}
+
+Status WriteLog::replay() {
+    // ring mirror is loaded as a whole, records are parsed in place
+    for (uint64_t off = 0; off < ring_size_; off += kIOChunkSize) {
+        uint64_t len = std::min(ring_size_ - off, kIOChunkSize);
+        Status s = doIO(
+                RequestType::kTypeMetaRead, ring_offset_ + off,
+                ring_buf_ + off, len);
+        if (!s.ok()) return s;
+    }
+
+    head_ = sb_.tail_pos;
+    next_lsn_ = sb_.tail_lsn;
+    ckpt_tail_ = sb_.tail_pos;
+    ckpt_lsn_ = sb_.tail_lsn;
+    uint64_t num_records = 0;
+    uint32_t epoch = 0;
+    while (true) {
+        const RecordHeader *header =
+                reinterpret_cast<const RecordHeader *>(ringAt(head_));
+        if (!validHeader(header, epoch)) {
+            break;
+        }
+        epoch = header->epoch;
+
+        LogRecord *record = newRecord(header->len);
+        record->durable = true;
+        record->acked = true;
+        if (header->type == kRecordWrite) {
+            applyRecord(record, header);
+        }
+        releaseIfDone(record);
+        ++num_records;
+    }
+
+    LOG(INFO) << "Replay log finished, records:" << num_records
+              << ", tail:" << sb_.tail_pos << ", head:" << head_
+              << ", dirty bytes:" << dirty_bytes_;
+
+    // records of last open behind the torn one may be durable, a new
+    // epoch keeps them from being taken as successors of new records
+    sb_.epoch++;
+    return writeSuperBlock(ckpt_tail_, ckpt_lsn_);
+}
+
+WriteLog::LogRecord *WriteLog::newRecord(uint64_t len) {
+    LogRecord *record = new LogRecord(this);
+    record->pos = head_;
+    record->lsn = next_lsn_++;
+    record->len = len;
+    head_ += len;
+    records_[record->pos] = record;
+    return record;
+}
+
+void WriteLog::fillHeader(
+        LogRecord *record, RecordType type, const std::string &extent_id,
+        uint64_t offset, uint64_t size, uint64_t home) {
+    char *block = ringAt(record->pos);
+    memset(block, 0, kLogBlockSize);
+
+    RecordHeader *header = reinterpret_cast<RecordHeader *>(block);
+    header->magic = kRecordMagic;
+    header->log_id = log_id_;
+    header->lsn = record->lsn;
+    header->pos = record->pos;
+    header->len = record->len;
+    header->type = type;
+    header->offset = offset;
+    header->size = size;
+    header->home = home;
+    header->id_len = static_cast<uint32_t>(extent_id.size());
+    header->epoch = epoch_;
+    if (size > 0) {
+        header->data_crc = utils::Crc32::Checksum(block + kLogBlockSize, size);
+    }
+    memcpy(header + 1, extent_id.data(), extent_id.size());
+    header->crc = utils::Crc32::Checksum(
+            block, sizeof(RecordHeader) + extent_id.size());
+}
+
+Status WriteLog::Append(
+        Request *req, const std::string &extent_id, uint64_t offset,
+        uint64_t home, const butil::IOBuf &data) {
+    uint64_t size = data.size();
+    if (size % kLogBlockSize != 0 || offset % kLogBlockSize != 0
+        || size > MaxIOSize()
+        || sizeof(RecordHeader) + extent_id.size() > kLogBlockSize) {
+        return Status(
+                common::CYPRE_ER_INVALID_ARGUMENT, "invalid log append");
+    }
+
+    int64_t start_us = butil::cpuwide_time_us();
+    uint64_t len = kLogBlockSize + size;
+    LogRecord *pad = nullptr;
+    LogRecord *record = nullptr;
+    {
+        std::unique_lock<bthread::Mutex> lock(mutex_);
+        while (true) {
+            if (failed_ || stop_) {
+                return Status(
+                        common::CYPRE_ES_LOG_IO_ERROR, "log not writable");
+            }
+
+            // records don't cross ring end, pad the rest of this lap
+            uint64_t left = ring_size_ - head_ % ring_size_;
+            uint64_t pad_len = left < len ? left : 0;
+            if (head_ + pad_len + len - ckpt_tail_ <= ring_size_) {
+                if (pad_len > 0) {
+                    pad = newRecord(pad_len);
+                    inflight_.push_back(pad);
+                }
+                record = newRecord(len);
+                record->start_us = start_us;
+                record->user_req = req;
+                inflight_.push_back(record);
+                break;
+            }
+
+            urgent_ = true;
+            flush_cond_.notify_one();
+            space_cond_.wait(lock);
+        }
+    }
+
+    // space is reserved, fill and write it without lock
+    if (pad != nullptr) {
+        fillHeader(pad, kRecordPad, std::string(), 0, 0, 0);
+        submit(pad);
+    }
+    data.copy_to(ringAt(record->pos) + kLogBlockSize, size);
+    fillHeader(record, kRecordWrite, extent_id, offset, size, home);
+    submit(record);
+    return Status();
+}
+
+void WriteLog::submit(LogRecord *record) {
+    const RecordHeader *header = headerOf(record);
+    uint64_t io_size = header->type == kRecordPad ? kLogBlockSize : record->len;
+    record->io.SetMetaBuf(ringAt(record->pos), io_size);
+    record->io.SetPhysicalOffset(ring_offset_ + record->pos % ring_size_);
+    // spread appends like the home writes they stand for
+    record->io.SetWorkerHint(
+            header->type == kRecordPad ? record->pos : header->home);
+    record->io.SetUserCallback(appendDone);
+    record->io.SetUserArg(record);
+
+    Status s = bdev_->ProcessRequest(&record->io);
+    if (!s.ok()) {
+        LOG(ERROR) << "Couldn't submit log record, pos:" << record->pos
+                   << ", len:" << record->len << ", " << s.ToString();
+        onDurable(record, false);
+    }
+}
+
+void *WriteLog::appendDone(void *arg) {
+    Request *io = static_cast<Request *>(arg);
+    LogRecord *record = static_cast<LogRecord *>(io->UserArg());
+    record->log->onDurable(record, io->Result());
+    return nullptr;
+}
+
+void WriteLog::onDurable(LogRecord *record, bool success) {
+    std::vector<std::pair<Request *, bool>> acks;
+    int64_t now_us = butil::cpuwide_time_us();
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        record->durable = true;
+        if (!success && !failed_) {
+            LOG(ERROR) << "Couldn't write log record, pos:" << record->pos
+                       << ", lsn:" << record->lsn << ", log stops accepting";
+            failed_ = true;
+        }
+
+        // ack in lsn order, replay stops at the first torn record
+        while (!inflight_.empty() && inflight_.front()->durable) {
+            LogRecord *cur = inflight_.front();
+            inflight_.pop_front();
+            cur->acked = true;
+            if (!failed_ && headerOf(cur)->type == kRecordWrite) {
+                applyRecord(cur, headerOf(cur));
+            }
+            if (cur->user_req != nullptr) {
+                acks.emplace_back(cur->user_req, !failed_);
+                g_log_append_latency << now_us - cur->start_us;
+                cur->user_req = nullptr;
+            }
+            releaseIfDone(cur);
+        }
+        if (dirty_bytes_ >= flush_batch_size_) {
+            flush_cond_.notify_one();
+        }
+    }
+
+    for (auto &ack : acks) {
+        ack.first->SetResult(ack.second);
+        ack.first->UserCallback()(ack.first);
+    }
+}
+
+void WriteLog::applyRecord(LogRecord *record, const RecordHeader *header) {
+    std::string extent_id(
+            reinterpret_cast<const char *>(header + 1), header->id_len);
+    const char *data = reinterpret_cast<const char *>(header) + kLogBlockSize;
+    BlockMap &blocks = index_[extent_id];
+    for (uint64_t off = 0; off < header->size; off += kLogBlockSize) {
+        auto ret = blocks.insert(
+                std::make_pair(header->offset + off, LogBlock()));
+        LogBlock &block = ret.first->second;
+        if (!ret.second) {
+            dropBlock(block);  // older version
+        }
+        block.record = record;
+        block.lsn = record->lsn;
+        block.home = header->home + off;
+        block.data = data + off;
+        block.state = kBlockDirty;
+        ++record->live;
+        dirty_bytes_ += kLogBlockSize;
+    }
+}
+
+void WriteLog::dropBlock(const LogBlock &block) {
+    if (block.state == kBlockFlushed) {
+        return;  // record may be released already
+    }
+    if (block.state == kBlockDirty) {
+        dirty_bytes_ -= kLogBlockSize;
+    }
+    --block.record->live;
+    releaseIfDone(block.record);
+}
+
+void WriteLog::releaseIfDone(LogRecord *record) {
+    if (!record->acked || record->live > 0) {
+        return;
+    }
+    records_.erase(record->pos);
+    delete record;
+}
+
+uint64_t WriteLog::Snapshot(
+        const std::string &extent_id, uint64_t offset, uint64_t size,
+        std::vector<LogRun> *runs) {
+    std::lock_guard<bthread::Mutex> lock(mutex_);
+    auto it = index_.find(extent_id);
+    if (it == index_.end()) {
+        return 0;
+    }
+
+    uint64_t hit = 0;
+    const BlockMap &blocks = it->second;
+    for (auto b = blocks.lower_bound(offset);
+         b != blocks.end() && b->first < offset + size; ++b) {
+        if (runs->empty()
+            || runs->back().offset + runs->back().data.size() != b->first) {
+            runs->emplace_back(b->first);
+        }
+        runs->back().data.append(b->second.data, kLogBlockSize);
+        hit += kLogBlockSize;
+    }
+    return hit;
+}
+
+bool WriteLog::isClean(
+        const std::string &extent_id, uint64_t offset, uint64_t size) {
+    auto it = index_.find(extent_id);
+    if (it == index_.end()) {
+        return true;
+    }
+    auto b = it->second.lower_bound(offset);
+    return b == it->second.end() || b->first >= offset + size;
+}
+
+void WriteLog::WaitClean(
+        const std::string &extent_id, uint64_t offset, uint64_t size) {
+    std::unique_lock<bthread::Mutex> lock(mutex_);
+    while (!isClean(extent_id, offset, size) && !failed_
+           && !(stop_ && !drain_)) {
+        urgent_ = true;
+        flush_cond_.notify_one();
+        clean_cond_.wait(lock);
+    }
+}
+
+void *WriteLog::flushThread(void *arg) {
+    static_cast<WriteLog *>(arg)->run();
+    return NULL;
+}
+
+void WriteLog::run() {
+    std::vector<FlushItem> batch;
+    while (true) {
+        bool exit = false;
+        bool stopping = false;
+        {
+            std::unique_lock<bthread::Mutex> lock(mutex_);
+            if (!stop_ && !urgent_ && dirty_bytes_ < flush_batch_size_) {
+                flush_cond_.wait_for(lock, flush_interval_ms_ * 1000L);
+            }
+            stopping = stop_;
+            if (stop_ && (!drain_ || dirty_bytes_ == 0)) {
+                exit = true;
+            } else {
+                urgent_ = false;
+                collectBatch(&batch);
+            }
+        }
+
+        if (!batch.empty()) {
+            int64_t start_us = butil::cpuwide_time_us();
+            Status s = flushBatch(&batch);
+            finishBatch(&batch, s.ok());
+            g_log_flush_latency << butil::cpuwide_time_us() - start_us;
+            if (!s.ok() && stopping) {
+                break;  // Close reports blocks left in log
+            }
+        }
+        // a drained log checkpoints once more, nothing left to replay
+        if (!exit || drain_) {
+            Status s = checkpoint();
+            if (!s.ok()) {
+                LOG(ERROR) << "Couldn't checkpoint log, " << s.ToString();
+            }
+        }
+        if (exit) {
+            break;
+        }
+    }
+    LOG(INFO) << "Log flush thread exits";
+}
+
+void WriteLog::collectBatch(std::vector<FlushItem> *batch) {
+    // oldest first, so the tail moves
+    uint64_t bytes = 0;
+    for (auto &kv : records_) {
+        LogRecord *record = kv.second;
+        if (!record->acked) {
+            break;  // all records after are in flight too
+        }
+        const RecordHeader *header = headerOf(record);
+        if (record->live == 0 || header->type != kRecordWrite) {
+            continue;
+        }
+
+        std::string extent_id(
+                reinterpret_cast<const char *>(header + 1), header->id_len);
+        auto it = index_.find(extent_id);
+        if (it == index_.end()) continue;
+        BlockMap &blocks = it->second;
+        for (uint64_t off = 0; off < header->size; off += kLogBlockSize) {
+            auto b = blocks.find(header->offset + off);
+            if (b == blocks.end() || b->second.lsn != record->lsn
+                || b->second.state != kBlockDirty) {
+                continue;
+            }
+            b->second.state = kBlockFlushing;
+            dirty_bytes_ -= kLogBlockSize;
+            FlushItem item;
+            item.extent_id = extent_id;
+            item.offset = b->first;
+            item.lsn = record->lsn;
+            item.home = b->second.home;
+            item.data = b->second.data;
+            batch->push_back(item);
+            bytes += kLogBlockSize;
+        }
+        if (bytes >= flush_batch_size_) {
+            break;
+        }
+    }
+}
+
+Status WriteLog::flushBatch(std::vector<FlushItem> *batch) {
+    std::sort(
+            batch->begin(), batch->end(),
+            [](const FlushItem &a, const FlushItem &b) {
+                return a.home < b.home;
+            });
+
+    struct Run {
+        uint64_t home;
+        uint64_t buf_off;
+        uint64_t len;
+    };
+
+    // ring space of the batch is not reused until next super block,
+    // so blocks are copied without lock
+    char *buf = static_cast<char *>(flush_buf_);
+    size_t i = 0;
+    while (i < batch->size()) {
+        std::vector<Run> runs;
+        uint64_t used = 0;
+        for (; i < batch->size() && used < flush_batch_size_; ++i) {
+            const FlushItem &item = (*batch)[i];
+            if (!runs.empty()
+                && runs.back().home + runs.back().len == item.home) {
+                runs.back().len += kLogBlockSize;
+            } else {
+                runs.push_back({item.home, used, kLogBlockSize});
+            }
+            memcpy(buf + used, item.data, kLogBlockSize);
+            used += kLogBlockSize;
+        }
+
+        bthread::CountdownEvent done(static_cast<int>(runs.size()));
+        std::vector<std::unique_ptr<Request>> ios;
+        for (const auto &run : runs) {
+            ios.emplace_back(new Request(RequestType::kTypeMetaWrite));
+            Request *io = ios.back().get();
+            io->SetMetaBuf(buf + run.buf_off, run.len);
+            io->SetPhysicalOffset(run.home);
+            io->SetWorkerHint(run.home);
+            io->SetUserCallback(ioDone);
+            io->SetUserArg(&done);
+            if (!bdev_->ProcessRequest(io).ok()) {
+                io->SetResult(false);
+                done.signal();
+            }
+        }
+        done.wait();
+
+        g_log_flush_batch << used;
+        for (const auto &io : ios) {
+            if (!io->Result()) {
+                LOG(ERROR) << "Couldn't flush log blocks home, offset:"
+                           << io->PhysicalOffset() << ", size:" << io->Size();
+                return Status(
+                        common::CYPRE_ES_LOG_IO_ERROR, "log flush error");
+            }
+        }
+    }
+    return Status();
+}
+
+void WriteLog::finishBatch(std::vector<FlushItem> *batch, bool success) {
+    std::lock_guard<bthread::Mutex> lock(mutex_);
+    for (auto &item : *batch) {
+        auto it = index_.find(item.extent_id);
+        if (it == index_.end()) continue;
+        auto b = it->second.find(item.offset);
+        // overwritten while flushing
+        if (b == it->second.end() || b->second.lsn != item.lsn
+            || b->second.state != kBlockFlushing) {
+            continue;
+        }
+
+        LogBlock &block = b->second;
+        if (!success) {
+            block.state = kBlockDirty;  // retried by next batch
+            dirty_bytes_ += kLogBlockSize;
+            continue;
+        }
+        block.state = kBlockFlushed;
+        --block.record->live;
+        releaseIfDone(block.record);
+        flushed_.push_back(std::move(item));
+    }
+    batch->clear();
+}
+
+Status WriteLog::checkpoint() {
+    uint64_t tail_pos = 0, tail_lsn = 0;
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        if (records_.empty()) {
+            tail_pos = head_;
+            tail_lsn = next_lsn_;
+        } else {
+            tail_pos = records_.begin()->second->pos;
+            tail_lsn = records_.begin()->second->lsn;
+        }
+        if (tail_pos == ckpt_tail_) {
+            return Status();
+        }
+    }
+
+    // only the flusher writes super blocks
+    Status s = writeSuperBlock(tail_pos, tail_lsn);
+    if (!s.ok()) return s;
+
+    {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        ckpt_tail_ = tail_pos;
+        ckpt_lsn_ = tail_lsn;
+
+        // blocks of records before tail are never replayed, drop them
+        size_t kept = 0;
+        for (size_t i = 0; i < flushed_.size(); ++i) {
+            FlushItem &item = flushed_[i];
+            if (item.lsn >= ckpt_lsn_) {
+                flushed_[kept++] = std::move(item);
+                continue;
+            }
+            auto it = index_.find(item.extent_id);
+            if (it == index_.end()) continue;
+            auto b = it->second.find(item.offset);
+            if (b != it->second.end() && b->second.lsn == item.lsn
+                && b->second.state == kBlockFlushed) {
+                it->second.erase(b);
+                if (it->second.empty()) {
+                    index_.erase(it);
+                }
+            }
+        }
+        flushed_.resize(kept);
+    }
+    space_cond_.notify_all();
+    clean_cond_.notify_all();
+    return Status();
+}
+
+}  // namespace extentserver
+}  // namespace cyprestore
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#ifndef CYPRESTORE_EXTENTSERVER_WRITE_LOG_H_
+#define CYPRESTORE_EXTENTSERVER_WRITE_LOG_H_
+
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/iobuf.h>
+#include <butil/macros.h>
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "block_device.h"
+#include "common/status.h"
+#include "request_context.h"
+
+namespace cyprestore {
+namespace extentserver {
+
+// contiguous log resident data of a read, offset within extent
+struct LogRun {
+    LogRun() : offset(0) {}
+    explicit LogRun(uint64_t offset_) : offset(offset_) {}
+
+    uint64_t offset;
+    std::string data;
+};
+
+// Circular write ahead log in a reserved region of the block device.
+//
+// Region layout:
+//   | super block A | super block B | ring ...                       |
+//
+// Every Append writes one record (header block + data) at the ring head,
+// and the caller's request is completed once it and all records before
+// it are durable. The ring is mirrored in dma memory, so log resident
+// blocks are indexed by extent without extra copies, reads are served
+// from the mirror, and the flusher writes them to their home location
+// sorted and coalesced in large batches. After a batch is home, a new
+// super block generation moves the replay tail past released records,
+// only then their index entries are dropped and ring space is reused.
+// Open replays records from the tail until a bad header (torn tail), and
+// starts a new epoch so records behind a torn one are never replayed.
+class WriteLog {
+public:
+    WriteLog(
+            const BlockDevicePtr &bdev, uint64_t region_offset,
+            uint64_t region_size, uint64_t flush_batch_size,
+            int flush_interval_ms);
+    ~WriteLog();
+
+    Status Open();
+    // flushes all log resident blocks home
+    Status Close();
+
+    // data of extent [offset, offset + size) goes to home later,
+    // req's user callback runs when it is durable in log
+    Status Append(
+            Request *req, const std::string &extent_id, uint64_t offset,
+            uint64_t home, const butil::IOBuf &data);
+    // copies log resident blocks of [offset, offset + size),
+    // returns number of bytes hit
+    uint64_t Snapshot(
+            const std::string &extent_id, uint64_t offset, uint64_t size,
+            std::vector<LogRun> *runs);
+    // waits until no block of [offset, offset + size) lives in log,
+    // io bypassing the log can't be overwritten by a later flush or replay
+    void WaitClean(
+            const std::string &extent_id, uint64_t offset, uint64_t size);
+
+    // larger writes bypass the log
+    uint64_t MaxIOSize() const {
+        return ring_size_ / 4 - kLogBlockSize;
+    }
+    uint64_t DirtyBytes() {
+        std::lock_guard<bthread::Mutex> lock(mutex_);
+        return dirty_bytes_;
+    }
+
+    static const uint64_t kLogBlockSize = 4096;
+    static const uint64_t kMinRegionSize = 4 << 20;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(WriteLog);
+
+    struct SuperBlock {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t crc;
+        uint64_t log_id;  // random per format, rejects stale records
+        uint64_t generation;
+        uint64_t epoch;  // bumped by every open
+        uint64_t tail_pos;  // replay starts here
+        uint64_t tail_lsn;
+        uint64_t region_size;
+    };
+
+    enum RecordType {
+        kRecordWrite = 1,
+        kRecordPad,  // skip to ring start
+    };
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t crc;  // header with crc 0, then extent id
+        uint64_t log_id;
+        uint64_t lsn;
+        uint64_t pos;  // logical position, ring offset is pos % ring size
+        uint64_t len;  // bytes of ring used, header included
+        uint32_t type;
+        uint32_t data_crc;
+        uint64_t offset;  // in extent
+        uint64_t size;
+        uint64_t home;  // physical offset of data
+        uint32_t id_len;
+        uint32_t epoch;  // records of one open never precede older ones
+    };
+
+    struct LogRecord {
+        explicit LogRecord(WriteLog *log_)
+                : log(log_), io(RequestType::kTypeMetaWrite), pos(0), lsn(0),
+                  len(0), live(0), durable(false), acked(false),
+                  start_us(0), user_req(nullptr) {}
+
+        WriteLog *log;
+        Request io;
+        uint64_t pos;
+        uint64_t lsn;
+        uint64_t len;
+        uint32_t live;  // blocks not flushed or overwritten
+        bool durable;
+        bool acked;  // this and all records before are durable
+        int64_t start_us;
+        Request *user_req;
+    };
+
+    enum BlockState {
+        kBlockDirty = 0,
+        kBlockFlushing,
+        kBlockFlushed,  // home, dropped at next super block
+    };
+
+    struct LogBlock {
+        LogRecord *record;  // released once flushed
+        uint64_t lsn;
+        uint64_t home;
+        const char *data;  // in ring mirror
+        BlockState state;
+    };
+
+    // extent offset -> block
+    typedef std::map<uint64_t, LogBlock> BlockMap;
+
+    struct FlushItem {
+        std::string extent_id;
+        uint64_t offset;
+        uint64_t lsn;
+        uint64_t home;
+        const char *data;
+    };
+
+    static void *ioDone(void *arg);
+    static void *appendDone(void *arg);
+    static void *flushThread(void *arg);
+
+    Status doIO(RequestType type, uint64_t offset, void *buf, uint64_t size);
+    Status format();
+    Status loadSuperBlock(SuperBlock *sb, bool *found);
+    Status writeSuperBlock(uint64_t tail_pos, uint64_t tail_lsn);
+    Status replay();
+
+    char *ringAt(uint64_t pos) const {
+        return ring_buf_ + pos % ring_size_;
+    }
+    const RecordHeader *headerOf(const LogRecord *record) const {
+        return reinterpret_cast<const RecordHeader *>(ringAt(record->pos));
+    }
+    bool validHeader(const RecordHeader *header, uint32_t min_epoch) const;
+    LogRecord *newRecord(uint64_t len);
+    void fillHeader(
+            LogRecord *record, RecordType type, const std::string &extent_id,
+            uint64_t offset, uint64_t size, uint64_t home);
+    void submit(LogRecord *record);
+    void onDurable(LogRecord *record, bool success);
+    void applyRecord(LogRecord *record, const RecordHeader *header);
+    void dropBlock(const LogBlock &block);
+    void releaseIfDone(LogRecord *record);
+    bool isClean(
+            const std::string &extent_id, uint64_t offset, uint64_t size);
+
+    void run();
+    void collectBatch(std::vector<FlushItem> *batch);
+    Status flushBatch(std::vector<FlushItem> *batch);
+    void finishBatch(std::vector<FlushItem> *batch, bool success);
+    Status checkpoint();
+
+    BlockDevicePtr bdev_;
+    uint64_t region_offset_;
+    uint64_t region_size_;
+    uint64_t ring_offset_;  // absolute offset of ring
+    uint64_t ring_size_;
+    uint64_t flush_batch_size_;
+    int flush_interval_ms_;
+
+    bthread::Mutex mutex_;
+    bthread::ConditionVariable flush_cond_;  // wakes flusher
+    bthread::ConditionVariable space_cond_;  // ring space released
+    bthread::ConditionVariable clean_cond_;  // flushed blocks dropped
+    SuperBlock sb_;  // written by flusher only
+    uint64_t log_id_;  // of sb_, fixed once opened
+    uint32_t epoch_;
+    uint64_t head_;  // next append position
+    uint64_t next_lsn_;
+    uint64_t ckpt_tail_;  // tail in super block, ring reusable before it
+    uint64_t ckpt_lsn_;
+    uint64_t dirty_bytes_;
+    std::map<uint64_t, LogRecord *> records_;  // by position, not released
+    std::deque<LogRecord *> inflight_;         // by lsn, not durable yet
+    std::map<std::string, BlockMap> index_;    // log resident blocks
+    std::vector<FlushItem> flushed_;  // home, dropped once before tail
+    bool failed_;
+    bool urgent_;  // space or clean waiters
+    bool stop_;
+    bool drain_;  // flush all before flusher exits
+    bool opened_;
+    pthread_t tid_;
+
+    char *ring_buf_;  // dma mirror of ring
+    void *sb_buf_;
+    void *flush_buf_;
+};
+
+}  // namespace extentserver
+}  // namespace cyprestore
+
+#endif  // CYPRESTORE_EXTENTSERVER_WRITE_LOG_H_
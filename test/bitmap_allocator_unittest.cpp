@@ -57,6 +57,89 @@ TEST_F(BitmapAllocatorTest, TestAllocate) {
     }
 }
 
+TEST_F(BitmapAllocatorTest, TestAllocateRun) {
+    // runs crossing units
+    const uint64_t kRunBlocks = 100;
+    uint64_t num_runs = bitmap_allocator.NumBlocks() / kRunBlocks;
+    std::vector<AUnit> aunits;
+    for (uint64_t i = 0; i < num_runs; ++i) {
+        AUnit aunit;
+        Status s = bitmap_allocator.Allocate(kRunBlocks * kBlockSize, &aunit);
+        ASSERT_TRUE(s.ok()) << s.ToString();
+        EXPECT_EQ(aunit.offset, i * kRunBlocks * kBlockSize);
+        EXPECT_EQ(aunit.size, kRunBlocks * kBlockSize);
+        aunits.push_back(aunit);
+    }
+    AUnit aunit;
+    Status s = bitmap_allocator.Allocate(kRunBlocks * kBlockSize, &aunit);
+    EXPECT_FALSE(s.ok());
+
+    // free every other run, then only runs of the same size fit
+    for (size_t i = 1; i < aunits.size(); i += 2) {
+        bitmap_allocator.Free(aunits[i].offset, aunits[i].size);
+    }
+    s = bitmap_allocator.Allocate((kRunBlocks + 1) * kBlockSize, &aunit);
+    EXPECT_FALSE(s.ok());
+    for (size_t i = 1; i < aunits.size(); i += 2) {
+        s = bitmap_allocator.Allocate(kRunBlocks * kBlockSize, &aunit);
+        ASSERT_TRUE(s.ok()) << s.ToString();
+        EXPECT_EQ(aunit.offset, aunits[i].offset);
+    }
+    EXPECT_EQ(
+            bitmap_allocator.FreeBlocks(),
+            bitmap_allocator.NumBlocks() - num_runs * kRunBlocks);
+}
+
+TEST_F(BitmapAllocatorTest, TestMarkAndWrapAround) {
+    // mark a used region in the middle, allocation skips it
+    const uint64_t kMarkBlocks = 1000;
+    bitmap_allocator.Mark(0, kMarkBlocks * kBlockSize);
+    EXPECT_EQ(bitmap_allocator.UsedBlocks(), kMarkBlocks);
+
+    AUnit aunit;
+    Status s = bitmap_allocator.Allocate(kBlockSize, &aunit);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    EXPECT_EQ(aunit.offset, kMarkBlocks * kBlockSize);
+
+    // fill the rest, then free a block before the hint
+    uint64_t left = bitmap_allocator.FreeBlocks();
+    s = bitmap_allocator.Allocate(left * kBlockSize, &aunit);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    EXPECT_EQ(bitmap_allocator.FreeBlocks(), 0U);
+
+    bitmap_allocator.Free(10 * kBlockSize, kBlockSize);
+    bitmap_allocator.Free(500 * kBlockSize, 2 * kBlockSize);
+    s = bitmap_allocator.Allocate(2 * kBlockSize, &aunit);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    EXPECT_EQ(aunit.offset, 500 * kBlockSize);
+    s = bitmap_allocator.Allocate(kBlockSize, &aunit);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    EXPECT_EQ(aunit.offset, 10 * kBlockSize);
+    s = bitmap_allocator.Allocate(kBlockSize, &aunit);
+    EXPECT_FALSE(s.ok());
+}
+
+TEST_F(BitmapAllocatorTest, TestMarkBatch) {
+    // unordered, as loaded from meta store
+    std::vector<AUnit> aunits;
+    for (uint64_t i = 0; i < 1000; ++i) {
+        uint64_t block = (i * 7919) % 100000;
+        aunits.emplace_back(block * kBlockSize, kBlockSize);
+    }
+    aunits.emplace_back(200000 * kBlockSize, 100 * kBlockSize);
+    bitmap_allocator.MarkBatch(&aunits);
+    EXPECT_EQ(bitmap_allocator.UsedBlocks(), 1100U);
+
+    for (size_t i = 1; i < aunits.size(); ++i) {
+        EXPECT_LT(aunits[i - 1].offset, aunits[i].offset);
+    }
+    // marked blocks are skipped
+    AUnit aunit;
+    Status s = bitmap_allocator.Allocate(kBlockSize, &aunit);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    EXPECT_EQ(aunit.offset, kBlockSize);
+}
+
 }  // namespace
 }  // namespace extentserver
 }  // namespace cyprestore
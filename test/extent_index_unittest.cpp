@@ -0,0 +1,149 @@
+#include "extentserver/extent_index.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "common/extent_id_generator.h"
+#include "gtest/gtest.h"
+
+namespace cyprestore {
+namespace extentserver {
+namespace {
+
+class ExtentIndexTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+    void TearDown() override {}
+
+    ExtentKey key(uint64_t index) {
+        return ExtentKey::FromExtentID(
+                common::ExtentIDGenerator::GenerateExtentID(
+                        "blob_001", index));
+    }
+
+    ExtentIndex extent_index_;
+};
+
+TEST_F(ExtentIndexTest, TestExtentKey) {
+    ExtentKey k1 = ExtentKey::FromExtentID("blob_001.12");
+    ExtentKey k2 = ExtentKey::FromExtentID("blob_001.13");
+    ExtentKey k3 = ExtentKey::FromExtentID("blob_002.12");
+    EXPECT_EQ(k1.blob_hash, k2.blob_hash);
+    EXPECT_EQ(k1.extent_index, 12U);
+    EXPECT_EQ(k2.extent_index, 13U);
+    EXPECT_NE(k1.blob_hash, k3.blob_hash);
+    EXPECT_TRUE(k1 == ExtentKey::FromExtentID("blob_001.12"));
+
+    // not blob_id.extent_index, whole id is blob
+    ExtentKey k4 = ExtentKey::FromExtentID("1024");
+    ExtentKey k5 = ExtentKey::FromExtentID("blob.abc");
+    EXPECT_EQ(k4.extent_index, 0U);
+    EXPECT_EQ(k5.extent_index, 0U);
+    EXPECT_FALSE(k4 == k5);
+}
+
+TEST_F(ExtentIndexTest, TestInsertLookupErase) {
+    const uint64_t kNumExtents = 10000;
+    uint64_t offset = 0, size = 0;
+    for (uint64_t i = 0; i < kNumExtents; ++i) {
+        extent_index_.Insert(key(i), i << 30, 1 << 30);
+    }
+    EXPECT_EQ(extent_index_.Size(), kNumExtents);
+    EXPECT_GE(extent_index_.Capacity(), kNumExtents * 2);
+
+    for (uint64_t i = 0; i < kNumExtents; ++i) {
+        ASSERT_TRUE(extent_index_.Lookup(key(i), &offset, &size));
+        EXPECT_EQ(offset, i << 30);
+        EXPECT_EQ(size, 1U << 30);
+    }
+    EXPECT_FALSE(extent_index_.Lookup(key(kNumExtents), &offset, &size));
+
+    // update in place
+    extent_index_.Insert(key(0), 4096, 1 << 30);
+    EXPECT_EQ(extent_index_.Size(), kNumExtents);
+    ASSERT_TRUE(extent_index_.Lookup(key(0), &offset, &size));
+    EXPECT_EQ(offset, 4096U);
+
+    for (uint64_t i = 0; i < kNumExtents; i += 2) {
+        EXPECT_TRUE(extent_index_.Erase(key(i)));
+    }
+    EXPECT_FALSE(extent_index_.Erase(key(0)));
+    EXPECT_EQ(extent_index_.Size(), kNumExtents / 2);
+
+    for (uint64_t i = 0; i < kNumExtents; ++i) {
+        bool found = extent_index_.Lookup(key(i), &offset, &size);
+        EXPECT_EQ(found, i % 2 == 1) << "Index:" << i;
+        if (found) {
+            EXPECT_EQ(offset, i << 30);
+        }
+    }
+}
+
+TEST_F(ExtentIndexTest, TestConcurrentLookup) {
+    const uint64_t kNumStable = 1000;
+    const uint64_t kNumChurn = 5000;
+    for (uint64_t i = 0; i < kNumStable; ++i) {
+        extent_index_.Insert(key(i), i << 30, 1 << 30);
+    }
+
+    // readers must always find stable extents while writer churns others
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            uint64_t offset = 0, size = 0;
+            while (!stop.load()) {
+                for (uint64_t i = 0; i < kNumStable; ++i) {
+                    if (!extent_index_.Lookup(key(i), &offset, &size)
+                        || offset != (i << 30)) {
+                        errors.fetch_add(1);
+                    }
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 3; ++round) {
+        for (uint64_t i = kNumStable; i < kNumStable + kNumChurn; ++i) {
+            extent_index_.Insert(key(i), i << 30, 1 << 30);
+        }
+        for (uint64_t i = kNumStable; i < kNumStable + kNumChurn; ++i) {
+            extent_index_.Erase(key(i));
+        }
+    }
+    stop.store(true);
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(errors.load(), 0U);
+    EXPECT_EQ(extent_index_.Size(), kNumStable);
+}
+
+TEST_F(ExtentIndexTest, TestIOGatesDrain) {
+    ExtentIOGates gates;
+    ExtentKey k = key(1);
+    // nothing entered
+    gates.Drain(k);
+
+    std::atomic<int64_t> *before = gates.Enter(k);
+    std::atomic<bool> drained(false);
+    std::thread drainer([&] {
+        gates.Drain(k);
+        drained = true;
+    });
+    usleep(20 * 1000);
+    EXPECT_FALSE(drained);
+
+    before->fetch_sub(1);
+    drainer.join();
+    EXPECT_TRUE(drained);
+}
+
+}  // namespace
+}  // namespace extentserver
+}  // namespace cyprestore
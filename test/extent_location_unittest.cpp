@@ -2,6 +2,7 @@
 
 #define private public
 #include "extentserver/extent_location.h"
+#include "utils/serializer.h"
 
 namespace cyprestore {
 namespace extentserver {
@@ -42,6 +43,47 @@ TEST_F(ExtentLocationTest, TestStoreExtent) {
     }
 }
 
+TEST_F(ExtentLocationTest, TestEncodeExtent) {
+    ExtentLocation loc(1ULL << 30, 1ULL << 30, "bb-0A1B2C3D.17");
+    std::string value = loc.Encode();
+    ExtentLocationView view;
+    ASSERT_TRUE(ExtentLocationView::Decode(value, &view));
+    EXPECT_EQ(view.offset, loc.offset);
+    EXPECT_EQ(view.size, loc.size);
+    EXPECT_EQ(view.extent_id.as_string(), loc.extent_id);
+
+    value[5] ^= 1;
+    EXPECT_FALSE(ExtentLocationView::Decode(value, &view));
+    // older cereal encoded value
+    std::string old_value = utils::Serializer<ExtentLocation>::Encode(loc);
+    EXPECT_FALSE(ExtentLocationView::Decode(old_value, &view));
+}
+
+TEST_F(ExtentLocationTest, TestSplitLoadRanges) {
+    auto ranges = ExtentLocationMgr::splitLoadRanges(4);
+    ASSERT_EQ(ranges.size(), 4U);
+    EXPECT_EQ(ranges[0].start, kExtentLocPrefix);
+    EXPECT_EQ(ranges[1].start, "extent_loc_bb-4");
+    EXPECT_EQ(ranges[3].end, "extent_loc`");
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        EXPECT_EQ(ranges[i - 1].end, ranges[i].start);
+    }
+    EXPECT_EQ(ExtentLocationMgr::splitLoadRanges(100).size(), 16U);
+    EXPECT_EQ(ExtentLocationMgr::splitLoadRanges(0).size(), 1U);
+}
+
+TEST_F(ExtentLocationTest, TestCheckReserved) {
+    extent_loc_mgr_->reserved_.emplace_back(0, 1 << 20);
+    extent_loc_mgr_->reserved_.emplace_back(100 << 20, 4 << 20);
+    std::vector<AUnit> aunits;
+    aunits.emplace_back(1 << 20, 1 << 20);
+    aunits.emplace_back(99 << 20, 1 << 20);
+    EXPECT_TRUE(extent_loc_mgr_->checkReserved(aunits).ok());
+
+    aunits.emplace_back(103 << 20, 1 << 20);
+    EXPECT_FALSE(extent_loc_mgr_->checkReserved(aunits).ok());
+}
+
 TEST_F(ExtentLocationTest, TestLoadExtents) {
     Status s = extent_loc_mgr_->LoadExtents();
     EXPECT_TRUE(s.ok());
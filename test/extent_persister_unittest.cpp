@@ -0,0 +1,82 @@
+#include "extentserver/extent_persister.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cyprestore {
+namespace extentserver {
+namespace {
+
+class ExtentPersisterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        kvstore::RocksOption rocks_option;
+        rocks_option.db_path =
+                "./extent_persister_" + std::to_string(time(NULL));
+        meta_store_.reset(new RocksMetaStore(rocks_option));
+        auto s = meta_store_->Open();
+        ASSERT_TRUE(s.ok());
+    }
+    void TearDown() override {}
+
+    std::string get(const std::string &key) {
+        std::string value;
+        meta_store_->Load(
+                key, [&](const std::string &k, const std::string &v) {
+                    if (k == key) value = v;
+                    return Status();
+                });
+        return value;
+    }
+
+    MetaStorePtr meta_store_;
+};
+
+TEST_F(ExtentPersisterTest, TestConcurrentPersist) {
+    const int kNumThreads = 8;
+    const int kNumKeys = 1000;
+    ExtentPersister persister(meta_store_, 200, 32);
+    ASSERT_TRUE(persister.Start().ok());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; ++t) {
+        threads.emplace_back([&persister, t]() {
+            for (int i = 0; i < kNumKeys; ++i) {
+                std::string key = "extent_loc_" + std::to_string(t) + "."
+                                  + std::to_string(i);
+                EXPECT_TRUE(persister.Persist(key, std::to_string(i)).ok());
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // durable once Persist returns
+    for (int t = 0; t < kNumThreads; ++t) {
+        for (int i = 0; i < kNumKeys; ++i) {
+            std::string key = "extent_loc_" + std::to_string(t) + "."
+                              + std::to_string(i);
+            EXPECT_EQ(get(key), std::to_string(i));
+        }
+    }
+
+    EXPECT_TRUE(persister.Delete("extent_loc_0.0").ok());
+    EXPECT_EQ(get("extent_loc_0.0"), "");
+}
+
+TEST_F(ExtentPersisterTest, TestPersistAfterStop) {
+    ExtentPersister persister(meta_store_, 0, 1);
+    ASSERT_TRUE(persister.Start().ok());
+    EXPECT_TRUE(persister.Persist("extent_loc_blob.0", "0").ok());
+    persister.Stop();
+
+    auto s = persister.Persist("extent_loc_blob.1", "1");
+    EXPECT_EQ(s.code(), common::CYPRE_ES_ROCKSDB_STORE_ERROR);
+}
+
+}  // namespace
+}  // namespace extentserver
+}  // namespace cyprestore
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2020 The Cyprestore Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <time.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#define private public
+#include "extentmanager/extent_router.h"
+#undef private
+
+#include "common/error_code.h"
+#include "utils/serializer.h"
+
+namespace cyprestore {
+namespace extentmanager {
+namespace {
+
+TEST(BlobRouterTest, TestAppend) {
+    BlobRouter br("blob-1", "pool-1");
+    br.append({"rg-1", "rg-2", "rg-1"});
+    // resize
+    br.append({"rg-3"});
+
+    ASSERT_EQ(4U, br.extent_num());
+    ASSERT_EQ(3U, br.rgs_.size());
+    std::string rg_id;
+    ASSERT_TRUE(br.query_rg(1, &rg_id));
+    ASSERT_EQ("rg-1", rg_id);
+    ASSERT_TRUE(br.query_rg(2, &rg_id));
+    ASSERT_EQ("rg-2", rg_id);
+    ASSERT_TRUE(br.query_rg(3, &rg_id));
+    ASSERT_EQ("rg-1", rg_id);
+    ASSERT_TRUE(br.query_rg(4, &rg_id));
+    ASSERT_EQ("rg-3", rg_id);
+}
+
+TEST(BlobRouterTest, TestQueryRG) {
+    BlobRouter br("blob-1", "pool-1");
+    br.append({"rg-1", "rg-2"});
+    br.overrides_[2] = "rg-9";
+
+    std::string rg_id;
+    ASSERT_TRUE(br.query_rg(1, &rg_id));
+    ASSERT_EQ("rg-1", rg_id);
+    ASSERT_TRUE(br.query_rg(2, &rg_id));
+    ASSERT_EQ("rg-9", rg_id);
+    // index is from 1
+    ASSERT_FALSE(br.query_rg(0, &rg_id));
+    ASSERT_FALSE(br.query_rg(3, &rg_id));
+}
+
+TEST(BlobRouterTest, TestSerialize) {
+    BlobRouter br("blob-1", "pool-1");
+    br.append({"rg-1", "rg-2", "rg-1"});
+    br.overrides_[3] = "rg-9";
+
+    std::string value = utils::Serializer<BlobRouter>::Encode(br);
+    BlobRouter decoded;
+    ASSERT_TRUE(utils::Serializer<BlobRouter>::Decode(value, decoded));
+    ASSERT_EQ(br.blob_id_, decoded.blob_id_);
+    ASSERT_EQ(br.pool_id_, decoded.pool_id_);
+    ASSERT_EQ(br.rgs_, decoded.rgs_);
+    ASSERT_EQ(br.extent_rgs_, decoded.extent_rgs_);
+    ASSERT_EQ(br.overrides_, decoded.overrides_);
+    ASSERT_EQ(br.create_time_, decoded.create_time_);
+}
+
+class RouterManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        kvstore::RocksOption rocks_option;
+        rocks_option.db_path = "./router_" + std::to_string(time(NULL));
+        kv_store_ = std::make_shared<kvstore::RocksStore>(rocks_option);
+        ASSERT_TRUE(kv_store_->Open().ok());
+        router_mgr_.reset(new RouterManager(kv_store_));
+    }
+
+    void TearDown() override {
+        router_mgr_.reset();
+        kv_store_.reset();
+    }
+
+    Status query(const std::string &extent_id, std::string *rg_id) {
+        std::string pool_id;
+        return router_mgr_->query_router(extent_id, &pool_id, rg_id);
+    }
+
+    std::shared_ptr<kvstore::RocksStore> kv_store_;
+    std::unique_ptr<RouterManager> router_mgr_;
+};
+
+TEST_F(RouterManagerTest, TestResize) {
+    ASSERT_TRUE(router_mgr_->create_router("pool-1", "blob-1", 1, 2,
+                                           {"rg-1", "rg-2"})
+                        .ok());
+    // extents must follow the blob's
+    ASSERT_FALSE(router_mgr_->create_router("pool-1", "blob-1", 4, 4,
+                                            {"rg-3"})
+                         .ok());
+    ASSERT_TRUE(router_mgr_->create_router("pool-1", "blob-1", 3, 3,
+                                           {"rg-3"})
+                        .ok());
+
+    std::string rg_id;
+    ASSERT_TRUE(query("blob-1.2", &rg_id).ok());
+    ASSERT_EQ("rg-2", rg_id);
+    ASSERT_TRUE(query("blob-1.3", &rg_id).ok());
+    ASSERT_EQ("rg-3", rg_id);
+    ASSERT_EQ(common::CYPRE_EM_ROUTER_NOT_FOUND,
+              query("blob-1.4", &rg_id).code());
+
+    ASSERT_TRUE(router_mgr_->delete_blob_router("blob-1", 3).ok());
+    ASSERT_FALSE(query("blob-1.1", &rg_id).ok());
+}
+
+TEST_F(RouterManagerTest, TestLegacyBlob) {
+    // a row per extent, as blobs created before blob routers
+    ASSERT_TRUE(router_mgr_->create_extent_routers("pool-1", "legacy", 1, 2,
+                                                   {"rg-1", "rg-2"})
+                        .ok());
+    // resize keeps a row per extent
+    ASSERT_TRUE(router_mgr_->create_router("pool-1", "legacy", 3, 3,
+                                           {"rg-3"})
+                        .ok());
+    ASSERT_FALSE(router_mgr_->get_blob_router("legacy", true));
+
+    std::string rg_id;
+    ASSERT_TRUE(query("legacy.2", &rg_id).ok());
+    ASSERT_EQ("rg-2", rg_id);
+    ASSERT_TRUE(query("legacy.3", &rg_id).ok());
+    ASSERT_EQ("rg-3", rg_id);
+
+    ASSERT_TRUE(router_mgr_->delete_blob_router("legacy", 3).ok());
+    ASSERT_EQ(0U, router_mgr_->blob_router_map_.count("legacy"));
+    ASSERT_FALSE(query("legacy.1", &rg_id).ok());
+}
+
+TEST_F(RouterManagerTest, TestUnknownBlobCached) {
+    std::string rg_id;
+    ASSERT_EQ(common::CYPRE_EM_ROUTER_NOT_FOUND,
+              query("blob-2.1", &rg_id).code());
+    // kv isn't asked again
+    auto iter = router_mgr_->blob_router_map_.find("blob-2");
+    ASSERT_TRUE(iter != router_mgr_->blob_router_map_.end());
+    ASSERT_FALSE(iter->second);
+
+    // a blob created later replaces it
+    ASSERT_TRUE(router_mgr_->create_router("pool-1", "blob-2", 1, 1,
+                                           {"rg-1"})
+                        .ok());
+    ASSERT_TRUE(query("blob-2.1", &rg_id).ok());
+    ASSERT_EQ("rg-1", rg_id);
+}
+
+}  // namespace
+}  // namespace extentmanager
+}  // namespace cyprestore
@@ -144,6 +144,22 @@ TEST_F(IOMemMgrTest, TestMultiGetMultiPutIOUnit) {
     ASSERT_TRUE(ret == 0);
 }
 
+TEST_F(IOMemMgrTest, TestSocketIOUnit) {
+    const uint32_t kIOUnit = 4096;
+    IOMemMgr iomem_mgr(CypreRing::CypreRingType::TYPE_MP_SC, 64 << 10, 0);
+    Status s = iomem_mgr.Init();
+    ASSERT_TRUE(s.ok());
+
+    for (int i = 1; i <= 16; ++i) {
+        io_u *io;
+        s = iomem_mgr.GetIOUnitBulk(kIOUnit * i, &io);
+        ASSERT_TRUE(s.ok()) << "Index:" << i;
+        ASSERT_EQ(io->size, kIOUnit * i);
+        ASSERT_TRUE(io->data != nullptr);
+        iomem_mgr.PutIOUnit(io);
+    }
+}
+
 }  // namespace
 }  // namespace extentserver
 }  // namespace cyprestore
@@ -4,13 +4,25 @@
  *
  */
 
+#include <brpc/controller.h>
+#include <butil/iobuf.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#define private public
 #include "extentserver/nvme_device.h"
+#include "extentserver/spdk_worker.h"
+#undef private
 
 #include "butil/logging.h"
 #include "common/arena.h"
 #include "common/config.h"
 #include "common/status.h"
-#include "gtest/gtest.h"
+#include "extentserver/pb/extent_io.pb.h"
 
 namespace cyprestore {
 namespace extentserver {
@@ -67,6 +79,54 @@ TEST_F(NVMeDeviceTest, TestOpen) {
     status = nvme_device_->Close();
     ASSERT_TRUE(status.ok());
 }
+
+TEST_F(NVMeDeviceTest, TestZeroCopyWritable) {
+    auto status = nvme_device_->Open();
+    ASSERT_TRUE(status.ok());
+    SpdkMgr *spdk_mgr = nvme_device_->spdk_mgr_.get();
+    ASSERT_TRUE(spdk_mgr->EnableZeroCopyWrite().ok());
+
+    // received like a socket, into portal blocks
+    const size_t kSize = 128 << 10;
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp != nullptr);
+    std::string data(kSize, 'a');
+    ASSERT_EQ(kSize, fwrite(data.data(), 1, kSize, fp));
+    ASSERT_EQ(0, fflush(fp));
+    butil::IOPortal portal;
+    off_t offset = 0;
+    while (portal.size() < kSize) {
+        ssize_t nr = portal.pappend_from_file_descriptor(
+                fileno(fp), offset, kSize - portal.size());
+        ASSERT_GT(nr, 0);
+        offset += nr;
+    }
+    fclose(fp);
+
+    brpc::Controller cntl;
+    cntl.request_attachment().append(portal);
+    pb::WriteRequest request;
+    request.set_extent_id("1");
+    request.set_offset(0);
+    request.set_size(kSize);
+    Request req(RequestType::kTypeWrite);
+    req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+
+    // data of every block is page aligned dma memory, so 128K goes to
+    // bdev without copying
+    const butil::IOBuf &buf = cntl.request_attachment();
+    for (size_t i = 0; i < buf.backing_block_num(); ++i) {
+        uintptr_t start =
+                reinterpret_cast<uintptr_t>(buf.backing_block(i).data());
+        ASSERT_EQ(0U, start % kIOBufBlockAlign);
+    }
+    std::shared_ptr<CypreRing> task_queue;
+    SpdkWorker worker(spdk_mgr, task_queue);
+    ASSERT_TRUE(worker.zeroCopyWritable(&req));
+
+    status = nvme_device_->Close();
+    ASSERT_TRUE(status.ok());
+}
 }  // namespace
 }  // namespace extentserver
 }  // namespace cyprestore
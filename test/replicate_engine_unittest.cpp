@@ -0,0 +1,435 @@
+#include <brpc/server.h>
+#include <brpc/stream.h>
+#include <bthread/countdown_event.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "gtest/gtest.h"
+
+#define private public
+#include "extentserver/quorum_write.h"
+#include "extentserver/replicate_engine.h"
+#include "extentserver/replicate_stream.h"
+
+namespace cyprestore {
+namespace extentserver {
+namespace {
+
+TEST(ReplicateContextTest, TestReuse) {
+    ReplicateContext *ctx = ReplicateContext::Get();
+    ASSERT_NE(ctx, nullptr);
+    ctx->request.set_extent_id("blob.0");
+    ctx->request.set_offset(4096);
+    ctx->request.set_size(4096);
+    ctx->response.mutable_status()->set_code(0);
+    ctx->cntl.request_attachment().append(std::string(4096, 'a'));
+    ctx->Release();
+
+    // same thread takes the released context back, reset for next rpc
+    ReplicateContext *reused = ReplicateContext::Get();
+    EXPECT_EQ(reused, ctx);
+    EXPECT_FALSE(reused->request.has_extent_id());
+    EXPECT_FALSE(reused->response.has_status());
+    EXPECT_TRUE(reused->cntl.request_attachment().empty());
+    EXPECT_EQ(reused->req, nullptr);
+    reused->Release();
+}
+
+void *countReply(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    (*static_cast<int *>(req->UserArg()))++;
+    return nullptr;
+}
+
+TEST(QuorumWriteTest, TestAckOnQuorum) {
+    brpc::Controller cntl;
+    cntl.request_attachment().append(std::string(4096, 'a'));
+    pb::WriteRequest request;
+    request.set_extent_id("blob.0");
+    request.set_offset(0);
+    request.set_size(4096);
+    int replies = 0;
+    Request req(RequestType::kTypeWrite);
+    req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+    req.SetUserCallback(countReply);
+    req.SetUserArg(&replies);
+
+    // 2 of 3 copies, primary and one of two secondaries
+    QuorumWrite *write = QuorumWrite::Get();
+    write->Init(&req, 2, 1);
+    EXPECT_EQ(write->request.extent_id(), "blob.0");
+    EXPECT_EQ(write->cntl.request_attachment().size(), 4096U);
+    write->Report(&write->slots[0], false);
+    EXPECT_EQ(replies, 0);
+    write->Report(&write->slots[1], true);
+    EXPECT_EQ(replies, 1);
+    EXPECT_TRUE(req.Result());
+    EXPECT_EQ(write->req, nullptr);
+    // later outcome of a slot doesn't answer again
+    write->Report(&write->slots[0], true);
+    EXPECT_EQ(replies, 1);
+    for (int i = 0; i < 3; ++i) {
+        write->Unref();
+    }
+}
+
+TEST(QuorumWriteTest, TestFailOnLostQuorum) {
+    brpc::Controller cntl;
+    pb::WriteRequest request;
+    request.set_extent_id("blob.0");
+    request.set_size(4096);
+    int replies = 0;
+    Request req(RequestType::kTypeWrite);
+    req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+    req.SetUserCallback(countReply);
+    req.SetUserArg(&replies);
+
+    // both secondaries needed, first failure decides
+    QuorumWrite *write = QuorumWrite::Get();
+    write->Init(&req, 2, 2);
+    write->Report(&write->slots[0], false);
+    EXPECT_EQ(replies, 1);
+    EXPECT_FALSE(req.Result());
+    write->Report(&write->slots[1], true);
+    EXPECT_EQ(replies, 1);
+    for (int i = 0; i < 3; ++i) {
+        write->Unref();
+    }
+}
+
+TEST(QuorumWriteTest, TestPrimaryOnlyQuorum) {
+    brpc::Controller cntl;
+    pb::WriteRequest request;
+    request.set_extent_id("blob.0");
+    request.set_size(4096);
+    int replies = 0;
+    Request req(RequestType::kTypeWrite);
+    req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+    req.SetUserCallback(countReply);
+    req.SetUserArg(&replies);
+
+    // 1 of 3 copies, client is answered by the local write alone
+    QuorumWrite *write = QuorumWrite::Get();
+    write->Init(&req, 2, 0);
+    EXPECT_EQ(write->req, nullptr);
+    // secondaries are told, they don't serve reads of it
+    EXPECT_TRUE(write->request.quorum_acked());
+    EXPECT_FALSE(request.quorum_acked());
+    write->Report(&write->slots[0], false);
+    write->Report(&write->slots[1], true);
+    EXPECT_EQ(replies, 0);
+    EXPECT_TRUE(req.Result());
+    for (int i = 0; i < 3; ++i) {
+        write->Unref();
+    }
+}
+
+// client write (or discard) of 4K at offset 0 with one secondary, acked
+// by it
+struct TestWrite {
+    TestWrite(
+            const std::string &extent_id, ReplicaCatchup *catchup,
+            bool discard = false)
+            : req(RequestType::kTypeWrite), replies(0) {
+        if (discard) {
+            request.set_discard(true);
+        } else {
+            cntl.request_attachment().append(std::string(4096, 'a'));
+        }
+        request.set_extent_id(extent_id);
+        request.set_offset(0);
+        request.set_size(4096);
+        req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+        req.SetUserCallback(countReply);
+        req.SetUserArg(&replies);
+        write = QuorumWrite::Get();
+        write->Init(&req, 1, 1);
+        write->slots[0].catchup = catchup;
+    }
+
+    // what ReplicateEngine does with a slot it sent directly
+    void Done(bool success) {
+        ReplicaSlot *slot = &write->slots[0];
+        slot->Prepare(QuorumWrite::OnReplicaDone);
+        slot->req.SetResult(success);
+        QuorumWrite::OnReplicaDone(&slot->req);
+    }
+
+    brpc::Controller cntl;
+    pb::WriteRequest request;
+    Request req;
+    int replies;
+    QuorumWrite *write;
+};
+
+static void waitResyncStopped(ReplicaCatchup *catchup) {
+    while (true) {
+        {
+            std::lock_guard<bthread::Mutex> lock(catchup->mutex_);
+            if (!catchup->resyncing_) return;
+        }
+        usleep(1000);
+    }
+}
+
+TEST(ReplicaCatchupTest, TestMissedWriteResynced) {
+    common::ESInstance peer;
+    peer.public_ip = "127.0.0.1";
+    peer.public_port = 9000;
+    ReplicaCatchup catchup(nullptr, peer, 1 << 20, 100);
+
+    // overlapping writes sent directly, the first one fails after the
+    // second has landed
+    TestWrite first("blob.0", &catchup);
+    TestWrite second("blob.0", &catchup);
+    TestWrite other("blob.1", &catchup);
+    for (TestWrite *w : {&first, &second, &other}) {
+        EXPECT_FALSE(catchup.Enqueue(&w->write->slots[0]));
+        w->write->Unref();
+    }
+    second.Done(true);
+    first.Done(false);
+    EXPECT_EQ(second.replies, 1);
+    EXPECT_TRUE(second.req.Result());
+    EXPECT_EQ(first.replies, 1);
+    EXPECT_FALSE(first.req.Result());
+
+    {
+        // missed write isn't queued for replay over the newer one, its
+        // extent is copied once the send to blob.1 is done
+        std::lock_guard<bthread::Mutex> lock(catchup.mutex_);
+        EXPECT_TRUE(catchup.retry_.empty());
+        EXPECT_TRUE(catchup.backlog_.empty());
+        EXPECT_EQ(catchup.replaying_, nullptr);
+        EXPECT_EQ(catchup.backlog_bytes_, 0U);
+        EXPECT_EQ(catchup.dirty_.count("blob.0"), 1U);
+        EXPECT_TRUE(catchup.resyncing_);
+    }
+
+    // later writes to the dirty extent aren't sent, the copy has them
+    TestWrite later("blob.0", &catchup);
+    EXPECT_TRUE(catchup.Enqueue(&later.write->slots[0]));
+    later.write->Unref();
+    EXPECT_EQ(later.replies, 1);
+    EXPECT_FALSE(later.req.Result());
+
+    {
+        // as if copied, resync then stops on its own
+        std::lock_guard<bthread::Mutex> lock(catchup.mutex_);
+        catchup.dirty_.clear();
+    }
+    other.Done(true);
+    waitResyncStopped(&catchup);
+    EXPECT_FALSE(catchup.out_of_sync_);
+}
+
+TEST(ReplicaCatchupTest, TestOutOfSyncOnFullBacklog) {
+    common::ESInstance peer;
+    peer.public_ip = "127.0.0.1";
+    peer.public_port = 9001;
+    ReplicaCatchup catchup(nullptr, peer, 4096, 10);
+
+    // a send in flight holds replay and resync back
+    TestWrite inflight("blob.9", &catchup);
+    EXPECT_FALSE(catchup.Enqueue(&inflight.write->slots[0]));
+    inflight.write->Unref();
+    TestWrite missed("blob.0", &catchup);
+    EXPECT_FALSE(catchup.Enqueue(&missed.write->slots[0]));
+    missed.write->Unref();
+    missed.Done(false);
+
+    // lagging, writes to other extents queue for replay
+    TestWrite queued("blob.1", &catchup);
+    EXPECT_TRUE(catchup.Enqueue(&queued.write->slots[0]));
+    queued.write->Unref();
+    EXPECT_EQ(queued.replies, 0);
+    {
+        std::lock_guard<bthread::Mutex> lock(catchup.mutex_);
+        EXPECT_EQ(catchup.backlog_.size(), 1U);
+        EXPECT_EQ(catchup.backlog_bytes_, 4096U);
+        EXPECT_EQ(catchup.replaying_, nullptr);
+    }
+
+    // no room within lag_wait_ms, given up and everything queued fails
+    TestWrite full("blob.2", &catchup);
+    EXPECT_TRUE(catchup.Enqueue(&full.write->slots[0]));
+    full.write->Unref();
+    EXPECT_EQ(queued.replies, 1);
+    EXPECT_FALSE(queued.req.Result());
+    EXPECT_EQ(full.replies, 1);
+    EXPECT_FALSE(full.req.Result());
+    {
+        std::lock_guard<bthread::Mutex> lock(catchup.mutex_);
+        EXPECT_TRUE(catchup.out_of_sync_);
+        EXPECT_TRUE(catchup.backlog_.empty());
+        EXPECT_EQ(catchup.backlog_bytes_, 0U);
+        EXPECT_EQ(catchup.dirty_.size(), 3U);
+        catchup.dirty_.clear();
+    }
+
+    // rejoins once copied and nothing is in flight
+    inflight.Done(true);
+    waitResyncStopped(&catchup);
+    EXPECT_FALSE(catchup.out_of_sync_);
+}
+
+TEST(ReplicaCatchupTest, TestDiscardTakesNoRoom) {
+    common::ESInstance peer;
+    peer.public_ip = "127.0.0.1";
+    peer.public_port = 9002;
+    ReplicaCatchup catchup(nullptr, peer, 4096, 10);
+
+    TestWrite inflight("blob.9", &catchup);
+    EXPECT_FALSE(catchup.Enqueue(&inflight.write->slots[0]));
+    inflight.write->Unref();
+    TestWrite missed("blob.0", &catchup);
+    EXPECT_FALSE(catchup.Enqueue(&missed.write->slots[0]));
+    missed.write->Unref();
+    missed.Done(false);
+
+    // backlog full of data, a discard still queues behind it in order
+    TestWrite queued("blob.1", &catchup);
+    EXPECT_TRUE(catchup.Enqueue(&queued.write->slots[0]));
+    queued.write->Unref();
+    TestWrite discard("blob.1", &catchup, true);
+    EXPECT_TRUE(catchup.Enqueue(&discard.write->slots[0]));
+    discard.write->Unref();
+    EXPECT_EQ(discard.replies, 0);
+
+    std::deque<ReplicaSlot *> dropped;
+    {
+        std::lock_guard<bthread::Mutex> lock(catchup.mutex_);
+        EXPECT_FALSE(catchup.out_of_sync_);
+        ASSERT_EQ(catchup.backlog_.size(), 2U);
+        EXPECT_EQ(catchup.backlog_.back(), &discard.write->slots[0]);
+        EXPECT_EQ(catchup.backlog_bytes_, 4096U);
+        catchup.markOutOfSync(&dropped);
+        catchup.dirty_.clear();
+    }
+    for (auto slot : dropped) {
+        catchup.drop(slot);
+    }
+    inflight.Done(true);
+    waitResyncStopped(&catchup);
+    EXPECT_FALSE(catchup.out_of_sync_);
+}
+
+TEST(ReplicateFrameTest, TestLayout) {
+    // frames are copied raw on both ends of a stream, no padding
+    EXPECT_EQ(sizeof(ReplicateFrame), 32U);
+    EXPECT_EQ(offsetof(ReplicateFrame, seq), 16U);
+    EXPECT_EQ(offsetof(ReplicateFrame, offset), 24U);
+}
+
+// secondary end of a loopback stream, nacks writes at offset 4096
+class NackingReceiver : public brpc::StreamInputHandler {
+public:
+    virtual int on_received_messages(
+            brpc::StreamId id, butil::IOBuf *const messages[], size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            ReplicateFrame frame;
+            messages[i]->cutn(&frame, sizeof(frame));
+            if (frame.offset == 4096) {
+                writeFrame(id, ReplicateFrame::kFrameNack, frame.seq);
+            }
+            writeFrame(id, ReplicateFrame::kFrameAck, frame.seq);
+        }
+        return 0;
+    }
+    virtual void on_idle_timeout(brpc::StreamId id) {}
+    virtual void on_closed(brpc::StreamId id) {}
+
+private:
+    void writeFrame(brpc::StreamId id, uint8_t type, uint64_t seq) {
+        ReplicateFrame frame = {};
+        frame.magic = ReplicateFrame::kMagic;
+        frame.type = type;
+        frame.seq = seq;
+        butil::IOBuf msg;
+        msg.append(&frame, sizeof(frame));
+        brpc::StreamWrite(id, msg);
+    }
+};
+
+class LoopbackService : public pb::ExtentIOService {
+public:
+    virtual void OpenReplicateStream(
+            google::protobuf::RpcController *cntl_base,
+            const pb::OpenReplicateStreamRequest *request,
+            pb::OpenReplicateStreamResponse *response,
+            google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+        brpc::StreamOptions options;
+        options.handler = &receiver_;
+        brpc::StreamId stream_id;
+        int rc = brpc::StreamAccept(&stream_id, *cntl, &options);
+        response->mutable_status()->set_code(rc);
+    }
+
+private:
+    NackingReceiver receiver_;
+};
+
+struct StreamWrite {
+    StreamWrite(uint64_t offset, bthread::CountdownEvent *d)
+            : req(RequestType::kTypeWrite), done(d), result(false) {
+        cntl.request_attachment().append(std::string(4096, 'a'));
+        request.set_extent_id("blob.0");
+        request.set_offset(offset);
+        request.set_size(4096);
+        req.SetOperationContext(&cntl, &request, nullptr, nullptr);
+        req.SetUserCallback(OnDone);
+        req.SetUserArg(this);
+    }
+
+    static void *OnDone(void *arg) {
+        Request *req = static_cast<Request *>(arg);
+        StreamWrite *write = static_cast<StreamWrite *>(req->UserArg());
+        write->result = req->Result();
+        write->done->signal();
+        return nullptr;
+    }
+
+    brpc::Controller cntl;
+    pb::WriteRequest request;
+    Request req;
+    bthread::CountdownEvent *done;
+    bool result;
+};
+
+TEST(ReplicateStreamTest, TestAckAndNack) {
+    LoopbackService service;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("127.0.0.1:0", nullptr));
+    common::ConnectionPtr conn(new common::Connection());
+    conn->channel.reset(new brpc::Channel());
+    ASSERT_EQ(0, conn->channel->Init(server.listen_address(), nullptr));
+
+    {
+        ReplicateStream stream("127.0.0.1:1", "loopback", 0);
+        bthread::CountdownEvent done(3);
+        StreamWrite acked(0, &done);
+        StreamWrite nacked(4096, &done);
+        StreamWrite acked_after(8192, &done);
+        // stream is opened by the first write
+        ASSERT_TRUE(stream.Send(&acked.req, conn).ok());
+        ASSERT_TRUE(stream.Send(&nacked.req, conn).ok());
+        ASSERT_TRUE(stream.Send(&acked_after.req, conn).ok());
+        done.wait();
+        EXPECT_TRUE(acked.result);
+        EXPECT_FALSE(nacked.result);
+        EXPECT_TRUE(acked_after.result);
+        EXPECT_EQ(3U, stream.next_seq_ - 1);
+        EXPECT_TRUE(stream.pending_.empty());
+    }
+    server.Stop(0);
+    server.Join();
+}
+
+}  // namespace
+}  // namespace extentserver
+}  // namespace cyprestore
@@ -0,0 +1,248 @@
+#include "extentserver/write_log.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cyprestore {
+namespace extentserver {
+namespace {
+
+const uint64_t kBlock = WriteLog::kLogBlockSize;
+
+// memory backed device, io completes inline
+class MemDevice : public BlockDevice {
+public:
+    explicit MemDevice(uint64_t capacity)
+            : BlockDevice("mem", BlockDeviceType::kTypeUnknown),
+              data_(capacity, '\0') {
+        capacity_ = capacity;
+        block_size_ = 512;
+    }
+
+    virtual Status InitEnv() { return Status(); }
+    virtual Status CloseEnv() { return Status(); }
+    virtual Status Open() { return Status(); }
+    virtual Status Close() { return Status(); }
+    virtual Status PeriodDeviceAdmin() { return Status(); }
+
+    virtual Status ProcessRequest(Request *req) {
+        if (req->GetRequestType() == RequestType::kTypeMetaRead) {
+            memcpy(req->MetaBuf(), &data_[req->PhysicalOffset()],
+                   req->Size());
+        } else {
+            memcpy(&data_[req->PhysicalOffset()], req->MetaBuf(),
+                   req->Size());
+        }
+        req->UserCallback()(req);
+        return Status();
+    }
+
+    virtual void *AllocIOMem(size_t size) { return malloc(size); }
+    virtual void FreeIOMem(void *p) { free(p); }
+
+    std::string data_;
+};
+
+struct AckCounter {
+    int ok = 0;
+    int failed = 0;
+};
+
+void *countAck(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    AckCounter *counter = static_cast<AckCounter *>(req->UserArg());
+    if (req->Result()) {
+        ++counter->ok;
+    } else {
+        ++counter->failed;
+    }
+    delete req;
+    return nullptr;
+}
+
+class WriteLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // home area first, log region after it
+        bdev_.reset(new MemDevice(kHomeSize + kRegionSize));
+    }
+
+    WriteLog *newLog() {
+        return new WriteLog(bdev_, kHomeSize, kRegionSize, 64 * kBlock, 1);
+    }
+
+    Status append(
+            WriteLog *log, const std::string &extent_id, uint64_t offset,
+            uint64_t home, const std::string &data) {
+        Request *req = new Request(RequestType::kTypeWrite);
+        req->SetUserCallback(countAck);
+        req->SetUserArg(&acks_);
+        butil::IOBuf buf;
+        buf.append(data);
+        Status s = log->Append(req, extent_id, offset, home, buf);
+        if (!s.ok()) {
+            delete req;
+        }
+        return s;
+    }
+
+    std::string read(
+            WriteLog *log, const std::string &extent_id, uint64_t offset,
+            uint64_t size, uint64_t *hit) {
+        std::vector<LogRun> runs;
+        *hit = log->Snapshot(extent_id, offset, size, &runs);
+        std::string data;
+        for (const auto &run : runs) {
+            data += run.data;
+        }
+        return data;
+    }
+
+    const uint64_t kHomeSize = 16 << 20;
+    const uint64_t kRegionSize = WriteLog::kMinRegionSize;
+    std::shared_ptr<MemDevice> bdev_;
+    AckCounter acks_;
+};
+
+TEST_F(WriteLogTest, TestAppendAndSnapshot) {
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    ASSERT_TRUE(append(log.get(), "blob.0", 0, 0, std::string(2 * kBlock, 'a'))
+                        .ok());
+    ASSERT_TRUE(append(log.get(), "blob.0", kBlock, kBlock,
+                       std::string(kBlock, 'b'))
+                        .ok());
+    EXPECT_EQ(acks_.ok, 2);
+
+    uint64_t hit = 0;
+    std::string data = read(log.get(), "blob.0", 0, 4 * kBlock, &hit);
+    EXPECT_EQ(hit, 2 * kBlock);
+    EXPECT_EQ(data, std::string(kBlock, 'a') + std::string(kBlock, 'b'));
+    read(log.get(), "blob.1", 0, 4 * kBlock, &hit);
+    EXPECT_EQ(hit, 0U);
+
+    // unaligned append is rejected
+    EXPECT_FALSE(append(log.get(), "blob.0", 512, 0, std::string(kBlock, 'c'))
+                         .ok());
+    ASSERT_TRUE(log->Close().ok());
+}
+
+TEST_F(WriteLogTest, TestFlushHome) {
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(append(log.get(), "blob.0", i * kBlock, i * kBlock,
+                           std::string(kBlock, 'a' + i))
+                            .ok());
+    }
+    ASSERT_TRUE(log->Close().ok());
+    EXPECT_EQ(log->DirtyBytes(), 0U);
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(bdev_->data_.substr(i * kBlock, kBlock),
+                  std::string(kBlock, 'a' + i));
+    }
+}
+
+TEST_F(WriteLogTest, TestReplay) {
+    {
+        std::unique_ptr<WriteLog> log(newLog());
+        ASSERT_TRUE(log->Open().ok());
+        ASSERT_TRUE(append(log.get(), "blob.0", 0, 0, std::string(kBlock, 'a'))
+                            .ok());
+        ASSERT_TRUE(append(log.get(), "blob.0", 0, 0, std::string(kBlock, 'b'))
+                            .ok());
+        ASSERT_TRUE(append(log.get(), "blob.1", kBlock, 8 * kBlock,
+                           std::string(kBlock, 'c'))
+                            .ok());
+        // crash without close
+    }
+
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    uint64_t hit = 0;
+    // may be flushed and dropped before crash, then it is home
+    std::string data = read(log.get(), "blob.0", 0, kBlock, &hit);
+    if (hit > 0) {
+        EXPECT_EQ(data, std::string(kBlock, 'b'));
+    }
+    ASSERT_TRUE(log->Close().ok());
+    EXPECT_EQ(bdev_->data_.substr(0, kBlock), std::string(kBlock, 'b'));
+    EXPECT_EQ(bdev_->data_.substr(8 * kBlock, kBlock),
+              std::string(kBlock, 'c'));
+}
+
+TEST_F(WriteLogTest, TestWrapAround) {
+    // ring is about 4M, 16M of appends wrap it several times
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    const int kNumBlocks = 256;
+    for (int round = 0; round < 16; ++round) {
+        for (int i = 0; i < kNumBlocks; i += 4) {
+            std::string data(4 * kBlock, 'a' + (round + i) % 26);
+            ASSERT_TRUE(append(log.get(), "blob.0", i * kBlock, i * kBlock,
+                               data)
+                                .ok());
+        }
+    }
+    ASSERT_TRUE(log->Close().ok());
+    EXPECT_EQ(acks_.ok, 16 * kNumBlocks / 4);
+    for (int i = 0; i < kNumBlocks; i += 4) {
+        EXPECT_EQ(bdev_->data_.substr(i * kBlock, 4 * kBlock),
+                  std::string(4 * kBlock, 'a' + (15 + i) % 26));
+    }
+}
+
+TEST_F(WriteLogTest, TestTornTail) {
+    const uint64_t ring_offset = kHomeSize + 2 * kBlock;
+    {
+        // long interval, nothing flushed before crash
+        WriteLog log(bdev_, kHomeSize, kRegionSize, 64 * kBlock, 100000);
+        ASSERT_TRUE(log.Open().ok());
+        ASSERT_TRUE(append(&log, "blob.0", 0, 0, std::string(kBlock, 'a'))
+                            .ok());
+        ASSERT_TRUE(append(&log, "blob.0", kBlock, kBlock,
+                           std::string(kBlock, 'b'))
+                            .ok());
+    }
+    // second record's data is torn
+    bdev_->data_[ring_offset + 3 * kBlock] ^= 0xff;
+
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    uint64_t hit = 0;
+    EXPECT_EQ(read(log.get(), "blob.0", 0, kBlock, &hit),
+              std::string(kBlock, 'a'));
+    read(log.get(), "blob.0", kBlock, kBlock, &hit);
+    EXPECT_EQ(hit, 0U);
+
+    // new records are appended after the torn one is cut
+    ASSERT_TRUE(append(log.get(), "blob.0", 2 * kBlock, 2 * kBlock,
+                       std::string(kBlock, 'c'))
+                        .ok());
+    ASSERT_TRUE(log->Close().ok());
+    EXPECT_EQ(bdev_->data_.substr(0, kBlock), std::string(kBlock, 'a'));
+    EXPECT_EQ(bdev_->data_.substr(2 * kBlock, kBlock),
+              std::string(kBlock, 'c'));
+}
+
+TEST_F(WriteLogTest, TestWaitClean) {
+    std::unique_ptr<WriteLog> log(newLog());
+    ASSERT_TRUE(log->Open().ok());
+    ASSERT_TRUE(append(log.get(), "blob.0", 0, 0, std::string(kBlock, 'a'))
+                        .ok());
+    log->WaitClean("blob.0", 0, kBlock);
+
+    uint64_t hit = 0;
+    read(log.get(), "blob.0", 0, kBlock, &hit);
+    EXPECT_EQ(hit, 0U);
+    EXPECT_EQ(bdev_->data_.substr(0, kBlock), std::string(kBlock, 'a'));
+    ASSERT_TRUE(log->Close().ok());
+}
+
+}  // namespace
+}  // namespace extentserver
+}  // namespace cyprestore
@@ -162,11 +162,20 @@ inline void* cp(void *__restrict dest, const void *__restrict src, size_t n) {
 // Function pointers to allocate or deallocate memory for a IOBuf::Block
 void* (*blockmem_allocate)(size_t) = ::malloc;
 void  (*blockmem_deallocate)(void*) = ::free;
+// Allocate data of blocks that IOPortal reads into, NULL to share TLS
+// blocks with appending operations. The data is a whole allocation of its
+// own, header of the block lives on heap, so the data keeps whatever
+// alignment portal_blockmem_allocate gives. Freed by
+// portal_blockmem_deallocate.
+void* (*portal_blockmem_allocate)(size_t) = NULL;
+void  (*portal_blockmem_deallocate)(void*) = NULL;
 
 // Use default function pointers
 void reset_blockmem_allocate_and_deallocate() {
     blockmem_allocate = ::malloc;
     blockmem_deallocate = ::free;
+    portal_blockmem_allocate = NULL;
+    portal_blockmem_deallocate = NULL;
 }
 
 butil::static_atomic<size_t> g_nblock = BUTIL_STATIC_ATOMIC_INIT(0);
@@ -188,6 +197,8 @@ size_t IOBuf::new_bigview_count() {
 }
 
 const uint16_t IOBUF_BLOCK_FLAGS_USER_DATA = 0x1;
+// data comes from portal_blockmem_allocate, header from malloc
+const uint16_t IOBUF_BLOCK_FLAGS_PORTAL_DATA = 0x2;
 typedef void (*UserDataDeleter)(void*);
 
 struct UserDataExtension {
@@ -264,6 +275,13 @@ struct IOBuf::Block {
                 get_user_data_extension()->deleter(data);
                 this->~Block();
                 free(this);
+            } else if (flags & IOBUF_BLOCK_FLAGS_PORTAL_DATA) {
+                iobuf::g_nblock.fetch_sub(1, butil::memory_order_relaxed);
+                iobuf::g_blockmem.fetch_sub(cap + sizeof(Block),
+                                            butil::memory_order_relaxed);
+                iobuf::portal_blockmem_deallocate(data);
+                this->~Block();
+                free(this);
             }
         }
     }
@@ -464,6 +482,26 @@ IOBuf::Block* acquire_tls_block() {
     return b;
 }
 
+// Get a block for IOPortal to read into.
+inline IOBuf::Block* acquire_portal_block() {
+    if (portal_blockmem_allocate == NULL) {
+        return acquire_tls_block();
+    }
+    const size_t block_size = IOBuf::DEFAULT_BLOCK_SIZE;
+    char* data = (char*)portal_blockmem_allocate(block_size);
+    if (data == NULL) {
+        return acquire_tls_block();
+    }
+    void* mem = malloc(sizeof(IOBuf::Block));
+    if (mem == NULL) {
+        portal_blockmem_deallocate(data);
+        return NULL;
+    }
+    IOBuf::Block* b = new (mem) IOBuf::Block(data, block_size);
+    b->flags = IOBUF_BLOCK_FLAGS_PORTAL_DATA;
+    return b;
+}
+
 inline IOBuf::BlockRef* acquire_blockref_array(size_t cap) {
     iobuf::g_newbigview.fetch_add(1, butil::memory_order_relaxed);
     return new IOBuf::BlockRef[cap];
@@ -1554,7 +1592,7 @@ ssize_t IOPortal::pappend_from_file_descriptor(
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            p = iobuf::acquire_portal_block();
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1615,7 +1653,7 @@ ssize_t IOPortal::append_from_reader(IReader* reader, size_t max_count) {
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            p = iobuf::acquire_portal_block();
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1667,7 +1705,7 @@ ssize_t IOPortal::append_from_SSL_channel(
     size_t nr = 0;
     do {
         if (!_block) {
-            _block = iobuf::acquire_tls_block();
+            _block = iobuf::acquire_portal_block();
             if (BAIDU_UNLIKELY(!_block)) {
                 errno = ENOMEM;
                 *ssl_error = SSL_ERROR_SYSCALL;
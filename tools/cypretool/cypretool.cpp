@@ -99,6 +99,7 @@ DEFINE_string(command, "", "command name");
 /* bench */
 DEFINE_int32(thread_num, 0, "thread num");
 DEFINE_int32(blob_num, 0, "blob num");
+DEFINE_int32(batch_size, 256, "extents in one batch router query");
 
 using namespace cyprestore::tools;
 
@@ -164,6 +165,7 @@ int setup_options(Options &options) {
     /* bench */
     options.thread_num = FLAGS_thread_num;
     options.blob_num = FLAGS_blob_num;
+    options.batch_size = FLAGS_batch_size;
 
     return 0;
 }
@@ -136,6 +136,7 @@ struct Options {
     /* bench */
     int32_t thread_num;
     int32_t blob_num;
+    int32_t batch_size;
 };
 
 Object getObject(const std::string &obj);
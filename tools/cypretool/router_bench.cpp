@@ -6,6 +6,7 @@
 
 #include "router_bench.h"
 
+#include <algorithm>
 #include <iostream>
 #include <thread>
 
@@ -40,9 +41,17 @@ int RouterBench::BenchQuery() {
         std::cerr << "Create blob failed." << std::endl;
     }
 
-    // first query in store
+    // first query in store, then in cache, then in batches
+    benchQuery(&RouterBench::Query, "Query");
+    benchQuery(&RouterBench::Query, "Query");
+    benchQuery(&RouterBench::QueryBatch, "Batch query");
+    return 0;
+}
+
+void RouterBench::benchQuery(
+        void (RouterBench::*query)(std::vector<std::string>),
+        const std::string &what) {
     int blob_each_thread = options_.blob_num / options_.thread_num;
-    int begin = 0;
     std::vector<std::thread> threads;
     time_t start = getTimeStamp();
     for (int i = 0; i < options_.thread_num; i++) {
@@ -51,39 +60,15 @@ int RouterBench::BenchQuery() {
              j++) {
             tmp.push_back(blob_ids_[j]);
         }
-        threads.push_back(std::thread(&RouterBench::Query, this, tmp));
-        begin += blob_each_thread;
+        threads.push_back(std::thread(query, this, tmp));
     }
 
     for (auto &th : threads) {
         th.join();
     }
     time_t end = getTimeStamp();
-    int total_blob = options_.blob_num;
-    std::cout << "Query " << total_blob << " blob cost " << end - start << " us"
-              << std::endl;
-
-    // second query in cache
-    threads.clear();
-    start = getTimeStamp();
-    for (int i = 0; i < options_.thread_num; i++) {
-        std::vector<std::string> tmp;
-        for (int j = i * blob_each_thread; j < (i + 1) * blob_each_thread;
-             j++) {
-            tmp.push_back(blob_ids_[j]);
-        }
-        threads.push_back(std::thread(&RouterBench::Query, this, tmp));
-        begin += blob_each_thread;
-    }
-
-    for (auto &th : threads) {
-        th.join();
-    }
-    end = getTimeStamp();
-    total_blob = options_.blob_num;
-    std::cout << "Query " << total_blob << " blob cost " << end - start << " us"
-              << std::endl;
-    return 0;
+    std::cout << what << " " << options_.blob_num << " blob cost "
+              << end - start << " us" << std::endl;
 }
 
 void RouterBench::Query(std::vector<std::string> blob_ids) {
@@ -118,6 +103,43 @@ void RouterBench::Query(std::vector<std::string> blob_ids) {
               << " us" << std::endl;
 }
 
+void RouterBench::QueryBatch(std::vector<std::string> blob_ids) {
+    int num_each_blob = blob_size / (1024 * 1024 * 1024);
+    int batch = options_.batch_size > 0 ? options_.batch_size : 1;
+    int total_cost = 0;
+    int num_calls = 0;
+    for (auto &blob : blob_ids) {
+        for (int i = 1; i <= num_each_blob; i += batch) {
+            brpc::Controller cntl;
+            extentmanager::pb::QueryRoutersRequest request;
+            extentmanager::pb::QueryRoutersResponse response;
+
+            request.set_blob_id(blob);
+            request.set_begin_index(i);
+            request.set_end_index(std::min(i + batch - 1, num_each_blob));
+            time_t begin = getTimeStamp();
+            router_stub_->QueryRouters(&cntl, &request, &response, NULL);
+            time_t end = getTimeStamp();
+            if (cntl.Failed()) {
+                std::cerr << "Send request failed, err:" << cntl.ErrorText()
+                          << std::endl;
+                return;
+            } else if (response.status().code() != 0) {
+                std::cerr << "Failed to query routers, err: "
+                          << response.status().message() << std::endl;
+                return;
+            }
+            total_cost += end - begin;
+            ++num_calls;
+        }
+    }
+    int total_extent = blob_ids.size() * num_each_blob;
+    std::cout << "Batch query " << total_extent << " extent in " << num_calls
+              << " calls, each extent cost " << total_cost / total_extent
+              << " us, each call cost " << total_cost / num_calls << " us"
+              << std::endl;
+}
+
 int RouterBench::CreateBlob(int num) {
     time_t begin = getTimeStamp();
     for (int i = 0; i < num; i++) {
@@ -31,6 +31,10 @@ public:
 private:
     int init();
     void Query(std::vector<std::string> blob_ids);
+    void QueryBatch(std::vector<std::string> blob_ids);
+    void benchQuery(
+            void (RouterBench::*query)(std::vector<std::string>),
+            const std::string &what);
     int CreateBlob(int num);
     int PreCreateBlob();
     std::time_t getTimeStamp();
@@ -6,6 +6,7 @@
 
 #include "scrub.h"
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 
@@ -19,17 +20,26 @@ int Scrub::Verify() {
     }
 
     uint32_t count = blob_size_ / extent_size_;
-    for (uint32_t i = 1; i <= count; ++i) {
-        // query router
-        std::string extent_id = options_.blob_id + "." + std::to_string(i);
-        common::pb::ExtentRouter router;
-        if (queryRouter(extent_id, &router) != 0) {
+    for (uint32_t begin = 1; begin <= count; begin += router_batch_) {
+        // query routers
+        uint32_t end = std::min(begin + router_batch_ - 1, count);
+        std::vector<common::pb::ExtentRouter> routers;
+        if (queryRouters(begin, end, &routers) != 0) {
             return -1;
         }
-        if (doVerify(extent_id, router) != 0) {
+        if (routers.size() != end - begin + 1) {
+            std::cerr << "Some extent router of [" << begin << ", " << end
+                      << "] not found" << std::endl;
             return -1;
         }
-        std::cout << "Scrub extent: " << extent_id << " success." << std::endl;
+        for (auto &router : routers) {
+            const std::string &extent_id = router.extent_id();
+            if (doVerify(extent_id, router) != 0) {
+                return -1;
+            }
+            std::cout << "Scrub extent: " << extent_id << " success."
+                      << std::endl;
+        }
     }
     return 0;
 }
@@ -99,23 +109,26 @@ int Scrub::doVerify(
     return 0;
 }
 
-int Scrub::queryRouter(
-        const std::string &extent_id, common::pb::ExtentRouter *router) {
+int Scrub::queryRouters(
+        uint32_t begin, uint32_t end,
+        std::vector<common::pb::ExtentRouter> *routers) {
     brpc::Controller cntl;
-    extentmanager::pb::QueryRouterRequest request;
-    extentmanager::pb::QueryRouterResponse response;
-    request.set_extent_id(extent_id);
-    router_stub_->QueryRouter(&cntl, &request, &response, NULL);
+    extentmanager::pb::QueryRoutersRequest request;
+    extentmanager::pb::QueryRoutersResponse response;
+    request.set_blob_id(options_.blob_id);
+    request.set_begin_index(begin);
+    request.set_end_index(end);
+    router_stub_->QueryRouters(&cntl, &request, &response, NULL);
     if (cntl.Failed()) {
-        std::cerr << "Send query blob request failed, err: " << cntl.ErrorText()
-                  << std::endl;
+        std::cerr << "Send query routers request failed, err: "
+                  << cntl.ErrorText() << std::endl;
         return -1;
     } else if (response.status().code() != 0) {
-        std::cerr << "Failed to query blob, err: "
+        std::cerr << "Failed to query routers, err: "
                   << response.status().message() << std::endl;
         return -1;
     }
-    *router = response.router();
+    routers->assign(response.routers().begin(), response.routers().end());
     return 0;
 }
 
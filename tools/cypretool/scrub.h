@@ -40,11 +40,14 @@ private:
     int doVerify(
             const std::string &extent_id,
             const common::pb::ExtentRouter &router);
-    int
-    queryRouter(const std::string &extent_id, common::pb::ExtentRouter *router);
+    // routers of extents [begin, end] of the blob
+    int queryRouters(
+            uint32_t begin, uint32_t end,
+            std::vector<common::pb::ExtentRouter> *routers);
     int queryBlob();
 
     const uint64_t block_size_ = 4 << 10;  // 4k
+    const uint32_t router_batch_ = 256;     // extents in a router query
     uint64_t blob_size_;
     uint64_t extent_size_;
     Options options_;
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#include "bitmap_bench.h"
+
+#include <butil/time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "extentserver/bitmap_allocator.h"
+
+namespace cyprestore {
+namespace tools {
+
+namespace {
+
+struct FillResult {
+    FillResult() : count(0), total_us(0), max_us(0) {}
+    uint64_t count;
+    int64_t total_us;
+    int64_t max_us;
+};
+
+void fill(
+        extentserver::BitmapAllocator *alloc, uint64_t extent_size,
+        std::vector<extentserver::AUnit> *aunits, FillResult *result) {
+    butil::Timer timer;
+    while (true) {
+        extentserver::AUnit aunit;
+        timer.start();
+        common::Status s = alloc->Allocate(extent_size, &aunit);
+        timer.stop();
+        if (!s.ok()) {
+            break;
+        }
+        aunits->push_back(aunit);
+        result->count++;
+        result->total_us += timer.u_elapsed();
+        result->max_us = std::max(result->max_us, timer.u_elapsed());
+    }
+}
+
+void report(const std::string &name, const FillResult &result) {
+    double avg_us = result.count == 0
+                            ? 0
+                            : result.total_us / static_cast<double>(result.count);
+    std::cout << name << ": allocate " << result.count << " extents"
+              << ", cost " << result.total_us << " us"
+              << ", avg " << avg_us << " us, max " << result.max_us << " us"
+              << std::endl;
+}
+
+}  // namespace
+
+int BitmapBench::Run() {
+    extentserver::BitmapAllocator alloc;
+    common::Status s = alloc.Init(options_.block_size, options_.capacity);
+    if (!s.ok()) {
+        std::cerr << "Couldn't init bitmap allocator, " << s.ToString()
+                  << std::endl;
+        return -1;
+    }
+    std::cout << "Capacity " << options_.capacity << ", block size "
+              << options_.block_size << ", extent size "
+              << options_.extent_size << ", blocks " << alloc.NumBlocks()
+              << ", chunks " << alloc.NumChunks() << std::endl;
+
+    std::vector<extentserver::AUnit> aunits;
+    FillResult first;
+    fill(&alloc, options_.extent_size, &aunits, &first);
+    report("Fill empty device", first);
+
+    // fragment: free a random half, fill again
+    std::mt19937_64 rng(0);
+    std::shuffle(aunits.begin(), aunits.end(), rng);
+    size_t half = aunits.size() / 2;
+    butil::Timer timer;
+    timer.start();
+    for (size_t i = 0; i < half; ++i) {
+        alloc.Free(aunits[i].offset, aunits[i].size);
+    }
+    timer.stop();
+    std::cout << "Free " << half << " extents cost " << timer.u_elapsed()
+              << " us" << std::endl;
+    aunits.erase(aunits.begin(), aunits.begin() + half);
+
+    FillResult second;
+    fill(&alloc, options_.extent_size, &aunits, &second);
+    report("Refill fragmented device", second);
+
+    if (alloc.FreeBlocks() * options_.block_size >= options_.extent_size) {
+        std::cerr << "Device not full after refill, free blocks "
+                  << alloc.FreeBlocks() << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+}  // namespace tools
+}  // namespace cyprestore
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#pragma once
+
+#include "options.h"
+
+namespace cyprestore {
+namespace tools {
+
+// fill a simulated device with extents through BitmapAllocator, then
+// free a random half and fill it again
+class BitmapBench {
+public:
+    explicit BitmapBench(const Options &options) : options_(options) {}
+
+    int Run();
+
+private:
+    Options options_;
+};
+
+}  // namespace tools
+}  // namespace cyprestore
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#include "extent_index_bench.h"
+
+#include <butil/time.h>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "common/extent_id_generator.h"
+#include "extentserver/extent_index.h"
+
+namespace cyprestore {
+namespace tools {
+
+namespace {
+
+struct Location {
+    Location(uint64_t offset_, uint64_t size_) : offset(offset_), size(size_) {}
+    uint64_t offset;
+    uint64_t size;
+};
+
+// the way ExtentLocationMgr looked extents up before ExtentIndex
+class LockedLocationMap {
+public:
+    void Insert(const std::string &extent_id, uint64_t offset, uint64_t size) {
+        boost::unique_lock<boost::shared_mutex> lock(lock_);
+        map_.insert(std::make_pair(
+                extent_id, std::make_shared<Location>(offset, size)));
+    }
+
+    bool Lookup(const std::string &extent_id, uint64_t *offset) {
+        boost::shared_lock<boost::shared_mutex> lock(lock_);
+        auto it = map_.find(extent_id);
+        if (it == map_.end()) {
+            return false;
+        }
+        *offset = it->second->offset;
+        return true;
+    }
+
+private:
+    std::unordered_map<std::string, std::shared_ptr<Location>> map_;
+    boost::shared_mutex lock_;
+};
+
+const uint64_t kExtentSize = 1ULL << 30;
+const uint64_t kExtentsPerBlob = 1024;
+
+}  // namespace
+
+int ExtentIndexBench::Run() {
+    if (options_.num_threads <= 0 || options_.num_extents == 0) {
+        std::cerr << "Invalid num_threads or num_extents" << std::endl;
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < options_.num_extents; ++i) {
+        std::string blob_id = "blob-" + std::to_string(i / kExtentsPerBlob);
+        extent_ids_.push_back(common::ExtentIDGenerator::GenerateExtentID(
+                blob_id, i % kExtentsPerBlob));
+    }
+
+    std::cout << "Lookup " << options_.num_lookups << " extents each thread"
+              << ", threads: " << options_.num_threads
+              << ", extents: " << options_.num_extents << std::endl;
+    benchMap();
+    benchIndex();
+    return 0;
+}
+
+void ExtentIndexBench::benchMap() {
+    LockedLocationMap map;
+    for (uint64_t i = 0; i < extent_ids_.size(); ++i) {
+        map.Insert(extent_ids_[i], i * kExtentSize, kExtentSize);
+    }
+
+    butil::Timer timer;
+    timer.start();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options_.num_threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            uint64_t offset = 0, sum = 0;
+            for (uint64_t i = 0; i < options_.num_lookups; ++i) {
+                const std::string &id =
+                        extent_ids_[(i * 7919 + t) % extent_ids_.size()];
+                if (map.Lookup(id, &offset)) sum += offset;
+            }
+            if (sum == 1) std::cout << sum;
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    timer.stop();
+    report("shared_mutex+unordered_map", timer.u_elapsed());
+}
+
+void ExtentIndexBench::benchIndex() {
+    extentserver::ExtentIndex index;
+    for (uint64_t i = 0; i < extent_ids_.size(); ++i) {
+        index.Insert(
+                extentserver::ExtentKey::FromExtentID(extent_ids_[i]),
+                i * kExtentSize, kExtentSize);
+    }
+
+    // with key parsed from extent id, as QueryLocation does
+    butil::Timer timer;
+    timer.start();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options_.num_threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            uint64_t offset = 0, size = 0, sum = 0;
+            for (uint64_t i = 0; i < options_.num_lookups; ++i) {
+                const std::string &id =
+                        extent_ids_[(i * 7919 + t) % extent_ids_.size()];
+                if (index.Lookup(
+                            extentserver::ExtentKey::FromExtentID(id), &offset,
+                            &size)) {
+                    sum += offset;
+                }
+            }
+            if (sum == 1) std::cout << sum;
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    timer.stop();
+    report("extent_index", timer.u_elapsed());
+
+    // numeric key only
+    std::vector<extentserver::ExtentKey> keys;
+    for (auto &id : extent_ids_) {
+        keys.push_back(extentserver::ExtentKey::FromExtentID(id));
+    }
+    threads.clear();
+    timer.start();
+    for (int t = 0; t < options_.num_threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            uint64_t offset = 0, size = 0, sum = 0;
+            for (uint64_t i = 0; i < options_.num_lookups; ++i) {
+                if (index.Lookup(
+                            keys[(i * 7919 + t) % keys.size()], &offset,
+                            &size)) {
+                    sum += offset;
+                }
+            }
+            if (sum == 1) std::cout << sum;
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    timer.stop();
+    report("extent_index(numeric key)", timer.u_elapsed());
+}
+
+void ExtentIndexBench::report(const std::string &name, uint64_t cost_us) {
+    uint64_t total = options_.num_lookups * options_.num_threads;
+    double ns_per_op = cost_us * 1000.0 / options_.num_lookups;
+    double mops = cost_us == 0 ? 0 : total / static_cast<double>(cost_us);
+    std::cout << name << ": cost " << cost_us << " us"
+              << ", " << ns_per_op << " ns/lookup each thread"
+              << ", " << mops << " Mops" << std::endl;
+}
+
+}  // namespace tools
+}  // namespace cyprestore
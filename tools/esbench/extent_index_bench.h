@@ -0,0 +1,35 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+namespace cyprestore {
+namespace tools {
+
+// compare lookup cost of extent location index with the string keyed map
+// guarded by shared_mutex it replaces
+class ExtentIndexBench {
+public:
+    explicit ExtentIndexBench(const Options &options) : options_(options) {}
+
+    int Run();
+
+private:
+    void benchMap();
+    void benchIndex();
+    void report(const std::string &name, uint64_t cost_us);
+
+    Options options_;
+    std::vector<std::string> extent_ids_;
+};
+
+}  // namespace tools
+}  // namespace cyprestore
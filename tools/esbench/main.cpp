@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#include <gflags/gflags.h>
+
+#include <iostream>
+
+#include "bitmap_bench.h"
+#include "extent_index_bench.h"
+#include "replicate_bench.h"
+
+DEFINE_string(
+        bench, "", "benchmark to run: [extent_index|bitmap|replicate]");
+DEFINE_int32(num_threads, 4, "number of lookup threads");
+DEFINE_uint64(num_extents, 1 << 16, "number of extents indexed");
+DEFINE_uint64(num_lookups, 10000000, "number of lookups each thread");
+DEFINE_uint64(capacity, 16ULL << 40, "simulated device capacity, bytes");
+DEFINE_uint64(block_size, 1 << 20, "bitmap allocator block size, bytes");
+DEFINE_uint64(extent_size, 1 << 30, "extent size, bytes");
+DEFINE_string(peers, "", "secondaries served by mock_es, ip:port,ip:port");
+DEFINE_uint64(num_writes, 100000, "number of replicated writes each thread");
+DEFINE_uint64(io_size, 4096, "replicated write size, bytes");
+DEFINE_int32(iodepth, 32, "writes in flight each thread");
+
+static void Usage() {
+    std::cout << "Usage: esbench"
+              << "\n  -bench=[extent_index|bitmap|replicate]"
+              << "\n  -num_threads=[4]"
+              << "\n  -num_extents=[65536]"
+              << "\n  -num_lookups=[10000000]"
+              << "\n  -capacity=[17592186044416]"
+              << "\n  -block_size=[1048576]"
+              << "\n  -extent_size=[1073741824]"
+              << "\n  -peers=[ip:port,ip:port]"
+              << "\n  -num_writes=[100000]"
+              << "\n  -io_size=[4096]"
+              << "\n  -iodepth=[32]" << std::endl;
+}
+
+using namespace cyprestore::tools;
+
+int main(int argc, char **argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    Options options;
+    options.num_threads = FLAGS_num_threads;
+    options.num_extents = FLAGS_num_extents;
+    options.num_lookups = FLAGS_num_lookups;
+    options.capacity = FLAGS_capacity;
+    options.block_size = FLAGS_block_size;
+    options.extent_size = FLAGS_extent_size;
+    options.peers = FLAGS_peers;
+    options.num_writes = FLAGS_num_writes;
+    options.io_size = FLAGS_io_size;
+    options.iodepth = FLAGS_iodepth;
+
+    if (FLAGS_bench == "extent_index") {
+        ExtentIndexBench bench(options);
+        return bench.Run();
+    }
+    if (FLAGS_bench == "bitmap") {
+        BitmapBench bench(options);
+        return bench.Run();
+    }
+    if (FLAGS_bench == "replicate") {
+        ReplicateBench bench(options);
+        return bench.Run();
+    }
+
+    Usage();
+    return -1;
+}
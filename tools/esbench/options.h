@@ -0,0 +1,30 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace cyprestore {
+namespace tools {
+
+struct Options {
+    int num_threads;
+    uint64_t num_extents;   // extents indexed in total
+    uint64_t num_lookups;   // lookups of each thread
+    uint64_t capacity;      // simulated device capacity, bytes
+    uint64_t block_size;    // allocator block size, bytes
+    uint64_t extent_size;   // bytes
+    std::string peers;      // secondaries, ip:port,ip:port
+    uint64_t num_writes;    // replicated writes of each thread
+    uint64_t io_size;       // bytes
+    int iodepth;            // writes in flight of each thread
+};
+
+}  // namespace tools
+}  // namespace cyprestore
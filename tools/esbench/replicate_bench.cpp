@@ -0,0 +1,268 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#include "replicate_bench.h"
+
+#include <brpc/callback.h>
+#include <brpc/controller.h>
+#include <bthread/countdown_event.h>
+#include <butil/time.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "common/connection_pool.h"
+#include "extentserver/pb/extent_io.pb.h"
+#include "extentserver/replicate_engine.h"
+#include "extentserver/request_context.h"
+
+namespace {
+
+std::atomic<uint64_t> g_num_allocs(0);
+
+}  // namespace
+
+// counts heap allocations of the whole process, brpc's included
+void *operator new(size_t size) {
+    g_num_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+namespace cyprestore {
+namespace tools {
+
+using extentserver::Request;
+using extentserver::RequestType;
+
+namespace {
+
+// the way ReplicateEngine sent a replicate before pooled contexts
+class LegacyReplicator {
+public:
+    void Send(Request *req) {
+        auto extent_router = req->GetExtentRouter();
+        req->SetRefCount(1 + extent_router->secondaries.size());
+        for (size_t i = 0; i < extent_router->secondaries.size(); ++i) {
+            auto conn = conn_pool_.GetConnection(
+                    extent_router->secondaries[i].public_ip,
+                    extent_router->secondaries[i].public_port);
+            if (!conn) {
+                req->SetResult(false);
+                req->UserCallback()(req);
+                continue;
+            }
+            sendOne(req, conn);
+        }
+    }
+
+private:
+    static void handleResponse(
+            brpc::Controller *cntl, extentserver::pb::ReplicateResponse *resp,
+            void *arg) {
+        std::unique_ptr<brpc::Controller> cntl_guard(cntl);
+        std::unique_ptr<extentserver::pb::ReplicateResponse> resp_guard(resp);
+        Request *req = static_cast<Request *>(arg);
+        req->SetResult(!cntl->Failed() && resp->status().code() == 0);
+        req->UserCallback()(req);
+    }
+
+    void sendOne(Request *req, common::ConnectionPtr conn) {
+        brpc::Controller *cntl = new brpc::Controller();
+        extentserver::pb::ReplicateResponse *resp =
+                new extentserver::pb::ReplicateResponse();
+        extentserver::pb::ExtentIOService_Stub stub(conn->channel.get());
+        extentserver::pb::ReplicateRequest repl_req;
+        repl_req.set_extent_id(req->ExtentID());
+        repl_req.set_offset(req->Offset());
+        repl_req.set_size(req->Size());
+        cntl->request_attachment() =
+                req->GetOperationContext().cntl->request_attachment();
+        google::protobuf::Closure *done = brpc::NewCallback<
+                brpc::Controller *, extentserver::pb::ReplicateResponse *,
+                void *>(&LegacyReplicator::handleResponse, cntl, resp, req);
+        stub.Replicate(cntl, &repl_req, resp, done);
+    }
+
+    common::ConnectionPool conn_pool_;
+};
+
+// one in flight client write on the primary
+struct WriteSlot {
+    WriteSlot() : req(RequestType::kTypeWrite), round(nullptr), failed(0) {}
+
+    Request req;
+    brpc::Controller cntl;  // client's, holds the attachment
+    extentserver::pb::WriteRequest request;
+    bthread::CountdownEvent *round;
+    uint64_t failed;
+};
+
+void *writeDone(void *arg) {
+    Request *req = static_cast<Request *>(arg);
+    // local write and every secondary
+    if (req->FetchAndSubRef() != 1) {
+        return nullptr;
+    }
+    WriteSlot *slot = static_cast<WriteSlot *>(req->UserArg());
+    if (!req->Result()) {
+        ++slot->failed;
+    }
+    slot->round->signal();
+    return nullptr;
+}
+
+}  // namespace
+
+int ReplicateBench::parsePeers() {
+    router_ = std::make_shared<common::ExtentRouter>();
+    std::stringstream ss(options_.peers);
+    std::string peer;
+    while (std::getline(ss, peer, ',')) {
+        auto pos = peer.rfind(':');
+        if (pos == std::string::npos) {
+            std::cerr << "Invalid peer " << peer << std::endl;
+            return -1;
+        }
+        common::ESInstance es;
+        es.public_ip = es.private_ip = peer.substr(0, pos);
+        es.public_port = es.private_port = atoi(peer.c_str() + pos + 1);
+        router_->secondaries.push_back(es);
+    }
+    if (router_->secondaries.empty()) {
+        std::cerr << "No peers, start mock_es and pass -peers" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int ReplicateBench::Run() {
+    if (options_.num_threads <= 0 || options_.iodepth <= 0
+        || options_.io_size == 0) {
+        std::cerr << "Invalid num_threads, iodepth or io_size" << std::endl;
+        return -1;
+    }
+    if (parsePeers() != 0) {
+        return -1;
+    }
+
+    std::cout << "Replicate " << options_.num_writes << " writes each thread"
+              << ", threads: " << options_.num_threads
+              << ", iodepth: " << options_.iodepth
+              << ", io size: " << options_.io_size
+              << ", secondaries: " << router_->secondaries.size() << std::endl;
+    bench("legacy", kLegacy);
+    bench("pooled", kPooled);
+    bench("stream", kStream);
+    return 0;
+}
+
+void ReplicateBench::bench(const std::string &name, Mode mode) {
+    extentserver::ReplicateEngine engine(nullptr);
+    if (mode == kStream) {
+        // a stream per peer for each bench thread
+        engine.EnableStream("esbench", options_.num_threads);
+    }
+    LegacyReplicator legacy;
+    std::string data(options_.io_size, 'r');
+
+    auto worker = [&](int t, uint64_t num_writes, uint64_t *failed) {
+        std::vector<std::unique_ptr<WriteSlot>> slots;
+        for (int i = 0; i < options_.iodepth; ++i) {
+            slots.emplace_back(new WriteSlot());
+            WriteSlot *slot = slots.back().get();
+            slot->request.set_extent_id(
+                    "bench-blob-" + std::to_string(t) + "."
+                    + std::to_string(i));
+            slot->request.set_size(options_.io_size);
+            slot->cntl.request_attachment().append(data);
+        }
+
+        uint64_t offset = 0;
+        for (uint64_t done = 0; done < num_writes;
+             done += options_.iodepth) {
+            bthread::CountdownEvent round(options_.iodepth);
+            for (auto &slot : slots) {
+                slot->request.set_offset(offset);
+                offset = (offset + options_.io_size) % (1ULL << 30);
+                slot->round = &round;
+                slot->req.Reset(RequestType::kTypeWrite);
+                slot->req.SetOperationContext(
+                        &slot->cntl, &slot->request, nullptr, nullptr);
+                slot->req.SetExtentRouter(router_);
+                slot->req.SetUserCallback(writeDone);
+                slot->req.SetUserArg(slot.get());
+                if (mode == kLegacy) {
+                    legacy.Send(&slot->req);
+                } else {
+                    engine.Send(&slot->req);
+                }
+                writeDone(&slot->req);  // local write
+            }
+            round.wait();
+        }
+        for (auto &slot : slots) {
+            *failed += slot->failed;
+        }
+    };
+
+    // warm connections and pools up
+    uint64_t failed = 0;
+    worker(0, options_.iodepth * 16, &failed);
+
+    std::vector<uint64_t> failures(options_.num_threads, 0);
+    uint64_t allocs_begin = g_num_allocs.load();
+    butil::Timer timer;
+    timer.start();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options_.num_threads; ++t) {
+        threads.push_back(std::thread(
+                worker, t, options_.num_writes, &failures[t]));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    timer.stop();
+
+    uint64_t num_writes = 0;
+    failed = 0;
+    uint64_t rounds = (options_.num_writes + options_.iodepth - 1)
+                      / options_.iodepth;
+    for (int t = 0; t < options_.num_threads; ++t) {
+        num_writes += rounds * options_.iodepth;
+        failed += failures[t];
+    }
+    report(name, timer.u_elapsed(), num_writes,
+           g_num_allocs.load() - allocs_begin, failed);
+}
+
+void ReplicateBench::report(
+        const std::string &name, uint64_t cost_us, uint64_t num_writes,
+        uint64_t num_allocs, uint64_t num_failed) {
+    double kiops = cost_us == 0 ? 0 : num_writes * 1000.0 / cost_us;
+    double allocs_per_write =
+            num_writes == 0 ? 0 : num_allocs / static_cast<double>(num_writes);
+    std::cout << name << ": cost " << cost_us << " us"
+              << ", " << kiops << " Kiops"
+              << ", " << allocs_per_write << " allocs/write"
+              << ", failed: " << num_failed << std::endl;
+}
+
+}  // namespace tools
+}  // namespace cyprestore
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2020 JDD authors.
+ * @yangchunxin3
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include "common/extent_router.h"
+#include "options.h"
+
+namespace cyprestore {
+namespace tools {
+
+// drive the replication fan-out of a primary against secondaries served
+// by mock_es, with per write allocated rpc state as ReplicateEngine used
+// to do, with pooled replicate contexts and over replicate streams
+class ReplicateBench {
+public:
+    explicit ReplicateBench(const Options &options) : options_(options) {}
+
+    int Run();
+
+private:
+    enum Mode {
+        kLegacy = 0,
+        kPooled = 1,
+        kStream = 2,
+    };
+
+    int parsePeers();
+    void bench(const std::string &name, Mode mode);
+    void report(
+            const std::string &name, uint64_t cost_us, uint64_t num_writes,
+            uint64_t num_allocs, uint64_t num_failed);
+
+    Options options_;
+    common::ExtentRouterPtr router_;
+};
+
+}  // namespace tools
+}  // namespace cyprestore